@@ -31,6 +31,10 @@ Client::Client(
     std::string server_address, 
     int server_port)
     :   username_(username),  
+        server_address_(server_address),
+        server_port_(server_port),
+        connected_(false),
+        settling_(false),
         UI_(
             &ui_buffer_mtx_, 
             &ui_cv_, 
@@ -99,6 +103,7 @@ Client::Client(
         aprint("Logging in as \'" + username + "\'...");
         session_id_ = connection_manager_.login(username_, machine_name_);
         aprint("Got following session id: " + std::to_string(session_id_));
+        connected_.store(true);
 
         // sets running flag to true
         running_app_.store(true);
@@ -180,9 +185,37 @@ void Client::start_sync_(std::string new_path)
         // initializes inotify watcher module
         inotify_.init(
             sync_dir_path_, 
-            inotify_buffer_, 
-            inotify_buffer_mtx_);
+            inotify_events_);
         inotify_.start_watching();
+        aprint("Watching sync dir through " + inotify_watcher::backend_name(inotify_.get_backend()) + "...");
+
+        // changes made while the client was not running, found by one stat
+        // pass against the saved state and sent like any other local change
+        bool known_state = state_.open(sync_dir_path_);
+        state_store::Reconciliation offline = reconcile_sync_dir_();
+
+        // changes left queued by a run that lost the server, sent now if it is back
+        std::size_t queued_changes = offline_.open(sync_dir_path_);
+        if(queued_changes > 0)
+        {
+            aprint("Found " + std::to_string(queued_changes) + " changes queued while offline.");
+            if(connected_.load())
+            {
+                replay_offline_changes_();
+            }
+        }
+
+        std::string output = known_state ? "Compared " : "Recorded ";
+        output += std::to_string(offline.scanned_files) + " files in ";
+        output += std::to_string(offline.elapsed_us / 1000) + "ms";
+        if(known_state)
+        {
+            output += ": " + std::to_string(offline.created.size()) + " created, ";
+            output += std::to_string(offline.modified.size()) + " modified, ";
+            output += std::to_string(offline.deleted.size()) + " deleted (";
+            output += std::to_string(offline.hashed_files) + " hashed)";
+        }
+        aprint(output + ".");
         
         aprint("Synchronization routine initialized!");
         return;
@@ -206,6 +239,26 @@ void Client::start_sync_(std::string new_path)
     
 }
 
+state_store::Reconciliation Client::reconcile_sync_dir_()
+{
+    // one stat pass against the saved state, what changed is pushed as local changes
+    state_store::Reconciliation reconciliation = state_.reconcile();
+    for(const std::string& path : reconciliation.created)
+    {
+        inotify_events_.push({event_coalescer::EventType::CLOSE_WRITE, path});
+    }
+    for(const std::string& path : reconciliation.modified)
+    {
+        inotify_events_.push({event_coalescer::EventType::CLOSE_WRITE, path});
+    }
+    for(const std::string& path : reconciliation.deleted)
+    {
+        inotify_events_.push({event_coalescer::EventType::DELETE, path});
+    }
+    state_.save();
+    return reconciliation;
+}
+
 void Client::main_loop()
 {
     try
@@ -278,6 +331,9 @@ void Client::stop()
         UI_.stop();
         ui_cv_.notify_all();
 
+        // the next start only looks at what changed from here
+        state_.save();
+
     }
     catch(const std::exception& e)
     {
@@ -12,21 +12,46 @@
 #include <functional>
 #include <unordered_map>
 #include <shared_mutex>
+#include <unordered_set>
 
 // third-party libraries
 #include "../include/common/cxxopts.hpp"
 
 // local includes
 #include "../common/include/inotify_watcher.hpp"
+#include "../common/include/event_coalescer.hpp"
+#include "../common/include/echo_filter.hpp"
+#include "../common/include/state_store.hpp"
 #include "../common/include/user_interface.hpp"
 #include "../common/include/network/connection_manager.hpp"
 #include "../common/include/utils.hpp"
 #include "../common/include/network/packet.hpp"
+#include "../common/include/path_table.hpp"
+#include "../common/include/file_lock_manager.hpp"
+#include "../common/include/chunk_writer.hpp"
+#include "../common/include/commit_pipeline.hpp"
+#include "../common/include/upload_pipeline.hpp"
+#include "../common/include/download_scheduler.hpp"
+#include "../common/include/offline_queue.hpp"
 
 using namespace utils_packet;
 
 namespace client_application
 {
+    // file chunks waiting for the socket before the upload pipeline is held back
+    const std::size_t MAX_QUEUED_UPLOAD_PACKETS = 1024;
+
+    // reconnection backoff, doubled after every failed attempt
+    const int RECONNECT_MIN_DELAY_MS = 500;
+    const int RECONNECT_MAX_DELAY_MS = 30000;
+
+    // how long the receiver waits on an idle connection before checking if it should stop
+    const int RECEIVE_POLL_MS = 1000;
+
+    // packets received between acknowledgements, the server keeps the
+    // unacknowledged ones to send again on a resumed session
+    const uint64_t SESSION_ACK_PACKETS = 64;
+
     // modified output strings to show code scopes
     void aprint(std::string content, int scope = -1, bool endl = true);
     void raise(std::string error, int scope = -1);
@@ -37,6 +62,8 @@ namespace client_application
             // identifiers
             std::string username_;
             std::string machine_name_;
+            std::string server_address_;
+            int server_port_;
             int session_id_;
 
             // runtime control
@@ -44,14 +71,38 @@ namespace client_application
             std::atomic<bool> running_sender_;
             std::atomic<bool> running_receiver_;
             std::atomic<bool> running_sync_;
+            std::atomic<bool> connected_;
+
+            // reconnection timing, reported once nothing is left to catch up on
+            std::chrono::steady_clock::time_point connection_lost_time_;
+            std::atomic<bool> settling_;
 
             // internal buffers
             std::string ui_buffer_;
             std::vector<std::string> ui_sanitized_buffer_;
-            std::vector<std::string> inotify_buffer_;
             std::vector<packet> sender_buffer_;
             std::vector<packet> receiver_buffer_;
-            std::unordered_map<std::string, std::shared_ptr<std::shared_mutex>> file_mtx_;
+
+            // file locks, keyed by interned paths
+            path_table::PathTable paths_;
+            file_lock_manager::FileLockManager file_locks_;
+            chunk_writer::ChunkWriterTable chunk_writers_;
+
+            // local changes, merged until their paths settle
+            event_coalescer::EventCoalescer inotify_events_;
+
+            // files this client wrote itself, kept from being sent back
+            echo_filter::EchoFilter echoes_;
+
+            // what the sync dir held when the client last ran
+            state_store::StateStore state_;
+
+            // local changes made while the server was away
+            offline_queue::OfflineQueue offline_;
+
+            // files handed to the socket the server did not acknowledge yet
+            // NOTE: guarded by send_mtx_
+            std::unordered_set<std::string> unacknowledged_uploads_;
 
             // modules
             connection::ClientConnectionManager connection_manager_;
@@ -65,7 +116,6 @@ namespace client_application
             const std::string default_async_dir_path_ = "./downloads";
 
             // mutexes
-            std::mutex inotify_buffer_mtx_;
             std::mutex ui_buffer_mtx_;
             std::mutex send_mtx_;
             std::mutex receive_mtx_;
@@ -73,6 +123,18 @@ namespace client_application
             // condition variables
             std::condition_variable ui_cv_;
             std::condition_variable send_cv_;
+            std::condition_variable send_space_cv_;  // a packet left the sender buffer
+
+            // publishes downloaded files - declared after the buffers, as
+            // pending commits are flushed on destruction
+            commit_pipeline::CommitPipeline commits_;
+
+            // hashes, reads and queues local files for sending - stopped
+            // before anything it calls back into goes away
+            upload_pipeline::UploadPipeline uploads_;
+
+            // writes files pushed by the server, several at once
+            download_scheduler::DownloadScheduler downloads_;
 
             // benchmark
             std::chrono::high_resolution_clock::time_point ping_start_;
@@ -88,23 +150,39 @@ namespace client_application
 
             // command handlers
             void process_user_interface_commands_();
-            void process_inotify_commands_();
+            void process_inotify_commands_(const std::vector<event_coalescer::Change>& changes);
+            state_store::Reconciliation reconcile_sync_dir_();
+
+            // connection recovery
+            void connection_lost_(std::string error);
+            bool reconnect_();
+            void replay_offline_changes_();
+            void report_steady_state_();
 
             // main server received commands 
             void server_ping_command_();
             void server_list_command_(std::string args, packet buffer);
             void server_download_command_(std::string args, std::string reason = "");
             void server_upload_command_(std::string args, std::string checksum, packet buffer);
+            void start_downloads_();
             void server_delete_file_command_(std::string args, packet buffer, std::string arg2 = "");
             void server_async_upload_command_(std::string args, std::string checksum, packet buffer);
             void server_exit_command_(std::string reason = "");
+            void server_commit_command_(std::string args, std::string checksum, packet buffer);
+            void server_versions_command_(std::string args, packet buffer);
+            void server_restore_command_(std::string args, std::string result, packet buffer);
             void server_malformed_command_(std::string command);
             
             // main client entered commands
             void request_async_download_(std::string args);
             void request_list_server_(std::string args);
             void request_delete_(std::string args);
+            void request_sync_();
+            void acknowledge_packets_(uint64_t received_packets);
+            void request_versions_(std::string args);
+            void request_restore_(std::string args, std::string version);
             void upload_command_(std::string args, std::string reason = "");
+            void start_uploads_();
             void pong_command_();
             void list_command_(std::string args);
             int delete_temporary_download_files_(std::string directory);
@@ -1,35 +1,84 @@
+// c++
+#include <filesystem>
+
+// locals
 #include "../application.hpp"
 #include "../../common/include/async_cout.hpp"
 #include "../../common/include/inotify_watcher.hpp"
 
 using namespace client_application;
+namespace fs = std::filesystem;
 
-void Client::process_inotify_commands_()
+void Client::process_inotify_commands_(const std::vector<event_coalescer::Change>& changes)
 {
-    // TODO: this
-    int inotify_nargs = inotify_buffer_.size();
-    switch (inotify_nargs)
+    // every path shows up once per batch, in the order it first changed
+    // writes and deletes done on behalf of the server are dropped here
+    for(const event_coalescer::Change& change : echoes_.filter(sync_dir_path_, changes))
     {
-        case 3:
+        if(!connected_.load())
+        {
+            // the server is away, the change waits on disk until it is back
+            offline_queue::Operation operation;
+            operation.path = "/" + change.path;
+            switch(change.type)
+            {
+                case event_coalescer::ChangeType::UPLOAD:
+                {
+                    operation.type = offline_queue::OperationType::UPLOAD;
+                    break;
+                }
+                case event_coalescer::ChangeType::DELETE:
+                {
+                    operation.type = offline_queue::OperationType::DELETE;
+                    break;
+                }
+                case event_coalescer::ChangeType::RENAME:
+                {
+                    operation.type = offline_queue::OperationType::RENAME;
+                    operation.old_path = "/" + change.old_path;
+                    break;
+                }
+                default:
+                {
+                    aprint("Invalid inotify event!", 1);
+                    continue;
+                }
+            }
+            offline_.append(operation);
+            continue;
+        }
+
+        switch(change.type)
         {
-            std::string type = inotify_buffer_[1];
-            std::string file_path = inotify_buffer_[2];
-            if(type == "create" || type == "modify")
+            case event_coalescer::ChangeType::UPLOAD:
             {
                 // upload file to server
+                upload_command_("/" + change.path, "inotify");
                 break;
             }
-            else if(type == "delete")
+            case event_coalescer::ChangeType::DELETE:
             {
-                // request file deletion on server
+                // request file deletion on server, paths are sent with the
+                // leading slash the server joins them with - a directory is
+                // removed there with everything stored under it
+                request_delete_("/" + change.path);
+                break;
+            }
+            case event_coalescer::ChangeType::RENAME:
+            {
+                // the server has no rename, the old name is dropped and the
+                // content sent again under the new one - a directory is
+                // deleted whole on the server and expanded into its files
+                // by the upload pipeline
+                request_delete_("/" + change.old_path);
+                upload_command_("/" + change.path, "inotify");
+                break;
+            }
+            default:
+            {
+                aprint("Invalid inotify event!", 1);
                 break;
             }
-        }
-        default:
-        {
-            aprint("Invalid inotify event!", 1);
-            break;
         }
     }
-
-}
\ No newline at end of file
+}
@@ -5,6 +5,7 @@
 #include <string>
 #include <algorithm>
 #include <fstream>
+#include <filesystem>
 
 // multithreading & synchronization
 #include <atomic>
@@ -12,6 +13,11 @@
 #include <condition_variable>
 #include <thread>
 #include <cstring>
+#include <cerrno>
+
+// c
+#include <poll.h>
+#include <sys/socket.h>
 
 // local
 #include "client_app.hpp"
@@ -22,10 +28,12 @@
 
 using namespace client_app;
 using namespace async_cout;
+namespace fs = std::filesystem;
 
 void Client::start_receiver()
 {
     aprint("Starting up receiver module.", 2);
+    start_downloads_();
     running_receiver_.store(true);
     receiver_th_ = std::thread(
         [this]()
@@ -38,6 +46,7 @@ void Client::stop_receiver()
 {
     aprint("Stopping receiver module...", 2);
     running_receiver_.store(false);
+    downloads_.stop();
     if(receiver_th_.joinable())
     {
         receiver_th_.join();
@@ -56,12 +65,39 @@ void Client::receiver_loop()
             return;
         }   
 
+        // a lost connection is retried until the receiver is stopped
+        if(!connected_.load() && !reconnect_())
+        {
+            continue;
+        }
+
+        packet buffer;
         try
         {
+            // an idle connection is not an error, only a packet cut short is
+            pollfd socket_poll = {connection_manager_.get_sock_fd(), POLLIN, 0};
+            int ready = poll(&socket_poll, 1, RECEIVE_POLL_MS);
+            if(ready == 0 || (ready < 0 && errno == EINTR) || !connected_.load())
+            {
+                continue;
+            }
+
             // receives a new packet
-            packet buffer;
             connection_manager_.receive_packet(&buffer);
+            uint64_t received_packets = connection_manager_.count_received_packet();
+            if(received_packets % SESSION_ACK_PACKETS == 0)
+            {
+                acknowledge_packets_(received_packets);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            connection_lost_("Lost connection to server: " + std::string(e.what()));
+            continue;
+        }
 
+        try
+        {
             // sanitizes packet command argument
             std::vector<std::string> received_buffer = split_buffer(buffer.command);
             int nargs = received_buffer.size();
@@ -125,6 +161,12 @@ void Client::receiver_loop()
                         this->server_list_command_(args, buffer);
                         break;
                     }
+                    else if(command_name == "versions")
+                    {
+                        // server is responding to a versions request
+                        this->server_versions_command_(args, buffer);
+                        break;
+                    }
                     else
                     {
                         this->malformed_command_(command_name);
@@ -155,12 +197,24 @@ void Client::receiver_loop()
                         this->server_upload_command_(args, checksum, buffer);
                         break;
                     }
+                    else if(command_name == "commit")
+                    {
+                        // server stored a file sent by this user
+                        this->server_commit_command_(args, checksum, buffer);
+                        break;
+                    }
                     else if(command_name == "delete")
                     {
                         // server is telling that a delete request has failed
                         this->server_delete_file_command_(args, buffer, checksum);
                         break;
                     }
+                    else if(command_name == "restore")
+                    {
+                        // server is telling that a restore request has failed
+                        this->server_restore_command_(args, checksum, buffer);
+                        break;
+                    }
                     else
                     {
                         this->malformed_command_(command_name);
@@ -193,6 +247,7 @@ void Client::start_sender()
         {
             sender_loop();
         });
+    start_uploads_();
 }
 
 void Client::stop_sender()
@@ -200,6 +255,8 @@ void Client::stop_sender()
     aprint("Stopping sender module...", 2);
     running_sender_.store(false);
     send_cv_.notify_one();
+    send_space_cv_.notify_all();
+    uploads_.stop();
     if(sender_th_.joinable())
     {
         sender_th_.join();
@@ -213,27 +270,72 @@ void Client::sender_loop()
     {
         try
         {
-            std::unique_lock<std::mutex> lock(send_mtx_);
-            send_cv_.wait(lock, [this]() { return !sender_buffer_.empty() || !running_sender_.load(); });
+            std::string send_error;
+            {
+                // also wakes up when the next local change may have settled
+                std::unique_lock<std::mutex> lock(send_mtx_);
+                send_cv_.wait_for(
+                    lock, 
+                    inotify_events_.time_until_ready(), 
+                    [this]() 
+                    { 
+                        return (!sender_buffer_.empty() && connected_.load()) || !running_sender_.load(); 
+                    });
 
-            if(running_sender_.load() == false)
+                if(running_sender_.load() == false)
+                {
+                    aprint("Stopping sender module...", 2);
+                    return;
+                }
+
+                if(sender_buffer_.empty() == false && connected_.load())
+                {
+                    try
+                    {
+                        // sends using previoulsy set callback method - buffer is treated as FIFO
+                        connection_manager_.send_packet(sender_buffer_.front());
+
+                        sender_buffer_.erase(sender_buffer_.begin());
+                        send_space_cv_.notify_all();
+                    }
+                    catch(const std::exception& e)
+                    {
+                        send_error = e.what();
+                    }
+                }
+            }
+
+            // the unsent packet is kept, requeued along with the rest
+            if(!send_error.empty())
             {
-                aprint("Stopping sender module...", 2);
-                return;
+                connection_lost_("Lost connection to server: " + send_error);
             }
 
-            // process inotify events
-            if(!inotify_buffer_.empty())
+            // events the watcher lost to an overflow are found by comparing the
+            // sync dir with the saved state, as done on startup
+            if(inotify_.take_lost_events())
             {
-                process_inotify_commands_();
+                state_store::Reconciliation lost = reconcile_sync_dir_();
+                std::string output = "Watcher queue overflowed, recovered " + std::to_string(lost.created.size());
+                output += " created, " + std::to_string(lost.modified.size()) + " modified and ";
+                output += std::to_string(lost.deleted.size()) + " deleted files.";
+                aprint(output, 2);
             }
 
-            if(sender_buffer_.empty() == false)
+            // process inotify events - outside the send lock, as handlers queue packets
+            std::vector<event_coalescer::Change> changes = inotify_events_.take_ready();
+            if(!changes.empty())
             {
-                // sends using previoulsy set callback method - buffer is treated as FIFO
-                connection_manager_.send_packet(sender_buffer_.front());
+                process_inotify_commands_(changes);
+            }
 
-                sender_buffer_.erase(sender_buffer_.begin());
+            // keeps the saved state close to the sync dir, a crash costs a
+            // few rehashed files at most
+            state_.save_if_dirty();
+
+            if(settling_.load())
+            {
+                report_steady_state_();
             }
         }
         catch(const std::exception& e)
@@ -247,3 +349,199 @@ void Client::sender_loop()
     }
 }
 
+void Client::connection_lost_(std::string error)
+{
+    std::vector<packet> unsent;
+    std::unordered_set<std::string> unacknowledged;
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        if(connected_.exchange(false) == false)
+        {
+            // the other thread noticed first
+            return;
+        }
+        connection_lost_time_ = std::chrono::steady_clock::now();
+        settling_.store(false);
+        unsent.swap(sender_buffer_);
+        unacknowledged.swap(unacknowledged_uploads_);
+    }
+    send_space_cv_.notify_all();
+    aprint(error, 2);
+
+    // wakes up the receiver if it is still waiting on the socket
+    shutdown(connection_manager_.get_sock_fd(), SHUT_RDWR);
+
+    // nothing the server did not acknowledge is lost, it is queued as a change
+    // again - other requests were made by the user and are dropped
+    std::size_t dropped_requests = 0;
+    for(packet& unsent_packet : unsent)
+    {
+        std::vector<std::string> args = split_buffer(unsent_packet.command);
+        if(args.size() == 3 && args[0] == "upload")
+        {
+            unacknowledged.insert(args[1]);
+        }
+        else if(args.size() == 2 && args[0] == "delete")
+        {
+            offline_queue::Operation operation;
+            operation.type = offline_queue::OperationType::DELETE;
+            operation.path = args[1];
+            offline_.append(operation);
+        }
+        else if(args.size() == 2 && args[0] == "ack")
+        {
+            // the login of the next session tells the same
+        }
+        else
+        {
+            dropped_requests++;
+        }
+        delete[] unsent_packet.payload;
+    }
+    for(const std::string& path : unacknowledged)
+    {
+        offline_queue::Operation operation;
+        operation.type = offline_queue::OperationType::UPLOAD;
+        operation.path = path;
+        offline_.append(operation);
+    }
+
+    std::string output = "Working offline with " + std::to_string(offline_.size()) + " changes queued";
+    if(dropped_requests > 0)
+    {
+        output += ", " + std::to_string(dropped_requests) + " requests dropped";
+    }
+    aprint(output + ".", 2);
+}
+
+bool Client::reconnect_()
+{
+    int delay_ms = RECONNECT_MIN_DELAY_MS;
+    int attempts = 0;
+    while(running_receiver_.load())
+    {
+        attempts++;
+        try
+        {
+            connection_manager_.close_socket();
+            connection_manager_.create_socket();
+            connection_manager_.connect_to_server(server_address_, server_port_);
+            session_id_ = connection_manager_.login(username_, machine_name_);
+        }
+        catch(const std::exception& e)
+        {
+            std::string output = "Could not reach server (attempt " + std::to_string(attempts) + "), ";
+            output += "retrying in " + std::to_string(delay_ms) + "ms...";
+            aprint(output, 2);
+
+            // sleeps in steps, so stopping the receiver is not held back
+            auto retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+            while(running_receiver_.load() && std::chrono::steady_clock::now() < retry)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            delay_ms = std::min(delay_ms * 2, RECONNECT_MAX_DELAY_MS);
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point lost;
+        {
+            std::lock_guard<std::mutex> lock(send_mtx_);
+            connected_.store(true);
+            lost = connection_lost_time_;
+        }
+        send_cv_.notify_one();
+        send_space_cv_.notify_all();
+
+        auto offline_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - lost).count();
+        bool resumed = connection_manager_.was_resumed();
+        std::string output = resumed ? "Resumed session " : "Reconnected on new session ";
+        output += std::to_string(session_id_) + " after " + std::to_string(offline_ms) + "ms (";
+        output += std::to_string(attempts) + " attempts).";
+        aprint(output, 2);
+
+        // a resumed session gets what changed on the server from the changes
+        // queued for it, and the packets lost with the connection again, so
+        // its unfinished downloads go on - a new one has to compare every
+        // file again, and nothing will complete them
+        if(resumed)
+        {
+            downloads_.restart_stale_timers();
+        }
+        else
+        {
+            downloads_.cancel("");
+        }
+        if(!resumed && !sync_dir_path_.empty())
+        {
+            request_sync_();
+        }
+        replay_offline_changes_();
+        settling_.store(true);
+        return true;
+    }
+    return false;
+}
+
+void Client::replay_offline_changes_()
+{
+    // the latest change of each path, in the order those happened
+    std::vector<offline_queue::Operation> operations = offline_.take();
+    if(operations.empty())
+    {
+        return;
+    }
+    aprint("Sending " + std::to_string(operations.size()) + " changes made while offline...", 2);
+
+    for(const offline_queue::Operation& operation : operations)
+    {
+        if(operation.type == offline_queue::OperationType::DELETE)
+        {
+            // the local file is long gone, or was created again since and
+            // is queued after this - it must not be deleted here
+            // queued again by the upload pipeline if the connection drops
+            uploads_.remove(sync_dir_path_, operation.path);
+            continue;
+        }
+
+        // failed uploads are queued again by the upload pipeline callbacks
+        // only files are answered by a commit, a directory or a file gone
+        // since has nothing left to wait for
+        upload_command_(operation.path, "offline");
+        std::error_code error;
+        if(!fs::is_regular_file(sync_dir_path_ + operation.path, error))
+        {
+            offline_.acknowledge(operation.path);
+        }
+    }
+    send_cv_.notify_one();
+}
+
+void Client::report_steady_state_()
+{
+    // caught up once nothing is left to send, upload or write
+    std::chrono::steady_clock::time_point lost;
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        if(!connected_.load() || !sender_buffer_.empty())
+        {
+            return;
+        }
+        lost = connection_lost_time_;
+    }
+    if(!offline_.empty() || !uploads_.is_idle() || downloads_.get_stats().active > 0)
+    {
+        return;
+    }
+
+    if(settling_.exchange(false))
+    {
+        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - lost).count();
+        std::string output = "Caught up with the server " + std::to_string(elapsed_ms);
+        output += "ms after the connection was lost (";
+        output += connection_manager_.was_resumed() ? "resumed session)." : "new session).";
+        aprint(output, 2);
+    }
+}
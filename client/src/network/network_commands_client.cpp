@@ -8,6 +8,7 @@
 
 #include "client_app.hpp"
 #include "../include/common/async_cout.hpp"
+#include "../include/common/directory_scanner.hpp"
 
 using namespace client_app;
 using namespace async_cout;
@@ -68,8 +69,6 @@ void Client::request_delete_(std::string args)
 {
     // user requesting a file deletion from server
     // also deletes the same file locally
-    packet delete_packet;
-    
     std::string file_path = args;
     file_path.erase(
         std::remove_if(
@@ -81,19 +80,21 @@ void Client::request_delete_(std::string args)
             }), 
         file_path.end());
 
-    // mounts download command
-    std::string delete_command = "delete|" + file_path;
-    strcharray(
-        delete_command, 
-        delete_packet.command,
-        sizeof(delete_packet.command));
-    
-    // requests lock to acess upload buffer
+    // goes through the upload pipeline, so it can not overtake an upload
+    // of the same file still being sent
+    if(connected_.load())
     {
-        std::lock_guard<std::mutex> lock(send_mtx_);
-        sender_buffer_.push_back(delete_packet);
+        uploads_.remove(sync_dir_path_, file_path);
     }
-    send_cv_.notify_one();
+    else
+    {
+        // sent once the server is back
+        offline_queue::Operation operation;
+        operation.type = offline_queue::OperationType::DELETE;
+        operation.path = file_path;
+        offline_.append(operation);
+    }
+    state_.remove(file_path);
 
     // deletes file locally
     std::string local_file_path = sync_dir_path_ + file_path;
@@ -103,41 +104,106 @@ void Client::request_delete_(std::string args)
         return;
     }
     
-    // requests file mutex to delete entry
-    if(file_mtx_.find(file_path) == file_mtx_.end())
+    // requests file lock to delete entry
+    path_table::path_id file_id = paths_.intern(file_path);
+    file_lock_manager::ExclusiveLock file_lock = file_locks_.lock_exclusive(file_id);
+    
+    // deletes file
+    delete_file(local_file_path);
+}
+
+void Client::request_sync_()
+{
+    // sends every local file, the server answers with whatever differs
+    std::string file_list = "";
+    try
     {
-        std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[file_path]);
-        
-        // deletes file
-        delete_file(local_file_path);
-
-        // removes file mutex from internal list
-        auto it = file_mtx_.find(file_path);
-        if(it != file_mtx_.end())
-        {
-            file_mtx_.erase(it);
-            return;
-        }
-        else
+        for(const directory_scanner::ScanEntry& entry : directory_scanner::default_scanner().scan_to_vector(sync_dir_path_))
         {
-            std::string output = "Could not find a file mutex for \"";
-            output += file_path + "\"!";
-            raise(output, 3);
-            return;
+            file_list += (file_list.empty() ? "/" : "|/") + entry.path;
         }
     }
-    else
+    catch(const std::exception& e)
     {
-        std::string output = "Could not find a file mutex for \"";
-        output += args + "\"!";
-        raise(output, 3);
+        aprint("Could not list sync dir for the server: " + std::string(e.what()), 3);
         return;
     }
+
+    packet clist_packet;
+    std::string clist_command = "clist";
+    strcharray(
+        clist_command, 
+        clist_packet.command,
+        sizeof(clist_packet.command));
+    clist_packet.payload = new char[file_list.size()];
+    std::memcpy(clist_packet.payload, file_list.data(), file_list.size());
+    clist_packet.payload_size = file_list.size();
+
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        sender_buffer_.push_back(clist_packet);
+    }
+    send_cv_.notify_one();
+}
+
+void Client::acknowledge_packets_(uint64_t received_packets)
+{
+    // lets the server drop the packets it kept for a resumption
+    packet ack_packet;
+    std::string ack_command = "ack|" + std::to_string(received_packets);
+    strcharray(
+        ack_command, 
+        ack_packet.command,
+        sizeof(ack_packet.command));
+
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        sender_buffer_.push_back(ack_packet);
+    }
+    send_cv_.notify_one();
+}
+
+void Client::request_versions_(std::string args)
+{
+    // user requesting the old versions the server kept of a file
+    packet versions_packet;
+
+    std::string versions_command = "versions|" + args;
+    strcharray(
+        versions_command, 
+        versions_packet.command,
+        sizeof(versions_packet.command));
+
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        sender_buffer_.push_back(versions_packet);
+    }
+    send_cv_.notify_one();
+}
+
+void Client::request_restore_(std::string args, std::string version)
+{
+    // user requesting an old version of a file back
+    // the server commits it as the newest one, reaching this and
+    // every other device on their next sync
+    packet restore_packet;
+
+    std::string restore_command = "restore|" + args + "|" + version;
+    strcharray(
+        restore_command, 
+        restore_packet.command,
+        sizeof(restore_packet.command));
+
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        sender_buffer_.push_back(restore_packet);
+    }
+    send_cv_.notify_one();
 }
 
 void Client::upload_command_(std::string args, std::string reason)
 {
-    // user is sending some file to server - keeping a local copy
+    // user is sending some file, or a whole directory, to server
     std::string file_path = args;
     file_path.erase(
         std::remove_if(
@@ -149,10 +215,7 @@ void Client::upload_command_(std::string args, std::string reason)
             }), 
         file_path.end());
 
-    std::string local_file_path = sync_dir_path_ + args;
-    std::string temp_file_path = local_file_path + ".swizdownload";
-    
-
+    std::string local_file_path = sync_dir_path_ + file_path;
     if(!is_valid_path(local_file_path))
     {
         aprint("Malformed upload request!", 3);
@@ -161,93 +224,129 @@ void Client::upload_command_(std::string args, std::string reason)
         aprint(output, 3);
         return;
     }
-    else
+
+    // hashed, read and sent by the upload pipeline workers
+    uploads_.submit(sync_dir_path_, file_path);
+}
+
+void Client::start_uploads_()
+{
+    upload_pipeline::UploadCallbacks callbacks;
+
+    // files the state store knows unmodified are not hashed again
+    callbacks.lookup_checksum = [this](const upload_pipeline::UploadFile& file, std::string& checksum)
     {
-        // given path is valid - creates file lock
-        if(file_mtx_.find(file_path) == file_mtx_.end())
+        return state_.lookup_checksum(file.path, file.size, file.modification_time, file.inode, checksum);
+    };
+
+    callbacks.lock_file = [this](const std::string& path)
+    {
+        return file_locks_.lock_shared(paths_.intern(path));
+    };
+
+    // the protocol has no compressed chunks, they are sent as read
+    callbacks.compress = nullptr;
+
+    callbacks.send = [this](const upload_pipeline::UploadChunk& chunk)
+    {
+        packet upload_buffer;
+        upload_buffer.sequence_number = chunk.index;
+        upload_buffer.expected_packets = chunk.file->chunk_count;
+        upload_buffer.payload_size = chunk.data.size();
+        upload_buffer.payload = new char[chunk.data.size()];
+        std::memcpy(upload_buffer.payload, chunk.data.data(), chunk.data.size());
+
+        std::string command_response = "upload|" + chunk.file->path + "|" + chunk.file->checksum;
+        strcharray(command_response, upload_buffer.command, sizeof(upload_buffer.command));
+
+        // waits for the socket to catch up, this is what holds back the disk
         {
-            auto new_mutex = std::make_shared<std::shared_mutex>();
-            file_mtx_.emplace(args, std::move(new_mutex));
+            std::unique_lock<std::mutex> lock(send_mtx_);
+            send_space_cv_.wait(
+                lock, 
+                [this]() 
+                { 
+                    return sender_buffer_.size() < MAX_QUEUED_UPLOAD_PACKETS 
+                        || !running_sender_.load() 
+                        || !connected_.load(); 
+                });
+            if(!running_sender_.load())
+            {
+                delete[] upload_buffer.payload;
+                throw std::runtime_error("sender module stopped");
+            }
+            if(!connected_.load())
+            {
+                delete[] upload_buffer.payload;
+                throw std::runtime_error("server is unreachable");
+            }
+            sender_buffer_.push_back(upload_buffer);
         }
-        
-        // requests newly created file lock
-        {
-            std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[file_path]);
-    
-            std::string checksum = calculate_md5_checksum(local_file_path);
-            std::ifstream file(local_file_path, std::ios::binary);
-
-            // also tries to write on temporary file on local sync dir
-            std::ofstream temp_file(temp_file_path, std::ios::app | std::ios::binary);
+        send_cv_.notify_one();
+    };
 
-            if(!file.is_open()) 
+    callbacks.send_delete = [this](const std::string& path)
+    {
+        packet delete_packet;
+        std::string delete_command = "delete|" + path;
+        strcharray(
+            delete_command, 
+            delete_packet.command,
+            sizeof(delete_packet.command));
+
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> lock(send_mtx_);
+            if(connected_.load())
             {
-                std::string output = "Local machine could not acess given file: ";
-                output += "\"" + local_file_path + "\"!";
-                aprint(output, 3);
-                return;
+                sender_buffer_.push_back(delete_packet);
+                queued = true;
             }
-            else
-            {        
-                // packet defaults
-                int default_payload = 8192;  // 8kb
-                int packet_index = 0;
-                file.seekg(0, std::ios::end);
-                std::size_t file_size = file.tellg();
-                file.seekg(0, std::ios::beg);
-                size_t expected_packets = (file_size + default_payload - 1) / default_payload;
-                
-                // reads file bufferizingit
-                while(!file.eof())
-                {
-                    // mounts a new buffer packet with default values
-                    packet upload_buffer;
-                    upload_buffer.sequence_number = packet_index;
-                    upload_buffer.expected_packets = expected_packets;
-                    upload_buffer.payload_size = default_payload;
-                    
-                    // mounts packet command
-                    std::string command_response = "upload|" + file_path + "|" + checksum;
-                    strcharray(command_response, upload_buffer.command, sizeof(upload_buffer.command));
-                    
-                    // gathers payload from file stream
-                    file.read(upload_buffer.payload, upload_buffer.payload_size);
-
-                    // writes the same file on local sync dir
-                    temp_file.write(upload_buffer.payload, upload_buffer.payload_size);
-                    
-                    // adjusts payload size on the last packet to save network bandwith
-                    std::size_t bytes_read = static_cast<std::size_t>(file.gcount());
-                    if(packet_index == expected_packets - 1) 
-                    {
-                        // resizes buffer to actual read buffer size
-                        char* resized_buffer = new char[bytes_read];
-                        std::memcpy(resized_buffer, upload_buffer.payload, bytes_read);
-                        delete[] upload_buffer.payload;  // deletes current payload
-                        upload_buffer.payload = resized_buffer;
-                    }
-
-                    // adds current file buffer packet to sender buffer
-                    {
-                        std::unique_lock<std::mutex> lock(send_mtx_);
-                        sender_buffer_.push_back(upload_buffer);
-                    }
-                    send_cv_.notify_one();
-
-                    // increments packet index for the next iteration
-                    packet_index++;
-                }
+        }
+        if(queued)
+        {
+            send_cv_.notify_one();
+            return;
+        }
 
-                // closes files after being done
-                file.close();
-                temp_file.close();
+        // sent once the server is back
+        offline_queue::Operation operation;
+        operation.type = offline_queue::OperationType::DELETE;
+        operation.path = path;
+        offline_.append(operation);
+    };
 
-                // removes temp extension from file name
-                rename_replacing(temp_file_path, local_file_path);
-                return;
-            }
+    callbacks.on_sent = [this](const upload_pipeline::UploadFile& file)
+    {
+        // sent again after a reconnection unless the server commits it first
+        {
+            std::lock_guard<std::mutex> lock(send_mtx_);
+            unacknowledged_uploads_.insert(file.path);
         }
-    }
+
+        state_store::FileState state;
+        state.size = file.size;
+        state.modification_time = file.modification_time;
+        state.inode = file.inode;
+        state.checksum = file.checksum;
+        state_.record(file.path, state);
+    };
+
+    callbacks.on_failed = [this](const std::string& path, const std::string& error)
+    {
+        if(!connected_.load())
+        {
+            // the connection went away under the file, it is sent on reconnection
+            offline_queue::Operation operation;
+            operation.type = offline_queue::OperationType::UPLOAD;
+            operation.path = path;
+            offline_.append(operation);
+            return;
+        }
+        aprint("Could not upload \"" + path + "\": " + error, 3);
+    };
+
+    uploads_.start(callbacks);
 }
 
 void Client::pong_command_()
@@ -277,75 +376,49 @@ void Client::list_command_(std::string args)
         return;
     }
 
-    DIR* dir = opendir(sync_dir_path_.c_str());
-    if(dir == nullptr) 
+    std::vector<directory_scanner::ScanEntry> entries;
+    try
+    {
+        entries = directory_scanner::default_scanner().scan_to_vector(sync_dir_path_);
+    }
+    catch(const std::exception& e)
     {
-        raise("Could not access local sync_dir folder!", 3);
+        raise("Could not access or read from local sync_dir folder!", 3);
         return;
     }
 
     std::string output = "Currently these files are being hosted on sync_dir:";
-    std::function<void(const std::string&)> list_files_recursively = [&](const std::string& current_path) 
+    for(const directory_scanner::ScanEntry& entry : entries)
     {
-        DIR* dir = opendir(current_path.c_str());
-        if(dir == nullptr) 
-        {
-            raise("Could not access or read from local sync_dir folder!", 3);
-        }
-
-        
-        dirent* entry;
-        while((entry = readdir(dir)) != nullptr) 
-        {
-            if(entry->d_type == DT_REG) 
-            { 
-                std::string file_path = current_path + "/" + entry->d_name;
-                file_path += "/";
-                file_path += entry->d_name;
-
-                struct stat file_info;
-                if(lstat(file_path.c_str(), &file_info) == 0) 
-                {
-                    char modification_time_buffer[100];
-                    char access_time_buffer[100];
-                    char change_creation_time_buffer[100];
-
-                    output += "\n\t\t\tFile name: " + std::string(entry->d_name);
-                    output += "\n\t\t\tFile path: " + file_path;
-
-                    std::strftime(
-                        modification_time_buffer, 
-                        sizeof(modification_time_buffer), 
-                        "%c", 
-                        std::localtime(&file_info.st_mtime));
-                    output += "\n\t\t\tModification time: " + std::string(modification_time_buffer);
-
-                    std::strftime(
-                        access_time_buffer, 
-                        sizeof(access_time_buffer), 
-                        "%c", 
-                        std::localtime(&file_info.st_atime));
-                    output += "\n\t\t\tAccess time: " + std::string(access_time_buffer);
-
-                    std::strftime(
-                        change_creation_time_buffer, 
-                        sizeof(change_creation_time_buffer), 
-                        "%c", 
-                        std::localtime(&file_info.st_ctime));
-                    output += "\n\t\t\tChange/creation time: " + std::string(change_creation_time_buffer);
-
-                }
-                else if(entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) 
-                {
-                    list_files_recursively(current_path + "/" + entry->d_name);
-                }
-            }
-        }
-        closedir(dir);
-    };
+        char modification_time_buffer[100];
+        char access_time_buffer[100];
+        char change_creation_time_buffer[100];
+
+        output += "\n\t\t\tFile name: " + entry.name;
+        output += "\n\t\t\tFile path: " + sync_dir_path_ + "/" + entry.path;
+
+        std::strftime(
+            modification_time_buffer, 
+            sizeof(modification_time_buffer), 
+            "%c", 
+            std::localtime(&entry.modification_time));
+        output += "\n\t\t\tModification time: " + std::string(modification_time_buffer);
+
+        std::strftime(
+            access_time_buffer, 
+            sizeof(access_time_buffer), 
+            "%c", 
+            std::localtime(&entry.access_time));
+        output += "\n\t\t\tAccess time: " + std::string(access_time_buffer);
+
+        std::strftime(
+            change_creation_time_buffer, 
+            sizeof(change_creation_time_buffer), 
+            "%c", 
+            std::localtime(&entry.change_time));
+        output += "\n\t\t\tChange/creation time: " + std::string(change_creation_time_buffer);
+    }
 
-    list_files_recursively(sync_dir_path_);
-    
     aprint(output, 3);
     return;
 }
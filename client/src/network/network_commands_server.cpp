@@ -1,6 +1,8 @@
 // standard c++
 #include <filesystem>
 #include <fstream>
+#include <algorithm>
+#include <stdexcept>
 
 // c
 #include <dirent.h>
@@ -100,10 +102,10 @@ void Client::server_download_command_(std::string args, std::string reason)
     }
     else
     {
-        // given path is valid - requests file lock
-        if(file_mtx_.find(args) != file_mtx_.end())
+        // given path is valid - requests file lock, only for reading
         {
-            std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[args]);
+            path_table::path_id file_id = paths_.intern(args);
+            file_lock_manager::SharedLock file_lock = file_locks_.lock_shared(file_id);
             
             std::string checksum = calculate_md5_checksum(local_file_path);
             std::ifstream file(local_file_path, std::ios::binary);
@@ -179,21 +181,12 @@ void Client::server_download_command_(std::string args, std::string reason)
                 return;
             }
         }
-        else
-        {
-            // if there is no mutex for this file, an error has occured!
-            raise("No file mutex was found for \"" + args + "\"!", 4);
-            return;
-        }
     }
 }
 
 void Client::server_upload_command_(std::string args, std::string checksum, packet buffer)
 {
     // server is sending some file
-    std::string local_file_path = sync_dir_path_ + args;
-    std::string temp_file_path = local_file_path + ".swizdownload";
-    
     if(checksum == "fail")
     {
         // user requested file download failed
@@ -205,20 +198,81 @@ void Client::server_upload_command_(std::string args, std::string checksum, pack
         return;
     }
 
-    // tries to write on temporary file
-    std::ofstream temp_file(temp_file_path, std::ios::app | std::ios::binary);
-    if(!temp_file) 
+    // written, verified and committed off the receiver thread - blocks
+    // while every transfer slot is taken
+    downloads_.receive(
+        sync_dir_path_, 
+        args, 
+        checksum, 
+        buffer.expected_packets, 
+        buffer.sequence_number, 
+        buffer.payload, 
+        buffer.payload_size);
+}
+
+void Client::start_downloads_()
+{
+    download_scheduler::SchedulerCallbacks callbacks;
+
+    // directories are created under the same locks files are replaced with
+    callbacks.lock_path = [this](const std::string& path)
     {
-        // given file does not exist locally - informs server
+        return file_locks_.lock_exclusive(paths_.intern(path));
+    };
+
+    callbacks.on_complete = [this](const download_scheduler::CompletedTransfer& transfer)
+    {
+        std::string args = transfer.path;
+        std::string current_checksum = calculate_md5_checksum(transfer.temp_path);
+        if(current_checksum != transfer.checksum)
+        {
+            std::string output = "File md5 checksum for";
+            output += "\"" + args + "\" is different than the informed amount!";
+            aprint(output, 4);
+        }
+        else
+        {
+            std::string output = "File md5 checksum for";
+            output += "\"" + args + "\" is exactly the informed amount!";
+            aprint(output, 4);
+        }
+
+        // the watcher sees this file appear, it must not be sent back
+        echoes_.expect_write(args, current_checksum);
+
+        // replaces the original file under its lock once the data is durable
+        path_table::path_id file_id = paths_.intern(args);
+        std::string checksum = transfer.checksum;
+        commits_.commit(
+            transfer.temp_path, 
+            transfer.final_path,
+            [this, file_id]()
+            {
+                return file_locks_.lock_exclusive(file_id);
+            },
+            [this, args, checksum, current_checksum](const std::string& error)
+            {
+                if(!error.empty())
+                {
+                    aprint("Could not commit file \"" + args + "\": " + error, 4);
+                    return;
+                }
+                state_.record(args, current_checksum);
+                state_.set_server_checksum(args, checksum);
+            });
+    };
+
+    callbacks.on_failed = [this](const std::string& path, const std::string& error)
+    {
+        // informs server the file could not be written here
         packet fail_packet;
-        std::string command_response = "supload|" + args + "|fail";
+        std::string command_response = "supload|" + path + "|fail";
         strcharray(command_response, fail_packet.command, sizeof(fail_packet.command));
-        std::string args_response = "Given file could not be created or accessed";
-        args_response += "on user local machine.";
-        strcharray(args_response, fail_packet.payload, args_response.size());
+        std::string args_response = "Given file could not be created or accessed on user local machine.";
+        fail_packet.payload = new char[args_response.size() + 1];
+        strcharray(args_response, fail_packet.payload, args_response.size() + 1);
         fail_packet.payload_size = args_response.size();
 
-        // adds to sender buffer
         {
             std::unique_lock<std::mutex> lock(send_mtx_);
             sender_buffer_.push_back(fail_packet);
@@ -226,58 +280,27 @@ void Client::server_upload_command_(std::string args, std::string checksum, pack
         send_cv_.notify_one();
 
         aprint("Could not write on file sent by server!", 4);
-        aprint("Could not acess file: \"" + args + "\"!", 4);
-        return;
-    }
-    else 
-    {
-        // updates temporary file with payload
-        temp_file.write(buffer.payload, buffer.payload_size);
-        temp_file.close();
-
-        // checks if the packet is last to overwrite original file
-        if(buffer.sequence_number == buffer.expected_packets - 1)
-        {
-            if(file_mtx_.find(args) != file_mtx_.end())
-            {
-                // requests file mutex to change original file
-                std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[args]);
-                    
-                std::string current_checksum = calculate_md5_checksum(temp_file_path);
-
-                if(current_checksum != checksum)
-                {
-                    std::string output = "File md5 checksum for";
-                    output += "\"" + args + "\" is different than the informed amount!";
-                    aprint(output, 4);
-                }
-                else
-                {
-                    std::string output = "File md5 checksum for";
-                    output += "\"" + args + "\" is exactly the informed amount!";
-                    aprint(output, 4);
-                }
+        aprint("Could not acess file: \"" + path + "\"! " + error, 4);
+    };
 
-                // deletes temporaty file replacing the original file
-                rename_replacing(temp_file_path, local_file_path);
-                return;
-            }
-            else
-            {
-                std::string output = "No file mutex was found for \"" + args + "\"!";
-                raise(output, 4);
-            }
-        }
-        return;
-    }
+    downloads_.start(callbacks);
 }
 
 void Client::server_delete_file_command_(std::string args, packet buffer, std::string arg2)
 {
     std::string local_file_path = sync_dir_path_ + args;
     
-    if(arg2 == "fail")
+    if(arg2 == "ok")
+    {
+        // server deleted a file this user asked it to
+        offline_.acknowledge(args);
+        return;
+    }
+    else if(arg2 == "fail")
     {
+        // answered all the same, it is not replayed again
+        offline_.acknowledge(args);
+
         // user requested file download failed
         std::string output = "User requested delete command for \"" + args + "\" failed!";
         aprint(output, 4);
@@ -326,18 +349,46 @@ void Client::server_delete_file_command_(std::string args, packet buffer, std::s
         // valid path, tries to delete file
         try
         {
-            // requests file mutex
-            if(file_mtx_.find(args) != file_mtx_.end())
+            // the server names what goes, it is only ever removed from strictly inside
+            // the sync folder - a link there is removed itself, never followed
+            fs::path target = fs::path(local_file_path).lexically_normal();
+            if(!target.has_filename())
             {
-                std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[args]);
-                delete_file(local_file_path);
-                return;
+                target = target.parent_path();
             }
-            else
+            target = fs::canonical(target.parent_path()) / target.filename();
+            fs::path sync_root = fs::canonical(sync_dir_path_);
+            auto divergence = std::mismatch(sync_root.begin(), sync_root.end(), target.begin(), target.end());
+            if(divergence.first != sync_root.end() || divergence.second == target.end())
             {
-                // if there is no mutex for this file, an error has occured!
-                raise("No file mutex was found for \"" + args + "\"!", 4);
+                throw std::runtime_error("\"" + args + "\" is not inside the sync folder");
             }
+
+            // a download of the file, or of anything under the directory, would
+            // bring it back - it is dropped, or waited for until it is committed
+            downloads_.cancel(args);
+            commits_.flush();
+
+            // requests file lock
+            path_table::path_id file_id = paths_.intern(args);
+            file_lock_manager::ExclusiveLock file_lock = file_locks_.lock_exclusive(file_id);
+            if(fs::is_directory(local_file_path))
+            {
+                // a directory deleted elsewhere goes along with everything under it
+                for(const fs::directory_entry& entry : fs::recursive_directory_iterator(local_file_path))
+                {
+                    std::string path = args + "/" + fs::relative(entry.path(), local_file_path).string();
+                    echoes_.expect_delete(path);
+                    state_.remove(path);
+                }
+                echoes_.expect_delete(args);
+                fs::remove_all(local_file_path);
+                return;
+            }
+            echoes_.expect_delete(args);
+            delete_file(local_file_path);
+            state_.remove(args);
+            return;
         }
         catch(const std::exception& e)
         {
@@ -383,10 +434,17 @@ void Client::server_async_upload_command_(std::string args, std::string checksum
     }
 
     // tries to write on temporary file
-    std::ofstream temp_file(temp_file_path, std::ios::app | std::ios::binary);
-    if(!temp_file) 
+    std::shared_ptr<chunk_writer::ChunkWriter> writer;
+    try
+    {
+        writer = chunk_writers_.acquire(temp_file_path, buffer.expected_packets, buffer.sequence_number);
+        writer->write_chunk(buffer.sequence_number, buffer.payload, buffer.payload_size);
+    }
+    catch(const std::exception& e)
     {
         // given file does not exist locally - informs server
+        chunk_writers_.release(temp_file_path, writer);
+
         packet fail_packet;
         std::string command_response = "aupload|" + args + "|fail";
         strcharray(command_response, fail_packet.command, sizeof(fail_packet.command));
@@ -403,48 +461,60 @@ void Client::server_async_upload_command_(std::string args, std::string checksum
         send_cv_.notify_one();
 
         aprint("Could not write on file sent by server!", 4);
-        aprint("Could not acess file: \"" + args + "\"!", 4);
+        aprint("Could not acess file: \"" + args + "\"! " + std::string(e.what()), 4);
+        return;
+    }
+
+    // file is replaced once every chunk arrived, in whatever order
+    // only the call that claims the complete transfer commits it
+    bool completed = false;
+    std::string finished_file_path;
+    try
+    {
+        completed = chunk_writers_.complete(temp_file_path, writer, finished_file_path);
+    }
+    catch(const std::exception& e)
+    {
+        aprint("Could not finish file \"" + args + "\": " + std::string(e.what()), 4);
         return;
     }
-    else 
+
+    if(completed)
     {
-        // updates temporary file with payload
-        temp_file.write(buffer.payload, buffer.payload_size);
-        temp_file.close();
+        std::string current_checksum = calculate_md5_checksum(finished_file_path);
 
-        // checks if the packet is last to overwrite original file
-        if(buffer.sequence_number == buffer.expected_packets - 1)
+        if(current_checksum != checksum)
         {
-            if(file_mtx_.find(args) != file_mtx_.end())
-            {
-                // requests file mutex to change original file
-                std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[args]);
-                    
-                std::string current_checksum = calculate_md5_checksum(temp_file_path);
+            std::string output = "File md5 checksum for";
+            output += "\"" + args + "\" is different than the informed amount!";
+            aprint(output, 4);
+        }
+        else
+        {
+            std::string output = "File md5 checksum for";
+            output += "\"" + args + "\" is exactly the informed amount!";
+            aprint(output, 4);
+        }
 
-                if(current_checksum != checksum)
-                {
-                    std::string output = "File md5 checksum for";
-                    output += "\"" + args + "\" is different than the informed amount!";
-                    aprint(output, 4);
-                }
-                else
-                {
-                    std::string output = "File md5 checksum for";
-                    output += "\"" + args + "\" is exactly the informed amount!";
-                    aprint(output, 4);
-                }
+        // the watcher sees this file appear, it must not be sent back
+        echoes_.expect_write(args, current_checksum);
 
-                // deletes temporaty file replacing the original file
-                rename_replacing(temp_file_path, local_file_path);
-                return;
-            }
-            else
+        // replaces the original file under its lock once the data is durable
+        path_table::path_id file_id = paths_.intern(args);
+        commits_.commit(
+            finished_file_path, 
+            local_file_path,
+            [this, file_id]()
             {
-                raise("No file mutex was found for \"" + args + "\"!", 4);
-            }
-        }
-        return;
+                return file_locks_.lock_exclusive(file_id);
+            },
+            [args](const std::string& error)
+            {
+                if(!error.empty())
+                {
+                    aprint("Could not commit file \"" + args + "\": " + error, 4);
+                }
+            });
     }
 }
 
@@ -468,6 +538,47 @@ void Client::server_exit_command_(std::string reason)
     return;
 }
 
+void Client::server_commit_command_(std::string args, std::string checksum, packet buffer)
+{
+    // server acknowledged a file sent by this user as stored
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        unacknowledged_uploads_.erase(args);
+    }
+    offline_.acknowledge(args);
+
+    if(checksum == "fail")
+    {
+        // rejected uploads, over the user quota for one, come with a reason
+        std::string output = "Server could not store file \"" + args + "\"!";
+        if(buffer.payload != nullptr && buffer.payload_size > 0)
+        {
+            output += " " + charraystr(buffer.payload, buffer.payload_size);
+        }
+        aprint(output, 4);
+        return;
+    }
+    aprint("File \"" + args + "\" is stored on server (" + checksum + ").", 4);
+    state_.set_server_checksum(args, checksum);
+}
+
+void Client::server_versions_command_(std::string args, packet buffer)
+{
+    // server is responding to a versions request
+    std::string output = "Versions of \"" + args + "\" kept on the server:";
+    output += charraystr(buffer.payload, buffer.payload_size);
+    aprint(output, 4);
+}
+
+void Client::server_restore_command_(std::string args, std::string result, packet buffer)
+{
+    // server could not restore the requested version
+    // successful restores are acknowledged as commits
+    std::string output = "Could not restore \"" + args + "\": ";
+    output += charraystr(buffer.payload, buffer.payload_size);
+    aprint(output, 4);
+}
+
 void Client::server_malformed_command_(std::string command)
 {
     // invalid command request recieved from server
@@ -60,6 +60,16 @@ void Client::process_user_interface_commands_()
                 running_sender_.store(false);
                 break;
             }
+            else if(command_name == "stats")
+            {
+                // prints runtime statistics
+                aprint(file_locks_.format_stats(), 1);
+                aprint(commits_.format_stats(), 1);
+                aprint(uploads_.format_stats(), 1);
+                aprint(downloads_.format_stats(), 1);
+                aprint(offline_.format_stats(), 1);
+                break;
+            }
             else if(command_name == "help")
             {
                 // TODO: this
@@ -101,6 +111,12 @@ void Client::process_user_interface_commands_()
                 this->list_command_(args);
                 break;
             }
+            else if(command_name == "versions")
+            {
+                // user requests the old versions the server kept of a file
+                request_versions_(args);
+                break;
+            }
             else
             {
                 aprint("Could not find a valid command by \"" + ui_buffer_ + "\"!", 1);
@@ -119,6 +135,12 @@ void Client::process_user_interface_commands_()
                 this->start_sync_();
                 break;
             }
+            else if(ui_sanitized_buffer_[0] == "restore")
+            {
+                // user requests an old version of a file back
+                request_restore_(ui_sanitized_buffer_[1], ui_sanitized_buffer_[2]);
+                break;
+            }
             else
             {
                 aprint("Could not find a valid command by \"" + ui_buffer_ + "\"!", 1);
@@ -0,0 +1,229 @@
+// c++
+#include <stdexcept>
+#include <unordered_map>
+#include <cstring>
+
+// local
+#include "binary_delta.hpp"
+#include "utils.hpp"
+
+const char DELTA_MAGIC[4] = {'S', 'W', 'D', 'T'};
+const uint8_t OPERATION_COPY = 0;
+const uint8_t OPERATION_INSERT = 1;
+const uint64_t HASH_BASE = 1099511628211ULL;
+
+// magic, source size, target size, target crc
+const std::size_t DELTA_HEADER_SIZE = 4 + 8 + 8 + 4;
+
+static void write_varint(std::string& output, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        output.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+static uint64_t read_varint(const std::string& input, std::size_t& position)
+{
+    uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        if(position >= input.size())
+        {
+            break;
+        }
+
+        uint8_t byte = static_cast<uint8_t>(input[position++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    throw std::runtime_error("[BINARY DELTA] Truncated delta!");
+}
+
+template <typename T>
+static void write_field(std::string& output, T value)
+{
+    output.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T read_field(const std::string& input, std::size_t offset)
+{
+    T value;
+    std::memcpy(&value, input.data() + offset, sizeof(T));
+    return value;
+}
+
+static uint64_t hash_block(const char* data, std::size_t size)
+{
+    uint64_t hash = 0;
+    for(std::size_t i = 0; i < size; i++)
+    {
+        hash = hash * HASH_BASE + static_cast<uint8_t>(data[i]);
+    }
+    return hash;
+}
+
+static void flush_literal(std::string& output, const std::string& target, std::size_t start, std::size_t end)
+{
+    if(end <= start)
+    {
+        return;
+    }
+
+    output.push_back(static_cast<char>(OPERATION_INSERT));
+    write_varint(output, end - start);
+    output.append(target, start, end - start);
+}
+
+std::string binary_delta::encode(const std::string& source, const std::string& target, std::size_t block_size)
+{
+    // keeps the index bounded, very big sources get coarser matches
+    while(source.size() / block_size > MAX_INDEXED_BLOCKS)
+    {
+        block_size *= 2;
+    }
+
+    std::string delta;
+    delta.append(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    write_field<uint64_t>(delta, source.size());
+    write_field<uint64_t>(delta, target.size());
+    write_field<uint32_t>(delta, calculate_crc32(target.data(), target.size()));
+
+    // source is indexed on block boundaries only, the target is scanned at
+    // every offset - so any shift of the contents still finds its blocks
+    std::unordered_map<uint64_t, std::size_t> blocks;
+    blocks.reserve(source.size() / block_size + 1);
+    for(std::size_t offset = 0; offset + block_size <= source.size(); offset += block_size)
+    {
+        blocks.emplace(hash_block(source.data() + offset, block_size), offset);
+    }
+
+    // base^(block_size - 1), to drop the leaving byte from the rolling hash
+    uint64_t leading_power = 1;
+    for(std::size_t i = 1; i < block_size; i++)
+    {
+        leading_power *= HASH_BASE;
+    }
+
+    std::size_t literal_start = 0;
+    std::size_t position = 0;
+    bool hash_valid = false;
+    uint64_t hash = 0;
+
+    while(position + block_size <= target.size())
+    {
+        if(!hash_valid)
+        {
+            hash = hash_block(target.data() + position, block_size);
+            hash_valid = true;
+        }
+
+        auto match = blocks.find(hash);
+        if(match != blocks.end()
+            && std::memcmp(source.data() + match->second, target.data() + position, block_size) == 0)
+        {
+            std::size_t source_start = match->second;
+            std::size_t target_start = position;
+
+            // grows the match backwards into the pending literal
+            while(target_start > literal_start
+                && source_start > 0
+                && source[source_start - 1] == target[target_start - 1])
+            {
+                source_start--;
+                target_start--;
+            }
+
+            // and forwards as far as both sides agree
+            std::size_t length = position + block_size - target_start;
+            while(source_start + length < source.size()
+                && target_start + length < target.size()
+                && source[source_start + length] == target[target_start + length])
+            {
+                length++;
+            }
+
+            flush_literal(delta, target, literal_start, target_start);
+            delta.push_back(static_cast<char>(OPERATION_COPY));
+            write_varint(delta, source_start);
+            write_varint(delta, length);
+
+            position = target_start + length;
+            literal_start = position;
+            hash_valid = false;
+            continue;
+        }
+
+        // rolls the window one byte forward
+        if(position + block_size < target.size())
+        {
+            hash -= leading_power * static_cast<uint8_t>(target[position]);
+            hash = hash * HASH_BASE + static_cast<uint8_t>(target[position + block_size]);
+        }
+        position++;
+    }
+
+    flush_literal(delta, target, literal_start, target.size());
+    return delta;
+}
+
+std::string binary_delta::apply(const std::string& source, const std::string& delta)
+{
+    if(delta.size() < DELTA_HEADER_SIZE || std::memcmp(delta.data(), DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0)
+    {
+        throw std::runtime_error("[BINARY DELTA] Invalid delta header!");
+    }
+
+    uint64_t source_size = read_field<uint64_t>(delta, 4);
+    uint64_t target_size = read_field<uint64_t>(delta, 12);
+    uint32_t target_crc = read_field<uint32_t>(delta, 20);
+    if(source_size != source.size())
+    {
+        throw std::runtime_error("[BINARY DELTA] Delta was made against another source!");
+    }
+
+    std::string target;
+    target.reserve(target_size);
+
+    std::size_t position = DELTA_HEADER_SIZE;
+    while(position < delta.size())
+    {
+        uint8_t operation = static_cast<uint8_t>(delta[position++]);
+        if(operation == OPERATION_COPY)
+        {
+            uint64_t offset = read_varint(delta, position);
+            uint64_t length = read_varint(delta, position);
+            if(offset > source.size() || length > source.size() - offset)
+            {
+                throw std::runtime_error("[BINARY DELTA] Copy out of source bounds!");
+            }
+            target.append(source, offset, length);
+        }
+        else if(operation == OPERATION_INSERT)
+        {
+            uint64_t length = read_varint(delta, position);
+            if(length > delta.size() - position)
+            {
+                throw std::runtime_error("[BINARY DELTA] Truncated delta!");
+            }
+            target.append(delta, position, length);
+            position += length;
+        }
+        else
+        {
+            throw std::runtime_error("[BINARY DELTA] Unknown delta operation!");
+        }
+    }
+
+    if(target.size() != target_size || calculate_crc32(target.data(), target.size()) != target_crc)
+    {
+        throw std::runtime_error("[BINARY DELTA] Rebuilt contents do not match the delta!");
+    }
+    return target;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// c++
+#include <string>
+#include <cstdint>
+
+namespace binary_delta
+{
+    const std::size_t DEFAULT_BLOCK_SIZE = 16;
+    const std::size_t MAX_INDEXED_BLOCKS = 1 << 20;  // bigger sources are indexed with bigger blocks
+
+    // encodes target as ranges copied from source plus literal bytes
+    // matches are found through a rolling hash over source blocks, so
+    // insertions and deletions anywhere in the file keep the delta small
+    std::string encode(const std::string& source, const std::string& target, std::size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    // rebuilds the target of a delta made by encode against the same source
+    // throws if the delta is damaged or was made against another source
+    std::string apply(const std::string& source, const std::string& delta);
+}
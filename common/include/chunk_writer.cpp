@@ -0,0 +1,315 @@
+// c++
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// local
+#include "chunk_writer.hpp"
+
+using namespace chunk_writer;
+
+std::string chunk_writer::completed_path(const std::string& path)
+{
+    // the pid keeps leftovers of an earlier run from ever being reused
+    static std::atomic<uint64_t> next_transfer(0);
+    std::string id = std::to_string(getpid()) + "-" + std::to_string(next_transfer.fetch_add(1));
+
+    std::size_t name_start = path.find_last_of('/') + 1;
+    std::size_t suffix_start = path.find_last_of('.');
+    if(suffix_start == std::string::npos || suffix_start <= name_start)
+    {
+        return path + "." + id;
+    }
+    return path.substr(0, suffix_start) + "." + id + path.substr(suffix_start);
+}
+
+ChunkWriter::ChunkWriter(const std::string& path, std::size_t expected_chunks, std::size_t chunk_size)
+    :   path_(path),
+        fd_(-1),
+        chunk_size_(chunk_size),
+        expected_chunks_(expected_chunks),
+        received_chunks_(0),
+        file_size_(0),
+        last_write_(std::time(nullptr)),
+        finish_claimed_(false),
+        received_(expected_chunks, false)
+{
+    if(chunk_size_ == 0 || expected_chunks_ == 0)
+    {
+        throw std::runtime_error("[CHUNK WRITER] Invalid transfer layout for \"" + path_ + "\"!");
+    }
+
+    // a new transfer always starts from a fresh temporary file - a leftover
+    // may share its inode with other files, so it is never truncated in place
+    unlink(path_.c_str());
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd_ < 0)
+    {
+        throw std::runtime_error("[CHUNK WRITER] Could not open \"" + path_ + "\": " + std::strerror(errno));
+    }
+
+    // reserves every block at once, keeping the file contiguous - the size is
+    // kept as is, so a crashed transfer never looks bigger than what arrived
+    // filesystems without fallocate support simply allocate as chunks arrive
+    off_t announced_size = static_cast<off_t>(expected_chunks_ * chunk_size_);
+    fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, announced_size);
+}
+
+ChunkWriter::~ChunkWriter()
+{
+    if(fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+void ChunkWriter::write_chunk(int sequence_number, const char* data, std::size_t size)
+{
+    std::shared_lock<std::shared_mutex> fd_lock(fd_mtx_);
+
+    if(fd_ < 0)
+    {
+        throw std::runtime_error("[CHUNK WRITER] Transfer of \"" + path_ + "\" is already finished!");
+    }
+    if(sequence_number < 0 || static_cast<std::size_t>(sequence_number) >= expected_chunks_ || size > chunk_size_)
+    {
+        throw std::runtime_error("[CHUNK WRITER] Chunk " + std::to_string(sequence_number) 
+            + " does not fit transfer of \"" + path_ + "\"!");
+    }
+
+    off_t offset = static_cast<off_t>(sequence_number) * chunk_size_;
+    std::size_t written = 0;
+    while(written < size)
+    {
+        ssize_t result = pwrite(fd_, data + written, size - written, offset + written);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("[CHUNK WRITER] Could not write on \"" + path_ + "\": " + std::strerror(errno));
+        }
+        written += result;
+    }
+
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    if(!received_[sequence_number])
+    {
+        received_[sequence_number] = true;
+        received_chunks_++;
+    }
+    file_size_ = std::max<uint64_t>(file_size_, offset + size);
+    last_write_ = std::time(nullptr);
+}
+
+bool ChunkWriter::has_chunk(int sequence_number)
+{
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    if(sequence_number < 0 || static_cast<std::size_t>(sequence_number) >= expected_chunks_)
+    {
+        return false;
+    }
+    return received_[sequence_number];
+}
+
+std::size_t ChunkWriter::get_received_chunks()
+{
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    return received_chunks_;
+}
+
+bool ChunkWriter::is_complete()
+{
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    return received_chunks_ == expected_chunks_;
+}
+
+bool ChunkWriter::claim_finish()
+{
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    if(finish_claimed_ || received_chunks_ != expected_chunks_)
+    {
+        return false;
+    }
+    finish_claimed_ = true;
+    return true;
+}
+
+void ChunkWriter::finish()
+{
+    std::unique_lock<std::shared_mutex> fd_lock(fd_mtx_);
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    if(fd_ < 0)
+    {
+        return;
+    }
+
+    // last chunk is usually short, which leaves preallocated blocks past the
+    // end of the data - truncating releases them
+    int result = ftruncate(fd_, static_cast<off_t>(file_size_));
+    close(fd_);
+    fd_ = -1;
+
+    if(result != 0)
+    {
+        throw std::runtime_error("[CHUNK WRITER] Could not trim \"" + path_ + "\": " + std::strerror(errno));
+    }
+}
+
+void ChunkWriter::abandon()
+{
+    std::unique_lock<std::shared_mutex> fd_lock(fd_mtx_);
+    if(fd_ < 0)
+    {
+        return;
+    }
+
+    close(fd_);
+    fd_ = -1;
+    unlink(path_.c_str());
+}
+
+std::string ChunkWriter::get_path()
+{
+    return path_;
+}
+
+std::size_t ChunkWriter::get_expected_chunks()
+{
+    return expected_chunks_;
+}
+
+std::time_t ChunkWriter::get_last_write()
+{
+    std::lock_guard<std::mutex> lock(writer_mtx_);
+    return last_write_;
+}
+
+std::shared_ptr<ChunkWriter> ChunkWriterTable::acquire(
+    const std::string& path, 
+    std::size_t expected_chunks, 
+    int sequence_number)
+{
+    std::lock_guard<std::mutex> lock(table_mtx_);
+
+    auto it = writers_.find(path);
+    if(it != writers_.end())
+    {
+        std::shared_ptr<ChunkWriter> writer = it->second;
+        if(writer->get_expected_chunks() == expected_chunks && !writer->has_chunk(sequence_number))
+        {
+            return writer;
+        }
+
+        // same file is being sent again from the start
+        writer->abandon();
+        writers_.erase(it);
+    }
+
+    // only new transfers pay for the sweep
+    close_stale_();
+
+    std::shared_ptr<ChunkWriter> writer = std::make_shared<ChunkWriter>(path, expected_chunks);
+    writers_.emplace(path, writer);
+    return writer;
+}
+
+bool ChunkWriterTable::complete(
+    const std::string& path, 
+    const std::shared_ptr<ChunkWriter>& writer, 
+    std::string& finished_path)
+{
+    // claimed and moved under the table lock, so no new transfer of the
+    // path can start on the temporary file before it was handed over
+    std::lock_guard<std::mutex> lock(table_mtx_);
+    if(!writer->claim_finish())
+    {
+        return false;
+    }
+
+    auto it = writers_.find(path);
+    if(it != writers_.end() && it->second == writer)
+    {
+        writers_.erase(it);
+    }
+
+    try
+    {
+        writer->finish();
+    }
+    catch(const std::exception& e)
+    {
+        unlink(path.c_str());
+        throw;
+    }
+
+    finished_path = completed_path(path);
+    if(std::rename(path.c_str(), finished_path.c_str()) != 0)
+    {
+        std::string error = std::strerror(errno);
+        unlink(path.c_str());
+        throw std::runtime_error("[CHUNK WRITER] Could not hand over \"" + path + "\": " + error);
+    }
+    return true;
+}
+
+void ChunkWriterTable::release(const std::string& path, const std::shared_ptr<ChunkWriter>& writer)
+{
+    // a writer the table already let go of was abandoned or finished then
+    std::lock_guard<std::mutex> lock(table_mtx_);
+    auto it = writers_.find(path);
+    if(writer != nullptr && it != writers_.end() && it->second == writer)
+    {
+        writer->abandon();
+        writers_.erase(it);
+    }
+}
+
+bool ChunkWriterTable::cancel(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(table_mtx_);
+    auto it = writers_.find(path);
+    if(it == writers_.end())
+    {
+        return false;
+    }
+
+    it->second->abandon();
+    writers_.erase(it);
+    return true;
+}
+
+std::size_t ChunkWriterTable::size()
+{
+    std::lock_guard<std::mutex> lock(table_mtx_);
+    return writers_.size();
+}
+
+void ChunkWriterTable::close_stale_()
+{
+    // NOTE: caller must hold table_mtx_
+    // senders that disconnected mid transfer never send their last chunk
+    std::time_t now = std::time(nullptr);
+    for(auto it = writers_.begin(); it != writers_.end();)
+    {
+        if(now - it->second->get_last_write() >= STALE_WRITER_SECONDS)
+        {
+            it->second->abandon();
+            it = writers_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
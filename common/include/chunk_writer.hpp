@@ -0,0 +1,102 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <ctime>
+
+// synchronization
+#include <mutex>
+#include <shared_mutex>
+
+namespace chunk_writer
+{
+    const std::size_t DEFAULT_CHUNK_SIZE = 8192;  // payload size used by every sender
+    const int STALE_WRITER_SECONDS = 300;          // abandoned transfers are closed after this
+
+    // where a finished transfer of path is moved before it is committed - the
+    // name is unique to the transfer, so a new transfer of the same file never
+    // recreates it under a commit still waiting to be published
+    // the suffix of path is kept, "a.txt.swizdownload" becomes "a.txt.<id>.swizdownload"
+    std::string completed_path(const std::string& path);
+
+    class ChunkWriter
+    {
+        // receive side of a chunked file transfer
+        // the file stays open for the whole transfer, is preallocated up front
+        // from the announced chunk count, and every chunk is written at its own
+        // offset - so chunks may arrive in any order, or from parallel senders
+        public:
+            ChunkWriter(const std::string& path, std::size_t expected_chunks, std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
+            ~ChunkWriter();
+
+            // writes a chunk at sequence_number * chunk_size
+            // chunks never overlap, so several threads may write at once
+            void write_chunk(int sequence_number, const char* data, std::size_t size);
+
+            bool has_chunk(int sequence_number);
+            std::size_t get_received_chunks();
+            bool is_complete();
+
+            // true for exactly one caller once every chunk arrived, the one
+            // that has to finish and commit the file
+            bool claim_finish();
+
+            // trims the preallocated tail and closes the file
+            void finish();
+
+            // closes the file and removes it, unless it was already finished
+            // writes from then on throw
+            void abandon();
+
+            std::string get_path();
+            std::size_t get_expected_chunks();
+            std::time_t get_last_write();
+
+        private:
+            std::string path_;
+            int fd_;
+            std::size_t chunk_size_;
+            std::size_t expected_chunks_;
+            std::size_t received_chunks_;
+            uint64_t file_size_;
+            std::time_t last_write_;
+            bool finish_claimed_;
+            std::vector<bool> received_;
+            std::mutex writer_mtx_;
+            std::shared_mutex fd_mtx_;  // shared by writers, the descriptor only closes exclusively
+    };
+
+    class ChunkWriterTable
+    {
+        // open writers keyed by temporary file path
+        // writers dropped by the table (restarted, failed or stale) are
+        // abandoned, so their temporary file never outlives them
+        public:
+            // returns the writer for an ongoing transfer, or starts a new one when
+            // there is none or the chunk was already received (transfer restarted)
+            std::shared_ptr<ChunkWriter> acquire(const std::string& path, std::size_t expected_chunks, int sequence_number);
+
+            // claims and finishes a complete transfer, forgetting its writer and
+            // moving its file to completed_path(path), which is returned in
+            // finished_path - true for exactly one caller, which then owns it
+            bool complete(const std::string& path, const std::shared_ptr<ChunkWriter>& writer, std::string& finished_path);
+
+            // abandons a failed transfer, unless the path moved on to a new one
+            void release(const std::string& path, const std::shared_ptr<ChunkWriter>& writer);
+
+            // abandons whatever transfer of path is ongoing, true if there was one
+            bool cancel(const std::string& path);
+
+            std::size_t size();
+
+        private:
+            std::unordered_map<std::string, std::shared_ptr<ChunkWriter>> writers_;
+            std::mutex table_mtx_;
+
+            void close_stale_();
+    };
+}
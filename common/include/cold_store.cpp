@@ -0,0 +1,569 @@
+// c++
+#include <stdexcept>
+#include <filesystem>
+#include <vector>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zstd.h>
+
+// local
+#include "cold_store.hpp"
+
+using namespace cold_store;
+namespace fs = std::filesystem;
+
+const char COLD_MAGIC[4] = {'S', 'W', 'Z', 'C'};
+const std::string STORED_SUFFIX = ".swzc";
+const std::string COMPRESSING_SUFFIX = ".swizcold";
+const std::string REHYDRATING_SUFFIX = ".swizwarm";
+
+// magic, chunk size, original size, modification time in nanoseconds
+const std::size_t COLD_HEADER_SIZE = 4 + 4 + 8 + 8;
+
+// original size, compressed size
+const std::size_t FRAME_HEADER_SIZE = 4 + 4;
+
+static bool ends_with(const std::string& value, const std::string& suffix)
+{
+    return value.size() >= suffix.size()
+        && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static std::string relative_path(const std::string& path)
+{
+    // keyed like the pack store, relative to the user folder
+    std::size_t start = path.find_first_not_of('/');
+    return (start == std::string::npos) ? "" : path.substr(start);
+}
+
+static bool write_all(int fd, const char* data, std::size_t size)
+{
+    std::size_t written = 0;
+    while(written < size)
+    {
+        ssize_t result = write(fd, data + written, size - written);
+        if(result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(result <= 0)
+        {
+            return false;
+        }
+        written += result;
+    }
+    return true;
+}
+
+static std::size_t read_up_to(int fd, char* data, std::size_t size)
+{
+    // reads until size bytes or end of file, whichever comes first
+    std::size_t total = 0;
+    while(total < size)
+    {
+        ssize_t result = read(fd, data + total, size - total);
+        if(result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(result <= 0)
+        {
+            break;
+        }
+        total += result;
+    }
+    return total;
+}
+
+static void sync_parent(const std::string& path)
+{
+    int dir_fd = open(fs::path(path).parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+ColdStore::ColdStore(const std::string& directory, int compression_level)
+    :   directory_(directory),
+        compression_level_(compression_level),
+        next_pending_(0),
+        compressed_files_(0),
+        skipped_files_(0),
+        rehydrated_files_(0),
+        reads_(0),
+        total_read_us_(0),
+        max_read_us_(0)
+{
+    fs::create_directories(directory_);
+    open_index_();
+}
+
+bool ColdStore::prepare(const std::string& path, const std::string& file_path, PendingCold& pending)
+{
+    // reading for compression must not make the file look used
+    int source_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if(source_fd < 0 && errno == EPERM)
+    {
+        source_fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if(source_fd < 0)
+    {
+        return false;
+    }
+
+    // files linked elsewhere (deduplicated or kept as a version) would
+    // stay on disk anyway, compressing them only adds a copy
+    struct stat source_info;
+    if(fstat(source_fd, &source_info) != 0
+        || !S_ISREG(source_info.st_mode)
+        || source_info.st_nlink > 1
+        || static_cast<uint64_t>(source_info.st_size) < MIN_COLD_FILE_SIZE)
+    {
+        close(source_fd);
+        return false;
+    }
+
+    int64_t modification_ns = static_cast<int64_t>(source_info.st_mtim.tv_sec) * 1000000000LL + source_info.st_mtim.tv_nsec;
+    {
+        std::shared_lock<std::shared_mutex> lock(store_mtx_);
+        auto it = incompressible_.find(relative_path(path));
+        if(it != incompressible_.end() && it->second == modification_ns)
+        {
+            close(source_fd);
+            return false;
+        }
+    }
+
+    // nothing is locked yet, a name of its own keeps passes apart
+    std::string stored_path = stored_path_(path);
+    std::string temp_path = stored_path + "." + std::to_string(next_pending_.fetch_add(1)) + COMPRESSING_SUFFIX;
+    fs::create_directories(fs::path(stored_path).parent_path());
+
+    int target_fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(target_fd < 0)
+    {
+        close(source_fd);
+        return false;
+    }
+
+    uint64_t original_size = source_info.st_size;
+    char header[COLD_HEADER_SIZE];
+    std::memcpy(header, COLD_MAGIC, 4);
+    std::memcpy(header + 4, &DEFAULT_CHUNK_SIZE, 4);
+    std::memcpy(header + 8, &original_size, 8);
+    std::memcpy(header + 16, &modification_ns, 8);
+    bool ok = write_all(target_fd, header, COLD_HEADER_SIZE);
+
+    std::vector<char> input(DEFAULT_CHUNK_SIZE);
+    std::vector<char> output(ZSTD_compressBound(DEFAULT_CHUNK_SIZE));
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+
+    uint64_t read_bytes = 0;
+    uint64_t stored_size = COLD_HEADER_SIZE;
+    bool shrinks = true;
+    while(ok)
+    {
+        std::size_t chunk_size = read_up_to(source_fd, input.data(), input.size());
+        if(chunk_size == 0)
+        {
+            break;
+        }
+
+        std::size_t compressed_size = ZSTD_compressCCtx(
+            context,
+            output.data(),
+            output.size(),
+            input.data(),
+            chunk_size,
+            compression_level_);
+        if(ZSTD_isError(compressed_size))
+        {
+            ok = false;
+            break;
+        }
+
+        uint32_t frame_header[2] = {static_cast<uint32_t>(chunk_size), static_cast<uint32_t>(compressed_size)};
+        ok = write_all(target_fd, reinterpret_cast<const char*>(frame_header), FRAME_HEADER_SIZE)
+            && write_all(target_fd, output.data(), compressed_size);
+        read_bytes += chunk_size;
+        stored_size += FRAME_HEADER_SIZE + compressed_size;
+
+        // a few chunks are enough to tell incompressible data apart
+        if(read_bytes >= 4 * DEFAULT_CHUNK_SIZE && stored_size > read_bytes * MAX_COMPRESSED_RATIO)
+        {
+            shrinks = false;
+            break;
+        }
+    }
+    ZSTD_freeCCtx(context);
+    close(source_fd);
+
+    shrinks = shrinks && stored_size <= original_size * MAX_COMPRESSED_RATIO;
+    if(!ok || !shrinks || (read_bytes != original_size) || fsync(target_fd) != 0)
+    {
+        close(target_fd);
+        unlink(temp_path.c_str());
+
+        if(ok && !shrinks)
+        {
+            std::unique_lock<std::shared_mutex> lock(store_mtx_);
+            incompressible_[relative_path(path)] = modification_ns;
+            skipped_files_.fetch_add(1);
+        }
+        return false;
+    }
+    close(target_fd);
+
+    pending.path = path;
+    pending.temp_path = temp_path;
+    pending.file.size = original_size;
+    pending.file.stored_size = stored_size;
+    pending.file.modification_time = source_info.st_mtim.tv_sec;
+    pending.device = source_info.st_dev;
+    pending.inode = source_info.st_ino;
+    pending.modification_ns = modification_ns;
+    return true;
+}
+
+bool ColdStore::publish(PendingCold& pending, const std::string& file_path)
+{
+    // NOTE: caller must hold the file lock exclusively
+    if(pending.temp_path.empty())
+    {
+        return false;
+    }
+
+    // files are replaced by renames, a commit in between shows as another inode
+    struct stat current_info;
+    bool unchanged = stat(file_path.c_str(), &current_info) == 0
+        && static_cast<uint64_t>(current_info.st_dev) == pending.device
+        && static_cast<uint64_t>(current_info.st_ino) == pending.inode
+        && current_info.st_nlink == 1
+        && static_cast<uint64_t>(current_info.st_size) == pending.file.size
+        && static_cast<int64_t>(current_info.st_mtim.tv_sec) * 1000000000LL + current_info.st_mtim.tv_nsec == pending.modification_ns;
+
+    // durable before the caller drops the original
+    std::string stored_path = stored_path_(pending.path);
+    if(!unchanged || rename(pending.temp_path.c_str(), stored_path.c_str()) != 0)
+    {
+        unlink(pending.temp_path.c_str());
+        pending.temp_path.clear();
+        return false;
+    }
+    pending.temp_path.clear();
+    sync_parent(stored_path);
+
+    {
+        std::unique_lock<std::shared_mutex> lock(store_mtx_);
+        index_[relative_path(pending.path)] = pending.file;
+        incompressible_.erase(relative_path(pending.path));
+    }
+    compressed_files_.fetch_add(1);
+    return true;
+}
+
+bool ColdStore::rehydrate(const std::string& path, const std::string& file_path)
+{
+    // NOTE: caller must hold the file lock exclusively
+    auto read_start = std::chrono::steady_clock::now();
+
+    // written next to the compressed copy, the user folder only ever sees
+    // the complete file appear
+    std::string stored_path = stored_path_(path);
+    std::string temp_path = stored_path + REHYDRATING_SUFFIX;
+    int target_fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(target_fd < 0)
+    {
+        return false;
+    }
+
+    int64_t modification_ns = 0;
+    bool ok = decompress_(
+        path,
+        [target_fd](const char* data, std::size_t size)
+        {
+            return write_all(target_fd, data, size);
+        },
+        &modification_ns);
+
+    // the original modification time is kept, clients compare it
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_NOW;
+    times[1].tv_sec = modification_ns / 1000000000LL;
+    times[1].tv_nsec = modification_ns % 1000000000LL;
+    ok = ok && futimens(target_fd, times) == 0 && fsync(target_fd) == 0;
+    close(target_fd);
+
+    if(!ok || rename(temp_path.c_str(), file_path.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    sync_parent(file_path);
+    remove(path);
+
+    rehydrated_files_.fetch_add(1);
+    record_read_(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - read_start).count());
+    return true;
+}
+
+bool ColdStore::read(const std::string& path, std::string& contents)
+{
+    auto read_start = std::chrono::steady_clock::now();
+
+    contents.clear();
+    bool ok = decompress_(
+        path,
+        [&contents](const char* data, std::size_t size)
+        {
+            contents.append(data, size);
+            return true;
+        });
+
+    record_read_(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - read_start).count());
+    return ok;
+}
+
+bool ColdStore::extract(const std::string& path, const std::string& target_path)
+{
+    auto read_start = std::chrono::steady_clock::now();
+
+    int target_fd = open(target_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(target_fd < 0)
+    {
+        return false;
+    }
+
+    bool ok = decompress_(
+        path,
+        [target_fd](const char* data, std::size_t size)
+        {
+            return write_all(target_fd, data, size);
+        });
+    close(target_fd);
+
+    if(!ok)
+    {
+        unlink(target_path.c_str());
+        return false;
+    }
+
+    record_read_(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - read_start).count());
+    return true;
+}
+
+bool ColdStore::find(const std::string& path, ColdFile& file)
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+    auto it = index_.find(relative_path(path));
+    if(it == index_.end())
+    {
+        return false;
+    }
+    file = it->second;
+    return true;
+}
+
+bool ColdStore::remove(const std::string& path)
+{
+    std::unique_lock<std::shared_mutex> lock(store_mtx_);
+    if(index_.erase(relative_path(path)) == 0)
+    {
+        return false;
+    }
+    unlink(stored_path_(path).c_str());
+    return true;
+}
+
+void ColdStore::list(std::function<void(const std::string& path, const ColdFile& file)> on_file)
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+    for(const auto& [path, file] : index_)
+    {
+        on_file(path, file);
+    }
+}
+
+ColdStats ColdStore::get_stats()
+{
+    ColdStats stats;
+    {
+        std::shared_lock<std::shared_mutex> lock(store_mtx_);
+        stats.files = index_.size();
+        for(const auto& [path, file] : index_)
+        {
+            stats.original_bytes += file.size;
+            stats.stored_bytes += file.stored_size;
+        }
+    }
+
+    stats.compressed_files = compressed_files_.load();
+    stats.skipped_files = skipped_files_.load();
+    stats.rehydrated_files = rehydrated_files_.load();
+    stats.reads = reads_.load();
+    stats.total_read_us = total_read_us_.load();
+    stats.max_read_us = max_read_us_.load();
+    return stats;
+}
+
+std::string ColdStore::format_stats()
+{
+    ColdStats stats = get_stats();
+
+    char ratio[16];
+    double compression_ratio = (stats.stored_bytes > 0) ? static_cast<double>(stats.original_bytes) / stats.stored_bytes : 0;
+    std::snprintf(ratio, sizeof(ratio), "%.2f", compression_ratio);
+
+    uint64_t average_read_us = (stats.reads > 0) ? stats.total_read_us / stats.reads : 0;
+
+    std::string output = "cold: " + std::to_string(stats.files) + " files, ";
+    output += std::to_string(stats.original_bytes) + " bytes in " + std::to_string(stats.stored_bytes);
+    output += " (ratio " + std::string(ratio) + "), ";
+    output += std::to_string(stats.compressed_files) + " compressed, ";
+    output += std::to_string(stats.skipped_files) + " incompressible, ";
+    output += std::to_string(stats.rehydrated_files) + " rehydrated, ";
+    output += std::to_string(stats.reads) + " reads (avg " + std::to_string(average_read_us);
+    output += "us, max " + std::to_string(stats.max_read_us) + "us)";
+    return output;
+}
+
+std::string ColdStore::stored_path_(const std::string& path)
+{
+    return directory_ + "/" + relative_path(path) + STORED_SUFFIX;
+}
+
+void ColdStore::open_index_()
+{
+    std::error_code error;
+    for(const fs::directory_entry& entry : fs::recursive_directory_iterator(directory_, error))
+    {
+        if(!entry.is_regular_file(error))
+        {
+            continue;
+        }
+
+        // leftovers of a compression or rehydration cut short
+        std::string stored_path = entry.path().string();
+        if(ends_with(stored_path, COMPRESSING_SUFFIX) || ends_with(stored_path, REHYDRATING_SUFFIX))
+        {
+            unlink(stored_path.c_str());
+            continue;
+        }
+        if(!ends_with(stored_path, STORED_SUFFIX))
+        {
+            continue;
+        }
+
+        int fd = open(stored_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+            continue;
+        }
+
+        char header[COLD_HEADER_SIZE];
+        bool valid = read_up_to(fd, header, COLD_HEADER_SIZE) == COLD_HEADER_SIZE
+            && std::memcmp(header, COLD_MAGIC, 4) == 0;
+        close(fd);
+        if(!valid)
+        {
+            continue;
+        }
+
+        int64_t modification_ns;
+        ColdFile file;
+        std::memcpy(&file.size, header + 8, 8);
+        std::memcpy(&modification_ns, header + 16, 8);
+        file.modification_time = modification_ns / 1000000000LL;
+        file.stored_size = entry.file_size(error);
+
+        std::string path = stored_path.substr(directory_.size(), stored_path.size() - directory_.size() - STORED_SUFFIX.size());
+        index_[relative_path(path)] = file;
+    }
+}
+
+bool ColdStore::decompress_(
+    const std::string& path,
+    std::function<bool(const char* data, std::size_t size)> on_chunk,
+    int64_t* modification_ns)
+{
+    int fd = open(stored_path_(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    char header[COLD_HEADER_SIZE];
+    if(read_up_to(fd, header, COLD_HEADER_SIZE) != COLD_HEADER_SIZE || std::memcmp(header, COLD_MAGIC, 4) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    uint32_t chunk_size;
+    uint64_t original_size;
+    std::memcpy(&chunk_size, header + 4, 4);
+    std::memcpy(&original_size, header + 8, 8);
+    if(modification_ns != nullptr)
+    {
+        std::memcpy(modification_ns, header + 16, 8);
+    }
+
+    std::vector<char> input(ZSTD_compressBound(chunk_size));
+    std::vector<char> output(chunk_size);
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+
+    bool ok = true;
+    uint64_t total = 0;
+    while(ok)
+    {
+        uint32_t frame_header[2];
+        std::size_t header_read = read_up_to(fd, reinterpret_cast<char*>(frame_header), FRAME_HEADER_SIZE);
+        if(header_read == 0)
+        {
+            break;
+        }
+
+        // sizes are checked before use, a damaged file must not overflow the buffers
+        ok = header_read == FRAME_HEADER_SIZE
+            && frame_header[0] <= chunk_size
+            && frame_header[1] <= input.size()
+            && read_up_to(fd, input.data(), frame_header[1]) == frame_header[1];
+        if(!ok)
+        {
+            break;
+        }
+
+        std::size_t decompressed = ZSTD_decompressDCtx(context, output.data(), frame_header[0], input.data(), frame_header[1]);
+        ok = !ZSTD_isError(decompressed) && decompressed == frame_header[0] && on_chunk(output.data(), decompressed);
+        total += decompressed;
+    }
+    ZSTD_freeDCtx(context);
+    close(fd);
+
+    return ok && total == original_size;
+}
+
+void ColdStore::record_read_(uint64_t read_us)
+{
+    reads_.fetch_add(1, std::memory_order_relaxed);
+    total_read_us_.fetch_add(read_us, std::memory_order_relaxed);
+
+    uint64_t previous_max = max_read_us_.load();
+    while(read_us > previous_max && !max_read_us_.compare_exchange_weak(previous_max, read_us))
+    {
+        // retries until the max is updated or surpassed by another thread
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+// c++
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
+namespace cold_store
+{
+    const int DEFAULT_COMPRESSION_LEVEL = 9;             // cold data is compressed once, read rarely
+    const uint32_t DEFAULT_CHUNK_SIZE = 1024 * 1024;     // compressed independently, bounds decompression memory
+    const uint64_t MIN_COLD_FILE_SIZE = 64 * 1024;       // smaller files are not worth a frame
+    const double MAX_COMPRESSED_RATIO = 0.9;             // files that do not shrink more stay as they are
+
+    struct ColdFile
+    {
+        uint64_t size = 0;          // of the original contents
+        uint64_t stored_size = 0;   // compressed, on disk
+        int64_t modification_time = 0;
+    };
+
+    struct ColdStats
+    {
+        uint64_t files = 0;
+        uint64_t original_bytes = 0;
+        uint64_t stored_bytes = 0;
+        uint64_t compressed_files = 0;
+        uint64_t skipped_files = 0;
+        uint64_t rehydrated_files = 0;
+        uint64_t reads = 0;
+        uint64_t total_read_us = 0;
+        uint64_t max_read_us = 0;
+    };
+
+    // a compressed copy written without the file lock, only put in place
+    // if the file it was made of is still there unchanged
+    struct PendingCold
+    {
+        std::string path;
+        std::string temp_path;  // empty when there is nothing to put in place
+        ColdFile file;
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        int64_t modification_ns = 0;
+    };
+
+    class ColdStore
+    {
+        // files of a user left cold for long enough, compressed with zstd
+        // every file is kept at <directory>/<path>.swzc as independent frames
+        // of a fixed chunk size, so neither side ever holds it whole in memory
+        // cold files are never served compressed - the first read writes the
+        // original back to the user folder, which makes the file hot again
+        public:
+            ColdStore(const std::string& directory, int compression_level = DEFAULT_COMPRESSION_LEVEL);
+
+            // compresses a regular file aside, keeping its modification time
+            // returns false if the file is shared, too small or did not shrink enough
+            // the file is only read, so no lock is needed - publish checks it stayed the same
+            bool prepare(const std::string& path, const std::string& file_path, PendingCold& pending);
+
+            // puts a prepared copy in place, dropping it if file_path changed meanwhile
+            // the compressed copy is durable on return, the caller removes the original
+            // NOTE: caller must hold the file lock exclusively
+            bool publish(PendingCold& pending, const std::string& file_path);
+
+            // writes the original contents back to file_path and drops the compressed copy
+            // NOTE: caller must hold the file lock exclusively
+            bool rehydrate(const std::string& path, const std::string& file_path);
+
+            // decompressed contents, for callers needing them in memory
+            bool read(const std::string& path, std::string& contents);
+
+            // writes the decompressed contents to target_path, a chunk at a time,
+            // keeping the compressed copy
+            bool extract(const std::string& path, const std::string& target_path);
+
+            // paths are relative to the user folder, a leading slash is ignored
+            bool find(const std::string& path, ColdFile& file);
+            bool remove(const std::string& path);
+            void list(std::function<void(const std::string& path, const ColdFile& file)> on_file);
+
+            ColdStats get_stats();
+            std::string format_stats();
+
+        private:
+            std::string directory_;
+            int compression_level_;
+
+            std::map<std::string, ColdFile> index_;
+
+            // files that did not shrink, by path and modification time, so
+            // they are not compressed again on every pass
+            std::unordered_map<std::string, int64_t> incompressible_;
+
+            std::atomic<uint64_t> next_pending_;
+            std::atomic<uint64_t> compressed_files_;
+            std::atomic<uint64_t> skipped_files_;
+            std::atomic<uint64_t> rehydrated_files_;
+            std::atomic<uint64_t> reads_;
+            std::atomic<uint64_t> total_read_us_;
+            std::atomic<uint64_t> max_read_us_;
+
+            std::shared_mutex store_mtx_;
+
+            std::string stored_path_(const std::string& path);
+            void open_index_();
+            bool decompress_(
+                const std::string& path,
+                std::function<bool(const char* data, std::size_t size)> on_chunk,
+                int64_t* modification_ns = nullptr);
+            void record_read_(uint64_t read_us);
+    };
+}
@@ -0,0 +1,524 @@
+// c++
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <map>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "commit_pipeline.hpp"
+
+using namespace commit_pipeline;
+
+// returns the directory holding the given path, "." for bare names
+static std::string parent_directory(const std::string& path)
+{
+    std::size_t slash = path.find_last_of('/');
+    if(slash == std::string::npos)
+    {
+        return ".";
+    }
+    else if(slash == 0)
+    {
+        return "/";
+    }
+    return path.substr(0, slash);
+}
+
+static void sync_directory(const std::string& directory)
+{
+    int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd < 0)
+    {
+        throw std::runtime_error("[COMMIT PIPELINE] Could not open directory \"" + directory + "\": " + std::strerror(errno));
+    }
+
+    int result = fsync(dir_fd);
+    int saved_errno = errno;
+    close(dir_fd);
+
+    if(result != 0)
+    {
+        throw std::runtime_error("[COMMIT PIPELINE] Could not sync directory \"" + directory + "\": " + std::strerror(saved_errno));
+    }
+}
+
+DurabilityPolicy commit_pipeline::parse_policy(const std::string& name)
+{
+    if(name == "none")
+    {
+        return DurabilityPolicy::NONE;
+    }
+    else if(name == "batched")
+    {
+        return DurabilityPolicy::BATCHED;
+    }
+    else if(name == "strict")
+    {
+        return DurabilityPolicy::STRICT;
+    }
+    throw std::runtime_error("[COMMIT PIPELINE] Unknown durability policy \"" + name + "\"!");
+}
+
+std::string commit_pipeline::policy_name(DurabilityPolicy policy)
+{
+    switch(policy)
+    {
+        case DurabilityPolicy::NONE:
+            return "none";
+        case DurabilityPolicy::BATCHED:
+            return "batched";
+        case DurabilityPolicy::STRICT:
+            return "strict";
+    }
+    return "unknown";
+}
+
+CommitPipeline::CommitPipeline(DurabilityPolicy policy, int batch_interval_ms)
+    :   policy_(policy),
+        batch_interval_ms_(batch_interval_ms),
+        queued_commits_(0),
+        flushed_commits_(0),
+        flush_requested_(false),
+        running_(false),
+        commits_(0),
+        failed_commits_(0),
+        undurable_commits_(0),
+        batches_(0),
+        filesystem_syncs_(0),
+        directory_syncs_(0),
+        total_flush_us_(0),
+        max_flush_us_(0)
+{
+    if(batch_interval_ms_ < 0)
+    {
+        throw std::runtime_error("[COMMIT PIPELINE] Batch interval must not be negative!");
+    }
+
+    // only batched commits are deferred to a background thread
+    if(policy_ == DurabilityPolicy::BATCHED)
+    {
+        running_.store(true);
+        flusher_th_ = std::thread(&CommitPipeline::flusher_loop_, this);
+    }
+}
+
+CommitPipeline::~CommitPipeline()
+{
+    // whatever is still queued is flushed before the thread exits
+    {
+        std::lock_guard<std::mutex> lock(pending_mtx_);
+        running_.store(false);
+    }
+    pending_cv_.notify_all();
+
+    if(flusher_th_.joinable())
+    {
+        flusher_th_.join();
+    }
+}
+
+void CommitPipeline::commit(
+    const std::string& temp_path, 
+    const std::string& final_path, 
+    LockCallback lock_file, 
+    CommitCallback on_committed,
+    CommitCallback on_acknowledged,
+    RenameCallback on_renamed)
+{
+    PendingCommit pending{temp_path, final_path, lock_file, on_committed, on_acknowledged, on_renamed};
+
+    if(policy_ == DurabilityPolicy::STRICT)
+    {
+        commit_strict_(pending);
+        return;
+    }
+    else if(policy_ == DurabilityPolicy::NONE)
+    {
+        commit_now_(pending);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mtx_);
+        pending_.push_back(std::move(pending));
+        queued_commits_++;
+    }
+    pending_cv_.notify_one();
+}
+
+void CommitPipeline::sync_point(
+    const std::string& path, 
+    CommitCallback on_committed, 
+    CommitCallback on_acknowledged)
+{
+    // a commit without a final path is never renamed, only synced
+    commit(path, "", nullptr, on_committed, on_acknowledged);
+}
+
+void CommitPipeline::set_record_sync(RecordSyncCallback sync_records)
+{
+    sync_records_ = sync_records;
+}
+
+void CommitPipeline::flush()
+{
+    if(policy_ != DurabilityPolicy::BATCHED)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(pending_mtx_);
+    uint64_t target = queued_commits_;
+    flush_requested_ = true;
+    pending_cv_.notify_one();
+    flushed_cv_.wait(lock, [this, target]() { return flushed_commits_ >= target || !running_.load(); });
+}
+
+DurabilityPolicy CommitPipeline::get_policy()
+{
+    return policy_;
+}
+
+CommitStats CommitPipeline::get_stats()
+{
+    CommitStats stats;
+    stats.commits = commits_.load();
+    stats.failed_commits = failed_commits_.load();
+    stats.undurable_commits = undurable_commits_.load();
+    stats.batches = batches_.load();
+    stats.filesystem_syncs = filesystem_syncs_.load();
+    stats.directory_syncs = directory_syncs_.load();
+    stats.total_flush_us = total_flush_us_.load();
+    stats.max_flush_us = max_flush_us_.load();
+    return stats;
+}
+
+std::string CommitPipeline::format_stats()
+{
+    CommitStats stats = get_stats();
+    uint64_t average_batch = (stats.batches > 0) ? stats.commits / stats.batches : 0;
+    uint64_t average_flush_us = (stats.batches > 0) ? stats.total_flush_us / stats.batches : 0;
+
+    std::string output = "commits (" + policy_name(policy_) + "): ";
+    output += std::to_string(stats.commits) + " committed, ";
+    output += std::to_string(stats.failed_commits) + " failed, ";
+    output += std::to_string(stats.undurable_commits) + " not durable, ";
+    output += std::to_string(stats.batches) + " flushes (~" + std::to_string(average_batch) + " per flush), ";
+    output += std::to_string(stats.filesystem_syncs) + " fs syncs, ";
+    output += std::to_string(stats.directory_syncs) + " dir syncs, ";
+    output += "flush avg " + std::to_string(average_flush_us) + "us max " + std::to_string(stats.max_flush_us) + "us";
+    return output;
+}
+
+void CommitPipeline::flusher_loop_()
+{
+    std::unique_lock<std::mutex> lock(pending_mtx_);
+    while(true)
+    {
+        pending_cv_.wait(lock, [this]() { return !pending_.empty() || !running_.load(); });
+        if(pending_.empty() && !running_.load())
+        {
+            break;
+        }
+
+        // first commit of a batch opens a short window for others to join
+        if(running_.load() && !flush_requested_)
+        {
+            pending_cv_.wait_for(
+                lock, 
+                std::chrono::milliseconds(batch_interval_ms_), 
+                [this]() { return flush_requested_ || !running_.load(); });
+        }
+        flush_requested_ = false;
+
+        std::vector<PendingCommit> batch;
+        batch.swap(pending_);
+        lock.unlock();
+
+        flush_batch_(batch);
+
+        lock.lock();
+        flushed_commits_ += batch.size();
+        flushed_cv_.notify_all();
+    }
+    flushed_cv_.notify_all();
+}
+
+void CommitPipeline::flush_batch_(std::vector<PendingCommit>& batch)
+{
+    auto flush_start = std::chrono::steady_clock::now();
+
+    // one syncfs per filesystem makes the contents of every temporary file durable
+    // before anything is renamed, so no crash can publish a partially written file
+    // a failed sync fails every commit on that filesystem, none of them is published
+    std::vector<std::string> errors(batch.size());
+    std::map<dev_t, std::string> device_errors;
+    for(std::size_t i = 0; i < batch.size(); i++)
+    {
+        std::string directory = parent_directory(batch[i].temp_path);
+        int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(dir_fd < 0)
+        {
+            errors[i] = "[COMMIT PIPELINE] Could not open directory \"" + directory + "\": " + std::strerror(errno);
+            continue;
+        }
+
+        struct stat dir_info;
+        if(fstat(dir_fd, &dir_info) != 0)
+        {
+            errors[i] = "[COMMIT PIPELINE] Could not stat directory \"" + directory + "\": " + std::strerror(errno);
+        }
+        else if(device_errors.count(dir_info.st_dev) == 0)
+        {
+            std::string& error = device_errors[dir_info.st_dev];
+            if(syncfs(dir_fd) != 0)
+            {
+                error = "[COMMIT PIPELINE] Could not sync filesystem of \"" + directory + "\": " + std::strerror(errno);
+            }
+            filesystem_syncs_.fetch_add(1, std::memory_order_relaxed);
+            errors[i] = error;
+        }
+        else
+        {
+            errors[i] = device_errors[dir_info.st_dev];
+        }
+        close(dir_fd);
+    }
+
+    // publishes every file, in the order they were committed
+    std::set<std::string> touched_directories;
+    for(std::size_t i = 0; i < batch.size(); i++)
+    {
+        if(batch[i].final_path.empty() || !errors[i].empty())
+        {
+            continue;
+        }
+
+        try
+        {
+            rename_locked_(batch[i]);
+            touched_directories.insert(parent_directory(batch[i].final_path));
+        }
+        catch(const std::exception& e)
+        {
+            errors[i] = e.what();
+        }
+    }
+
+    // renames become durable with a single fsync of each directory, a
+    // failed one only fails the commits published into it
+    std::map<std::string, std::string> directory_errors;
+    for(const std::string& directory : touched_directories)
+    {
+        try
+        {
+            sync_directory(directory);
+            directory_syncs_.fetch_add(1, std::memory_order_relaxed);
+        }
+        catch(const std::exception& e)
+        {
+            directory_errors[directory] = e.what();
+        }
+    }
+
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    record_flush_(flush_start);
+
+    for(std::size_t i = 0; i < batch.size(); i++)
+    {
+        if(errors[i].empty() && !batch[i].final_path.empty())
+        {
+            auto directory_error = directory_errors.find(parent_directory(batch[i].final_path));
+            if(directory_error != directory_errors.end())
+            {
+                errors[i] = directory_error->second;
+            }
+        }
+        finish_(batch[i], errors[i]);
+    }
+    acknowledge_(batch, errors);
+}
+
+void CommitPipeline::commit_strict_(PendingCommit& pending)
+{
+    auto flush_start = std::chrono::steady_clock::now();
+    std::string error;
+    try
+    {
+        int file_fd = open(pending.temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(file_fd < 0)
+        {
+            throw std::runtime_error("[COMMIT PIPELINE] Could not open \"" + pending.temp_path + "\": " + std::strerror(errno));
+        }
+        int result = fsync(file_fd);
+        int saved_errno = errno;
+        close(file_fd);
+        if(result != 0)
+        {
+            throw std::runtime_error("[COMMIT PIPELINE] Could not sync \"" + pending.temp_path + "\": " + std::strerror(saved_errno));
+        }
+
+        if(!pending.final_path.empty())
+        {
+            rename_locked_(pending);
+            sync_directory(parent_directory(pending.final_path));
+            directory_syncs_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        error = e.what();
+    }
+
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    record_flush_(flush_start);
+    finish_(pending, error);
+
+    std::vector<PendingCommit> commits{pending};
+    std::vector<std::string> errors{error};
+    acknowledge_(commits, errors);
+}
+
+void CommitPipeline::commit_now_(PendingCommit& pending)
+{
+    std::string error;
+    try
+    {
+        if(!pending.final_path.empty())
+        {
+            rename_locked_(pending);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        error = e.what();
+    }
+    finish_(pending, error);
+
+    // nothing is synced without a durability policy
+    if(pending.on_acknowledged)
+    {
+        try
+        {
+            pending.on_acknowledged(error);
+        }
+        catch(const std::exception& e)
+        {
+            // nothing left to report to
+        }
+    }
+}
+
+void CommitPipeline::rename_locked_(PendingCommit& pending)
+{
+    file_lock_manager::ExclusiveLock file_lock;
+    if(pending.lock_file)
+    {
+        file_lock = pending.lock_file();
+    }
+
+    bool renamed = std::rename(pending.temp_path.c_str(), pending.final_path.c_str()) == 0;
+    int saved_errno = errno;
+    if(pending.on_renamed)
+    {
+        pending.on_renamed(renamed);
+    }
+
+    if(!renamed)
+    {
+        throw std::runtime_error("[COMMIT PIPELINE] Could not rename \"" + pending.temp_path + "\": " + std::strerror(saved_errno));
+    }
+}
+
+void CommitPipeline::record_flush_(std::chrono::steady_clock::time_point flush_start)
+{
+    uint64_t flush_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - flush_start).count();
+    total_flush_us_.fetch_add(flush_us, std::memory_order_relaxed);
+
+    uint64_t previous_max = max_flush_us_.load();
+    while(flush_us > previous_max && !max_flush_us_.compare_exchange_weak(previous_max, flush_us))
+    {
+        // retries until the max is updated or surpassed by another thread
+    }
+}
+
+void CommitPipeline::finish_(PendingCommit& pending, const std::string& error)
+{
+    if(error.empty())
+    {
+        commits_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        failed_commits_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if(!pending.on_committed)
+    {
+        return;
+    }
+
+    // a failing acknowledgement must not take the flusher down with it
+    try
+    {
+        pending.on_committed(error);
+    }
+    catch(const std::exception& e)
+    {
+        // nothing left to report to
+    }
+}
+
+void CommitPipeline::acknowledge_(std::vector<PendingCommit>& commits, std::vector<std::string>& errors)
+{
+    // records of the whole flush are synced together, nobody is told a
+    // commit is done before it would be found again after a crash
+    if(sync_records_)
+    {
+        std::string sync_error;
+        try
+        {
+            sync_records_();
+        }
+        catch(const std::exception& e)
+        {
+            sync_error = e.what();
+        }
+
+        // the files are in place and on_committed already ran, the commits
+        // are done - whoever waits on them is only told they may not survive a crash
+        for(std::string& error : errors)
+        {
+            if(error.empty() && !sync_error.empty())
+            {
+                error = "[COMMIT PIPELINE] Committed, but not durable: " + sync_error;
+                undurable_commits_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    for(std::size_t i = 0; i < commits.size(); i++)
+    {
+        if(!commits[i].on_acknowledged)
+        {
+            continue;
+        }
+
+        try
+        {
+            commits[i].on_acknowledged(errors[i]);
+        }
+        catch(const std::exception& e)
+        {
+            // nothing left to report to
+        }
+    }
+}
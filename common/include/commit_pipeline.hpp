@@ -0,0 +1,151 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+
+// local
+#include "file_lock_manager.hpp"
+
+namespace commit_pipeline
+{
+    enum class DurabilityPolicy
+    {
+        NONE,     // renames only, durability is left to the kernel
+        BATCHED,  // commits are grouped and made durable every few milliseconds
+        STRICT    // every commit is fsynced before it is acknowledged
+    };
+
+    const int DEFAULT_BATCH_INTERVAL_MS = 50;
+
+    // parses "none", "batched" or "strict", throws on anything else
+    DurabilityPolicy parse_policy(const std::string& name);
+    std::string policy_name(DurabilityPolicy policy);
+
+    // acquires the lock guarding the final path while it is replaced
+    typedef std::function<file_lock_manager::ExclusiveLock()> LockCallback;
+
+    // runs under the lock taken by LockCallback right after the rename, renamed
+    // tells whether it went through - for state that has to change along with it
+    typedef std::function<void(bool renamed)> RenameCallback;
+
+    // called once the commit reached the durability point of the policy
+    // error is empty on success
+    typedef std::function<void(const std::string& error)> CommitCallback;
+
+    // makes whatever the commit callbacks of a flush recorded durable
+    // throws on failure
+    typedef std::function<void()> RecordSyncCallback;
+
+    struct CommitStats
+    {
+        uint64_t commits = 0;
+        uint64_t failed_commits = 0;
+        uint64_t undurable_commits = 0;  // committed, but their records could not be synced
+        uint64_t batches = 0;
+        uint64_t filesystem_syncs = 0;
+        uint64_t directory_syncs = 0;
+        uint64_t total_flush_us = 0;
+        uint64_t max_flush_us = 0;
+    };
+
+    class CommitPipeline
+    {
+        // publishes completed transfers (temporary file renamed over the final path)
+        // batched commits are grouped: one syncfs per filesystem makes the data of
+        // every pending file durable, the renames are done, and every touched
+        // directory is fsynced once - only then are the commits acknowledged
+        public:
+            CommitPipeline(
+                DurabilityPolicy policy = DurabilityPolicy::BATCHED, 
+                int batch_interval_ms = DEFAULT_BATCH_INTERVAL_MS);
+            ~CommitPipeline();
+
+            // lock_file may be empty when the path needs no locking
+            // on_committed records the commit, on_acknowledged tells whoever
+            // waits on it - only after the records of the whole flush were synced
+            // NOTE: both may run on the flusher thread
+            void commit(
+                const std::string& temp_path, 
+                const std::string& final_path, 
+                LockCallback lock_file, 
+                CommitCallback on_committed,
+                CommitCallback on_acknowledged = nullptr,
+                RenameCallback on_renamed = nullptr);
+
+            // acknowledges once everything written to path so far is durable,
+            // for data that is published in place rather than renamed
+            void sync_point(
+                const std::string& path, 
+                CommitCallback on_committed, 
+                CommitCallback on_acknowledged = nullptr);
+
+            // runs once per flush between the commit and acknowledge callbacks,
+            // on failure the commits of the flush stay done, as their files were
+            // already renamed, but are acknowledged as not durable
+            // NOTE: must be set before the first commit
+            void set_record_sync(RecordSyncCallback sync_records);
+
+            // blocks until every commit queued so far was flushed
+            void flush();
+
+            DurabilityPolicy get_policy();
+            CommitStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct PendingCommit
+            {
+                std::string temp_path;
+                std::string final_path;
+                LockCallback lock_file;
+                CommitCallback on_committed;
+                CommitCallback on_acknowledged;
+                RenameCallback on_renamed;
+            };
+
+            DurabilityPolicy policy_;
+            int batch_interval_ms_;
+            RecordSyncCallback sync_records_;
+
+            std::vector<PendingCommit> pending_;
+            uint64_t queued_commits_;
+            uint64_t flushed_commits_;
+            bool flush_requested_;
+            std::mutex pending_mtx_;
+            std::condition_variable pending_cv_;
+            std::condition_variable flushed_cv_;
+
+            std::atomic<bool> running_;
+            std::thread flusher_th_;
+
+            // statistics
+            std::atomic<uint64_t> commits_;
+            std::atomic<uint64_t> failed_commits_;
+            std::atomic<uint64_t> undurable_commits_;
+            std::atomic<uint64_t> batches_;
+            std::atomic<uint64_t> filesystem_syncs_;
+            std::atomic<uint64_t> directory_syncs_;
+            std::atomic<uint64_t> total_flush_us_;
+            std::atomic<uint64_t> max_flush_us_;
+
+            void flusher_loop_();
+            void flush_batch_(std::vector<PendingCommit>& batch);
+            void commit_strict_(PendingCommit& pending);
+            void commit_now_(PendingCommit& pending);
+            void rename_locked_(PendingCommit& pending);
+            void record_flush_(std::chrono::steady_clock::time_point flush_start);
+            void finish_(PendingCommit& pending, const std::string& error);
+            void acknowledge_(std::vector<PendingCommit>& commits, std::vector<std::string>& errors);
+    };
+}
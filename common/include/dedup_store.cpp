@@ -0,0 +1,419 @@
+// c++
+#include <stdexcept>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iterator>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
+
+// local
+#include "dedup_store.hpp"
+#include "utils.hpp"
+
+using namespace dedup_store;
+namespace fs = std::filesystem;
+
+const char* DIGEST_ATTRIBUTE = "user.swiz.sha256";
+const char* REFERENCE_ATTRIBUTE = "user.swiz.ref";
+const std::string PENDING_SUFFIX = ".swizdedup";
+const std::string REFERENCES_SUFFIX = ".refs";
+
+static bool clone_file(const std::string& source_path, const std::string& target_path)
+{
+    // target is created or truncated, then shares every extent of the source
+    int source_fd = open(source_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(source_fd < 0)
+    {
+        return false;
+    }
+
+    int target_fd = open(target_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(target_fd < 0)
+    {
+        close(source_fd);
+        return false;
+    }
+
+    bool cloned = ioctl(target_fd, FICLONE, source_fd) == 0;
+    close(target_fd);
+    close(source_fd);
+    return cloned;
+}
+
+static bool is_pending(const std::string& name)
+{
+    return name.size() > PENDING_SUFFIX.size()
+        && name.compare(name.size() - PENDING_SUFFIX.size(), PENDING_SUFFIX.size(), PENDING_SUFFIX) == 0;
+}
+
+static std::string read_attribute(const std::string& path, const char* name)
+{
+    char value[128];
+    ssize_t size = getxattr(path.c_str(), name, value, sizeof(value));
+    if(size <= 0)
+    {
+        return "";
+    }
+    return std::string(value, size);
+}
+
+static bool write_attribute(const std::string& path, const char* name, const std::string& value)
+{
+    return setxattr(path.c_str(), name, value.data(), value.size(), 0) == 0;
+}
+
+static std::string read_marker(const std::string& marker_path)
+{
+    std::ifstream marker(marker_path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(marker)), std::istreambuf_iterator<char>());
+}
+
+DedupStore::DedupStore(const std::string& directory)
+    :   directory_(directory),
+        objects_(0),
+        object_bytes_(0),
+        duplicates_(0),
+        saved_bytes_(0),
+        released_objects_(0),
+        repaired_references_(0),
+        next_reference_(0)
+{
+    fs::create_directories(directory_);
+
+    // hard links would share every later write, only clones are safe to hand out
+    if(!supports_reflinks_())
+    {
+        throw std::runtime_error("[DEDUP STORE] \"" + directory_ + "\" has no reflink or extended attribute support!");
+    }
+    count_objects_();
+}
+
+Reference DedupStore::deduplicate(const std::string& file_path, const std::string& final_path)
+{
+    struct stat file_info;
+    if(stat(file_path.c_str(), &file_info) != 0 || !S_ISREG(file_info.st_mode))
+    {
+        return Reference();
+    }
+
+    std::string digest = calculate_sha256_checksum(file_path);
+    std::string object_path = object_path_(digest);
+    std::lock_guard<std::mutex> lock(get_stripe_(digest));
+
+    struct stat object_info;
+    if(stat(object_path.c_str(), &object_info) != 0)
+    {
+        // first copy of these contents, becomes the stored object
+        fs::create_directories(fs::path(object_path).parent_path());
+        if(!store_object_(file_path, object_path))
+        {
+            return Reference();
+        }
+
+        objects_.fetch_add(1);
+        object_bytes_.fetch_add(file_info.st_size);
+    }
+    else
+    {
+        // same digest with a different size can only be a damaged object
+        if(object_info.st_size != file_info.st_size || !clone_file(object_path, file_path))
+        {
+            return Reference();
+        }
+
+        duplicates_.fetch_add(1);
+        saved_bytes_.fetch_add(file_info.st_size);
+    }
+
+    // an object nobody ended up referencing is left for the sweep
+    Reference reference;
+    reference.digest = digest;
+    reference.id = add_reference_(digest, final_path);
+    if(reference.id.empty())
+    {
+        return Reference();
+    }
+
+    if(!write_attribute(file_path, DIGEST_ATTRIBUTE, digest) 
+        || !write_attribute(file_path, REFERENCE_ATTRIBUTE, reference.id))
+    {
+        unlink((references_path_(digest) + "/" + reference.id).c_str());
+        return Reference();
+    }
+    return reference;
+}
+
+Reference DedupStore::hold(const std::string& file_path)
+{
+    // files that were never deduplicated carry no digest
+    Reference reference;
+    reference.digest = read_attribute(file_path, DIGEST_ATTRIBUTE);
+    reference.id = read_attribute(file_path, REFERENCE_ATTRIBUTE);
+    if(reference.digest.empty() || reference.id.empty())
+    {
+        return Reference();
+    }
+    return reference;
+}
+
+void DedupStore::release(const Reference& reference)
+{
+    if(reference.digest.empty() || reference.id.empty())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(get_stripe_(reference.digest));
+    unlink((references_path_(reference.digest) + "/" + reference.id).c_str());
+
+    struct stat object_info;
+    if(count_references_(reference.digest) == 0 && stat(object_path_(reference.digest).c_str(), &object_info) == 0)
+    {
+        remove_object_(reference.digest, object_info.st_size);
+    }
+}
+
+uint64_t DedupStore::sweep(std::function<bool()> pace)
+{
+    uint64_t reclaimed_bytes = 0;
+    std::time_t settled_before = std::time(nullptr) - PENDING_REFERENCE_SECONDS;
+
+    std::error_code error;
+    for(const fs::directory_entry& prefix : fs::directory_iterator(directory_, error))
+    {
+        if(!prefix.is_directory(error))
+        {
+            continue;
+        }
+
+        for(const fs::directory_entry& entry : fs::directory_iterator(prefix.path(), error))
+        {
+            if(pace != nullptr && !pace())
+            {
+                return reclaimed_bytes;
+            }
+
+            // reference directories are visited along with their object
+            if(!entry.is_regular_file(error))
+            {
+                continue;
+            }
+
+            std::string object_path = entry.path().string();
+            std::string digest = entry.path().filename().string();
+            bool pending = is_pending(digest);
+            if(pending)
+            {
+                digest.resize(digest.size() - PENDING_SUFFIX.size());
+            }
+
+            std::lock_guard<std::mutex> lock(get_stripe_(digest));
+
+            struct stat object_info;
+            if(stat(object_path.c_str(), &object_info) != 0)
+            {
+                continue;
+            }
+
+            // leftovers of a store interrupted by a crash
+            if(pending)
+            {
+                unlink(object_path.c_str());
+                continue;
+            }
+
+            // a settled reference whose path does not carry it anymore was
+            // never released, the file was replaced or deleted behind our back
+            std::string references_path = references_path_(digest);
+            for(const fs::directory_entry& marker : fs::directory_iterator(references_path, error))
+            {
+                struct stat marker_info;
+                if(stat(marker.path().c_str(), &marker_info) != 0 || marker_info.st_mtime > settled_before)
+                {
+                    continue;
+                }
+
+                std::string file_path = read_marker(marker.path().string());
+                if(read_attribute(file_path, DIGEST_ATTRIBUTE) != digest 
+                    || read_attribute(file_path, REFERENCE_ATTRIBUTE) != marker.path().filename().string())
+                {
+                    unlink(marker.path().c_str());
+                    repaired_references_.fetch_add(1);
+                }
+            }
+
+            if(count_references_(digest) == 0)
+            {
+                remove_object_(digest, object_info.st_size);
+                reclaimed_bytes += object_info.st_size;
+            }
+        }
+    }
+    return reclaimed_bytes;
+}
+
+uint64_t DedupStore::get_references(const std::string& digest)
+{
+    std::lock_guard<std::mutex> lock(get_stripe_(digest));
+    return count_references_(digest);
+}
+
+DedupStats DedupStore::get_stats()
+{
+    DedupStats stats;
+    stats.objects = objects_.load();
+    stats.object_bytes = object_bytes_.load();
+    stats.duplicates = duplicates_.load();
+    stats.saved_bytes = saved_bytes_.load();
+    stats.released_objects = released_objects_.load();
+    stats.repaired_references = repaired_references_.load();
+    return stats;
+}
+
+std::string DedupStore::format_stats()
+{
+    DedupStats stats = get_stats();
+    std::string output = "dedup: ";
+    output += std::to_string(stats.objects) + " objects (" + std::to_string(stats.object_bytes) + " bytes), ";
+    output += std::to_string(stats.duplicates) + " duplicates cloned, ";
+    output += std::to_string(stats.saved_bytes) + " bytes saved, ";
+    output += std::to_string(stats.released_objects) + " objects released, ";
+    output += std::to_string(stats.repaired_references) + " stale references dropped";
+    return output;
+}
+
+std::string DedupStore::object_path_(const std::string& digest)
+{
+    return directory_ + "/" + digest.substr(0, 2) + "/" + digest;
+}
+
+std::string DedupStore::references_path_(const std::string& digest)
+{
+    return object_path_(digest) + REFERENCES_SUFFIX;
+}
+
+std::mutex& DedupStore::get_stripe_(const std::string& digest)
+{
+    return stripes_[std::hash<std::string>{}(digest) % DEDUP_STRIPE_COUNT];
+}
+
+bool DedupStore::supports_reflinks_()
+{
+    // clones need support from the filesystem holding the store, and user
+    // files name their reference in user extended attributes
+    std::string source_path = directory_ + "/.probe-source";
+    std::string clone_path = directory_ + "/.probe-clone";
+
+    bool supported = false;
+    int fd = open(source_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd >= 0)
+    {
+        bool written = write(fd, "swiz", 4) == 4;
+        close(fd);
+
+        supported = written
+            && clone_file(source_path, clone_path)
+            && write_attribute(clone_path, REFERENCE_ATTRIBUTE, "probe");
+    }
+
+    unlink(source_path.c_str());
+    unlink(clone_path.c_str());
+    return supported;
+}
+
+void DedupStore::count_objects_()
+{
+    std::error_code error;
+    for(const fs::directory_entry& prefix : fs::directory_iterator(directory_, error))
+    {
+        if(!prefix.is_directory(error))
+        {
+            continue;
+        }
+
+        for(const fs::directory_entry& entry : fs::directory_iterator(prefix.path(), error))
+        {
+            if(!entry.is_regular_file(error) || is_pending(entry.path().filename().string()))
+            {
+                continue;
+            }
+
+            objects_.fetch_add(1);
+            object_bytes_.fetch_add(entry.file_size(error));
+        }
+    }
+}
+
+bool DedupStore::store_object_(const std::string& file_path, const std::string& object_path)
+{
+    // NOTE: caller must hold the stripe of the digest
+    // the object is built aside, so a crash never leaves a partial one
+    std::string pending_path = object_path + PENDING_SUFFIX;
+    if(!clone_file(file_path, pending_path) || rename(pending_path.c_str(), object_path.c_str()) != 0)
+    {
+        unlink(pending_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string DedupStore::add_reference_(const std::string& digest, const std::string& final_path)
+{
+    // NOTE: caller must hold the stripe of the digest
+    // the marker names the file holding it, which is all the sweep needs
+    // to tell a live reference from one a crash left behind
+    std::string references_path = references_path_(digest);
+    std::error_code error;
+    fs::create_directories(references_path, error);
+
+    std::string id = std::to_string(getpid()) + "-" + std::to_string(std::time(nullptr));
+    id += "-" + std::to_string(next_reference_.fetch_add(1));
+
+    std::string marker_path = references_path + "/" + id;
+    int fd = open(marker_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        return "";
+    }
+
+    bool written = write(fd, final_path.data(), final_path.size()) == static_cast<ssize_t>(final_path.size());
+    close(fd);
+    if(!written)
+    {
+        unlink(marker_path.c_str());
+        return "";
+    }
+    return id;
+}
+
+uint64_t DedupStore::count_references_(const std::string& digest)
+{
+    // NOTE: caller must hold the stripe of the digest
+    std::error_code error;
+    fs::directory_iterator markers(references_path_(digest), error);
+    return error ? 0 : std::distance(markers, fs::directory_iterator());
+}
+
+void DedupStore::remove_object_(const std::string& digest, uint64_t size)
+{
+    // NOTE: caller must hold the stripe of the digest
+    if(unlink(object_path_(digest).c_str()) != 0)
+    {
+        return;
+    }
+    rmdir(references_path_(digest).c_str());
+
+    objects_.fetch_sub(1);
+    object_bytes_.fetch_sub(size);
+    released_objects_.fetch_add(1);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// c++
+#include <string>
+#include <functional>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <mutex>
+
+namespace dedup_store
+{
+    const int DEDUP_STRIPE_COUNT = 64;
+    const int PENDING_REFERENCE_SECONDS = 600;  // references younger than this may still be on their way to their path
+
+    struct DedupStats
+    {
+        uint64_t objects = 0;
+        uint64_t object_bytes = 0;
+        uint64_t duplicates = 0;
+        uint64_t saved_bytes = 0;
+        uint64_t released_objects = 0;
+        uint64_t repaired_references = 0;
+    };
+
+    // what a user file needs to drop the reference it holds, read while the
+    // file is still in place - both are empty for files never deduplicated
+    struct Reference
+    {
+        std::string digest;
+        std::string id;
+    };
+
+    class DedupStore
+    {
+        // content addressed store shared by every user of the server
+        // received files are keyed by their sha256 and stored once under
+        // <directory>/<first two digits>/<digest>, each user file then being
+        // a copy on write clone of that object
+        // every reference is a marker file under <object>.refs naming the
+        // user file holding it, so references are added and dropped with a
+        // single create or unlink, and markers a crash left behind are found
+        // by sweep, as their path no longer carries their id
+        // needs a filesystem with reflinks, the constructor throws otherwise
+        public:
+            DedupStore(const std::string& directory);
+
+            // replaces a received file by a clone of the object with the same
+            // contents, storing it as a new object first if there is none
+            // final_path is where the file is about to be published
+            // returns the reference it took, empty if the file was left alone
+            Reference deduplicate(const std::string& file_path, const std::string& final_path);
+
+            // reads the reference of a user file about to be deleted or replaced,
+            // to be released once it actually was
+            Reference hold(const std::string& file_path);
+
+            // drops a reference - the object goes away with its last one
+            void release(const Reference& reference);
+
+            // removes references whose file is gone or moved on to other
+            // contents, and objects nothing references anymore
+            // pace is called before every object, returning false stops the sweep
+            // returns how many bytes were reclaimed
+            uint64_t sweep(std::function<bool()> pace = nullptr);
+
+            uint64_t get_references(const std::string& digest);
+            DedupStats get_stats();
+            std::string format_stats();
+
+        private:
+            std::string directory_;
+
+            std::mutex stripes_[DEDUP_STRIPE_COUNT];
+
+            std::atomic<uint64_t> objects_;
+            std::atomic<uint64_t> object_bytes_;
+            std::atomic<uint64_t> duplicates_;
+            std::atomic<uint64_t> saved_bytes_;
+            std::atomic<uint64_t> released_objects_;
+            std::atomic<uint64_t> repaired_references_;
+            std::atomic<uint64_t> next_reference_;
+
+            std::string object_path_(const std::string& digest);
+            std::string references_path_(const std::string& digest);
+            std::mutex& get_stripe_(const std::string& digest);
+            bool supports_reflinks_();
+            void count_objects_();
+            bool store_object_(const std::string& file_path, const std::string& object_path);
+            std::string add_reference_(const std::string& digest, const std::string& final_path);
+            uint64_t count_references_(const std::string& digest);
+            void remove_object_(const std::string& digest, uint64_t size);
+    };
+}
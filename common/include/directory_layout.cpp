@@ -0,0 +1,212 @@
+// c++
+#include <stdexcept>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cctype>
+
+// local
+#include "directory_layout.hpp"
+
+using namespace directory_layout;
+namespace fs = std::filesystem;
+
+static uint32_t hash_username(const std::string& username)
+{
+    // fnv-1a, std::hash is free to change between builds
+    uint32_t hash = 2166136261u;
+    for(unsigned char c : username)
+    {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool is_shard_name(const std::string& name)
+{
+    return name.size() == 2 && std::isxdigit(static_cast<unsigned char>(name[0]))
+        && std::isxdigit(static_cast<unsigned char>(name[1]));
+}
+
+static std::vector<fs::path> list_directories(const fs::path& directory)
+{
+    std::vector<fs::path> directories;
+    std::error_code error;
+    for(const fs::directory_entry& entry : fs::directory_iterator(directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        if(!name.empty() && name[0] != '.' && entry.is_directory(error))
+        {
+            directories.push_back(entry.path());
+        }
+    }
+    return directories;
+}
+
+static std::vector<fs::path> list_users(const fs::path& root, Layout layout)
+{
+    if(layout == Layout::FLAT)
+    {
+        return list_directories(root);
+    }
+
+    std::vector<fs::path> users;
+    for(const fs::path& first : list_directories(root))
+    {
+        if(!is_shard_name(first.filename().string()))
+        {
+            continue;
+        }
+        for(const fs::path& second : list_directories(first))
+        {
+            if(!is_shard_name(second.filename().string()))
+            {
+                continue;
+            }
+            for(const fs::path& user : list_directories(second))
+            {
+                users.push_back(user);
+            }
+        }
+    }
+    return users;
+}
+
+Layout directory_layout::parse_layout(const std::string& name)
+{
+    if(name == "flat")
+    {
+        return Layout::FLAT;
+    }
+    else if(name == "hashed")
+    {
+        return Layout::HASHED;
+    }
+    throw std::runtime_error("[DIRECTORY LAYOUT] Unknown directory layout \"" + name + "\"!");
+}
+
+std::string directory_layout::layout_name(Layout layout)
+{
+    switch(layout)
+    {
+        case Layout::FLAT:
+            return "flat";
+        case Layout::HASHED:
+            return "hashed";
+    }
+    return "unknown";
+}
+
+std::string directory_layout::user_directory(const std::string& root, const std::string& username, Layout layout)
+{
+    if(layout == Layout::FLAT)
+    {
+        return root + "/" + username;
+    }
+
+    char prefix[8];
+    uint32_t hash = hash_username(username);
+    std::snprintf(prefix, sizeof(prefix), "%02x/%02x", (hash >> 24) & 0xff, (hash >> 16) & 0xff);
+    return root + "/" + prefix + "/" + username;
+}
+
+Layout directory_layout::read_layout(const std::string& marker_path)
+{
+    std::ifstream marker(marker_path);
+    std::string name;
+    if(!marker.is_open() || !std::getline(marker, name))
+    {
+        // trees from before layouts were recorded are flat
+        return Layout::FLAT;
+    }
+    return parse_layout(name);
+}
+
+void directory_layout::write_layout(const std::string& marker_path, Layout layout)
+{
+    std::string temp_path = marker_path + ".swizdownload";
+    {
+        std::ofstream marker(temp_path, std::ios::trunc);
+        marker << layout_name(layout) << "\n";
+        if(!marker.good())
+        {
+            throw std::runtime_error("[DIRECTORY LAYOUT] Could not write layout marker \"" + marker_path + "\"!");
+        }
+    }
+    fs::rename(temp_path, marker_path);
+}
+
+MigrationStats directory_layout::migrate(
+    const std::string& root,
+    const std::string& marker_path,
+    const std::string& staging_path,
+    Layout layout)
+{
+    auto migration_start = std::chrono::steady_clock::now();
+
+    MigrationStats stats;
+    stats.previous_layout = read_layout(marker_path);
+    fs::create_directories(staging_path);
+
+    // users staged by a migration that was cut short come first
+    std::vector<std::string> usernames;
+    for(const fs::path& user : list_directories(staging_path))
+    {
+        usernames.push_back(user.filename().string());
+    }
+
+    if(stats.previous_layout != layout)
+    {
+        for(const fs::path& user : list_users(root, stats.previous_layout))
+        {
+            std::string username = user.filename().string();
+            fs::rename(user, fs::path(staging_path) / username);
+            usernames.push_back(username);
+        }
+
+        // shard directories left empty by a hashed tree
+        if(stats.previous_layout == Layout::HASHED)
+        {
+            for(const fs::path& first : list_directories(root))
+            {
+                if(!is_shard_name(first.filename().string()))
+                {
+                    continue;
+                }
+
+                std::error_code error;
+                for(const fs::path& second : list_directories(first))
+                {
+                    fs::remove(second, error);
+                }
+                fs::remove(first, error);
+            }
+        }
+    }
+
+    // from here on staging is the only place these users live in
+    write_layout(marker_path, layout);
+
+    for(const std::string& username : usernames)
+    {
+        fs::path target = user_directory(root, username, layout);
+        if(fs::exists(target))
+        {
+            throw std::runtime_error("[DIRECTORY LAYOUT] \"" + target.string() + "\" already exists, user left in staging!");
+        }
+
+        fs::create_directories(target.parent_path());
+        fs::rename(fs::path(staging_path) / username, target);
+        stats.moved_users++;
+    }
+
+    std::error_code error;
+    fs::remove(staging_path, error);
+
+    stats.elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - migration_start).count();
+    return stats;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// c++
+#include <string>
+#include <cstdint>
+
+namespace directory_layout
+{
+    enum class Layout
+    {
+        FLAT,    // <root>/<user>
+        HASHED   // <root>/ab/cd/<user>, spreads users over 65536 small directories
+    };
+
+    // parses "flat" or "hashed", throws on anything else
+    Layout parse_layout(const std::string& name);
+    std::string layout_name(Layout layout);
+
+    // the shard prefix comes from a hash of the username that never changes
+    // between runs or builds, so a user always maps to the same directory
+    std::string user_directory(const std::string& root, const std::string& username, Layout layout);
+
+    // layout the tree was last written with, flat when it was never recorded
+    Layout read_layout(const std::string& marker_path);
+    void write_layout(const std::string& marker_path, Layout layout);
+
+    struct MigrationStats
+    {
+        Layout previous_layout = Layout::FLAT;
+        uint64_t moved_users = 0;
+        uint64_t elapsed_us = 0;
+    };
+
+    // moves every user directory under root to where layout places it
+    // users are renamed into staging first, so usernames clashing with shard
+    // names are never in the way, and the marker is switched before they
+    // leave it - a migration cut short completes when run again
+    // directories whose name starts with a dot are never taken for users
+    MigrationStats migrate(
+        const std::string& root,
+        const std::string& marker_path,
+        const std::string& staging_path,
+        Layout layout);
+}
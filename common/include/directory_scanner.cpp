@@ -0,0 +1,345 @@
+// c++
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// local
+#include "directory_scanner.hpp"
+
+using namespace directory_scanner;
+
+// getdents64 is used directly - readdir hides the buffer size
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+const std::size_t DENTS_BUFFER_SIZE = 1024 * 1024;  // 1mb per worker
+const unsigned int STATX_SCAN_MASK = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO
+    | STATX_ATIME | STATX_MTIME | STATX_CTIME;
+
+DirectoryScanner::DirectoryScanner(int worker_count)
+    :   running_(true),
+        queued_tasks_(0),
+        next_worker_(0)
+{
+    if(worker_count <= 0)
+    {
+        // defaults to the number of cores, bounded to keep disk queues sane
+        worker_count = std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 2, 8);
+    }
+
+    for(int i = 0; i < worker_count; i++)
+    {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+
+    // threads are only started after every deque exists, as they steal from each other
+    for(int i = 0; i < worker_count; i++)
+    {
+        workers_[i]->th = std::thread(
+            [this, i]()
+            {
+                worker_loop_(i);
+            });
+    }
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    running_.store(false);
+    {
+        std::lock_guard<std::mutex> lock(idle_mtx_);
+    }
+    idle_cv_.notify_all();
+
+    for(auto& worker : workers_)
+    {
+        if(worker->th.joinable())
+        {
+            worker->th.join();
+        }
+    }
+}
+
+uint64_t DirectoryScanner::scan(
+    const std::string& root,
+    std::function<void(const ScanEntry&)> on_entry,
+    bool include_directories,
+    int* failed_directories)
+{
+    int root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(root_fd < 0)
+    {
+        throw std::runtime_error("[DIRECTORY SCANNER] Could not open \"" + root + "\"!");
+    }
+
+    ScanJob job;
+    job.root_fd = root_fd;
+    job.include_directories = include_directories;
+    job.on_entry = on_entry;
+    job.pending_tasks.store(1);
+
+    // root task goes to the next worker in round robin, the rest is stolen
+    ScanTask root_task;
+    root_task.job = &job;
+    root_task.relative_path = "";
+    push_task_(next_worker_.fetch_add(1) % workers_.size(), root_task);
+
+    // waits for every spawned task to finish
+    {
+        std::unique_lock<std::mutex> lock(job.done_mtx);
+        job.done_cv.wait(lock, [&job]() { return job.pending_tasks.load() == 0; });
+    }
+
+    close(root_fd);
+    if(failed_directories != nullptr)
+    {
+        *failed_directories = job.failed_directories.load();
+    }
+    return job.emitted_entries.load();
+}
+
+std::vector<ScanEntry> DirectoryScanner::scan_to_vector(
+    const std::string& root,
+    bool include_directories,
+    int* failed_directories)
+{
+    std::vector<ScanEntry> entries;
+    std::mutex entries_mtx;
+
+    scan(
+        root,
+        [&entries, &entries_mtx](const ScanEntry& entry)
+        {
+            std::lock_guard<std::mutex> lock(entries_mtx);
+            entries.push_back(entry);
+        },
+        include_directories,
+        failed_directories);
+
+    std::sort(
+        entries.begin(),
+        entries.end(),
+        [](const ScanEntry& a, const ScanEntry& b)
+        {
+            return a.path < b.path;
+        });
+    return entries;
+}
+
+int DirectoryScanner::get_worker_count()
+{
+    return workers_.size();
+}
+
+void DirectoryScanner::worker_loop_(int index)
+{
+    std::vector<char> dents_buffer(DENTS_BUFFER_SIZE);
+
+    while(running_.load())
+    {
+        ScanTask task;
+        if(pop_task_(index, task))
+        {
+            process_directory_(index, task, dents_buffer);
+            finish_task_(task.job);
+            continue;
+        }
+
+        // nothing to run or steal, sleeps until a new task is queued
+        std::unique_lock<std::mutex> lock(idle_mtx_);
+        idle_cv_.wait(lock, [this]() { return queued_tasks_.load() > 0 || !running_.load(); });
+    }
+}
+
+void DirectoryScanner::push_task_(int index, ScanTask task)
+{
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->deque_mtx);
+        workers_[index]->tasks.push_back(std::move(task));
+    }
+    queued_tasks_.fetch_add(1);
+
+    {
+        std::lock_guard<std::mutex> lock(idle_mtx_);
+    }
+    idle_cv_.notify_one();
+}
+
+bool DirectoryScanner::pop_task_(int index, ScanTask& task)
+{
+    // own deque is used as a stack, keeping the walk depth first and cache friendly
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard<std::mutex> lock(own.deque_mtx);
+        if(!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued_tasks_.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // steals the oldest (usually shallowest, thus biggest) directory from the others
+    int worker_count = workers_.size();
+    for(int i = 1; i < worker_count; i++)
+    {
+        Worker& victim = *workers_[(index + i) % worker_count];
+        std::lock_guard<std::mutex> lock(victim.deque_mtx);
+        if(!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued_tasks_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void DirectoryScanner::process_directory_(int index, ScanTask& task, std::vector<char>& dents_buffer)
+{
+    ScanJob* job = task.job;
+    const char* open_path = task.relative_path.empty() ? "." : task.relative_path.c_str();
+
+    int dir_fd = openat(job->root_fd, open_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd < 0)
+    {
+        job->failed_directories.fetch_add(1);
+        return;
+    }
+
+    std::string prefix = task.relative_path.empty() ? "" : task.relative_path + "/";
+
+    // entries are gathered first, so every statx of this directory
+    // is issued back to back relative to the same descriptor
+    std::vector<std::pair<std::string, unsigned char>> stat_batch;
+
+    while(true)
+    {
+        long bytes_read = syscall(SYS_getdents64, dir_fd, dents_buffer.data(), dents_buffer.size());
+        if(bytes_read < 0)
+        {
+            job->failed_directories.fetch_add(1);
+            break;
+        }
+        else if(bytes_read == 0)
+        {
+            break;
+        }
+
+        long offset = 0;
+        while(offset < bytes_read)
+        {
+            linux_dirent64* dent = reinterpret_cast<linux_dirent64*>(dents_buffer.data() + offset);
+            offset += dent->d_reclen;
+
+            if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            if(dent->d_type == DT_DIR)
+            {
+                ScanTask subtask;
+                subtask.job = job;
+                subtask.relative_path = prefix + dent->d_name;
+                job->pending_tasks.fetch_add(1);
+                push_task_(index, std::move(subtask));
+
+                if(job->include_directories)
+                {
+                    stat_batch.emplace_back(dent->d_name, dent->d_type);
+                }
+            }
+            else if(dent->d_type == DT_REG || dent->d_type == DT_UNKNOWN)
+            {
+                // symlinks, sockets and devices are never synchronized
+                stat_batch.emplace_back(dent->d_name, dent->d_type);
+            }
+        }
+    }
+
+    for(const auto& [name, type] : stat_batch)
+    {
+        struct statx file_info;
+        if(statx(dir_fd, name.c_str(), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_SCAN_MASK, &file_info) != 0)
+        {
+            continue;
+        }
+
+        bool is_directory = S_ISDIR(file_info.stx_mode);
+        if(!is_directory && !S_ISREG(file_info.stx_mode))
+        {
+            continue;
+        }
+
+        if(is_directory && type == DT_UNKNOWN)
+        {
+            // filesystem does not fill d_type, descends only now
+            ScanTask subtask;
+            subtask.job = job;
+            subtask.relative_path = prefix + name;
+            job->pending_tasks.fetch_add(1);
+            push_task_(index, std::move(subtask));
+        }
+
+        if(is_directory && !job->include_directories)
+        {
+            continue;
+        }
+
+        ScanEntry entry;
+        entry.path = prefix + name;
+        entry.name = name;
+        entry.is_directory = is_directory;
+        entry.size = file_info.stx_size;
+        entry.inode = file_info.stx_ino;
+        entry.modification_time = file_info.stx_mtime.tv_sec;
+        entry.access_time = file_info.stx_atime.tv_sec;
+        entry.change_time = file_info.stx_ctime.tv_sec;
+
+        try
+        {
+            job->on_entry(entry);
+            job->emitted_entries.fetch_add(1);
+        }
+        catch(const std::exception& e)
+        {
+            // a failing consumer must not take the worker down with it
+            job->failed_directories.fetch_add(1);
+        }
+    }
+
+    close(dir_fd);
+}
+
+void DirectoryScanner::finish_task_(ScanJob* job)
+{
+    // decremented under the lock, otherwise the scan caller could
+    // return and destroy the job between the decrement and the notify
+    std::lock_guard<std::mutex> lock(job->done_mtx);
+    if(job->pending_tasks.fetch_sub(1) == 1)
+    {
+        job->done_cv.notify_all();
+    }
+}
+
+DirectoryScanner& directory_scanner::default_scanner()
+{
+    static DirectoryScanner scanner;
+    return scanner;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+// multithread & synchronization
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace directory_scanner
+{
+    struct ScanEntry
+    {
+        std::string path;  // relative to the scanned root, without leading slash
+        std::string name;
+        bool is_directory = false;
+        uint64_t size = 0;
+        uint64_t inode = 0;
+        std::time_t modification_time = 0;
+        std::time_t access_time = 0;
+        std::time_t change_time = 0;
+    };
+
+    // a single scan request, shared by every task spawned from its root
+    struct ScanJob
+    {
+        int root_fd = -1;
+        bool include_directories = false;
+        std::function<void(const ScanEntry&)> on_entry;
+
+        std::atomic<int> pending_tasks{0};
+        std::atomic<int> failed_directories{0};
+        std::atomic<uint64_t> emitted_entries{0};
+        std::mutex done_mtx;
+        std::condition_variable done_cv;
+    };
+
+    struct ScanTask
+    {
+        ScanJob* job = nullptr;
+        std::string relative_path;
+    };
+
+    class DirectoryScanner
+    {
+        // parallel recursive directory walker
+        // every worker owns a deque of pending directories, popping from
+        // its back and stealing from the front of the others when idle
+        public:
+            DirectoryScanner(int worker_count = 0);
+            ~DirectoryScanner();
+
+            // walks the whole tree under root, calling on_entry for every
+            // regular file (and directory, if requested)
+            // returns the number of emitted entries, failed_directories is set
+            // to how many directories could not be read, leaving the walk partial
+            // NOTE: on_entry is called concurrently from the worker threads
+            uint64_t scan(
+                const std::string& root,
+                std::function<void(const ScanEntry&)> on_entry,
+                bool include_directories = false,
+                int* failed_directories = nullptr);
+
+            // convenience wrapper, entries are returned sorted by path
+            std::vector<ScanEntry> scan_to_vector(
+                const std::string& root,
+                bool include_directories = false,
+                int* failed_directories = nullptr);
+
+            int get_worker_count();
+
+        private:
+            struct Worker
+            {
+                std::mutex deque_mtx;
+                std::deque<ScanTask> tasks;
+                std::thread th;
+            };
+
+            std::vector<std::unique_ptr<Worker>> workers_;
+            std::atomic<bool> running_;
+            std::atomic<int> queued_tasks_;
+            std::atomic<unsigned int> next_worker_;
+
+            std::mutex idle_mtx_;
+            std::condition_variable idle_cv_;
+
+            void worker_loop_(int index);
+            void push_task_(int index, ScanTask task);
+            bool pop_task_(int index, ScanTask& task);
+            void process_directory_(int index, ScanTask& task, std::vector<char>& dents_buffer);
+            void finish_task_(ScanJob* job);
+    };
+
+    // process-wide scanner shared by every session
+    DirectoryScanner& default_scanner();
+}
@@ -0,0 +1,546 @@
+// c++
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "download_scheduler.hpp"
+
+using namespace download_scheduler;
+
+static void sync_directory(const std::string& directory)
+{
+    int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd < 0)
+    {
+        throw std::runtime_error("[DOWNLOAD SCHEDULER] Could not open directory \"" + directory + "\": " + std::strerror(errno));
+    }
+
+    int result = fsync(dir_fd);
+    int saved_errno = errno;
+    close(dir_fd);
+
+    if(result != 0)
+    {
+        throw std::runtime_error("[DOWNLOAD SCHEDULER] Could not sync directory \"" + directory + "\": " + std::strerror(saved_errno));
+    }
+}
+
+DownloadScheduler::DownloadScheduler(SchedulerConfig config)
+    :   config_(config),
+        next_transfer_(0),
+        running_(false)
+{
+    if(config_.max_transfers < 1 || config_.writers_per_transfer < 1 || config_.max_buffered_chunks == 0)
+    {
+        throw std::runtime_error("[DOWNLOAD SCHEDULER] Transfers, writers and buffered chunks must be positive!");
+    }
+}
+
+DownloadScheduler::~DownloadScheduler()
+{
+    stop();
+}
+
+void DownloadScheduler::start(SchedulerCallbacks callbacks)
+{
+    std::lock_guard<std::mutex> lock(scheduler_mtx_);
+    if(running_)
+    {
+        return;
+    }
+    callbacks_ = callbacks;
+    running_ = true;
+
+    // one writer per chunk that may be written at once
+    int worker_count = config_.max_transfers * config_.writers_per_transfer;
+    for(int i = 0; i < worker_count; i++)
+    {
+        workers_.emplace_back(&DownloadScheduler::worker_loop_, this);
+    }
+}
+
+void DownloadScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mtx_);
+        if(!running_)
+        {
+            return;
+        }
+        running_ = false;
+    }
+    work_cv_.notify_all();
+    space_cv_.notify_all();
+
+    for(std::thread& worker : workers_)
+    {
+        if(worker.joinable())
+        {
+            worker.join();
+        }
+    }
+    workers_.clear();
+
+    std::lock_guard<std::mutex> lock(scheduler_mtx_);
+    for(const std::shared_ptr<Transfer>& transfer : active_)
+    {
+        transfer->dropped = true;
+    }
+    stats_.abandoned += active_.size();
+    active_.clear();
+    idle_cv_.notify_all();
+}
+
+void DownloadScheduler::receive(
+    const std::string& root,
+    const std::string& path,
+    const std::string& checksum,
+    std::size_t expected_chunks,
+    int sequence_number,
+    const char* data,
+    std::size_t size)
+{
+    if(sequence_number < 0 || static_cast<std::size_t>(sequence_number) >= expected_chunks)
+    {
+        if(callbacks_.on_failed)
+        {
+            callbacks_.on_failed(path, "chunk " + std::to_string(sequence_number) + " does not fit the transfer");
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(scheduler_mtx_);
+    if(!running_)
+    {
+        return;
+    }
+
+    // a chunk seen before means the server started the file over
+    std::shared_ptr<Transfer> transfer = find_(path);
+    if(transfer != nullptr
+        && (transfer->expected_chunks != expected_chunks || transfer->accepted[sequence_number]))
+    {
+        remove_(transfer);
+        stats_.abandoned++;
+        transfer = nullptr;
+    }
+
+    if(transfer == nullptr)
+    {
+        if(active_.size() >= static_cast<std::size_t>(config_.max_transfers))
+        {
+            stats_.slot_waits++;
+        }
+        while(running_ && active_.size() >= static_cast<std::size_t>(config_.max_transfers))
+        {
+            space_cv_.wait_for(lock, std::chrono::seconds(1));
+            drop_stale_();
+        }
+        if(!running_)
+        {
+            return;
+        }
+
+        // the slot is taken before opening, chunks arriving meanwhile queue up
+        transfer = std::make_shared<Transfer>();
+        transfer->info.path = path;
+        transfer->info.final_path = root + path;
+        // a restarted file never opens the temporary file of the one it replaces
+        transfer->info.temp_path = chunk_writer::completed_path(transfer->info.final_path + TEMPORARY_SUFFIX);
+        transfer->info.checksum = checksum;
+        transfer->expected_chunks = expected_chunks;
+        transfer->accepted.assign(expected_chunks, false);
+        transfer->last_chunk = std::chrono::steady_clock::now();
+        active_.push_back(transfer);
+        stats_.transfers++;
+        stats_.max_concurrent = std::max<uint64_t>(stats_.max_concurrent, active_.size());
+
+        lock.unlock();
+        open_transfer_(transfer, root);
+        lock.lock();
+    }
+
+    if(transfer->failed || transfer->dropped)
+    {
+        // the rest of a failed file is swallowed, its slot freed once it all arrived
+        if(!transfer->dropped && !transfer->accepted[sequence_number])
+        {
+            transfer->accepted[sequence_number] = true;
+            transfer->accepted_chunks++;
+            if(transfer->accepted_chunks == transfer->expected_chunks && transfer->writers == 0)
+            {
+                remove_(transfer);
+            }
+        }
+        return;
+    }
+
+    space_cv_.wait(
+        lock,
+        [this, &transfer]()
+        {
+            return transfer->chunks.size() < config_.max_buffered_chunks
+                || !running_
+                || transfer->failed
+                || transfer->dropped;
+        });
+    if(!running_ || transfer->failed || transfer->dropped)
+    {
+        return;
+    }
+
+    transfer->chunks.push_back({sequence_number, std::string(data, size)});
+    transfer->accepted[sequence_number] = true;
+    transfer->accepted_chunks++;
+    transfer->last_chunk = std::chrono::steady_clock::now();
+    work_cv_.notify_one();
+}
+
+void DownloadScheduler::restart_stale_timers()
+{
+    std::lock_guard<std::mutex> lock(scheduler_mtx_);
+    auto now = std::chrono::steady_clock::now();
+    for(const std::shared_ptr<Transfer>& transfer : active_)
+    {
+        transfer->last_chunk = now;
+    }
+}
+
+std::size_t DownloadScheduler::cancel(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(scheduler_mtx_);
+    std::vector<std::shared_ptr<Transfer>> cancelled;
+    for(const std::shared_ptr<Transfer>& transfer : active_)
+    {
+        const std::string& transfer_path = transfer->info.path;
+        if(transfer_path == path 
+            || (transfer_path.size() > path.size() 
+                && transfer_path.compare(0, path.size(), path) == 0 
+                && transfer_path[path.size()] == '/'))
+        {
+            cancelled.push_back(transfer);
+        }
+    }
+
+    // a transfer being finished is already on its way to the commit, it
+    // is waited for instead
+    std::size_t dropped = 0;
+    for(const std::shared_ptr<Transfer>& transfer : cancelled)
+    {
+        if(!transfer->finishing)
+        {
+            remove_(transfer);
+            stats_.abandoned++;
+            dropped++;
+        }
+    }
+
+    idle_cv_.wait(
+        lock,
+        [this, &cancelled]()
+        {
+            if(!running_)
+            {
+                return true;
+            }
+            for(const std::shared_ptr<Transfer>& transfer : cancelled)
+            {
+                if(transfer->writers > 0 || !transfer->dropped)
+                {
+                    return false;
+                }
+            }
+            return true;
+        });
+    return dropped;
+}
+
+void DownloadScheduler::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(scheduler_mtx_);
+    idle_cv_.wait(lock, [this]() { return active_.empty() || !running_; });
+}
+
+SchedulerStats DownloadScheduler::get_stats()
+{
+    std::lock_guard<std::mutex> lock(scheduler_mtx_);
+    SchedulerStats stats = stats_;
+    stats.active = active_.size();
+    return stats;
+}
+
+std::string DownloadScheduler::format_stats()
+{
+    SchedulerStats stats = get_stats();
+    std::string output = "downloads (" + std::to_string(config_.max_transfers) + " transfers x ";
+    output += std::to_string(config_.writers_per_transfer) + " writers): ";
+    output += std::to_string(stats.completed) + " completed, ";
+    output += std::to_string(stats.failed) + " failed, ";
+    output += std::to_string(stats.abandoned) + " abandoned, ";
+    output += std::to_string(stats.active) + " active (max " + std::to_string(stats.max_concurrent) + "), ";
+    output += std::to_string(stats.slot_waits) + " waited for a slot, ";
+    output += std::to_string(stats.chunks) + " chunks (" + std::to_string(stats.bytes) + " bytes), ";
+    output += std::to_string(stats.created_directories) + " directories created";
+    return output;
+}
+
+void DownloadScheduler::worker_loop_()
+{
+    std::unique_lock<std::mutex> lock(scheduler_mtx_);
+    while(true)
+    {
+        std::shared_ptr<Transfer> transfer;
+        work_cv_.wait(lock, [this, &transfer]() { return !running_ || (transfer = pick_()) != nullptr; });
+        if(!running_)
+        {
+            return;
+        }
+
+        PendingChunk chunk = std::move(transfer->chunks.front());
+        transfer->chunks.pop_front();
+        transfer->writers++;
+        space_cv_.notify_all();
+        lock.unlock();
+
+        std::string error;
+        try
+        {
+            transfer->writer->write_chunk(chunk.sequence_number, chunk.data.data(), chunk.data.size());
+        }
+        catch(const std::exception& e)
+        {
+            error = e.what();
+        }
+
+        lock.lock();
+        transfer->writers--;
+        if(transfer->dropped)
+        {
+            // cancel() waits for the last writer to let go
+            if(transfer->writers == 0)
+            {
+                idle_cv_.notify_all();
+            }
+            continue;
+        }
+
+        if(!error.empty())
+        {
+            bool reported = transfer->failed;
+            transfer->failed = true;
+            transfer->chunks.clear();
+            space_cv_.notify_all();
+            if(transfer->accepted_chunks == transfer->expected_chunks && transfer->writers == 0)
+            {
+                remove_(transfer);
+            }
+            if(reported)
+            {
+                continue;
+            }
+
+            stats_.failed++;
+            lock.unlock();
+            if(callbacks_.on_failed)
+            {
+                callbacks_.on_failed(transfer->info.path, error);
+            }
+            lock.lock();
+            continue;
+        }
+
+        stats_.chunks++;
+        stats_.bytes += chunk.data.size();
+
+        // the last writer out of a complete file finishes it
+        if(!transfer->failed
+            && !transfer->finishing
+            && transfer->writers == 0
+            && transfer->chunks.empty()
+            && transfer->accepted_chunks == transfer->expected_chunks)
+        {
+            transfer->finishing = true;
+            lock.unlock();
+            finish_transfer_(transfer);
+            lock.lock();
+            if(!transfer->dropped)
+            {
+                remove_(transfer);
+            }
+        }
+    }
+}
+
+void DownloadScheduler::open_transfer_(std::shared_ptr<Transfer> transfer, const std::string& root)
+{
+    std::shared_ptr<chunk_writer::ChunkWriter> writer;
+    std::string error;
+    try
+    {
+        create_directories_(root, transfer->info.path);
+        writer = std::make_shared<chunk_writer::ChunkWriter>(transfer->info.temp_path, transfer->expected_chunks);
+    }
+    catch(const std::exception& e)
+    {
+        error = e.what();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mtx_);
+        if(error.empty())
+        {
+            transfer->writer = writer;
+            work_cv_.notify_all();
+            return;
+        }
+
+        transfer->failed = true;
+        transfer->chunks.clear();
+        stats_.failed++;
+        space_cv_.notify_all();
+    }
+
+    if(callbacks_.on_failed)
+    {
+        callbacks_.on_failed(transfer->info.path, error);
+    }
+}
+
+void DownloadScheduler::create_directories_(const std::string& root, const std::string& path)
+{
+    // parents first, each new one made durable in its own parent before
+    // anything goes inside it
+    std::size_t slash = path.find('/', 1);
+    while(slash != std::string::npos)
+    {
+        std::string directory = path.substr(0, slash);
+        std::string full_path = root + directory;
+        slash = path.find('/', slash + 1);
+
+        file_lock_manager::ExclusiveLock directory_lock;
+        if(callbacks_.lock_path)
+        {
+            directory_lock = callbacks_.lock_path(directory);
+        }
+
+        if(mkdir(full_path.c_str(), 0755) != 0)
+        {
+            if(errno == EEXIST)
+            {
+                continue;
+            }
+            throw std::runtime_error("[DOWNLOAD SCHEDULER] Could not create directory \"" + full_path + "\": " + std::strerror(errno));
+        }
+        sync_directory(full_path.substr(0, full_path.find_last_of('/')));
+
+        std::lock_guard<std::mutex> lock(scheduler_mtx_);
+        stats_.created_directories++;
+    }
+}
+
+void DownloadScheduler::finish_transfer_(std::shared_ptr<Transfer> transfer)
+{
+    std::string error;
+    try
+    {
+        transfer->writer->finish();
+        if(callbacks_.on_complete)
+        {
+            callbacks_.on_complete(transfer->info);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        error = e.what();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mtx_);
+        if(error.empty())
+        {
+            stats_.completed++;
+        }
+        else
+        {
+            stats_.failed++;
+        }
+    }
+    if(!error.empty() && callbacks_.on_failed)
+    {
+        callbacks_.on_failed(transfer->info.path, error);
+    }
+}
+
+std::shared_ptr<DownloadScheduler::Transfer> DownloadScheduler::find_(const std::string& path)
+{
+    for(const std::shared_ptr<Transfer>& transfer : active_)
+    {
+        if(transfer->info.path == path)
+        {
+            return transfer;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<DownloadScheduler::Transfer> DownloadScheduler::pick_()
+{
+    // round robin, no single large file takes every writer
+    for(std::size_t i = 0; i < active_.size(); i++)
+    {
+        std::shared_ptr<Transfer>& transfer = active_[(next_transfer_ + i) % active_.size()];
+        if(transfer->writer != nullptr
+            && !transfer->failed
+            && !transfer->finishing
+            && !transfer->chunks.empty()
+            && transfer->writers < config_.writers_per_transfer)
+        {
+            next_transfer_ = (next_transfer_ + i + 1) % active_.size();
+            return transfer;
+        }
+    }
+    return nullptr;
+}
+
+void DownloadScheduler::remove_(const std::shared_ptr<Transfer>& transfer)
+{
+    transfer->dropped = true;
+    active_.erase(std::remove(active_.begin(), active_.end(), transfer), active_.end());
+
+    // its name is never reused, a transfer that did not reach its commit
+    // would leave the temporary file behind until the next start
+    if(!transfer->finishing)
+    {
+        unlink(transfer->info.temp_path.c_str());
+    }
+    space_cv_.notify_all();
+    idle_cv_.notify_all();
+}
+
+void DownloadScheduler::drop_stale_()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<Transfer>> stale;
+    for(const std::shared_ptr<Transfer>& transfer : active_)
+    {
+        if(!transfer->finishing
+            && transfer->writers == 0
+            && (transfer->writer != nullptr || transfer->failed)
+            && now - transfer->last_chunk > std::chrono::seconds(STALE_TRANSFER_SECONDS))
+        {
+            stale.push_back(transfer);
+        }
+    }
+    for(const std::shared_ptr<Transfer>& transfer : stale)
+    {
+        remove_(transfer);
+        stats_.abandoned++;
+    }
+}
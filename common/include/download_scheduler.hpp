@@ -0,0 +1,170 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+
+// local
+#include "chunk_writer.hpp"
+#include "file_lock_manager.hpp"
+
+namespace download_scheduler
+{
+    const int DEFAULT_MAX_TRANSFERS = 4;
+    const int DEFAULT_WRITERS_PER_TRANSFER = 2;
+    const std::size_t DEFAULT_MAX_BUFFERED_CHUNKS = 256;  // received but not yet written, per transfer
+    const int STALE_TRANSFER_SECONDS = 60;                // a transfer without chunks for this long gives up its slot
+    const char* const TEMPORARY_SUFFIX = ".swizdownload";
+
+    struct SchedulerConfig
+    {
+        int max_transfers = DEFAULT_MAX_TRANSFERS;
+        int writers_per_transfer = DEFAULT_WRITERS_PER_TRANSFER;
+        std::size_t max_buffered_chunks = DEFAULT_MAX_BUFFERED_CHUNKS;
+    };
+
+    struct CompletedTransfer
+    {
+        std::string path;  // relative to the root, as the server named it
+        std::string temp_path;  // unique to the transfer, see chunk_writer::completed_path
+        std::string final_path;
+        std::string checksum;  // announced by the server, not verified here
+    };
+
+    // exclusive lock on a path of the root, held while a directory is created
+    typedef std::function<file_lock_manager::ExclusiveLock(const std::string& path)> LockCallback;
+
+    // every chunk is on disk, the temporary file still has to be committed
+    // NOTE: called from a writer thread
+    typedef std::function<void(const CompletedTransfer& transfer)> CompleteCallback;
+    typedef std::function<void(const std::string& path, const std::string& error)> FailureCallback;
+
+    struct SchedulerCallbacks
+    {
+        LockCallback lock_path;  // may be empty when paths need no locking
+        CompleteCallback on_complete;
+        FailureCallback on_failed;
+    };
+
+    struct SchedulerStats
+    {
+        uint64_t transfers = 0;
+        uint64_t completed = 0;
+        uint64_t failed = 0;
+        uint64_t abandoned = 0;      // restarted by the server or gone stale
+        uint64_t chunks = 0;
+        uint64_t bytes = 0;
+        uint64_t created_directories = 0;
+        uint64_t slot_waits = 0;     // new transfers that found every slot taken
+        uint64_t max_concurrent = 0;
+        uint64_t active = 0;
+    };
+
+    class DownloadScheduler
+    {
+        // writes files pushed by the server off the receiver thread
+        // up to max_transfers files are open at once, each written by up to
+        // writers_per_transfer threads at their own chunk offsets, so the
+        // stream keeps flowing while earlier files are written and committed
+        // the receiver is held back when every slot is taken or a transfer has
+        // too many chunks waiting, which bounds the memory used
+        // the directories above a file are created, and made durable, before
+        // its temporary file is opened, so no file is ever committed into a
+        // directory a crash could still lose
+        public:
+            DownloadScheduler(SchedulerConfig config = SchedulerConfig());
+            ~DownloadScheduler();
+
+            void start(SchedulerCallbacks callbacks);
+
+            // transfers still open are dropped, their temporary files are
+            // cleaned on the next start
+            void stop();
+
+            // hands over one received chunk of path, which is relative to root
+            // and starts with a slash
+            void receive(
+                const std::string& root,
+                const std::string& path,
+                const std::string& checksum,
+                std::size_t expected_chunks,
+                int sequence_number,
+                const char* data,
+                std::size_t size);
+
+            // the connection is back after an outage - the time it was away
+            // does not count towards a transfer going stale
+            void restart_stale_timers();
+
+            // drops the transfers of path, or of anything under it, and waits
+            // for whatever is still writing or committing them - the receiver
+            // calls this before deleting path, an empty one drops them all
+            // returns how many transfers were dropped
+            std::size_t cancel(const std::string& path);
+
+            // blocks until every transfer started so far was completed or dropped
+            void wait_idle();
+
+            SchedulerStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct PendingChunk
+            {
+                int sequence_number;
+                std::string data;
+            };
+
+            struct Transfer
+            {
+                CompletedTransfer info;
+                std::shared_ptr<chunk_writer::ChunkWriter> writer;  // empty while opening
+                std::size_t expected_chunks = 0;
+                std::vector<bool> accepted;
+                std::size_t accepted_chunks = 0;
+                std::deque<PendingChunk> chunks;
+                int writers = 0;
+                bool finishing = false;
+                bool failed = false;
+                bool dropped = false;
+                std::chrono::steady_clock::time_point last_chunk;
+            };
+
+            SchedulerConfig config_;
+            SchedulerCallbacks callbacks_;
+
+            std::vector<std::shared_ptr<Transfer>> active_;  // never more than max_transfers
+            std::size_t next_transfer_;
+            bool running_;
+            SchedulerStats stats_;
+            std::mutex scheduler_mtx_;
+            std::condition_variable work_cv_;   // chunks to write
+            std::condition_variable space_cv_;  // a slot or buffer space freed
+            std::condition_variable idle_cv_;
+
+            std::vector<std::thread> workers_;
+
+            void worker_loop_();
+            void open_transfer_(std::shared_ptr<Transfer> transfer, const std::string& root);
+            void create_directories_(const std::string& root, const std::string& path);
+            void finish_transfer_(std::shared_ptr<Transfer> transfer);
+
+            // NOTE: caller must hold scheduler_mtx_
+            std::shared_ptr<Transfer> find_(const std::string& path);
+            std::shared_ptr<Transfer> pick_();
+            void remove_(const std::shared_ptr<Transfer>& transfer);
+            void drop_stale_();
+    };
+}
@@ -0,0 +1,149 @@
+// c++
+#include <filesystem>
+
+// local
+#include "echo_filter.hpp"
+#include "utils.hpp"
+
+using namespace echo_filter;
+namespace fs = std::filesystem;
+
+static std::string normalize_path(const std::string& path)
+{
+    std::size_t start = path.find_first_not_of('/');
+    return start == std::string::npos ? "" : path.substr(start);
+}
+
+EchoFilter::EchoFilter(std::vector<std::string> temporary_suffixes, int expiry_seconds)
+    :   temporary_suffixes_(temporary_suffixes),
+        expiry_(std::chrono::seconds(expiry_seconds))
+{
+    //
+}
+
+void EchoFilter::expect_write(const std::string& path, const std::string& checksum)
+{
+    std::lock_guard<std::mutex> lock(filter_mtx_);
+    Expectation& expectation = expected_[normalize_path(path)];
+    expectation.deleted = false;
+    expectation.checksum = checksum;
+    expectation.expires = std::chrono::steady_clock::now() + expiry_;
+    stats_.expected++;
+}
+
+void EchoFilter::expect_delete(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(filter_mtx_);
+    Expectation& expectation = expected_[normalize_path(path)];
+    expectation.deleted = true;
+    expectation.checksum.clear();
+    expectation.expires = std::chrono::steady_clock::now() + expiry_;
+    stats_.expected++;
+}
+
+std::vector<event_coalescer::Change> EchoFilter::filter(
+    const std::string& root,
+    const std::vector<event_coalescer::Change>& changes)
+{
+    std::lock_guard<std::mutex> lock(filter_mtx_);
+
+    auto now = std::chrono::steady_clock::now();
+    for(auto it = expected_.begin(); it != expected_.end();)
+    {
+        it = it->second.expires <= now ? expected_.erase(it) : std::next(it);
+    }
+
+    std::vector<event_coalescer::Change> remaining;
+    for(event_coalescer::Change change : changes)
+    {
+        if(change.type == event_coalescer::ChangeType::RENAME && is_temporary_(change.old_path))
+        {
+            // a download put in place
+            change.type = event_coalescer::ChangeType::UPLOAD;
+            change.old_path.clear();
+            change.upload = true;
+        }
+        else if(change.type == event_coalescer::ChangeType::RENAME && is_temporary_(change.path))
+        {
+            change.type = event_coalescer::ChangeType::DELETE;
+            change.path = change.old_path;
+            change.old_path.clear();
+        }
+
+        if(is_temporary_(change.path) || is_echo_(root, change))
+        {
+            stats_.suppressed++;
+            continue;
+        }
+        stats_.passed++;
+        remaining.push_back(change);
+    }
+    return remaining;
+}
+
+EchoStats EchoFilter::get_stats()
+{
+    std::lock_guard<std::mutex> lock(filter_mtx_);
+    return stats_;
+}
+
+std::string EchoFilter::format_stats()
+{
+    EchoStats stats = get_stats();
+    std::string output = "echoes: " + std::to_string(stats.suppressed) + " suppressed (";
+    output += std::to_string(stats.suppressed_bytes) + " bytes), ";
+    output += std::to_string(stats.mismatched) + " changed meanwhile, ";
+    output += std::to_string(stats.passed) + " passed";
+    return output;
+}
+
+bool EchoFilter::is_temporary_(const std::string& path)
+{
+    for(const std::string& suffix : temporary_suffixes_)
+    {
+        if(path.size() > suffix.size()
+            && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EchoFilter::is_echo_(const std::string& root, const event_coalescer::Change& change)
+{
+    if(change.is_directory || change.type == event_coalescer::ChangeType::RENAME)
+    {
+        return false;
+    }
+
+    auto expectation = expected_.find(change.path);
+    if(expectation == expected_.end())
+    {
+        return false;
+    }
+    Expectation expected = expectation->second;
+    expected_.erase(expectation);
+
+    if(change.type == event_coalescer::ChangeType::DELETE)
+    {
+        return expected.deleted;
+    }
+    if(expected.deleted)
+    {
+        return false;
+    }
+
+    // hashed only for paths the client wrote, user edits never pay for it
+    std::string file_path = root + "/" + change.path;
+    std::error_code error;
+    uint64_t size = fs::file_size(file_path, error);
+    if(error || calculate_md5_checksum(file_path) != expected.checksum)
+    {
+        stats_.mismatched++;
+        return false;
+    }
+
+    stats_.suppressed_bytes += size;
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+// synchronization
+#include <mutex>
+
+// local
+#include "event_coalescer.hpp"
+
+namespace echo_filter
+{
+    const int DEFAULT_EXPIRY_SECONDS = 60;  // an expected change never seen is forgotten after this
+    const char* const DEFAULT_TEMPORARY_SUFFIX = ".swizdownload";
+
+    struct EchoStats
+    {
+        uint64_t expected = 0;
+        uint64_t suppressed = 0;
+        uint64_t suppressed_bytes = 0;  // uploads the server would have received back
+        uint64_t mismatched = 0;        // expected writes changed again before they settled
+        uint64_t passed = 0;
+    };
+
+    class EchoFilter
+    {
+        // remembers what the client itself is about to write into or delete
+        // from the sync dir, so the watcher reporting it is not taken for a
+        // local change and sent back to the server
+        // a write only counts as an echo while the file still holds the content
+        // hash it was written with, an edit made in between is always sent
+        // temporary files of the client are never reported, and a temporary file
+        // renamed into place is judged as a write to its final name
+        public:
+            EchoFilter(
+                std::vector<std::string> temporary_suffixes = {DEFAULT_TEMPORARY_SUFFIX},
+                int expiry_seconds = DEFAULT_EXPIRY_SECONDS);
+
+            // paths are relative to the sync dir, a leading slash is ignored
+            void expect_write(const std::string& path, const std::string& checksum);
+            void expect_delete(const std::string& path);
+
+            // the changes left are the ones this machine's user made
+            std::vector<event_coalescer::Change> filter(
+                const std::string& root,
+                const std::vector<event_coalescer::Change>& changes);
+
+            EchoStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct Expectation
+            {
+                bool deleted;
+                std::string checksum;
+                std::chrono::steady_clock::time_point expires;
+            };
+
+            std::vector<std::string> temporary_suffixes_;
+            std::chrono::seconds expiry_;
+
+            std::unordered_map<std::string, Expectation> expected_;
+            EchoStats stats_;
+            std::mutex filter_mtx_;
+
+            bool is_temporary_(const std::string& path);
+
+            // NOTE: caller must hold filter_mtx_
+            bool is_echo_(const std::string& root, const event_coalescer::Change& change);
+    };
+}
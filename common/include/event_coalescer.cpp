@@ -0,0 +1,315 @@
+// c++
+#include <algorithm>
+
+// local
+#include "event_coalescer.hpp"
+
+using namespace event_coalescer;
+
+std::string event_coalescer::change_name(ChangeType type)
+{
+    switch(type)
+    {
+        case ChangeType::UPLOAD:
+            return "upload";
+        case ChangeType::DELETE:
+            return "delete";
+        case ChangeType::RENAME:
+            return "rename";
+    }
+    return "unknown";
+}
+
+EventCoalescer::EventCoalescer(int quiet_ms, int max_write_delay_ms)
+    :   quiet_window_(std::chrono::milliseconds(quiet_ms)),
+        max_write_delay_(std::chrono::milliseconds(max_write_delay_ms)),
+        next_sequence_(0)
+{
+    //
+}
+
+void EventCoalescer::push(const Event& event)
+{
+    std::lock_guard<std::mutex> lock(coalescer_mtx_);
+    stats_.events++;
+
+    if(event.is_directory)
+    {
+        // directories are created through the files in them
+        if(event.type == EventType::RENAME || event.type == EventType::DELETE)
+        {
+            settle_all_();
+
+            Change change;
+            change.type = event.type == EventType::RENAME ? ChangeType::RENAME : ChangeType::DELETE;
+            change.path = event.path;
+            change.old_path = event.old_path;
+            change.is_directory = true;
+            ordered_.push_back(change);
+        }
+        return;
+    }
+
+    switch(event.type)
+    {
+        case EventType::CREATE:
+        {
+            bool known = pending_.count(event.path) != 0;
+            PathState& state = touch_(event.path);
+            state.created = !known || state.created;
+            state.exists = true;
+            state.dirty = true;
+            break;
+        }
+        case EventType::MODIFY:
+        {
+            PathState& state = touch_(event.path);
+            state.exists = true;
+            state.dirty = true;
+            state.writing = true;
+            break;
+        }
+        case EventType::CLOSE_WRITE:
+        {
+            PathState& state = touch_(event.path);
+            state.exists = true;
+            state.dirty = true;
+            state.writing = false;
+            break;
+        }
+        case EventType::DELETE:
+        {
+            auto it = pending_.find(event.path);
+            if(it != pending_.end() && it->second.created)
+            {
+                // never left this machine, nothing to tell the server
+                pending_.erase(it);
+                stats_.collapsed++;
+                break;
+            }
+
+            std::string known_path = event.path;
+            if(it != pending_.end() && !it->second.renamed_from.empty())
+            {
+                // the server still has it under the name it was renamed from
+                known_path = it->second.renamed_from;
+                pending_.erase(it);
+            }
+
+            bool replaced = pending_.count(known_path) != 0;
+            PathState& state = touch_(known_path);
+            if(replaced)
+            {
+                // recreated after the rename, now overwrites the server copy
+                state.created = false;
+                break;
+            }
+            state.exists = false;
+            state.dirty = false;
+            state.writing = false;
+            break;
+        }
+        case EventType::RENAME:
+        {
+            // whatever was pending for the target is overwritten
+            pending_.erase(event.path);
+            PathState& state = touch_(event.path);
+
+            auto it = pending_.find(event.old_path);
+            if(it != pending_.end())
+            {
+                state = it->second;
+                state.last_event = std::chrono::steady_clock::now();
+                pending_.erase(it);
+            }
+
+            if(!state.created && state.renamed_from.empty())
+            {
+                state.renamed_from = event.old_path;
+            }
+            if(state.renamed_from == event.path)
+            {
+                // renamed back to where the server has it
+                state.renamed_from.clear();
+            }
+            state.exists = true;
+            break;
+        }
+    }
+}
+
+std::vector<Change> EventCoalescer::take_ready()
+{
+    std::lock_guard<std::mutex> lock(coalescer_mtx_);
+    std::vector<Change> changes;
+    changes.swap(ordered_);
+
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<uint64_t, std::string>> ready;
+    for(const auto& entry : pending_)
+    {
+        if(is_ready_(entry.second, now))
+        {
+            ready.push_back(std::make_pair(entry.second.sequence, entry.first));
+        }
+    }
+    std::sort(ready.begin(), ready.end());
+
+    for(const auto& entry : ready)
+    {
+        Change change;
+        if(to_change_(entry.second, pending_[entry.second], change))
+        {
+            changes.push_back(change);
+        }
+        pending_.erase(entry.second);
+    }
+
+    stats_.changes += changes.size();
+    return changes;
+}
+
+std::chrono::milliseconds EventCoalescer::time_until_ready()
+{
+    std::lock_guard<std::mutex> lock(coalescer_mtx_);
+    if(!ordered_.empty())
+    {
+        return std::chrono::milliseconds(0);
+    }
+    if(pending_.empty())
+    {
+        return quiet_window_;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto next_ready = now + max_write_delay_;
+    for(const auto& entry : pending_)
+    {
+        auto ready_at = entry.second.first_event + max_write_delay_;
+        if(!entry.second.writing)
+        {
+            ready_at = std::min(ready_at, entry.second.last_event + quiet_window_);
+        }
+        next_ready = std::min(next_ready, ready_at);
+    }
+
+    if(next_ready <= now)
+    {
+        return std::chrono::milliseconds(0);
+    }
+    // rounded up, waking early would only find nothing settled
+    return std::chrono::duration_cast<std::chrono::milliseconds>(next_ready - now) + std::chrono::milliseconds(1);
+}
+
+void EventCoalescer::set_quiet_window(int quiet_ms, int max_write_delay_ms)
+{
+    std::lock_guard<std::mutex> lock(coalescer_mtx_);
+    quiet_window_ = std::chrono::milliseconds(quiet_ms);
+    max_write_delay_ = std::chrono::milliseconds(max_write_delay_ms);
+}
+
+void EventCoalescer::clear()
+{
+    std::lock_guard<std::mutex> lock(coalescer_mtx_);
+    pending_.clear();
+    ordered_.clear();
+}
+
+CoalescerStats EventCoalescer::get_stats()
+{
+    std::lock_guard<std::mutex> lock(coalescer_mtx_);
+    CoalescerStats stats = stats_;
+    stats.pending = pending_.size() + ordered_.size();
+    return stats;
+}
+
+std::string EventCoalescer::format_stats()
+{
+    CoalescerStats stats = get_stats();
+    std::string output = "events: " + std::to_string(stats.events) + " in, ";
+    output += std::to_string(stats.changes) + " changes out, ";
+    output += std::to_string(stats.collapsed) + " collapsed, ";
+    output += std::to_string(stats.pending) + " pending";
+    return output;
+}
+
+EventCoalescer::PathState& EventCoalescer::touch_(const std::string& path)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto it = pending_.find(path);
+    if(it == pending_.end())
+    {
+        // a path first seen here existed before, unless it is being created
+        PathState state;
+        state.sequence = next_sequence_++;
+        state.created = false;
+        state.exists = true;
+        state.dirty = false;
+        state.writing = false;
+        state.first_event = now;
+        it = pending_.emplace(path, state).first;
+    }
+    it->second.last_event = now;
+    return it->second;
+}
+
+void EventCoalescer::settle_all_()
+{
+    std::vector<std::pair<uint64_t, std::string>> settled;
+    for(const auto& entry : pending_)
+    {
+        settled.push_back(std::make_pair(entry.second.sequence, entry.first));
+    }
+    std::sort(settled.begin(), settled.end());
+
+    for(const auto& entry : settled)
+    {
+        Change change;
+        if(to_change_(entry.second, pending_[entry.second], change))
+        {
+            ordered_.push_back(change);
+        }
+    }
+    pending_.clear();
+}
+
+bool EventCoalescer::is_ready_(const PathState& state, std::chrono::steady_clock::time_point now)
+{
+    if(now - state.first_event >= max_write_delay_)
+    {
+        return true;
+    }
+    // a write still open is worth waiting for, its close comes with the final content
+    return !state.writing && now - state.last_event >= quiet_window_;
+}
+
+bool EventCoalescer::to_change_(const std::string& path, const PathState& state, Change& change)
+{
+    change.path = path;
+
+    if(!state.exists)
+    {
+        if(state.created)
+        {
+            return false;
+        }
+        change.type = ChangeType::DELETE;
+        return true;
+    }
+
+    if(!state.renamed_from.empty())
+    {
+        change.type = ChangeType::RENAME;
+        change.old_path = state.renamed_from;
+        change.upload = state.dirty;
+        return true;
+    }
+
+    if(state.dirty)
+    {
+        change.type = ChangeType::UPLOAD;
+        change.upload = true;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+// synchronization
+#include <mutex>
+
+namespace event_coalescer
+{
+    const int DEFAULT_QUIET_MS = 500;           // a path must see no events for this long
+    const int DEFAULT_MAX_WRITE_DELAY_MS = 10000;  // longest wait for a write to be closed
+
+    enum class EventType
+    {
+        CREATE,
+        MODIFY,       // data written, the writer may still be at it
+        CLOSE_WRITE,  // a writer closed the file, its content is complete
+        DELETE,
+        RENAME        // old_path was renamed to path
+    };
+
+    struct Event
+    {
+        EventType type;
+        std::string path;  // relative to the sync dir
+        std::string old_path;
+        bool is_directory = false;
+    };
+
+    enum class ChangeType
+    {
+        UPLOAD,  // content at path has to be sent
+        DELETE,
+        RENAME   // old_path now lives at path, with upload set when its content changed too
+    };
+
+    struct Change
+    {
+        ChangeType type;
+        std::string path;
+        std::string old_path;
+        bool is_directory = false;
+        bool upload = false;
+    };
+
+    std::string change_name(ChangeType type);
+
+    struct CoalescerStats
+    {
+        uint64_t events = 0;
+        uint64_t changes = 0;
+        uint64_t collapsed = 0;  // paths created and deleted again before settling
+        uint64_t pending = 0;
+    };
+
+    class EventCoalescer
+    {
+        // merges raw watcher events into one change per path, handed out only
+        // once the path was quiet for a while
+        // a file being written is held back until its writer closes it, so a
+        // large save is sent once instead of once per write
+        // directory renames and deletes change the meaning of every path under
+        // them, so they settle whatever is pending and are handed out in order
+        public:
+            EventCoalescer(
+                int quiet_ms = DEFAULT_QUIET_MS,
+                int max_write_delay_ms = DEFAULT_MAX_WRITE_DELAY_MS);
+
+            void push(const Event& event);
+
+            // changes that settled, in the order their paths first changed
+            std::vector<Change> take_ready();
+
+            // time until the next pending path may settle, the quiet window
+            // while nothing is pending
+            std::chrono::milliseconds time_until_ready();
+
+            void set_quiet_window(int quiet_ms, int max_write_delay_ms = DEFAULT_MAX_WRITE_DELAY_MS);
+            void clear();
+
+            CoalescerStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct PathState
+            {
+                uint64_t sequence;   // order the path first changed in
+                bool created;        // did not exist before, unknown to the server
+                bool exists;
+                bool dirty;          // content has to be sent
+                bool writing;        // modified but not closed yet
+                std::string renamed_from;
+                std::chrono::steady_clock::time_point first_event;
+                std::chrono::steady_clock::time_point last_event;
+            };
+
+            std::chrono::milliseconds quiet_window_;
+            std::chrono::milliseconds max_write_delay_;
+
+            std::unordered_map<std::string, PathState> pending_;
+            std::vector<Change> ordered_;  // settled ahead of their quiet window
+            uint64_t next_sequence_;
+            CoalescerStats stats_;
+            std::mutex coalescer_mtx_;
+
+            // NOTE: caller must hold coalescer_mtx_
+            PathState& touch_(const std::string& path);
+            void settle_all_();
+            bool is_ready_(const PathState& state, std::chrono::steady_clock::time_point now);
+            bool to_change_(const std::string& path, const PathState& state, Change& change);
+    };
+}
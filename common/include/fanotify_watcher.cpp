@@ -0,0 +1,426 @@
+// c++
+#include <filesystem>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+// c
+#include <sys/fanotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+// local
+#include "fanotify_watcher.hpp"
+
+const uint64_t FANOTIFY_MASK = FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ONDIR;
+const std::size_t MAX_CACHED_DIRECTORIES = 65536;
+const int POLL_TIMEOUT_MS = 200;  // how long stop waits at most
+
+using namespace fanotify_watcher;
+namespace fs = std::filesystem;
+
+FanotifyWatcher::FanotifyWatcher()
+    :   fanotify_fd_(-1),
+        mount_fd_(-1),
+        events_(nullptr),
+        is_running_(false),
+        filtered_(0),
+        overflows_(0),
+        lost_events_(false)
+{
+    //
+}
+
+FanotifyWatcher::~FanotifyWatcher()
+{
+    stop();
+}
+
+bool FanotifyWatcher::start(const std::string& path, event_coalescer::EventCoalescer& events)
+{
+    stop();
+    events_ = &events;
+
+    std::error_code error;
+    root_ = fs::canonical(path, error).string();
+    if(error)
+    {
+        fail_("[FANOTIFY WATCHER] Could not resolve \"" + path + "\": " + error.message());
+        return false;
+    }
+
+    // the queue keeps the kernel default limit, a whole filesystem can fill
+    // any amount of memory - what overflows it is recovered by the caller
+    fanotify_fd_ = fanotify_init(
+        FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+        O_RDONLY | O_LARGEFILE);
+    if(fanotify_fd_ < 0)
+    {
+        // EPERM without CAP_SYS_ADMIN, EINVAL on kernels before 5.9
+        fail_("[FANOTIFY WATCHER] Error initializing: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    mount_fd_ = open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(mount_fd_ < 0)
+    {
+        fail_("[FANOTIFY WATCHER] Could not open \"" + root_ + "\": " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    // a single rename event carries both names, older kernels only report halves
+    int marked = -1;
+#ifdef FAN_RENAME
+    marked = fanotify_mark(
+        fanotify_fd_,
+        FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+        FANOTIFY_MASK | FAN_RENAME,
+        AT_FDCWD,
+        root_.c_str());
+#endif
+    if(marked != 0)
+    {
+        marked = fanotify_mark(
+            fanotify_fd_,
+            FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+            FANOTIFY_MASK | FAN_MOVED_FROM | FAN_MOVED_TO,
+            AT_FDCWD,
+            root_.c_str());
+    }
+    if(marked != 0)
+    {
+        fail_("[FANOTIFY WATCHER] Error marking filesystem: " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(error_mtx_);
+        error_.clear();
+    }
+    directory_paths_.clear();
+
+    is_running_.store(true);
+    monitor_thread_ = std::thread(&FanotifyWatcher::monitor_loop_, this);
+    return true;
+}
+
+void FanotifyWatcher::stop()
+{
+    is_running_.store(false);
+    if(monitor_thread_.joinable())
+    {
+        monitor_thread_.join();
+    }
+
+    if(fanotify_fd_ >= 0)
+    {
+        close(fanotify_fd_);
+        fanotify_fd_ = -1;
+    }
+    if(mount_fd_ >= 0)
+    {
+        close(mount_fd_);
+        mount_fd_ = -1;
+    }
+}
+
+bool FanotifyWatcher::is_running()
+{
+    return is_running_.load();
+}
+
+std::string FanotifyWatcher::get_error()
+{
+    std::lock_guard<std::mutex> lock(error_mtx_);
+    return error_;
+}
+
+uint64_t FanotifyWatcher::get_filtered_count()
+{
+    return filtered_.load();
+}
+
+uint64_t FanotifyWatcher::get_overflow_count()
+{
+    return overflows_.load();
+}
+
+bool FanotifyWatcher::take_lost_events()
+{
+    return lost_events_.exchange(false);
+}
+
+void FanotifyWatcher::monitor_loop_()
+{
+    while(is_running_.load())
+    {
+        struct pollfd poll_fd;
+        poll_fd.fd = fanotify_fd_;
+        poll_fd.events = POLLIN;
+
+        int ready = poll(&poll_fd, 1, POLL_TIMEOUT_MS);
+        if(ready < 0 && errno != EINTR)
+        {
+            fail_("[FANOTIFY WATCHER] Error polling fanotify: " + std::string(strerror(errno)));
+            return;
+        }
+        if(ready <= 0)
+        {
+            continue;
+        }
+
+        ssize_t length = read(fanotify_fd_, notify_buffer_, sizeof(notify_buffer_));
+        if(length < 0)
+        {
+            if(errno == EAGAIN || errno == EINTR)
+            {
+                continue;
+            }
+            fail_("[FANOTIFY WATCHER] Error reading from fanotify: " + std::string(strerror(errno)));
+            return;
+        }
+
+        const struct fanotify_event_metadata* metadata = reinterpret_cast<const struct fanotify_event_metadata*>(notify_buffer_);
+        while(FAN_EVENT_OK(metadata, length))
+        {
+            if(metadata->vers != FANOTIFY_METADATA_VERSION)
+            {
+                fail_("[FANOTIFY WATCHER] Unexpected fanotify metadata version.");
+                return;
+            }
+            handle_event_(metadata);
+            metadata = FAN_EVENT_NEXT(metadata, length);
+        }
+    }
+}
+
+void FanotifyWatcher::handle_event_(const struct fanotify_event_metadata* metadata)
+{
+    uint64_t mask = metadata->mask;
+    bool is_directory = mask & FAN_ONDIR;
+    if(mask & FAN_Q_OVERFLOW)
+    {
+        // nothing tells which paths were lost, see take_lost_events
+        overflows_.fetch_add(1);
+        lost_events_.store(true);
+        return;
+    }
+
+    // one record for most events, the old and the new name for renames
+    std::string path;
+    std::string old_path;
+    bool has_path = false;
+    bool has_old_path = false;
+
+    const char* info = reinterpret_cast<const char*>(metadata) + metadata->metadata_len;
+    const char* end = reinterpret_cast<const char*>(metadata) + metadata->event_len;
+    while(info + sizeof(struct fanotify_event_info_header) <= end)
+    {
+        const struct fanotify_event_info_header* header = reinterpret_cast<const struct fanotify_event_info_header*>(info);
+        if(header->len == 0 || info + header->len > end)
+        {
+            break;
+        }
+
+        const struct fanotify_event_info_fid* fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+        if(header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+        {
+            has_path = resolve_(fid, path);
+        }
+#ifdef FAN_RENAME
+        else if(header->info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+        {
+            has_path = resolve_(fid, path);
+        }
+        else if(header->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME)
+        {
+            has_old_path = resolve_(fid, old_path);
+        }
+#endif
+        info += header->len;
+    }
+
+    // paths below a renamed or deleted directory are not what they were
+    if(is_directory && (mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO
+#ifdef FAN_RENAME
+        | FAN_RENAME
+#endif
+        )))
+    {
+        directory_paths_.clear();
+    }
+
+    if(!has_path && !has_old_path)
+    {
+        filtered_.fetch_add(1);
+        return;
+    }
+
+    if((has_path && path.empty()) || (has_old_path && old_path.empty()))
+    {
+        // the sync dir itself went away
+        if(mask & (FAN_DELETE | FAN_MOVED_FROM
+#ifdef FAN_RENAME
+            | FAN_RENAME
+#endif
+            ))
+        {
+            fail_("[FANOTIFY WATCHER] Watched directory was removed.");
+        }
+        return;
+    }
+
+    event_coalescer::Event event;
+    event.is_directory = is_directory;
+
+#ifdef FAN_RENAME
+    if(mask & FAN_RENAME)
+    {
+        if(has_path && has_old_path)
+        {
+            event.type = event_coalescer::EventType::RENAME;
+            event.path = path;
+            event.old_path = old_path;
+            events_->push(event);
+        }
+        else if(has_old_path)
+        {
+            // moved out of the sync dir
+            event.type = event_coalescer::EventType::DELETE;
+            event.path = old_path;
+            events_->push(event);
+        }
+        else
+        {
+            // moved in, its content was never reported
+            event.type = event_coalescer::EventType::CREATE;
+            event.path = path;
+            events_->push(event);
+            if(is_directory)
+            {
+                report_tree_(path);
+            }
+        }
+        return;
+    }
+#endif
+
+    if(!has_path)
+    {
+        return;
+    }
+    event.path = path;
+
+    // fanotify merges queued events on the same name, so they are replayed in
+    // the order they can happen in
+    if(mask & (FAN_CREATE | FAN_MOVED_TO))
+    {
+        event.type = event_coalescer::EventType::CREATE;
+        events_->push(event);
+        if(is_directory && (mask & FAN_MOVED_TO))
+        {
+            report_tree_(path);
+        }
+    }
+    if(mask & FAN_MODIFY)
+    {
+        event.type = event_coalescer::EventType::MODIFY;
+        events_->push(event);
+    }
+    if(mask & FAN_CLOSE_WRITE)
+    {
+        event.type = event_coalescer::EventType::CLOSE_WRITE;
+        events_->push(event);
+    }
+    if(mask & (FAN_DELETE | FAN_MOVED_FROM))
+    {
+        event.type = event_coalescer::EventType::DELETE;
+        events_->push(event);
+    }
+}
+
+bool FanotifyWatcher::resolve_(const struct fanotify_event_info_fid* info, std::string& relative_path)
+{
+    struct file_handle* handle = reinterpret_cast<struct file_handle*>(const_cast<unsigned char*>(info->handle));
+    const char* name = reinterpret_cast<const char*>(handle->f_handle + handle->handle_bytes);
+    std::string key(reinterpret_cast<const char*>(handle), sizeof(struct file_handle) + handle->handle_bytes);
+
+    std::string directory;
+    auto cached = directory_paths_.find(key);
+    if(cached != directory_paths_.end())
+    {
+        directory = cached->second;
+    }
+    else
+    {
+        int directory_fd = open_by_handle_at(mount_fd_, handle, O_PATH | O_CLOEXEC);
+        if(directory_fd < 0)
+        {
+            // gone by now, its deletion is reported on its own
+            return false;
+        }
+
+        char link[PATH_MAX];
+        std::string fd_path = "/proc/self/fd/" + std::to_string(directory_fd);
+        ssize_t length = readlink(fd_path.c_str(), link, sizeof(link) - 1);
+        close(directory_fd);
+        if(length < 0)
+        {
+            return false;
+        }
+        directory.assign(link, length);
+
+        if(directory_paths_.size() >= MAX_CACHED_DIRECTORIES)
+        {
+            directory_paths_.clear();
+        }
+        directory_paths_[key] = directory;
+    }
+
+    std::string full_path = std::strcmp(name, ".") == 0 ? directory : directory + "/" + name;
+    if(full_path == root_)
+    {
+        relative_path.clear();
+        return true;
+    }
+    if(full_path.size() <= root_.size() + 1
+        || full_path.compare(0, root_.size(), root_) != 0
+        || full_path[root_.size()] != '/')
+    {
+        return false;
+    }
+
+    relative_path = full_path.substr(root_.size() + 1);
+    return true;
+}
+
+void FanotifyWatcher::report_tree_(const std::string& relative_path)
+{
+    std::error_code error;
+    fs::recursive_directory_iterator it(root_ + "/" + relative_path, fs::directory_options::skip_permission_denied, error);
+    for(; !error && it != fs::recursive_directory_iterator(); it.increment(error))
+    {
+        std::error_code type_error;
+        if(!fs::is_regular_file(it->symlink_status(type_error)) || type_error)
+        {
+            continue;
+        }
+
+        event_coalescer::Event event;
+        event.type = event_coalescer::EventType::CREATE;
+        event.path = it->path().string().substr(root_.size() + 1);
+        events_->push(event);
+    }
+}
+
+void FanotifyWatcher::fail_(const std::string& error)
+{
+    // nothing is thrown out of the monitor thread, the owner asks get_error
+    std::lock_guard<std::mutex> lock(error_mtx_);
+    error_ = error;
+    is_running_.store(false);
+}
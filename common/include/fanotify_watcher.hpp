@@ -0,0 +1,76 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+// c
+#include <sys/fanotify.h>
+
+// local
+#include "event_coalescer.hpp"
+
+namespace fanotify_watcher
+{
+    class FanotifyWatcher
+    {
+        // watches the sync dir through a single fanotify mark on the whole
+        // filesystem it lives in, reporting directory handles plus names
+        // nothing is walked or watched per directory, so starting takes the same
+        // time for any tree size, at the cost of seeing every change on that
+        // filesystem and dropping the ones outside the sync dir
+        // needs CAP_SYS_ADMIN and a 5.9 kernel, start tells when it cannot run
+        public:
+            FanotifyWatcher();
+            ~FanotifyWatcher();
+
+            // returns false with get_error set when fanotify is not available here
+            bool start(const std::string& path, event_coalescer::EventCoalescer& events);
+            void stop();
+
+            bool is_running();
+            std::string get_error();
+
+            // events seen for other directories of the filesystem
+            uint64_t get_filtered_count();
+            uint64_t get_overflow_count();
+
+            // true once after the queue overflowed, the watcher keeps no record
+            // of the tree to recover from, the caller compares it with its own
+            bool take_lost_events();
+
+        private:
+            int fanotify_fd_;
+            int mount_fd_;  // any descriptor on the filesystem, for open_by_handle_at
+
+            std::string root_;  // canonical sync dir path
+            event_coalescer::EventCoalescer* events_;
+
+            std::thread monitor_thread_;
+            std::atomic<bool> is_running_;
+            std::atomic<uint64_t> filtered_;
+            std::atomic<uint64_t> overflows_;
+            std::atomic<bool> lost_events_;
+            alignas(struct fanotify_event_metadata) char notify_buffer_[8192];
+
+            // directory handle bytes to path, dropped whenever a directory
+            // is renamed or deleted
+            std::unordered_map<std::string, std::string> directory_paths_;
+
+            std::string error_;
+            std::mutex error_mtx_;
+
+            void monitor_loop_();
+            void handle_event_(const struct fanotify_event_metadata* metadata);
+            bool resolve_(const struct fanotify_event_info_fid* info, std::string& relative_path);
+            void report_tree_(const std::string& relative_path);
+            void fail_(const std::string& error);
+    };
+}
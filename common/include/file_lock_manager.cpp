@@ -0,0 +1,251 @@
+// c++
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+
+// local
+#include "file_lock_manager.hpp"
+
+using namespace file_lock_manager;
+
+// stripes held by the calling thread, in the order they were taken
+static thread_local std::vector<const StripeMutex*> held_stripes;
+
+void StripeMutex::lock()
+{
+    check_order_();
+    mtx_.lock();
+    acquired_();
+}
+
+bool StripeMutex::try_lock()
+{
+    check_order_();
+    if(!mtx_.try_lock())
+    {
+        return false;
+    }
+    acquired_();
+    return true;
+}
+
+void StripeMutex::unlock()
+{
+    released_();
+    mtx_.unlock();
+}
+
+void StripeMutex::lock_shared()
+{
+    check_order_();
+    mtx_.lock_shared();
+    acquired_();
+}
+
+bool StripeMutex::try_lock_shared()
+{
+    check_order_();
+    if(!mtx_.try_lock_shared())
+    {
+        return false;
+    }
+    acquired_();
+    return true;
+}
+
+void StripeMutex::unlock_shared()
+{
+    released_();
+    mtx_.unlock_shared();
+}
+
+void StripeMutex::check_order_()
+{
+    // a shared stripe taken twice deadlocks as soon as a writer queues in between
+    for(const StripeMutex* held : held_stripes)
+    {
+        if(held->owner_ == owner_ && held->index_ >= index_)
+        {
+            throw std::logic_error(
+                "[FILE LOCK MANAGER] Stripe " + std::to_string(index_) + " taken while holding stripe "
+                + std::to_string(held->index_) + ", file locks must be taken together in stripe order!");
+        }
+    }
+}
+
+void StripeMutex::acquired_()
+{
+    held_stripes.push_back(this);
+}
+
+void StripeMutex::released_()
+{
+    auto held = std::find(held_stripes.rbegin(), held_stripes.rend(), this);
+    if(held != held_stripes.rend())
+    {
+        held_stripes.erase(std::next(held).base());
+    }
+}
+
+FileLockManager::FileLockManager(int stripe_count)
+    :   stripe_count_(stripe_count),
+        shared_acquisitions_(0),
+        exclusive_acquisitions_(0),
+        contended_acquisitions_(0),
+        total_wait_us_(0)
+{
+    if(stripe_count_ <= 0)
+    {
+        throw std::runtime_error("[FILE LOCK MANAGER] Stripe count must be positive!");
+    }
+
+    stripes_ = std::make_unique<Stripe[]>(stripe_count_);
+    for(int i = 0; i < stripe_count_; i++)
+    {
+        stripes_[i].mtx.owner_ = this;
+        stripes_[i].mtx.index_ = i;
+    }
+    for(int i = 0; i < WAIT_HISTOGRAM_BUCKETS; i++)
+    {
+        wait_histogram_[i].store(0);
+    }
+}
+
+ExclusiveLock FileLockManager::lock_exclusive(path_table::path_id id)
+{
+    StripeMutex& stripe = stripes_[get_stripe_index_(id)].mtx;
+    exclusive_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+
+    // uncontended locks are never timed
+    ExclusiveLock lock(stripe, std::try_to_lock);
+    if(lock.owns_lock())
+    {
+        wait_histogram_[0].fetch_add(1, std::memory_order_relaxed);
+        return lock;
+    }
+
+    auto wait_start = std::chrono::steady_clock::now();
+    lock.lock();
+    record_wait_(wait_start);
+    return lock;
+}
+
+SharedLock FileLockManager::lock_shared(path_table::path_id id)
+{
+    StripeMutex& stripe = stripes_[get_stripe_index_(id)].mtx;
+    shared_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+
+    SharedLock lock(stripe, std::try_to_lock);
+    if(lock.owns_lock())
+    {
+        wait_histogram_[0].fetch_add(1, std::memory_order_relaxed);
+        return lock;
+    }
+
+    auto wait_start = std::chrono::steady_clock::now();
+    lock.lock();
+    record_wait_(wait_start);
+    return lock;
+}
+
+std::vector<ExclusiveLock> FileLockManager::lock_exclusive(std::vector<path_table::path_id> ids)
+{
+    // paths sharing a stripe take it once
+    std::vector<int> indexes;
+    indexes.reserve(ids.size());
+    for(path_table::path_id id : ids)
+    {
+        indexes.push_back(get_stripe_index_(id));
+    }
+    std::sort(indexes.begin(), indexes.end());
+    indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+
+    std::vector<ExclusiveLock> locks;
+    locks.reserve(indexes.size());
+    for(int index : indexes)
+    {
+        exclusive_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+        ExclusiveLock lock(stripes_[index].mtx, std::try_to_lock);
+        if(lock.owns_lock())
+        {
+            wait_histogram_[0].fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            auto wait_start = std::chrono::steady_clock::now();
+            lock.lock();
+            record_wait_(wait_start);
+        }
+        locks.push_back(std::move(lock));
+    }
+    return locks;
+}
+
+int FileLockManager::get_stripe_count()
+{
+    return stripe_count_;
+}
+
+LockStats FileLockManager::get_stats()
+{
+    LockStats stats;
+    stats.shared_acquisitions = shared_acquisitions_.load();
+    stats.exclusive_acquisitions = exclusive_acquisitions_.load();
+    stats.contended_acquisitions = contended_acquisitions_.load();
+    stats.total_wait_us = total_wait_us_.load();
+    for(int i = 0; i < WAIT_HISTOGRAM_BUCKETS; i++)
+    {
+        stats.wait_histogram[i] = wait_histogram_[i].load();
+    }
+    return stats;
+}
+
+std::string FileLockManager::format_stats()
+{
+    LockStats stats = get_stats();
+
+    std::string output = "file locks: " + std::to_string(stats.shared_acquisitions) + " shared, ";
+    output += std::to_string(stats.exclusive_acquisitions) + " exclusive, ";
+    output += std::to_string(stats.contended_acquisitions) + " contended, ";
+    output += std::to_string(stats.total_wait_us) + "us waited";
+
+    // only non empty buckets are listed
+    output += " | wait histogram:";
+    for(int i = 0; i < WAIT_HISTOGRAM_BUCKETS; i++)
+    {
+        if(stats.wait_histogram[i] == 0)
+        {
+            continue;
+        }
+
+        std::string bound = (i == WAIT_HISTOGRAM_BUCKETS - 1)
+            ? ">=" + std::to_string(1ULL << (i - 1))
+            : "<" + std::to_string(1ULL << i);
+        output += " " + bound + "us=" + std::to_string(stats.wait_histogram[i]);
+    }
+    return output;
+}
+
+int FileLockManager::get_stripe_index_(path_table::path_id id)
+{
+    // ids are dense, so consecutive files already land on different stripes
+    // mixing only protects from patterns that stride on the stripe count
+    uint32_t mixed = id * 2654435761u;
+    return (mixed >> 8) % stripe_count_;
+}
+
+void FileLockManager::record_wait_(std::chrono::steady_clock::time_point wait_start)
+{
+    auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - wait_start).count();
+
+    contended_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+    total_wait_us_.fetch_add(waited, std::memory_order_relaxed);
+
+    int bucket = 0;
+    while(bucket < WAIT_HISTOGRAM_BUCKETS - 1 && static_cast<uint64_t>(waited) >= (1ULL << bucket))
+    {
+        bucket++;
+    }
+    wait_histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
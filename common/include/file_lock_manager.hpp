@@ -0,0 +1,106 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <chrono>
+
+// synchronization
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
+// locals
+#include "path_table.hpp"
+
+namespace file_lock_manager
+{
+    const int DEFAULT_STRIPE_COUNT = 256;
+    const int WAIT_HISTOGRAM_BUCKETS = 16;  // bucket i counts waits under 2^i microseconds
+
+    struct LockStats
+    {
+        uint64_t shared_acquisitions = 0;
+        uint64_t exclusive_acquisitions = 0;
+        uint64_t contended_acquisitions = 0;
+        uint64_t total_wait_us = 0;
+        uint64_t wait_histogram[WAIT_HISTOGRAM_BUCKETS] = {0};
+    };
+
+    class FileLockManager;
+
+    class StripeMutex
+    {
+        // shared_mutex of a single stripe, checking the order in which the
+        // calling thread takes stripes of the same manager - a thread may only
+        // take a stripe above every one it already holds there, anything else
+        // could deadlock (the same stripe even on its own) and throws instead
+        public:
+            void lock();
+            bool try_lock();
+            void unlock();
+
+            void lock_shared();
+            bool try_lock_shared();
+            void unlock_shared();
+
+        private:
+            friend class FileLockManager;
+
+            std::shared_mutex mtx_;
+            const FileLockManager* owner_ = nullptr;
+            int index_ = 0;
+
+            void check_order_();
+            void acquired_();
+            void released_();
+    };
+
+    typedef std::unique_lock<StripeMutex> ExclusiveLock;
+    typedef std::shared_lock<StripeMutex> SharedLock;
+
+    class FileLockManager
+    {
+        // readers-writer file locks shared by every session of a user
+        // paths are mapped to a fixed array of stripes by their interned id,
+        // so finding the lock for a path never takes a lock itself
+        // NOTE: two paths may share a stripe - a thread holding a file lock
+        // must not take another one with the calls for a single path, even
+        // for a different path, stripes are only taken in ascending order
+        // (see StripeMutex) - several files are locked together through the
+        // calls taking a list of paths, which order their stripes
+        public:
+            FileLockManager(int stripe_count = DEFAULT_STRIPE_COUNT);
+
+            ExclusiveLock lock_exclusive(path_table::path_id id);
+            SharedLock lock_shared(path_table::path_id id);
+
+            // every stripe of the given paths once, lowest first
+            std::vector<ExclusiveLock> lock_exclusive(std::vector<path_table::path_id> ids);
+
+            int get_stripe_count();
+            LockStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct alignas(64) Stripe
+            {
+                StripeMutex mtx;
+            };
+
+            int stripe_count_;
+            std::unique_ptr<Stripe[]> stripes_;
+
+            // contention counters
+            std::atomic<uint64_t> shared_acquisitions_;
+            std::atomic<uint64_t> exclusive_acquisitions_;
+            std::atomic<uint64_t> contended_acquisitions_;
+            std::atomic<uint64_t> total_wait_us_;
+            std::atomic<uint64_t> wait_histogram_[WAIT_HISTOGRAM_BUCKETS];
+
+            int get_stripe_index_(path_table::path_id id);
+            void record_wait_(std::chrono::steady_clock::time_point wait_start);
+    };
+}
@@ -0,0 +1,262 @@
+// c++
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+
+// c
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+// local
+#include "garbage_collector.hpp"
+
+using namespace garbage_collector;
+namespace fs = std::filesystem;
+
+// see ioprio_set(2), glibc has no wrapper for it
+const int IOPRIO_WHO_PROCESS = 1;
+const int IOPRIO_CLASS_IDLE = 3;
+const int IOPRIO_CLASS_SHIFT = 13;
+
+static bool has_suffix(const std::string& name, const std::vector<std::string>& suffixes)
+{
+    for(const std::string& suffix : suffixes)
+    {
+        if(name.size() > suffix.size()
+            && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Sweep::Sweep(GarbageCollector* collector, SweeperStats* stats)
+    :   collector_(collector),
+        stats_(stats)
+{
+    //
+}
+
+bool Sweep::pace(uint64_t bytes)
+{
+    return collector_->wait_next_operation_(bytes);
+}
+
+void Sweep::reclaimed(uint64_t bytes, uint64_t files)
+{
+    stats_->reclaimed_bytes += bytes;
+    stats_->removed_files += files;
+}
+
+void Sweep::remove_stale_files(
+    const std::string& root, 
+    const std::vector<std::string>& suffixes,
+    std::function<void(const std::string& path)> on_removed)
+{
+    std::time_t stale_before = std::time(nullptr) - collector_->stale_seconds_;
+
+    std::error_code error;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, error);
+    for(; !error && it != fs::recursive_directory_iterator(); it.increment(error))
+    {
+        if(!pace())
+        {
+            return;
+        }
+
+        // files still being written keep moving their modification time
+        struct stat file_info;
+        std::string path = it->path().string();
+        if(!has_suffix(path, suffixes)
+            || lstat(path.c_str(), &file_info) != 0
+            || !S_ISREG(file_info.st_mode)
+            || file_info.st_mtime >= stale_before)
+        {
+            continue;
+        }
+
+        if(unlink(path.c_str()) == 0)
+        {
+            reclaimed(file_info.st_size);
+            if(on_removed != nullptr)
+            {
+                on_removed(path);
+            }
+        }
+    }
+}
+
+int Sweep::get_stale_seconds()
+{
+    return collector_->stale_seconds_;
+}
+
+GarbageCollector::GarbageCollector(
+    int interval_seconds, 
+    int stale_seconds, 
+    int operations_per_second, 
+    uint64_t bytes_per_second)
+    :   interval_seconds_(std::max(interval_seconds, 1)),
+        stale_seconds_(stale_seconds),
+        operation_interval_(std::chrono::nanoseconds(1000000000LL / std::max(operations_per_second, 1))),
+        bytes_per_second_(std::max<uint64_t>(bytes_per_second, 1)),
+        next_operation_(std::chrono::steady_clock::now()),
+        running_(true),
+        pass_requested_(false),
+        passes_(0)
+{
+    collector_th_ = std::thread(&GarbageCollector::collector_loop_, this);
+}
+
+GarbageCollector::~GarbageCollector()
+{
+    {
+        std::lock_guard<std::mutex> lock(collector_mtx_);
+        running_.store(false);
+    }
+    collector_cv_.notify_all();
+
+    if(collector_th_.joinable())
+    {
+        collector_th_.join();
+    }
+}
+
+void GarbageCollector::add_sweeper(const std::string& name, Sweeper sweeper)
+{
+    std::lock_guard<std::mutex> lock(sweepers_mtx_);
+    Entry entry;
+    entry.sweeper = sweeper;
+    entry.stats.name = name;
+    sweepers_.push_back(entry);
+}
+
+void GarbageCollector::request_pass()
+{
+    {
+        std::lock_guard<std::mutex> lock(collector_mtx_);
+        pass_requested_ = true;
+    }
+    collector_cv_.notify_all();
+}
+
+std::vector<SweeperStats> GarbageCollector::get_stats()
+{
+    std::lock_guard<std::mutex> lock(sweepers_mtx_);
+    std::vector<SweeperStats> stats;
+    for(const Entry& entry : sweepers_)
+    {
+        stats.push_back(entry.stats);
+    }
+    return stats;
+}
+
+std::string GarbageCollector::format_stats()
+{
+    uint64_t removed_files = 0;
+    uint64_t reclaimed_bytes = 0;
+    std::string sweepers;
+    for(const SweeperStats& stats : get_stats())
+    {
+        removed_files += stats.removed_files;
+        reclaimed_bytes += stats.reclaimed_bytes;
+
+        sweepers += sweepers.empty() ? "" : ", ";
+        sweepers += stats.name + " " + std::to_string(stats.reclaimed_bytes) + " bytes in ";
+        sweepers += std::to_string(stats.last_pass_us / 1000) + "ms";
+    }
+
+    std::string output = "gc: " + std::to_string(passes_.load()) + " passes, ";
+    output += std::to_string(removed_files) + " files and " + std::to_string(reclaimed_bytes) + " bytes reclaimed";
+    output += sweepers.empty() ? "" : " (" + sweepers + ")";
+    return output;
+}
+
+void GarbageCollector::collector_loop_()
+{
+    // only this thread is lowered, clients are served at normal priority
+    lower_priority_();
+
+    std::unique_lock<std::mutex> lock(collector_mtx_);
+    while(running_.load())
+    {
+        collector_cv_.wait_for(
+            lock,
+            std::chrono::seconds(interval_seconds_),
+            [this]() { return !running_.load() || pass_requested_; });
+
+        if(!running_.load())
+        {
+            break;
+        }
+        pass_requested_ = false;
+
+        lock.unlock();
+        run_pass_();
+        lock.lock();
+    }
+}
+
+void GarbageCollector::run_pass_()
+{
+    // sweepers run on a copy, so stats can be read during a long pass
+    std::vector<Entry> sweepers;
+    {
+        std::lock_guard<std::mutex> lock(sweepers_mtx_);
+        sweepers = sweepers_;
+    }
+
+    for(std::size_t i = 0; i < sweepers.size() && running_.load(); i++)
+    {
+        SweeperStats pass_stats;
+        Sweep sweep(this, &pass_stats);
+
+        auto pass_start = std::chrono::steady_clock::now();
+        try
+        {
+            sweepers[i].sweeper(sweep);
+        }
+        catch(const std::exception& e)
+        {
+            // a failing sweeper only loses its own pass
+        }
+        uint64_t pass_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - pass_start).count();
+
+        std::lock_guard<std::mutex> lock(sweepers_mtx_);
+        SweeperStats& stats = sweepers_[i].stats;
+        stats.passes++;
+        stats.removed_files += pass_stats.removed_files;
+        stats.reclaimed_bytes += pass_stats.reclaimed_bytes;
+        stats.last_pass_us = pass_us;
+    }
+    passes_.fetch_add(1);
+}
+
+bool GarbageCollector::wait_next_operation_(uint64_t bytes)
+{
+    // only the collector thread paces, so the slot needs no lock
+    // bytes add the time they take at the byte rate to the slot
+    std::chrono::nanoseconds interval = operation_interval_ 
+        + std::chrono::nanoseconds(static_cast<int64_t>(bytes * 1000000000.0 / bytes_per_second_));
+    auto now = std::chrono::steady_clock::now();
+    next_operation_ = std::max(next_operation_, now - operation_interval_) + interval;
+    if(next_operation_ <= now)
+    {
+        return running_.load();
+    }
+
+    std::unique_lock<std::mutex> lock(collector_mtx_);
+    collector_cv_.wait_until(lock, next_operation_, [this]() { return !running_.load(); });
+    return running_.load();
+}
+
+void GarbageCollector::lower_priority_()
+{
+    // best effort, the collector is only slower to give way without it
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+}
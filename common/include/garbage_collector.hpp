@@ -0,0 +1,118 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace garbage_collector
+{
+    const int DEFAULT_INTERVAL_SECONDS = 600;
+    const int DEFAULT_STALE_SECONDS = 3600;          // temporary files untouched for this long are abandoned
+    const int DEFAULT_OPERATIONS_PER_SECOND = 1000;  // entries looked at, the disk stays mostly to clients
+    const uint64_t DEFAULT_BYTES_PER_SECOND = 32 * 1024 * 1024;  // read or written by sweepers on top of that
+
+    struct SweeperStats
+    {
+        std::string name;
+        uint64_t passes = 0;
+        uint64_t removed_files = 0;
+        uint64_t reclaimed_bytes = 0;
+        uint64_t last_pass_us = 0;
+    };
+
+    class GarbageCollector;
+
+    class Sweep
+    {
+        // handed to a sweeper on every pass, paces its work and counts what
+        // it reclaimed
+        public:
+            Sweep(GarbageCollector* collector, SweeperStats* stats);
+
+            // waits for the next operation slot of the rate limit, an operation
+            // about to read or write bytes waits for their share of it too
+            // returns false once the collector is stopping, the sweeper should return
+            bool pace(uint64_t bytes = 0);
+
+            void reclaimed(uint64_t bytes, uint64_t files = 1);
+
+            // removes regular files under root ending in one of the suffixes that
+            // were not modified for the stale time, one paced operation per entry
+            // on_removed is called with the path of every file removed
+            void remove_stale_files(
+                const std::string& root, 
+                const std::vector<std::string>& suffixes,
+                std::function<void(const std::string& path)> on_removed = nullptr);
+
+            int get_stale_seconds();
+
+        private:
+            GarbageCollector* collector_;
+            SweeperStats* stats_;
+    };
+
+    typedef std::function<void(Sweep& sweep)> Sweeper;
+
+    class GarbageCollector
+    {
+        // background thread reclaiming storage nothing refers to anymore
+        // it runs at idle io priority and the lowest cpu priority, and every
+        // sweeper goes through the same rate limit - clients only ever wait
+        // on it for the single file it is looking at
+        public:
+            GarbageCollector(
+                int interval_seconds = DEFAULT_INTERVAL_SECONDS,
+                int stale_seconds = DEFAULT_STALE_SECONDS,
+                int operations_per_second = DEFAULT_OPERATIONS_PER_SECOND,
+                uint64_t bytes_per_second = DEFAULT_BYTES_PER_SECOND);
+            ~GarbageCollector();
+
+            // sweepers run in the order they were added, once per pass
+            void add_sweeper(const std::string& name, Sweeper sweeper);
+
+            // starts a pass without waiting for the interval
+            void request_pass();
+
+            std::vector<SweeperStats> get_stats();
+            std::string format_stats();
+
+        private:
+            friend class Sweep;
+
+            struct Entry
+            {
+                Sweeper sweeper;
+                SweeperStats stats;
+            };
+
+            int interval_seconds_;
+            int stale_seconds_;
+            std::chrono::nanoseconds operation_interval_;
+            uint64_t bytes_per_second_;
+            std::chrono::steady_clock::time_point next_operation_;
+
+            std::vector<Entry> sweepers_;
+            std::mutex sweepers_mtx_;
+
+            std::atomic<bool> running_;
+            bool pass_requested_;
+            std::atomic<uint64_t> passes_;
+            std::thread collector_th_;
+            std::mutex collector_mtx_;
+            std::condition_variable collector_cv_;
+
+            void collector_loop_();
+            void run_pass_();
+            bool wait_next_operation_(uint64_t bytes);
+            static void lower_priority_();
+    };
+}
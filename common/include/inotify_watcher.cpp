@@ -2,62 +2,138 @@
 #include <iostream>
 #include <list>
 #include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
 // c
 #include <sys/inotify.h>
+#include <poll.h>
 #include <unistd.h>
 
 // local
 #include "inotify_watcher.hpp"
-#include "async_cout.hpp"
+#include "directory_scanner.hpp"
 #include "utils.hpp"
 
-const int EVENT_SIZE = sizeof(struct inotify_event);
-const int BUF_LEN = 1024;
+const uint32_t WATCH_MASK = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_DELETE_SELF
+    | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+const int POLL_TIMEOUT_MS = 200;  // how long stop_watching waits at most
 
 using namespace inotify_watcher;
+namespace fs = std::filesystem;
+
+static std::string join_path(const std::string& parent, const std::string& name)
+{
+    return parent.empty() ? name : parent + "/" + name;
+}
+
+Backend inotify_watcher::parse_backend(const std::string& name)
+{
+    if(name == "auto")
+    {
+        return Backend::AUTO;
+    }
+    else if(name == "inotify")
+    {
+        return Backend::INOTIFY;
+    }
+    else if(name == "fanotify")
+    {
+        return Backend::FANOTIFY;
+    }
+    throw std::runtime_error("[INOTIFY WATCHER] Unknown watcher backend \"" + name + "\"!");
+}
+
+std::string inotify_watcher::backend_name(Backend backend)
+{
+    switch(backend)
+    {
+        case Backend::AUTO:
+            return "auto";
+        case Backend::INOTIFY:
+            return "inotify";
+        case Backend::FANOTIFY:
+            return "fanotify";
+    }
+    return "unknown";
+}
 
 InotifyWatcher::InotifyWatcher()
-    : is_running_(false)
+    :   watched_path_fd_(-1),
+        is_running_(false),
+        requested_backend_(Backend::AUTO),
+        backend_(Backend::INOTIFY),
+        root_wd_(-1),
+        overflowed_(false)
 {
 
 };
 
-InotifyWatcher::~InotifyWatcher() 
+InotifyWatcher::~InotifyWatcher()
 {
-    is_running_.store(false);
     stop_watching();
 }
 
 void InotifyWatcher::init(
-    std::string& path_to_watch, 
-    std::vector<std::string>& inotify_buffer,
-    std::mutex& inotify_buffer_mtx)
+    std::string& path_to_watch,
+    event_coalescer::EventCoalescer& events,
+    Backend backend)
 {
-    watched_path_ = &path_to_watch; 
-    inotify_buffer_ = &inotify_buffer; 
-    inotify_buffer_mtx_ = &inotify_buffer_mtx;
+    watched_path_ = &path_to_watch;
+    events_ = &events;
+    requested_backend_ = backend;
     is_running_.store(false);
 }
 
-void InotifyWatcher::start_watching() 
+void InotifyWatcher::start_watching()
 {
-    int watched_path_fd_ = inotify_init();
-    
-    if(watched_path_fd_ < 0) 
+    stop_watching();
+
+    if(requested_backend_ != Backend::INOTIFY)
     {
-        throw std::runtime_error("[INOTIFY WATCHER] Error initializing.");
-        is_running_.store(false);
-        return;
+        fanotify_ = std::make_unique<fanotify_watcher::FanotifyWatcher>();
+        if(fanotify_->start(*watched_path_, *events_))
+        {
+            backend_ = Backend::FANOTIFY;
+            return;
+        }
+
+        std::string error = fanotify_->get_error();
+        fanotify_.reset();
+        if(requested_backend_ == Backend::FANOTIFY)
+        {
+            throw std::runtime_error(error);
+        }
     }
+    backend_ = Backend::INOTIFY;
 
-    int wd = inotify_add_watch(watched_path_fd_, watched_path_->c_str(), IN_CREATE | IN_MODIFY | IN_DELETE);
-    
-    if(wd < 0) 
+    // non blocking, the monitor thread polls so it can notice stop_watching
+    watched_path_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(watched_path_fd_ < 0)
     {
-        throw std::runtime_error("[INOTIFY WATCHER] Error adding watch.");
-        is_running_.store(false);
-        return;
+        throw std::runtime_error("[INOTIFY WATCHER] Error initializing: " + std::string(strerror(errno)));
+    }
+
+    root_wd_ = add_watch_(-1, "", "");
+    if(root_wd_ < 0)
+    {
+        std::string error = strerror(errno);
+        close(watched_path_fd_);
+        watched_path_fd_ = -1;
+        throw std::runtime_error("[INOTIFY WATCHER] Error adding watch: " + error);
+    }
+    watch_tree_();
+
+    {
+        std::lock_guard<std::mutex> lock(error_mtx_);
+        error_.clear();
     }
+    pending_moves_.clear();
+    overflowed_ = false;
 
     is_running_.store(true);
     monitor_thread_ = std::thread(
@@ -67,76 +143,611 @@ void InotifyWatcher::start_watching()
         });
 }
 
-void InotifyWatcher::stop_watching() 
+void InotifyWatcher::stop_watching()
 {
+    if(fanotify_)
+    {
+        fanotify_->stop();
+        fanotify_.reset();
+    }
+
     is_running_.store(false);
     if(monitor_thread_.joinable())
     {
         monitor_thread_.join();
     }
 
-    close(watched_path_fd_);
+    // closing the descriptor drops every watch with it
+    if(watched_path_fd_ >= 0)
+    {
+        close(watched_path_fd_);
+        watched_path_fd_ = -1;
+    }
+
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    watches_.clear();
+    root_wd_ = -1;
 }
 
-void InotifyWatcher::monitor_directory() 
+void InotifyWatcher::monitor_directory()
 {
-    while (is_running_.load()) 
+    while(is_running_.load())
     {
-        int length = read(watched_path_fd_, notify_buffer_, sizeof(notify_buffer_));
-        if (length < 0) 
+        struct pollfd poll_fd;
+        poll_fd.fd = watched_path_fd_;
+        poll_fd.events = POLLIN;
+
+        int ready = poll(&poll_fd, 1, POLL_TIMEOUT_MS);
+        if(ready < 0 && errno != EINTR)
         {
-            throw std::runtime_error("[INOTIFY WATCHER] Error reading from inotify.");
-            is_running_.store(false);
+            fail_("[INOTIFY WATCHER] Error polling inotify: " + std::string(strerror(errno)));
             return;
         }
-
-        int i = 0;
-        while (i < length) 
+        if(ready <= 0)
         {
-            struct inotify_event *event = reinterpret_cast<struct inotify_event*>(&notify_buffer_[i]);
+            // nothing queued, no moved to half is coming anymore
+            flush_pending_moves_();
+            continue;
+        }
 
-            if(event->mask & (IN_CREATE | IN_MODIFY | IN_DELETE)) 
+        try
+        {
+            // drains the whole queue before polling again
+            while(is_running_.load())
             {
-                if(!(event->mask & IN_ISDIR)) 
+                ssize_t length = read(watched_path_fd_, notify_buffer_, sizeof(notify_buffer_));
+                if(length < 0)
                 {
-                    FileEvent file_event;
-                    file_event.filename = event->name;
-                    file_event.mask = event->mask;
+                    if(errno == EAGAIN)
+                    {
+                        break;
+                    }
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+                    fail_("[INOTIFY WATCHER] Error reading from inotify: " + std::string(strerror(errno)));
+                    return;
+                }
 
-                    process_event(file_event);
+                ssize_t i = 0;
+                while(i < length)
+                {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(&notify_buffer_[i]);
+                    handle_event_(event);
+                    i += sizeof(struct inotify_event) + event->len;
                 }
             }
 
-            i += sizeof(struct inotify_event) + event->len;
+            if(overflowed_)
+            {
+                recover_overflow_();
+            }
+        }
+        catch(const std::exception& e)
+        {
+            fail_("[INOTIFY WATCHER] Error handling events: " + std::string(e.what()));
+            return;
         }
     }
+}
 
-    inotify_rm_watch(watched_path_fd_, IN_ALL_EVENTS);
-    close(watched_path_fd_);
+void InotifyWatcher::process_event(const FileEvent& event)
+{
+    event_coalescer::Event coalesced_event;
+    coalesced_event.path = event.filename;
+    coalesced_event.is_directory = event.is_directory;
+
+    if((event.mask & (IN_MOVED_FROM | IN_MOVED_TO)) && !event.old_filename.empty())
+    {
+        coalesced_event.type = event_coalescer::EventType::RENAME;
+        coalesced_event.old_path = event.old_filename;
+    }
+    else if(event.mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        coalesced_event.type = event_coalescer::EventType::CREATE;
+    }
+    else if(event.mask & IN_CLOSE_WRITE)
+    {
+        coalesced_event.type = event_coalescer::EventType::CLOSE_WRITE;
+    }
+    else if(event.mask & IN_MODIFY)
+    {
+        coalesced_event.type = event_coalescer::EventType::MODIFY;
+    }
+    else if(event.mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        coalesced_event.type = event_coalescer::EventType::DELETE;
+    }
+    else
+    {
+        return;
+    }
+
+    events_->push(coalesced_event);
 }
 
-void InotifyWatcher::process_event(const FileEvent& event) 
+bool InotifyWatcher::is_running()
 {
-    if (event.mask & IN_CREATE) 
+    return fanotify_ ? fanotify_->is_running() : is_running_.load();
+}
+
+Backend InotifyWatcher::get_backend()
+{
+    return backend_;
+}
+
+std::size_t InotifyWatcher::get_watch_count()
+{
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    return watches_.size();
+}
+
+WatcherStats InotifyWatcher::get_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mtx_);
+    WatcherStats stats = stats_;
+    if(fanotify_)
     {
-        std::unique_lock<std::mutex> lock(*inotify_buffer_mtx_);
-        inotify_buffer_->push_back("inotify|create|" + event.filename);
+        stats.overflows = fanotify_->get_overflow_count();
     }
+    return stats;
+}
 
-    if (event.mask & IN_MODIFY) 
+std::string InotifyWatcher::format_stats()
+{
+    WatcherStats stats = get_stats();
+    std::string output = "watcher: " + backend_name(backend_) + ", ";
+    output += std::to_string(get_watch_count()) + " watches, ";
+    output += std::to_string(stats.overflows) + " overflows, ";
+    output += std::to_string(stats.rescans) + " rescans of ";
+    output += std::to_string(stats.rescanned_directories) + " directories";
+    output += " (last " + std::to_string(stats.last_rescan_us / 1000) + "ms, ";
+    output += "max " + std::to_string(stats.max_rescan_us / 1000) + "ms)";
+    return output;
+}
+
+local_manifest::LocalManifest& InotifyWatcher::get_manifest()
+{
+    return manifest_;
+}
+
+bool InotifyWatcher::take_lost_events()
+{
+    return fanotify_ != nullptr && fanotify_->take_lost_events();
+}
+
+std::string InotifyWatcher::get_error()
+{
+    if(fanotify_)
     {
-        std::unique_lock<std::mutex> lock(*inotify_buffer_mtx_);
-        inotify_buffer_->push_back("inotify|modify|" + event.filename);
+        return fanotify_->get_error();
     }
+    std::lock_guard<std::mutex> lock(error_mtx_);
+    return error_;
+}
 
-    if (event.mask & IN_DELETE) 
+int InotifyWatcher::add_watch_(int parent_wd, const std::string& name, const std::string& relative_path)
+{
+    std::string full_path = relative_path.empty() ? *watched_path_ : *watched_path_ + "/" + relative_path;
+    int wd = inotify_add_watch(watched_path_fd_, full_path.c_str(), WATCH_MASK);
+    if(wd < 0)
     {
-        std::unique_lock<std::mutex> lock(*inotify_buffer_mtx_);
-        inotify_buffer_->push_back("inotify|delete|" + event.filename);
+        // gone again, or fs.inotify.max_user_watches is exhausted
+        return -1;
     }
+
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    auto existing = watches_.find(wd);
+    if(existing != watches_.end())
+    {
+        // same directory found under a new name, moved while events were lost
+        auto old_parent = watches_.find(existing->second.parent_wd);
+        if(old_parent != watches_.end())
+        {
+            auto child = old_parent->second.children.find(existing->second.name);
+            if(child != old_parent->second.children.end() && child->second == wd)
+            {
+                old_parent->second.children.erase(child);
+            }
+        }
+    }
+
+    WatchNode& node = watches_[wd];
+    node.parent_wd = parent_wd;
+    node.name = name;
+
+    auto parent = watches_.find(parent_wd);
+    if(parent != watches_.end())
+    {
+        parent->second.children[name] = wd;
+    }
+    return wd;
 }
 
-bool InotifyWatcher::is_running()
+void InotifyWatcher::watch_tree_()
+{
+    // the manifest is built with the parallel scanner, watches are then added
+    // parents first so every directory finds its parent already watched
+    std::vector<std::string> directories = manifest_.build(*watched_path_);
+
+    std::unordered_map<std::string, int> directory_wds;
+    directory_wds.reserve(directories.size() + 1);
+    directory_wds[""] = root_wd_;
+
+    for(const std::string& directory : directories)
+    {
+        std::size_t slash = directory.rfind('/');
+        std::string parent = slash == std::string::npos ? "" : directory.substr(0, slash);
+        std::string name = slash == std::string::npos ? directory : directory.substr(slash + 1);
+
+        auto parent_wd = directory_wds.find(parent);
+        if(parent_wd == directory_wds.end())
+        {
+            // parent could not be watched, nothing to hang this one from
+            continue;
+        }
+
+        int wd = add_watch_(parent_wd->second, name, directory);
+        if(wd >= 0)
+        {
+            directory_wds[directory] = wd;
+        }
+    }
+}
+
+void InotifyWatcher::watch_new_directory_(int parent_wd, const std::string& name, const std::string& relative_path)
+{
+    // the watch goes first, anything created after it is reported by inotify
+    // and anything created before it is found by the listing
+    int wd = add_watch_(parent_wd, name, relative_path);
+    if(wd < 0)
+    {
+        return;
+    }
+    rescan_directory_(wd, relative_path);
+}
+
+uint64_t InotifyWatcher::rescan_directory_(int wd, const std::string& relative_path)
+{
+    // reports whatever differs from the manifest, new directories are watched
+    // and listed in turn
+    local_manifest::DirectoryDiff diff = manifest_.rescan(*watched_path_, relative_path);
+    uint64_t rescanned = 1;
+
+    FileEvent file_event;
+    for(const std::string& name : diff.created_files)
+    {
+        file_event.filename = join_path(relative_path, name);
+        file_event.mask = IN_CREATE;
+        process_event(file_event);
+    }
+    for(const std::string& name : diff.modified_files)
+    {
+        file_event.filename = join_path(relative_path, name);
+        file_event.mask = IN_CLOSE_WRITE;
+        process_event(file_event);
+    }
+    for(const std::string& name : diff.deleted_files)
+    {
+        file_event.filename = join_path(relative_path, name);
+        file_event.mask = IN_DELETE;
+        process_event(file_event);
+    }
+
+    for(const std::string& name : diff.deleted_directories)
+    {
+        int child = find_child_(wd, name);
+        if(child >= 0)
+        {
+            unwatch_subtree_(child);
+        }
+
+        file_event.filename = join_path(relative_path, name);
+        file_event.mask = IN_DELETE;
+        file_event.is_directory = true;
+        process_event(file_event);
+        file_event.is_directory = false;
+    }
+    for(const std::string& name : diff.created_directories)
+    {
+        int child = add_watch_(wd, name, join_path(relative_path, name));
+        if(child >= 0)
+        {
+            rescanned += rescan_directory_(child, join_path(relative_path, name));
+        }
+    }
+    return rescanned;
+}
+
+void InotifyWatcher::recover_overflow_()
+{
+    auto rescan_start = std::chrono::steady_clock::now();
+    overflowed_ = false;
+
+    // halves whose partner was dropped are taken for moves out of the tree,
+    // the rescan finds them again if they were not
+    flush_pending_moves_();
+
+    std::vector<int> wds;
+    {
+        std::lock_guard<std::mutex> lock(watches_mtx_);
+        wds.reserve(watches_.size());
+        for(const auto& watch : watches_)
+        {
+            wds.push_back(watch.first);
+        }
+    }
+
+    // every directory is listed again, a lost write leaves its directory
+    // untouched and only shows in the size, time or inode of the file
+    std::vector<std::pair<std::string, int>> targets;
+    for(int wd : wds)
+    {
+        std::string relative_path;
+        if(resolve_(wd, relative_path))
+        {
+            targets.push_back(std::make_pair(relative_path, wd));
+        }
+    }
+
+    // parents first, a parent may drop or add watches below it
+    std::sort(targets.begin(), targets.end());
+    uint64_t rescanned = 0;
+    for(const auto& target : targets)
+    {
+        std::string relative_path;
+        if(resolve_(target.second, relative_path) && relative_path == target.first)
+        {
+            rescanned += rescan_directory_(target.second, target.first);
+        }
+    }
+
+    uint64_t rescan_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - rescan_start).count();
+
+    std::lock_guard<std::mutex> lock(stats_mtx_);
+    stats_.rescans++;
+    stats_.rescanned_directories += rescanned;
+    stats_.last_rescan_us = rescan_us;
+    stats_.max_rescan_us = std::max(stats_.max_rescan_us, rescan_us);
+}
+
+void InotifyWatcher::forget_watch_(int wd)
+{
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    auto node = watches_.find(wd);
+    if(node == watches_.end())
+    {
+        return;
+    }
+
+    auto parent = watches_.find(node->second.parent_wd);
+    if(parent != watches_.end())
+    {
+        auto child = parent->second.children.find(node->second.name);
+        if(child != parent->second.children.end() && child->second == wd)
+        {
+            parent->second.children.erase(child);
+        }
+    }
+    watches_.erase(node);
+}
+
+void InotifyWatcher::unwatch_subtree_(int wd)
+{
+    std::vector<int> subtree;
+    {
+        std::lock_guard<std::mutex> lock(watches_mtx_);
+        std::vector<int> pending = {wd};
+        while(!pending.empty())
+        {
+            int current = pending.back();
+            pending.pop_back();
+
+            auto node = watches_.find(current);
+            if(node == watches_.end())
+            {
+                continue;
+            }
+            subtree.push_back(current);
+            for(const auto& child : node->second.children)
+            {
+                pending.push_back(child.second);
+            }
+        }
+    }
+
+    // children first, so no parent is left pointing at a forgotten watch
+    for(auto it = subtree.rbegin(); it != subtree.rend(); it++)
+    {
+        inotify_rm_watch(watched_path_fd_, *it);
+        forget_watch_(*it);
+    }
+}
+
+void InotifyWatcher::move_watch_(int wd, int parent_wd, const std::string& name)
 {
-    return is_running_.load();
-}
\ No newline at end of file
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    auto node = watches_.find(wd);
+    auto new_parent = watches_.find(parent_wd);
+    if(node == watches_.end() || new_parent == watches_.end())
+    {
+        return;
+    }
+
+    auto old_parent = watches_.find(node->second.parent_wd);
+    if(old_parent != watches_.end())
+    {
+        auto child = old_parent->second.children.find(node->second.name);
+        if(child != old_parent->second.children.end() && child->second == wd)
+        {
+            old_parent->second.children.erase(child);
+        }
+    }
+
+    node->second.parent_wd = parent_wd;
+    node->second.name = name;
+    new_parent->second.children[name] = wd;
+}
+
+int InotifyWatcher::find_child_(int parent_wd, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    auto parent = watches_.find(parent_wd);
+    if(parent == watches_.end())
+    {
+        return -1;
+    }
+
+    auto child = parent->second.children.find(name);
+    return child == parent->second.children.end() ? -1 : child->second;
+}
+
+bool InotifyWatcher::resolve_(int wd, std::string& relative_path)
+{
+    std::lock_guard<std::mutex> lock(watches_mtx_);
+    std::vector<const std::string*> names;
+    while(wd != root_wd_)
+    {
+        auto node = watches_.find(wd);
+        if(node == watches_.end())
+        {
+            // part of a subtree that was already dropped
+            return false;
+        }
+        names.push_back(&node->second.name);
+        wd = node->second.parent_wd;
+    }
+
+    relative_path.clear();
+    for(auto it = names.rbegin(); it != names.rend(); it++)
+    {
+        relative_path = join_path(relative_path, **it);
+    }
+    return true;
+}
+
+void InotifyWatcher::handle_event_(const struct inotify_event* event)
+{
+    if(event->mask & IN_Q_OVERFLOW)
+    {
+        // recovered once the queue is drained
+        overflowed_ = true;
+        std::lock_guard<std::mutex> lock(stats_mtx_);
+        stats_.overflows++;
+        return;
+    }
+
+    if(!(event->mask & IN_MOVED_TO))
+    {
+        flush_pending_moves_();
+    }
+
+    if(event->mask & IN_IGNORED)
+    {
+        // the watch is gone, removed by us or along with its directory
+        forget_watch_(event->wd);
+        return;
+    }
+
+    if(event->mask & IN_DELETE_SELF)
+    {
+        if(event->wd == root_wd_)
+        {
+            fail_("[INOTIFY WATCHER] Watched directory was removed.");
+        }
+        // any other directory is also reported as deleted by its parent
+        return;
+    }
+
+    std::string directory;
+    if(event->len == 0 || !resolve_(event->wd, directory))
+    {
+        return;
+    }
+
+    FileEvent file_event;
+    file_event.filename = join_path(directory, event->name);
+    file_event.mask = event->mask;
+    file_event.is_directory = event->mask & IN_ISDIR;
+
+    if(event->mask & IN_MOVED_FROM)
+    {
+        PendingMove move;
+        move.event = file_event;
+        move.wd = file_event.is_directory ? find_child_(event->wd, event->name) : -1;
+        pending_moves_[event->cookie] = move;
+        return;
+    }
+
+    if(event->mask & IN_MOVED_TO)
+    {
+        auto move = pending_moves_.find(event->cookie);
+        if(move != pending_moves_.end())
+        {
+            // renamed inside the tree, a directory keeps its watches
+            if(move->second.wd >= 0)
+            {
+                move_watch_(move->second.wd, event->wd, event->name);
+            }
+            file_event.old_filename = move->second.event.filename;
+            manifest_.rename(file_event.old_filename, file_event.filename);
+            pending_moves_.erase(move);
+            process_event(file_event);
+            return;
+        }
+
+        // moved in from outside, same as a new file or directory
+        if(file_event.is_directory)
+        {
+            watch_new_directory_(event->wd, event->name, file_event.filename);
+        }
+        else
+        {
+            manifest_.update_file(*watched_path_, file_event.filename);
+        }
+        process_event(file_event);
+        return;
+    }
+
+    if(event->mask & IN_DELETE)
+    {
+        manifest_.remove(file_event.filename);
+    }
+    else if(file_event.is_directory && (event->mask & IN_CREATE))
+    {
+        watch_new_directory_(event->wd, event->name, file_event.filename);
+    }
+    else if(!file_event.is_directory)
+    {
+        if(event->mask & (IN_CREATE | IN_CLOSE_WRITE))
+        {
+            manifest_.update_file(*watched_path_, file_event.filename);
+        }
+    }
+    process_event(file_event);
+}
+
+void InotifyWatcher::flush_pending_moves_()
+{
+    for(auto it = pending_moves_.begin(); it != pending_moves_.end();)
+    {
+        // moved out of the tree, same as deleted
+        if(it->second.wd >= 0)
+        {
+            unwatch_subtree_(it->second.wd);
+        }
+        manifest_.remove(it->second.event.filename);
+        process_event(it->second.event);
+        it = pending_moves_.erase(it);
+    }
+}
+
+void InotifyWatcher::fail_(const std::string& error)
+{
+    // nothing is thrown out of the monitor thread, the owner asks get_error
+    std::lock_guard<std::mutex> lock(error_mtx_);
+    error_ = error;
+    is_running_.store(false);
+}
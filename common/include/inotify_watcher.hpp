@@ -8,25 +8,69 @@
 #include <mutex>
 #include <list>
 #include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+
+// c
+#include <sys/inotify.h>
+
+// local
+#include "event_coalescer.hpp"
+#include "fanotify_watcher.hpp"
+#include "local_manifest.hpp"
 
 namespace inotify_watcher
 {
-    struct FileEvent 
+    const std::size_t NOTIFY_BUFFER_SIZE = 65536;  // several hundred events per read
+    enum class Backend
     {
-        std::string filename;
+        AUTO,      // fanotify when this process may use it, inotify otherwise
+        INOTIFY,
+        FANOTIFY
+    };
+
+    // parses "auto", "inotify" or "fanotify", throws on anything else
+    Backend parse_backend(const std::string& name);
+    std::string backend_name(Backend backend);
+
+    struct WatcherStats
+    {
+        uint64_t overflows = 0;
+        uint64_t rescans = 0;
+        uint64_t rescanned_directories = 0;
+        uint64_t last_rescan_us = 0;
+        uint64_t max_rescan_us = 0;
+    };
+
+    struct FileEvent
+    {
+        std::string filename;      // relative to the watched path
+        std::string old_filename;  // set on renames inside the watched tree
         uint32_t mask;
+        bool is_directory = false;
     };
 
-    class InotifyWatcher 
+    class InotifyWatcher
     {
+        // watches the whole tree under the sync dir, one inotify watch per directory
+        // every watch only remembers its parent watch and its own name, so paths
+        // are resolved on demand and renaming a directory is a single update,
+        // however big the tree under it
+        // directories created while running are watched first and listed after,
+        // so files written into them before the watch existed are still reported
+        // when the kernel queue overflows, every watched directory is listed
+        // again and its files compared with the local manifest
+        // the fanotify backend replaces all of it with a single mark when it
+        // can be used, see fanotify_watcher
         public:
             InotifyWatcher();
             ~InotifyWatcher();
 
             void init(
-                std::string& path_to_watch, 
-                std::vector<std::string>& inotify_buffer,
-                std::mutex& inotify_buffer_mtx);
+                std::string& path_to_watch,
+                event_coalescer::EventCoalescer& events,
+                Backend backend = Backend::AUTO);
 
             void start_watching();
             void stop_watching();
@@ -35,16 +79,86 @@ namespace inotify_watcher
 
             bool is_running();
 
+            // backend in use since start_watching
+            Backend get_backend();
+
+            // directories watched by inotify, none with fanotify
+            std::size_t get_watch_count();
+
+            // why the monitor thread stopped on its own, empty while it runs
+            std::string get_error();
+
+            WatcherStats get_stats();
+            std::string format_stats();
+
+            // what was last seen of the tree, kept up to date by the inotify backend
+            local_manifest::LocalManifest& get_manifest();
+
+            // true once after the fanotify backend lost events to an overflow,
+            // the caller has to compare the sync dir with what it last sent
+            // the inotify backend recovers its own and never returns true
+            bool take_lost_events();
+
         private:
+            struct WatchNode
+            {
+                int parent_wd;
+                std::string name;
+                std::unordered_map<std::string, int> children;
+            };
+
+            struct PendingMove
+            {
+                FileEvent event;
+                int wd;  // watch of the moved directory, -1 for files
+            };
+
             int watched_path_fd_;
-            
+
             std::thread monitor_thread_;
             std::atomic<bool> is_running_;
-            char notify_buffer_[1024];
+            alignas(struct inotify_event) char notify_buffer_[NOTIFY_BUFFER_SIZE];
 
             std::string* watched_path_;
-            std::vector<std::string>* inotify_buffer_;
-            std::mutex* inotify_buffer_mtx_;
-            
+            event_coalescer::EventCoalescer* events_;
+
+            Backend requested_backend_;
+            Backend backend_;
+            std::unique_ptr<fanotify_watcher::FanotifyWatcher> fanotify_;
+
+            // NOTE: only the monitor thread changes watches, the mutex keeps
+            // readers from other threads consistent
+            std::unordered_map<int, WatchNode> watches_;
+            int root_wd_;
+            std::mutex watches_mtx_;
+
+            // moved from halves waiting for their moved to, by cookie
+            // the kernel queues both halves back to back, so a half followed by
+            // anything else, or by nothing, moved out of the tree
+            std::unordered_map<uint32_t, PendingMove> pending_moves_;
+
+            // events lost to an overflow are recovered from the manifest
+            local_manifest::LocalManifest manifest_;
+            bool overflowed_;
+
+            WatcherStats stats_;
+            std::mutex stats_mtx_;
+
+            std::string error_;
+            std::mutex error_mtx_;
+
+            int add_watch_(int parent_wd, const std::string& name, const std::string& relative_path);
+            void watch_tree_();
+            void watch_new_directory_(int parent_wd, const std::string& name, const std::string& relative_path);
+            uint64_t rescan_directory_(int wd, const std::string& relative_path);
+            void recover_overflow_();
+            void forget_watch_(int wd);
+            void unwatch_subtree_(int wd);
+            void move_watch_(int wd, int parent_wd, const std::string& name);
+            int find_child_(int parent_wd, const std::string& name);
+            bool resolve_(int wd, std::string& relative_path);
+            void handle_event_(const struct inotify_event* event);
+            void flush_pending_moves_();
+            void fail_(const std::string& error);
     };
 }
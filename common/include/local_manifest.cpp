@@ -0,0 +1,356 @@
+// c++
+#include <algorithm>
+#include <filesystem>
+
+// c
+#include <sys/stat.h>
+
+// local
+#include "local_manifest.hpp"
+#include "directory_scanner.hpp"
+
+using namespace local_manifest;
+namespace fs = std::filesystem;
+
+static void split_path(const std::string& path, std::string& parent, std::string& name)
+{
+    std::size_t slash = path.rfind('/');
+    parent = slash == std::string::npos ? "" : path.substr(0, slash);
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string join_path(const std::string& parent, const std::string& name)
+{
+    return parent.empty() ? name : parent + "/" + name;
+}
+
+void LocalManifest::clear()
+{
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    directories_.clear();
+}
+
+std::vector<std::string> LocalManifest::build(const std::string& root)
+{
+    std::time_t now = std::time(nullptr);
+    std::unordered_map<std::string, DirectoryRecord> directories;
+    std::mutex directories_mtx;
+
+    struct stat root_info;
+    DirectoryRecord& root_record = directories[""];
+    if(stat(root.c_str(), &root_info) == 0)
+    {
+        root_record.modification_time = root_info.st_mtime;
+        root_record.racy = root_info.st_mtime >= now;
+    }
+
+    directory_scanner::default_scanner().scan(
+        root,
+        [&](const directory_scanner::ScanEntry& entry)
+        {
+            std::string parent;
+            std::string name;
+            split_path(entry.path, parent, name);
+
+            std::lock_guard<std::mutex> lock(directories_mtx);
+            if(entry.is_directory)
+            {
+                DirectoryRecord& record = directories[entry.path];
+                record.modification_time = entry.modification_time;
+                record.racy = entry.modification_time >= now;
+                directories[parent].directories.insert(name);
+                return;
+            }
+
+            FileRecord& record = directories[parent].files[name];
+            record.size = entry.size;
+            record.modification_time = entry.modification_time;
+            record.inode = entry.inode;
+            record.racy = entry.modification_time >= now;
+        },
+        true);
+
+    std::vector<std::string> found;
+    found.reserve(directories.size());
+    for(const auto& entry : directories)
+    {
+        if(!entry.first.empty())
+        {
+            found.push_back(entry.first);
+        }
+    }
+    std::sort(found.begin(), found.end());
+
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    directories_.swap(directories);
+    return found;
+}
+
+void LocalManifest::update_file(const std::string& root, const std::string& path)
+{
+    std::string parent;
+    std::string name;
+    split_path(path, parent, name);
+
+    struct stat file_info;
+    std::string full_path = root + "/" + path;
+    bool exists = lstat(full_path.c_str(), &file_info) == 0 && S_ISREG(file_info.st_mode);
+    std::time_t now = std::time(nullptr);
+
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    if(!exists)
+    {
+        auto directory = directories_.find(parent);
+        if(directory != directories_.end())
+        {
+            directory->second.files.erase(name);
+        }
+        return;
+    }
+
+    FileRecord& record = directories_[parent].files[name];
+    record.size = file_info.st_size;
+    record.modification_time = file_info.st_mtime;
+    record.inode = file_info.st_ino;
+    record.racy = file_info.st_mtime >= now;
+}
+
+void LocalManifest::remove(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    if(directories_.count(path) != 0)
+    {
+        remove_directory_(path);
+        return;
+    }
+
+    std::string parent;
+    std::string name;
+    split_path(path, parent, name);
+    auto directory = directories_.find(parent);
+    if(directory != directories_.end())
+    {
+        directory->second.files.erase(name);
+    }
+}
+
+void LocalManifest::rename(const std::string& old_path, const std::string& new_path)
+{
+    std::string old_parent;
+    std::string old_name;
+    std::string new_parent;
+    std::string new_name;
+    split_path(old_path, old_parent, old_name);
+    split_path(new_path, new_parent, new_name);
+
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    if(directories_.count(old_path) == 0)
+    {
+        auto directory = directories_.find(old_parent);
+        if(directory == directories_.end())
+        {
+            return;
+        }
+
+        auto file = directory->second.files.find(old_name);
+        if(file != directory->second.files.end())
+        {
+            FileRecord record = file->second;
+            directory->second.files.erase(file);
+            directories_[new_parent].files[new_name] = record;
+        }
+        return;
+    }
+
+    if(directories_.count(new_path) != 0)
+    {
+        remove_directory_(new_path);
+    }
+
+    // the whole subtree is rekeyed, found through the children of every record
+    std::vector<std::string> subtree = {old_path};
+    for(std::size_t i = 0; i < subtree.size(); i++)
+    {
+        auto directory = directories_.find(subtree[i]);
+        if(directory == directories_.end())
+        {
+            continue;
+        }
+        for(const std::string& child : directory->second.directories)
+        {
+            subtree.push_back(subtree[i] + "/" + child);
+        }
+    }
+
+    for(const std::string& directory : subtree)
+    {
+        auto record = directories_.find(directory);
+        if(record == directories_.end())
+        {
+            continue;
+        }
+        DirectoryRecord moved = std::move(record->second);
+        directories_.erase(record);
+        directories_[new_path + directory.substr(old_path.size())] = std::move(moved);
+    }
+
+    auto parent = directories_.find(old_parent);
+    if(parent != directories_.end())
+    {
+        parent->second.directories.erase(old_name);
+    }
+    directories_[new_parent].directories.insert(new_name);
+}
+
+DirectoryDiff LocalManifest::rescan(const std::string& root, const std::string& directory)
+{
+    DirectoryDiff diff;
+    std::string full_path = directory.empty() ? root : root + "/" + directory;
+    std::time_t now = std::time(nullptr);
+
+    // the time is taken before listing, anything changed later shows up as newer
+    struct stat directory_info;
+    if(stat(full_path.c_str(), &directory_info) != 0 || !S_ISDIR(directory_info.st_mode))
+    {
+        std::lock_guard<std::mutex> lock(manifest_mtx_);
+        auto record = directories_.find(directory);
+        if(record != directories_.end())
+        {
+            for(const auto& file : record->second.files)
+            {
+                diff.deleted_files.push_back(file.first);
+            }
+            diff.deleted_directories.assign(record->second.directories.begin(), record->second.directories.end());
+            remove_directory_(directory);
+        }
+        return diff;
+    }
+
+    DirectoryRecord fresh;
+    fresh.modification_time = directory_info.st_mtime;
+    fresh.racy = directory_info.st_mtime >= now;
+
+    std::error_code error;
+    fs::directory_iterator it(full_path, error);
+    for(; !error && it != fs::directory_iterator(); it.increment(error))
+    {
+        struct stat entry_info;
+        std::string name = it->path().filename().string();
+        if(lstat(it->path().c_str(), &entry_info) != 0)
+        {
+            continue;
+        }
+
+        if(S_ISDIR(entry_info.st_mode))
+        {
+            fresh.directories.insert(name);
+        }
+        else if(S_ISREG(entry_info.st_mode))
+        {
+            FileRecord& record = fresh.files[name];
+            record.size = entry_info.st_size;
+            record.modification_time = entry_info.st_mtime;
+            record.inode = entry_info.st_ino;
+            record.racy = entry_info.st_mtime >= now;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    DirectoryRecord& record = directories_[directory];
+    for(const auto& file : fresh.files)
+    {
+        auto known = record.files.find(file.first);
+        if(known == record.files.end())
+        {
+            diff.created_files.push_back(file.first);
+        }
+        else if(known->second.racy
+            || known->second.size != file.second.size
+            || known->second.modification_time != file.second.modification_time
+            || known->second.inode != file.second.inode)
+        {
+            diff.modified_files.push_back(file.first);
+        }
+    }
+    for(const auto& file : record.files)
+    {
+        if(fresh.files.count(file.first) == 0)
+        {
+            diff.deleted_files.push_back(file.first);
+        }
+    }
+
+    for(const std::string& child : fresh.directories)
+    {
+        if(record.directories.count(child) == 0)
+        {
+            diff.created_directories.push_back(child);
+        }
+    }
+    for(const std::string& child : record.directories)
+    {
+        if(fresh.directories.count(child) == 0)
+        {
+            diff.deleted_directories.push_back(child);
+        }
+    }
+
+    record = std::move(fresh);
+    for(const std::string& child : diff.deleted_directories)
+    {
+        remove_directory_(join_path(directory, child));
+    }
+
+    if(!directory.empty())
+    {
+        std::string parent;
+        std::string name;
+        split_path(directory, parent, name);
+        directories_[parent].directories.insert(name);
+    }
+    return diff;
+}
+
+std::size_t LocalManifest::get_directory_count()
+{
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    return directories_.size();
+}
+
+std::size_t LocalManifest::get_file_count()
+{
+    std::lock_guard<std::mutex> lock(manifest_mtx_);
+    std::size_t files = 0;
+    for(const auto& directory : directories_)
+    {
+        files += directory.second.files.size();
+    }
+    return files;
+}
+
+void LocalManifest::remove_directory_(const std::string& directory)
+{
+    std::vector<std::string> subtree = {directory};
+    for(std::size_t i = 0; i < subtree.size(); i++)
+    {
+        auto record = directories_.find(subtree[i]);
+        if(record == directories_.end())
+        {
+            continue;
+        }
+        for(const std::string& child : record->second.directories)
+        {
+            subtree.push_back(subtree[i] + "/" + child);
+        }
+        directories_.erase(record);
+    }
+
+    std::string parent;
+    std::string name;
+    split_path(directory, parent, name);
+    auto parent_record = directories_.find(parent);
+    if(parent_record != directories_.end() && !directory.empty())
+    {
+        parent_record->second.directories.erase(name);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+#include <cstdint>
+
+// synchronization
+#include <mutex>
+
+namespace local_manifest
+{
+    struct FileRecord
+    {
+        uint64_t size = 0;
+        std::time_t modification_time = 0;
+        uint64_t inode = 0;  // a file replaced by a rename keeps neither
+        bool racy = false;   // recorded in the second it was last modified
+    };
+
+    struct DirectoryRecord
+    {
+        std::time_t modification_time = 0;
+        bool racy = false;
+        std::unordered_map<std::string, FileRecord> files;
+        std::unordered_set<std::string> directories;
+    };
+
+    // names relative to the rescanned directory
+    struct DirectoryDiff
+    {
+        std::vector<std::string> created_files;
+        std::vector<std::string> modified_files;
+        std::vector<std::string> deleted_files;
+        std::vector<std::string> created_directories;
+        std::vector<std::string> deleted_directories;
+    };
+
+    class LocalManifest
+    {
+        // what the client last saw of the sync dir, one record per directory
+        // with the size, modification time and inode of every file in it
+        // times have second resolution, anything recorded within the second it
+        // changed in is taken for changed again, as it may still have
+        public:
+            void clear();
+
+            // walks root with the shared directory scanner, replacing every record
+            // returns the directories found, parents first
+            std::vector<std::string> build(const std::string& root);
+
+            // stats one file and records it, or forgets it when it is gone
+            void update_file(const std::string& root, const std::string& path);
+
+            // forgets a file, or a directory with everything under it
+            void remove(const std::string& path);
+            void rename(const std::string& old_path, const std::string& new_path);
+
+            // lists one directory, compares it with its record and records it anew
+            DirectoryDiff rescan(const std::string& root, const std::string& directory);
+
+            std::size_t get_directory_count();
+            std::size_t get_file_count();
+
+        private:
+            // keyed by path relative to the root, "" for the root itself
+            std::unordered_map<std::string, DirectoryRecord> directories_;
+            std::mutex manifest_mtx_;
+
+            // NOTE: caller must hold manifest_mtx_
+            void remove_directory_(const std::string& directory);
+    };
+}
@@ -0,0 +1,879 @@
+// c++
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "metadata_journal.hpp"
+#include "utils.hpp"
+
+using namespace metadata_journal;
+
+const char JOURNAL_MAGIC[8] = {'S', 'W', 'I', 'Z', 'J', 'N', 'L', '1'};
+const char CHECKPOINT_MAGIC[8] = {'S', 'W', 'I', 'Z', 'I', 'D', 'X', '1'};
+const std::size_t JOURNAL_HEADER_SIZE = sizeof(JOURNAL_MAGIC) + sizeof(uint64_t);
+const std::size_t RECORD_FRAME_SIZE = 2 * sizeof(uint32_t);  // body length + crc
+const uint32_t MAX_RECORD_SIZE = 64 * 1024;
+
+// little helpers to (de)serialize fixed width fields in host order
+template <typename T>
+static void write_field(std::string& buffer, T value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void write_string(std::string& buffer, const std::string& value)
+{
+    write_field<uint16_t>(buffer, static_cast<uint16_t>(value.size()));
+    buffer.append(value);
+}
+
+template <typename T>
+static bool read_field(const char*& cursor, const char* end, T& value)
+{
+    if(static_cast<std::size_t>(end - cursor) < sizeof(T))
+    {
+        return false;
+    }
+    std::memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+static bool read_string(const char*& cursor, const char* end, std::string& value)
+{
+    uint16_t length;
+    if(!read_field(cursor, end, length) || static_cast<std::size_t>(end - cursor) < length)
+    {
+        return false;
+    }
+    value.assign(cursor, length);
+    cursor += length;
+    return true;
+}
+
+static void write_all(int fd, const std::string& data, const std::string& path)
+{
+    std::size_t written = 0;
+    while(written < data.size())
+    {
+        ssize_t result = write(fd, data.data() + written, data.size() - written);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("[METADATA JOURNAL] Could not write on \"" + path + "\": " + std::strerror(errno));
+        }
+        written += result;
+    }
+}
+
+static std::string read_file(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return "";
+    }
+
+    std::string contents;
+    char buffer[64 * 1024];
+    ssize_t result;
+    while((result = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            close(fd);
+            throw std::runtime_error("[METADATA JOURNAL] Could not read \"" + path + "\": " + std::strerror(errno));
+        }
+        contents.append(buffer, result);
+    }
+    close(fd);
+    return contents;
+}
+
+static void read_at(int fd, uint64_t offset, char* buffer, std::size_t size, const std::string& path)
+{
+    std::size_t done = 0;
+    while(done < size)
+    {
+        ssize_t result = pread(fd, buffer + done, size - done, offset + done);
+        if(result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(result <= 0)
+        {
+            throw std::runtime_error("[METADATA JOURNAL] Could not read \"" + path + "\"!");
+        }
+        done += result;
+    }
+}
+
+// writes a whole file aside, syncs it and renames it over path
+static void replace_file(const std::string& path, const std::string& contents)
+{
+    std::string temp_path = path + ".swizdownload";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not create \"" + temp_path + "\": " + std::strerror(errno));
+    }
+
+    try
+    {
+        write_all(fd, contents, temp_path);
+    }
+    catch(const std::exception& e)
+    {
+        close(fd);
+        throw;
+    }
+    fdatasync(fd);
+    close(fd);
+
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not replace \"" + path + "\": " + std::strerror(errno));
+    }
+}
+
+MetadataJournal::MetadataJournal(const std::string& path, bool sync_every_append)
+    :   path_(path),
+        fd_(-1),
+        sync_every_append_(sync_every_append),
+        next_lsn_(1),
+        size_(0)
+{
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd_ < 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not open \"" + path_ + "\": " + std::strerror(errno));
+    }
+
+    struct stat journal_info;
+    fstat(fd_, &journal_info);
+    if(journal_info.st_size == 0)
+    {
+        // brand new journal, lsns start right after the base
+        std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        write_field<uint64_t>(header, 0);
+        write_all(fd_, header, path_);
+        fdatasync(fd_);
+    }
+}
+
+MetadataJournal::~MetadataJournal()
+{
+    if(fd_ >= 0)
+    {
+        fdatasync(fd_);
+        close(fd_);
+    }
+}
+
+uint64_t MetadataJournal::replay(std::function<void(const JournalRecord&)> on_record)
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+    return read_records_(on_record);
+}
+
+uint64_t MetadataJournal::scan_user(
+    const std::string& username, 
+    uint64_t after_lsn, 
+    std::function<void(const JournalRecord&)> on_record)
+{
+    // the locations are copied along with a descriptor of the journal they
+    // point into - a compaction renames a new journal over the path, but this
+    // one keeps every record read here until it is closed
+    std::vector<RecordLocation> locations;
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(journal_mtx_);
+        auto user_records = user_records_.find(username);
+        if(user_records == user_records_.end())
+        {
+            return 0;
+        }
+
+        auto first = std::upper_bound(
+            user_records->second.begin(), 
+            user_records->second.end(), 
+            after_lsn,
+            [](uint64_t lsn, const RecordLocation& location)
+            {
+                return lsn < location.lsn;
+            });
+        if(first == user_records->second.end())
+        {
+            return 0;
+        }
+        locations.assign(first, user_records->second.end());
+
+        fd = dup(fd_);
+        if(fd < 0)
+        {
+            throw std::runtime_error("[METADATA JOURNAL] Could not open \"" + path_ + "\": " + std::strerror(errno));
+        }
+    }
+
+    uint64_t scanned = 0;
+    try
+    {
+        std::string body;
+        for(const RecordLocation& location : locations)
+        {
+            char frame[RECORD_FRAME_SIZE];
+            uint32_t body_size;
+            uint32_t checksum;
+            read_at(fd, location.offset, frame, RECORD_FRAME_SIZE, path_);
+            std::memcpy(&body_size, frame, sizeof(body_size));
+            std::memcpy(&checksum, frame + sizeof(body_size), sizeof(checksum));
+            if(body_size > MAX_RECORD_SIZE)
+            {
+                throw std::runtime_error("[METADATA JOURNAL] Damaged record in \"" + path_ + "\"!");
+            }
+
+            body.resize(body_size);
+            read_at(fd, location.offset + RECORD_FRAME_SIZE, &body[0], body_size, path_);
+            JournalRecord record;
+            if(calculate_crc32(body.data(), body_size) != checksum 
+                || !decode_(body.data(), body_size, record)
+                || record.lsn != location.lsn)
+            {
+                throw std::runtime_error("[METADATA JOURNAL] Damaged record in \"" + path_ + "\"!");
+            }
+
+            on_record(record);
+            scanned++;
+        }
+    }
+    catch(const std::exception& e)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return scanned;
+}
+
+uint64_t MetadataJournal::append(JournalRecord record)
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+
+    record.lsn = next_lsn_;
+    std::string frame = encode_(record);
+
+    // a single write per record keeps concurrent appends from interleaving
+    off_t offset = lseek(fd_, 0, SEEK_END);
+    if(offset < 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not seek \"" + path_ + "\": " + std::strerror(errno));
+    }
+    write_all(fd_, frame, path_);
+    next_lsn_++;
+    size_ += frame.size();
+    user_records_[record.username].push_back({record.lsn, static_cast<uint64_t>(offset)});
+
+    if(sync_every_append_ && fdatasync(fd_) != 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not sync \"" + path_ + "\": " + std::strerror(errno));
+    }
+    return record.lsn;
+}
+
+void MetadataJournal::compact(uint64_t checkpoint_lsn, std::function<bool(const JournalRecord&)> keep)
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+
+    std::vector<JournalRecord> records;
+    std::map<std::pair<std::string, std::string>, uint64_t> open_transfers;
+    read_records_(
+        [&records, &open_transfers](const JournalRecord& record)
+        {
+            // a transfer stays open until anything else happens to its path
+            std::pair<std::string, std::string> transfer(record.username, record.path);
+            if(record.operation == JournalOperation::BEGIN_TRANSFER)
+            {
+                open_transfers[transfer] = record.lsn;
+            }
+            else
+            {
+                open_transfers.erase(transfer);
+            }
+            records.push_back(record);
+        });
+
+    // keeps only the records checkpoints do not cover yet - the new base lsn
+    // makes sure lsns keep growing even if the journal ends up empty
+    std::string contents(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    write_field<uint64_t>(contents, checkpoint_lsn);
+
+    std::unordered_map<std::string, std::vector<RecordLocation>> user_records;
+    for(const JournalRecord& record : records)
+    {
+        auto open_transfer = open_transfers.find(std::make_pair(record.username, record.path));
+        bool still_open = open_transfer != open_transfers.end() && open_transfer->second == record.lsn;
+        if(record.lsn > checkpoint_lsn || still_open || (keep && keep(record)))
+        {
+            user_records[record.username].push_back({record.lsn, contents.size()});
+            contents += encode_(record);
+        }
+    }
+
+    replace_file(path_, contents);
+
+    close(fd_);
+    fd_ = open(path_.c_str(), O_RDWR | O_CLOEXEC);
+    if(fd_ < 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not reopen \"" + path_ + "\": " + std::strerror(errno));
+    }
+    size_ = contents.size() - JOURNAL_HEADER_SIZE;
+    user_records_.swap(user_records);
+}
+
+void MetadataJournal::sync()
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+    if(fdatasync(fd_) != 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Could not sync \"" + path_ + "\": " + std::strerror(errno));
+    }
+}
+
+uint64_t MetadataJournal::get_last_lsn()
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+    return next_lsn_ - 1;
+}
+
+uint64_t MetadataJournal::get_size()
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+    return size_;
+}
+
+uint64_t MetadataJournal::get_user_last_lsn(const std::string& username)
+{
+    std::lock_guard<std::mutex> lock(journal_mtx_);
+    auto it = user_records_.find(username);
+    return (it != user_records_.end() && !it->second.empty()) ? it->second.back().lsn : 0;
+}
+
+std::string MetadataJournal::encode_(const JournalRecord& record)
+{
+    std::string body;
+    write_field<uint64_t>(body, record.lsn);
+    write_field<uint8_t>(body, static_cast<uint8_t>(record.operation));
+    write_string(body, record.username);
+    write_string(body, record.path);
+    write_field<uint64_t>(body, record.size);
+    write_field<int64_t>(body, record.modification_time);
+    write_string(body, record.checksum);
+
+    std::string frame;
+    frame.reserve(RECORD_FRAME_SIZE + body.size());
+    write_field<uint32_t>(frame, static_cast<uint32_t>(body.size()));
+    write_field<uint32_t>(frame, calculate_crc32(body.data(), body.size()));
+    frame += body;
+    return frame;
+}
+
+bool MetadataJournal::decode_(const char* data, std::size_t size, JournalRecord& record)
+{
+    const char* cursor = data;
+    const char* end = data + size;
+
+    uint8_t operation;
+    if(!read_field(cursor, end, record.lsn) 
+        || !read_field(cursor, end, operation)
+        || !read_string(cursor, end, record.username)
+        || !read_string(cursor, end, record.path)
+        || !read_field(cursor, end, record.size)
+        || !read_field(cursor, end, record.modification_time)
+        || !read_string(cursor, end, record.checksum))
+    {
+        return false;
+    }
+
+    if(operation < static_cast<uint8_t>(JournalOperation::BEGIN_TRANSFER) 
+        || operation > static_cast<uint8_t>(JournalOperation::DELETE_FILE))
+    {
+        return false;
+    }
+    record.operation = static_cast<JournalOperation>(operation);
+    return cursor == end;
+}
+
+uint64_t MetadataJournal::read_records_(std::function<void(const JournalRecord&)> on_record, bool repair)
+{
+    // NOTE: caller must hold journal_mtx_
+    std::string contents = read_file(path_);
+    if(contents.size() < JOURNAL_HEADER_SIZE 
+        || std::memcmp(contents.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] \"" + path_ + "\" is not a journal!");
+    }
+
+    uint64_t base_lsn;
+    std::memcpy(&base_lsn, contents.data() + sizeof(JOURNAL_MAGIC), sizeof(base_lsn));
+
+    uint64_t last_lsn = base_lsn;
+    uint64_t replayed = 0;
+    if(repair)
+    {
+        user_records_.clear();
+    }
+    std::size_t offset = JOURNAL_HEADER_SIZE;
+    while(offset + RECORD_FRAME_SIZE <= contents.size())
+    {
+        uint32_t body_size;
+        uint32_t checksum;
+        std::memcpy(&body_size, contents.data() + offset, sizeof(body_size));
+        std::memcpy(&checksum, contents.data() + offset + sizeof(body_size), sizeof(checksum));
+
+        const char* body = contents.data() + offset + RECORD_FRAME_SIZE;
+        if(body_size > MAX_RECORD_SIZE 
+            || offset + RECORD_FRAME_SIZE + body_size > contents.size()
+            || calculate_crc32(body, body_size) != checksum)
+        {
+            break;
+        }
+
+        JournalRecord record;
+        if(!decode_(body, body_size, record))
+        {
+            break;
+        }
+
+        on_record(record);
+        last_lsn = std::max(last_lsn, record.lsn);
+        if(repair)
+        {
+            user_records_[record.username].push_back({record.lsn, offset});
+        }
+        replayed++;
+        offset += RECORD_FRAME_SIZE + body_size;
+    }
+
+    if(!repair)
+    {
+        return replayed;
+    }
+
+    // anything after the last intact record was torn by a crash
+    if(offset < contents.size())
+    {
+        if(ftruncate(fd_, offset) != 0)
+        {
+            throw std::runtime_error("[METADATA JOURNAL] Could not cut torn tail of \"" + path_ + "\"!");
+        }
+        fdatasync(fd_);
+    }
+
+    next_lsn_ = last_lsn + 1;
+    size_ = offset - JOURNAL_HEADER_SIZE;
+    return replayed;
+}
+
+FileIndex::FileIndex(path_table::PathTable* paths)
+    :   paths_(paths),
+        total_bytes_(0),
+        reserved_bytes_(0),
+        reserved_files_(0),
+        max_bytes_(0),
+        max_files_(0),
+        admitted_transfers_(0),
+        rejected_transfers_(0),
+        applied_lsn_(0),
+        dirty_(false),
+        changes_(0)
+{
+    //
+}
+
+void FileIndex::apply(const JournalRecord& record)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    apply_locked_(record);
+}
+
+uint64_t FileIndex::log(MetadataJournal& journal, JournalRecord record)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    record.lsn = journal.append(record);
+    apply_locked_(record);
+    return record.lsn;
+}
+
+void FileIndex::apply_locked_(const JournalRecord& record)
+{
+    // NOTE: caller must hold index_mtx_
+    // replaying a record twice is harmless, but an older one would undo newer state
+    if(record.lsn != 0 && record.lsn <= applied_lsn_)
+    {
+        return;
+    }
+
+    switch(record.operation)
+    {
+        case JournalOperation::COMMIT_TRANSFER:
+        {
+            // the reserved room turns into usage in the same step
+            path_table::path_id id = paths_->intern(record.path);
+            release_locked_(id, true);
+            FileRecord& file = files_[id];
+            total_bytes_ = total_bytes_ - file.size + record.size;
+            file.size = record.size;
+            file.modification_time = record.modification_time;
+            file.checksum = record.checksum;
+            dirty_ = true;
+            changes_++;
+            break;
+        }
+        case JournalOperation::DELETE_FILE:
+        {
+            path_table::path_id id = paths_->find(record.path);
+            auto it = files_.find(id);
+            if(it != files_.end())
+            {
+                total_bytes_ -= it->second.size;
+                files_.erase(it);
+                dirty_ = true;
+                changes_++;
+            }
+            break;
+        }
+        case JournalOperation::ABORT_TRANSFER:
+        {
+            release_locked_(paths_->find(record.path));
+            break;
+        }
+        default:
+        {
+            // transfers in flight are not part of the index
+            break;
+        }
+    }
+
+    if(record.lsn != 0)
+    {
+        applied_lsn_ = record.lsn;
+    }
+}
+
+void FileIndex::release_locked_(path_table::path_id id, bool committed)
+{
+    // NOTE: caller must hold index_mtx_
+    auto it = reservations_.find(id);
+    if(it == reservations_.end())
+    {
+        return;
+    }
+
+    // a new file is reserved once for all transfers to the path, and
+    // is no longer reserved once one of them committed it
+    reserved_bytes_ -= it->second.transfers.front();
+    it->second.transfers.pop_front();
+    if(committed || it->second.transfers.empty())
+    {
+        reserved_files_ -= it->second.files;
+        it->second.files = 0;
+    }
+    if(it->second.transfers.empty())
+    {
+        reservations_.erase(it);
+    }
+}
+
+void FileIndex::drop_stale_reservations_()
+{
+    // NOTE: caller must hold index_mtx_
+    std::time_t stale_before = std::time(nullptr) - STALE_RESERVATION_SECONDS;
+    for(auto it = reservations_.begin(); it != reservations_.end();)
+    {
+        if(it->second.reserved_time < stale_before)
+        {
+            for(uint64_t bytes : it->second.transfers)
+            {
+                reserved_bytes_ -= bytes;
+            }
+            reserved_files_ -= it->second.files;
+            it = reservations_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+bool FileIndex::fits_locked_(uint64_t bytes, uint64_t files)
+{
+    // NOTE: caller must hold index_mtx_
+    bool bytes_fit = max_bytes_ == 0 || total_bytes_ + reserved_bytes_ + bytes <= max_bytes_;
+    bool files_fit = max_files_ == 0 || files_.size() + reserved_files_ + files <= max_files_;
+    return bytes_fit && files_fit;
+}
+
+bool FileIndex::get(const std::string& path, FileRecord& record)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    auto it = files_.find(paths_->find(path));
+    if(it == files_.end())
+    {
+        return false;
+    }
+    record = it->second;
+    return true;
+}
+
+std::size_t FileIndex::size()
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    return files_.size();
+}
+
+uint64_t FileIndex::get_total_bytes()
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    return total_bytes_;
+}
+
+void FileIndex::set_quota(uint64_t max_bytes, uint64_t max_files)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    max_bytes_ = max_bytes;
+    max_files_ = max_files;
+}
+
+bool FileIndex::reserve(const std::string& path, uint64_t incoming_bytes, std::string& reason)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    path_table::path_id id = paths_->intern(path);
+
+    // a replaced file frees its own size once the new one is committed
+    auto it = files_.find(id);
+    uint64_t current_bytes = (it != files_.end()) ? it->second.size : 0;
+    uint64_t bytes = (incoming_bytes > current_bytes) ? incoming_bytes - current_bytes : 0;
+    uint64_t files = (it == files_.end() && reservations_.count(id) == 0) ? 1 : 0;
+
+    // abandoned transfers only get looked for when they could be in the way
+    if(!fits_locked_(bytes, files))
+    {
+        drop_stale_reservations_();
+        files = (it == files_.end() && reservations_.count(id) == 0) ? 1 : 0;
+    }
+    if(!fits_locked_(bytes, files))
+    {
+        rejected_transfers_++;
+        reason = "User quota exceeded: " + std::to_string(total_bytes_ + reserved_bytes_) + " of ";
+        reason += std::to_string(max_bytes_) + " bytes and " + std::to_string(files_.size() + reserved_files_);
+        reason += " of " + std::to_string(max_files_) + " files in use.";
+        return false;
+    }
+
+    Reservation& reservation = reservations_[id];
+    reservation.transfers.push_back(bytes);
+    reservation.files += files;
+    reservation.reserved_time = std::time(nullptr);
+    reserved_bytes_ += bytes;
+    reserved_files_ += files;
+    admitted_transfers_++;
+    return true;
+}
+
+bool FileIndex::has_quota()
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    return max_bytes_ > 0 || max_files_ > 0;
+}
+
+bool FileIndex::renew(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    auto it = reservations_.find(paths_->find(path));
+    if(it == reservations_.end())
+    {
+        return false;
+    }
+    it->second.reserved_time = std::time(nullptr);
+    return true;
+}
+
+void FileIndex::release(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    release_locked_(paths_->find(path));
+}
+
+QuotaStats FileIndex::get_quota_stats()
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    QuotaStats stats;
+    stats.used_bytes = total_bytes_;
+    stats.used_files = files_.size();
+    stats.reserved_bytes = reserved_bytes_;
+    stats.reserved_files = reserved_files_;
+    stats.reserved_transfers = 0;
+    for(const auto& reservation : reservations_)
+    {
+        stats.reserved_transfers += reservation.second.transfers.size();
+    }
+    stats.max_bytes = max_bytes_;
+    stats.max_files = max_files_;
+    stats.admitted_transfers = admitted_transfers_;
+    stats.rejected_transfers = rejected_transfers_;
+    return stats;
+}
+
+std::string FileIndex::format_quota_stats()
+{
+    QuotaStats stats = get_quota_stats();
+    std::string output = "usage: " + std::to_string(stats.used_bytes);
+    output += (stats.max_bytes > 0) ? "/" + std::to_string(stats.max_bytes) : "";
+    output += " bytes, " + std::to_string(stats.used_files);
+    output += (stats.max_files > 0) ? "/" + std::to_string(stats.max_files) : "";
+    output += " files, " + std::to_string(stats.reserved_bytes) + " bytes reserved by ";
+    output += std::to_string(stats.reserved_transfers) + " transfers, ";
+    output += std::to_string(stats.admitted_transfers) + " admitted, ";
+    output += std::to_string(stats.rejected_transfers) + " rejected";
+    return output;
+}
+
+uint64_t FileIndex::get_applied_lsn()
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    return applied_lsn_;
+}
+
+bool FileIndex::is_dirty()
+{
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    return dirty_;
+}
+
+void FileIndex::save_checkpoint(const std::string& checkpoint_path, uint64_t lsn)
+{
+    std::string contents(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    uint64_t saved_changes;
+    {
+        std::lock_guard<std::mutex> lock(index_mtx_);
+
+        // the checkpoint covers whatever was applied, even past the requested lsn
+        write_field<uint64_t>(contents, std::max(lsn, applied_lsn_));
+        write_field<uint64_t>(contents, files_.size());
+        for(const auto& [id, file] : files_)
+        {
+            write_string(contents, paths_->resolve(id));
+            write_field<uint64_t>(contents, file.size);
+            write_field<int64_t>(contents, file.modification_time);
+            write_string(contents, file.checksum);
+        }
+        write_field<uint32_t>(contents, calculate_crc32(contents.data(), contents.size()));
+        saved_changes = changes_;
+    }
+
+    // still dirty if the write failed, or if anything was applied meanwhile
+    replace_file(checkpoint_path, contents);
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    if(changes_ == saved_changes)
+    {
+        dirty_ = false;
+    }
+}
+
+uint64_t FileIndex::read_checkpoint_lsn(const std::string& checkpoint_path)
+{
+    // only the header is looked at, the body is verified when it is loaded
+    int fd = open(checkpoint_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return 0;
+    }
+
+    char header[sizeof(CHECKPOINT_MAGIC) + sizeof(uint64_t)];
+    ssize_t result = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    if(result != static_cast<ssize_t>(sizeof(header)) 
+        || std::memcmp(header, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+    {
+        return 0;
+    }
+
+    uint64_t lsn;
+    std::memcpy(&lsn, header + sizeof(CHECKPOINT_MAGIC), sizeof(lsn));
+    return lsn;
+}
+
+bool FileIndex::load_checkpoint(const std::string& checkpoint_path)
+{
+    std::string contents = read_file(checkpoint_path);
+    if(contents.empty())
+    {
+        return false;
+    }
+
+    const std::size_t minimum_size = sizeof(CHECKPOINT_MAGIC) + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+    if(contents.size() < minimum_size 
+        || std::memcmp(contents.data(), CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] \"" + checkpoint_path + "\" is not an index checkpoint!");
+    }
+
+    uint32_t checksum;
+    std::size_t body_size = contents.size() - sizeof(checksum);
+    std::memcpy(&checksum, contents.data() + body_size, sizeof(checksum));
+    if(calculate_crc32(contents.data(), body_size) != checksum)
+    {
+        throw std::runtime_error("[METADATA JOURNAL] Index checkpoint \"" + checkpoint_path + "\" is corrupted!");
+    }
+
+    const char* cursor = contents.data() + sizeof(CHECKPOINT_MAGIC);
+    const char* end = contents.data() + body_size;
+
+    uint64_t lsn;
+    uint64_t count;
+    read_field(cursor, end, lsn);
+    read_field(cursor, end, count);
+
+    std::lock_guard<std::mutex> lock(index_mtx_);
+    files_.clear();
+    files_.reserve(count);
+    total_bytes_ = 0;
+    for(uint64_t i = 0; i < count; i++)
+    {
+        std::string path;
+        FileRecord file;
+        if(!read_string(cursor, end, path)
+            || !read_field(cursor, end, file.size)
+            || !read_field(cursor, end, file.modification_time)
+            || !read_string(cursor, end, file.checksum))
+        {
+            throw std::runtime_error("[METADATA JOURNAL] Index checkpoint \"" + checkpoint_path + "\" is truncated!");
+        }
+
+        total_bytes_ += file.size;
+        files_.emplace(paths_->intern(path), std::move(file));
+    }
+
+    applied_lsn_ = lsn;
+    dirty_ = false;
+    return true;
+}
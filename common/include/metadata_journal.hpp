@@ -0,0 +1,201 @@
+#pragma once
+
+// c++
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+// synchronization
+#include <mutex>
+
+// locals
+#include "path_table.hpp"
+
+namespace metadata_journal
+{
+    enum class JournalOperation : uint8_t
+    {
+        BEGIN_TRANSFER = 1,   // first chunk of a file was received
+        COMMIT_TRANSFER = 2,  // file was published and is durable
+        ABORT_TRANSFER = 3,   // transfer failed, temporary file is garbage
+        DELETE_FILE = 4
+    };
+
+    struct JournalRecord
+    {
+        uint64_t lsn = 0;  // assigned on append
+        JournalOperation operation = JournalOperation::BEGIN_TRANSFER;
+        std::string username;
+        std::string path;  // relative to the user directory, as sent by clients
+        uint64_t size = 0;
+        int64_t modification_time = 0;
+        std::string checksum;
+    };
+
+    struct FileRecord
+    {
+        uint64_t size = 0;
+        int64_t modification_time = 0;
+        std::string checksum;
+    };
+
+    const int STALE_RESERVATION_SECONDS = 300;  // transfers without a chunk for this long are abandoned
+
+    struct QuotaStats
+    {
+        uint64_t used_bytes = 0;
+        uint64_t used_files = 0;
+        uint64_t reserved_bytes = 0;
+        uint64_t reserved_files = 0;
+        uint64_t reserved_transfers = 0;
+        uint64_t max_bytes = 0;   // 0 is no limit
+        uint64_t max_files = 0;
+        uint64_t admitted_transfers = 0;
+        uint64_t rejected_transfers = 0;
+    };
+
+    class MetadataJournal
+    {
+        // append only log of metadata operations, shared by every user
+        // records are framed with their length and a crc, so a write torn by a
+        // crash is detected on replay and cut off
+        public:
+            MetadataJournal(const std::string& path, bool sync_every_append = false);
+            ~MetadataJournal();
+
+            // reads every intact record, must run before the first append
+            // returns how many records were replayed
+            uint64_t replay(std::function<void(const JournalRecord&)> on_record);
+
+            // reads the records of a single user past after_lsn, going straight to
+            // where they are instead of through the whole journal, and without
+            // holding appends back while reading - throws on a damaged record
+            uint64_t scan_user(
+                const std::string& username, 
+                uint64_t after_lsn, 
+                std::function<void(const JournalRecord&)> on_record);
+
+            // returns the lsn given to the record
+            uint64_t append(JournalRecord record);
+
+            // drops every record up to lsn, once they are covered by checkpoints
+            // the begin record of a transfer still open is carried over, so
+            // recovery can clean up after it, and so is any record keep asks for
+            void compact(uint64_t checkpoint_lsn, std::function<bool(const JournalRecord&)> keep = nullptr);
+
+            // makes every record appended so far durable, throws on failure
+            void sync();
+
+            uint64_t get_last_lsn();
+            uint64_t get_size();
+
+            // lsn of the last record of the user still in the journal, 0 if none
+            uint64_t get_user_last_lsn(const std::string& username);
+
+        private:
+            std::string path_;
+            int fd_;
+            bool sync_every_append_;
+            uint64_t next_lsn_;
+            uint64_t size_;
+
+            // where every record of each user starts, in lsn order
+            struct RecordLocation
+            {
+                uint64_t lsn;
+                uint64_t offset;
+            };
+            std::unordered_map<std::string, std::vector<RecordLocation>> user_records_;
+            std::mutex journal_mtx_;
+
+            static std::string encode_(const JournalRecord& record);
+            static bool decode_(const char* data, std::size_t size, JournalRecord& record);
+
+            // repair cuts a torn tail off and resets the lsn and size counters
+            uint64_t read_records_(std::function<void(const JournalRecord&)> on_record, bool repair = true);
+    };
+
+    class FileIndex
+    {
+        // committed files of a single user, keyed by interned path
+        // rebuilt on load from the last checkpoint plus the journal tail
+        // usage totals are kept along with it, so quota admission only
+        // compares counters - transfers reserve their room when admitted
+        // and hand it over to the usage once their commit is applied
+        public:
+            FileIndex(path_table::PathTable* paths);
+
+            // applies a journal record, records already covered are ignored
+            void apply(const JournalRecord& record);
+
+            // appends the record to the journal and applies it atomically, so a
+            // checkpoint never covers an lsn whose record it does not contain
+            uint64_t log(MetadataJournal& journal, JournalRecord record);
+
+            bool get(const std::string& path, FileRecord& record);
+            std::size_t size();
+            uint64_t get_total_bytes();
+
+            // 0 lifts a limit
+            void set_quota(uint64_t max_bytes, uint64_t max_files);
+
+            // admits a transfer of up to incoming_bytes to path, keeping room for
+            // it until its commit or abort is applied - reason is set on rejection
+            // concurrent transfers to the same path each hold their own room,
+            // every commit or abort hands back the oldest one
+            bool reserve(const std::string& path, uint64_t incoming_bytes, std::string& reason);
+            bool has_quota();
+
+            // keeps the reservation of an ongoing transfer from going stale
+            // returns false if the path has none
+            bool renew(const std::string& path);
+            void release(const std::string& path);
+
+            QuotaStats get_quota_stats();
+            std::string format_quota_stats();
+
+            uint64_t get_applied_lsn();
+            bool is_dirty();
+
+            // checkpoints are written aside and renamed over the previous one
+            void save_checkpoint(const std::string& checkpoint_path, uint64_t lsn);
+            bool load_checkpoint(const std::string& checkpoint_path);
+
+            // lsn a checkpoint covers, 0 if it is missing or unreadable
+            static uint64_t read_checkpoint_lsn(const std::string& checkpoint_path);
+
+        private:
+            path_table::PathTable* paths_;
+            struct Reservation
+            {
+                std::deque<uint64_t> transfers;  // bytes of every admitted transfer, oldest first
+                uint64_t files = 0;
+                std::time_t reserved_time = 0;   // or of the last chunk of any of them
+            };
+
+            std::unordered_map<path_table::path_id, FileRecord> files_;
+            uint64_t total_bytes_;
+
+            std::unordered_map<path_table::path_id, Reservation> reservations_;
+            uint64_t reserved_bytes_;
+            uint64_t reserved_files_;
+            uint64_t max_bytes_;
+            uint64_t max_files_;
+            uint64_t admitted_transfers_;
+            uint64_t rejected_transfers_;
+
+            uint64_t applied_lsn_;
+            bool dirty_;
+            uint64_t changes_;  // tells a checkpoint whether it missed a change while being written
+            std::mutex index_mtx_;
+
+            void apply_locked_(const JournalRecord& record);
+            void release_locked_(path_table::path_id id, bool committed = false);
+            void drop_stale_reservations_();
+            bool fits_locked_(uint64_t bytes, uint64_t files);
+    };
+}
@@ -10,7 +10,9 @@ using namespace utils_packet;
 using namespace async_cout;
 
 ClientConnectionManager::ClientConnectionManager()
-    :   is_connected_(false)
+    :   is_connected_(false),
+        resumed_(false),
+        received_packets_(0)
 {
     // initialization here
 }
@@ -56,11 +58,30 @@ int ClientConnectionManager::login(std::string username, std::string machine_nam
         std::string login_command = "login|" + username + "|" + machine_name;
         packet login_packet;
         strcharray(login_command, login_packet.command, sizeof(login_packet.command));
+
+        // the server resumes the previous session if it still keeps it, sending
+        // again whatever came after the packets received here
+        if(!resume_token_.empty())
+        {
+            std::string resumption = resume_token_ + "|" + std::to_string(received_packets_.load());
+            login_packet.payload = new char[resumption.size()];
+            std::memcpy(login_packet.payload, resumption.data(), resumption.size());
+            login_packet.payload_size = resumption.size();
+        }
         
         {
             std::unique_lock<std::mutex> lock(send_mtx_);
-            this->send_packet(login_packet, get_sock_fd());
+            try
+            {
+                this->send_packet(login_packet, get_sock_fd());
+            }
+            catch(const std::exception& e)
+            {
+                delete[] login_packet.payload;
+                throw;
+            }
         }
+        delete[] login_packet.payload;
     }
     catch(const std::exception& e)
     {
@@ -87,7 +108,22 @@ int ClientConnectionManager::login(std::string username, std::string machine_nam
             {
                 std::string session_sid = sanitized_payload[2];
                 int session_id = std::stoi(session_sid);
-                aprint("Login approved on session " + session_sid + "!", 1);
+
+                // servers without resumption send no token
+                resume_token_ = sanitized_payload.size() > 3 ? sanitized_payload[3] : "";
+                resumed_ = sanitized_payload.size() > 4 && sanitized_payload[4] == "resumed";
+                if(!resumed_)
+                {
+                    received_packets_.store(0);
+                }
+                if(resumed_)
+                {
+                    aprint("Resumed previous session as session " + session_sid + "!", 1);
+                }
+                else
+                {
+                    aprint("Login approved on session " + session_sid + "!", 1);
+                }
                 return session_id;
             }
             else if(status == "fail")
@@ -114,4 +150,14 @@ int ClientConnectionManager::login(std::string username, std::string machine_nam
 
     // unreachable
     return -1;
-}
\ No newline at end of file
+}
+
+bool ClientConnectionManager::was_resumed()
+{
+    return resumed_;
+}
+
+uint64_t ClientConnectionManager::count_received_packet()
+{
+    return received_packets_.fetch_add(1) + 1;
+}
@@ -8,6 +8,7 @@
 #include <functional>
 #include <vector>
 #include <tuple>
+#include <cstdint>
 
 // network related libraries
 #include <unistd.h>
@@ -109,13 +110,25 @@ namespace connection
             //std::vector<std::pair<std::string, int>> server_backups_address_;
 
             void connect_to_server(std::string ip_address, int port);
+
+            // presents the token of the previous session, if there was one,
+            // along with how many packets of it were received
             int login(std::string username, std::string machine_name);
             void replace_primary(std::string address, int port);
+
+            // whether the last login took a parked session back
+            bool was_resumed();
+
+            // counts a packet received on the session, returns the total
+            uint64_t count_received_packet();
         private:
             std::atomic<bool> is_connected_;
 
             std::string username_;
             std::string machine_name_;
+            std::string resume_token_;
+            bool resumed_;
+            std::atomic<uint64_t> received_packets_;  // on the current session, across resumptions
 
     };
 
@@ -136,7 +149,7 @@ namespace connection
             void start_accept_loop();
             void stop_accept_loop();
             void server_accept_loop(
-                std::function<void(int, std::string, std::string)> connection_stablished_callback = nullptr);
+                std::function<void(int, std::string, std::string, std::string)> connection_stablished_callback = nullptr);
 
             // operating mode and backups
             void check_primary_server();
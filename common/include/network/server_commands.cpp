@@ -86,7 +86,7 @@ void ServerConnectionManager::stop_accept_loop()
 }
 
 void ServerConnectionManager::server_accept_loop(
-    std::function<void(int, std::string, std::string)> connection_stablished_callback) 
+    std::function<void(int, std::string, std::string, std::string)> connection_stablished_callback) 
 {
     aprint("Starting server accept loop...", 2);
 
@@ -168,23 +168,20 @@ void ServerConnectionManager::server_accept_loop(
                             std::string machine_name = sanitized_payload[2];
                             bool valid_connection = is_valid_username(username);
 
+                            // a device coming back sends the token of its previous session
+                            std::string resume_token = charraystr(accept_packet.payload, accept_packet.payload_size);
+                            delete[] accept_packet.payload;
+
                             // tries to approve connection, after validating
                             if(valid_connection)
                             {
                                 try
                                 {
-                                    // adds new session to internal session vector
-                                    connection_stablished_callback(new_socket, username, machine_name);
-
-                                    // mounts and sends a packet approving the login request
-                                    packet approval_packet;
-                                    std::string command_response = "login|ok|" + new_socket;
-                                    strcharray(command_response, approval_packet.command, sizeof(approval_packet.command));
-                                    
-                                    {
-                                        std::unique_lock<std::mutex> lock(send_mtx_);
-                                        this->send_packet(approval_packet, new_socket);
-                                    }
+                                    // adds new session to internal session vector, or hands
+                                    // the socket to the session being resumed - the callback
+                                    // approves the login itself, as the session starts sending
+                                    // on the socket right after
+                                    connection_stablished_callback(new_socket, username, machine_name, resume_token);
 
                                     std::string output = "User " + username + " joined with a new session on ";
                                     output += machine_name + "!";
@@ -0,0 +1,504 @@
+// c++
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "offline_queue.hpp"
+#include "utils.hpp"
+
+using namespace offline_queue;
+
+const char QUEUE_MAGIC[8] = {'S', 'W', 'I', 'Z', 'O', 'F', 'Q', '1'};
+const std::size_t RECORD_FRAME_SIZE = 2 * sizeof(uint32_t);  // body length + crc
+const uint32_t MAX_RECORD_SIZE = 64 * 1024;
+
+template <typename T>
+static void write_field(std::string& buffer, T value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void write_string(std::string& buffer, const std::string& value)
+{
+    write_field<uint16_t>(buffer, static_cast<uint16_t>(value.size()));
+    buffer.append(value);
+}
+
+template <typename T>
+static bool read_field(const char*& cursor, const char* end, T& value)
+{
+    if(static_cast<std::size_t>(end - cursor) < sizeof(T))
+    {
+        return false;
+    }
+    std::memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+static bool read_string(const char*& cursor, const char* end, std::string& value)
+{
+    uint16_t length;
+    if(!read_field(cursor, end, length) || static_cast<std::size_t>(end - cursor) < length)
+    {
+        return false;
+    }
+    value.assign(cursor, length);
+    cursor += length;
+    return true;
+}
+
+static void write_all(int fd, const std::string& data, const std::string& path)
+{
+    std::size_t written = 0;
+    while(written < data.size())
+    {
+        ssize_t result = write(fd, data.data() + written, data.size() - written);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("[OFFLINE QUEUE] Could not write on \"" + path + "\": " + std::strerror(errno));
+        }
+        written += result;
+    }
+}
+
+static void sync_file(int fd, const std::string& path)
+{
+    if(fdatasync(fd) != 0)
+    {
+        throw std::runtime_error("[OFFLINE QUEUE] Could not sync \"" + path + "\": " + std::strerror(errno));
+    }
+}
+
+static std::string read_file(int fd, const std::string& path)
+{
+    std::string contents;
+    char buffer[64 * 1024];
+    ssize_t result;
+    off_t offset = 0;
+    while((result = pread(fd, buffer, sizeof(buffer), offset)) != 0)
+    {
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("[OFFLINE QUEUE] Could not read \"" + path + "\": " + std::strerror(errno));
+        }
+        contents.append(buffer, result);
+        offset += result;
+    }
+    return contents;
+}
+
+static void replace_file(const std::string& path, const std::string& contents)
+{
+    std::string temp_path = path + REWRITE_SUFFIX;
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        throw std::runtime_error("[OFFLINE QUEUE] Could not create \"" + temp_path + "\": " + std::strerror(errno));
+    }
+
+    try
+    {
+        write_all(fd, contents, temp_path);
+        sync_file(fd, temp_path);
+    }
+    catch(const std::exception& e)
+    {
+        close(fd);
+        unlink(temp_path.c_str());
+        throw;
+    }
+    close(fd);
+
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("[OFFLINE QUEUE] Could not replace \"" + path + "\": " + std::strerror(errno));
+    }
+}
+
+std::string offline_queue::queue_path(const std::string& sync_dir)
+{
+    std::size_t end = sync_dir.find_last_not_of('/');
+    return (end == std::string::npos ? sync_dir : sync_dir.substr(0, end + 1)) + QUEUE_SUFFIX;
+}
+
+std::vector<Operation> offline_queue::compact(const std::vector<Operation>& operations)
+{
+    // latest operation of each path, along with when it was queued
+    std::unordered_map<std::string, std::pair<std::size_t, Operation>> latest;
+    std::size_t position = 0;
+    auto keep = [&latest, &position](OperationType type, const std::string& path, int64_t time)
+    {
+        Operation operation;
+        operation.type = type;
+        operation.path = path;
+        operation.time = time;
+        latest[path] = {position++, operation};
+    };
+
+    for(const Operation& operation : operations)
+    {
+        if(operation.type == OperationType::RENAME)
+        {
+            keep(OperationType::DELETE, operation.old_path, operation.time);
+            keep(OperationType::UPLOAD, operation.path, operation.time);
+            continue;
+        }
+        keep(operation.type, operation.path, operation.time);
+    }
+
+    std::vector<std::pair<std::size_t, Operation>> ordered;
+    ordered.reserve(latest.size());
+    for(auto& [path, entry] : latest)
+    {
+        ordered.push_back(std::move(entry));
+    }
+    std::sort(
+        ordered.begin(),
+        ordered.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<Operation> result;
+    result.reserve(ordered.size());
+    for(auto& entry : ordered)
+    {
+        result.push_back(std::move(entry.second));
+    }
+    return result;
+}
+
+OfflineQueue::OfflineQueue()
+    :   fd_(-1)
+{
+    //
+}
+
+OfflineQueue::~OfflineQueue()
+{
+    close();
+}
+
+std::size_t OfflineQueue::open(const std::string& sync_dir)
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    if(fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+
+    path_ = queue_path(sync_dir);
+    unlink((path_ + REWRITE_SUFFIX).c_str());
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0)
+    {
+        throw std::runtime_error("[OFFLINE QUEUE] Could not open \"" + path_ + "\": " + std::strerror(errno));
+    }
+
+    // operations recorded before the file was known come after the saved ones
+    std::vector<Operation> unsaved = std::move(operations_);
+    operations_.clear();
+    load_();
+    std::size_t recovered = operations_.size();
+    stats_.recovered += recovered;
+
+    for(Operation& operation : unsaved)
+    {
+        std::string frame = encode_(operation);
+        write_all(fd_, frame, path_);
+        stats_.file_size += frame.size();
+        operations_.push_back(std::move(operation));
+    }
+    sync_file(fd_, path_);
+
+    if(operations_.size() >= COMPACT_THRESHOLD)
+    {
+        rewrite_();
+    }
+    return recovered;
+}
+
+void OfflineQueue::close()
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    if(fd_ >= 0)
+    {
+        // every record was synced as it was written, this is only a last try
+        fdatasync(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+void OfflineQueue::append(Operation operation)
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    operation.time = std::time(nullptr);
+    std::string frame = fd_ >= 0 ? encode_(operation) : "";
+
+    // kept in memory even when it could not be made durable, it is still
+    // replayed by this run
+    operations_.push_back(std::move(operation));
+    stats_.recorded++;
+    if(fd_ >= 0)
+    {
+        // a single write per record, synced before the change counts as queued
+        write_all(fd_, frame, path_);
+        stats_.file_size += frame.size();
+        sync_file(fd_, path_);
+    }
+
+    // a long outage on a busy dir keeps touching the same few paths
+    if(operations_.size() % COMPACT_THRESHOLD == 0)
+    {
+        rewrite_();
+    }
+}
+
+std::vector<Operation> OfflineQueue::take()
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+
+    // never acknowledged ones happened first
+    std::vector<Operation> replayed = std::move(unacknowledged_);
+    replayed.insert(
+        replayed.end(), 
+        std::make_move_iterator(operations_.begin()), 
+        std::make_move_iterator(operations_.end()));
+    operations_.clear();
+
+    std::vector<Operation> result = compact(replayed);
+    if(replayed.size() > result.size())
+    {
+        stats_.compacted += replayed.size() - result.size();
+    }
+    stats_.replayed += result.size();
+    unacknowledged_ = result;
+
+    // the file keeps just what was handed over, compacted
+    if(unacknowledged_.empty())
+    {
+        truncate_();
+    }
+    else
+    {
+        rewrite_();
+    }
+    return result;
+}
+
+void OfflineQueue::acknowledge(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    auto operation = std::find_if(
+        unacknowledged_.begin(), 
+        unacknowledged_.end(), 
+        [&path](const Operation& operation) { return operation.path == path; });
+    if(operation == unacknowledged_.end())
+    {
+        return;
+    }
+    unacknowledged_.erase(operation);
+    stats_.acknowledged++;
+
+    // records are only dropped all at once, acknowledged ones left on disk
+    // meanwhile are at worst replayed once more after a crash
+    if(unacknowledged_.empty() && operations_.empty())
+    {
+        truncate_();
+    }
+}
+
+std::size_t OfflineQueue::size()
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    return operations_.size() + unacknowledged_.size();
+}
+
+bool OfflineQueue::empty()
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    return operations_.empty() && unacknowledged_.empty();
+}
+
+QueueStats OfflineQueue::get_stats()
+{
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    QueueStats stats = stats_;
+    stats.pending = operations_.size();
+    stats.unacknowledged = unacknowledged_.size();
+    return stats;
+}
+
+std::string OfflineQueue::format_stats()
+{
+    QueueStats stats = get_stats();
+    std::string output = "offline queue: " + std::to_string(stats.pending) + " pending (";
+    output += std::to_string(stats.file_size) + " bytes on disk), ";
+    output += std::to_string(stats.unacknowledged) + " unacknowledged, ";
+    output += std::to_string(stats.recorded) + " recorded, ";
+    output += std::to_string(stats.recovered) + " recovered, ";
+    output += std::to_string(stats.compacted) + " compacted away, ";
+    output += std::to_string(stats.replayed) + " replayed, ";
+    output += std::to_string(stats.acknowledged) + " acknowledged";
+    return output;
+}
+
+void OfflineQueue::load_()
+{
+    std::string contents = read_file(fd_, path_);
+    if(contents.size() < sizeof(QUEUE_MAGIC)
+        || std::memcmp(contents.data(), QUEUE_MAGIC, sizeof(QUEUE_MAGIC)) != 0)
+    {
+        // new or unreadable, the startup reconciliation covers what it held
+        if(ftruncate(fd_, 0) != 0)
+        {
+            throw std::runtime_error("[OFFLINE QUEUE] Could not reset \"" + path_ + "\": " + std::strerror(errno));
+        }
+        write_all(fd_, std::string(QUEUE_MAGIC, sizeof(QUEUE_MAGIC)), path_);
+        sync_file(fd_, path_);
+        stats_.file_size = sizeof(QUEUE_MAGIC);
+        return;
+    }
+
+    std::size_t offset = sizeof(QUEUE_MAGIC);
+    while(offset + RECORD_FRAME_SIZE <= contents.size())
+    {
+        uint32_t body_size;
+        uint32_t checksum;
+        std::memcpy(&body_size, contents.data() + offset, sizeof(body_size));
+        std::memcpy(&checksum, contents.data() + offset + sizeof(body_size), sizeof(checksum));
+
+        const char* body = contents.data() + offset + RECORD_FRAME_SIZE;
+        if(body_size > MAX_RECORD_SIZE
+            || offset + RECORD_FRAME_SIZE + body_size > contents.size()
+            || calculate_crc32(body, body_size) != checksum)
+        {
+            break;
+        }
+
+        Operation operation;
+        if(!decode_(body, body_size, operation))
+        {
+            break;
+        }
+        operations_.push_back(std::move(operation));
+        offset += RECORD_FRAME_SIZE + body_size;
+    }
+
+    // anything after the last intact record was torn by a crash
+    if(offset < contents.size())
+    {
+        if(ftruncate(fd_, offset) != 0)
+        {
+            throw std::runtime_error("[OFFLINE QUEUE] Could not cut torn tail of \"" + path_ + "\"!");
+        }
+        sync_file(fd_, path_);
+    }
+    stats_.file_size = offset;
+}
+
+void OfflineQueue::rewrite_()
+{
+    std::vector<Operation> compacted = compact(operations_);
+    if(operations_.size() > compacted.size())
+    {
+        stats_.compacted += operations_.size() - compacted.size();
+    }
+    operations_ = std::move(compacted);
+    if(fd_ < 0)
+    {
+        return;
+    }
+
+    // what is still waiting on the server goes first, as it happened first
+    std::string contents(QUEUE_MAGIC, sizeof(QUEUE_MAGIC));
+    for(const Operation& operation : unacknowledged_)
+    {
+        contents += encode_(operation);
+    }
+    for(const Operation& operation : operations_)
+    {
+        contents += encode_(operation);
+    }
+    replace_file(path_, contents);
+
+    ::close(fd_);
+    fd_ = ::open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if(fd_ < 0)
+    {
+        throw std::runtime_error("[OFFLINE QUEUE] Could not reopen \"" + path_ + "\": " + std::strerror(errno));
+    }
+    stats_.file_size = contents.size();
+}
+
+void OfflineQueue::truncate_()
+{
+    if(fd_ < 0)
+    {
+        return;
+    }
+    if(ftruncate(fd_, sizeof(QUEUE_MAGIC)) != 0)
+    {
+        throw std::runtime_error("[OFFLINE QUEUE] Could not empty \"" + path_ + "\": " + std::strerror(errno));
+    }
+    sync_file(fd_, path_);
+    stats_.file_size = sizeof(QUEUE_MAGIC);
+}
+
+std::string OfflineQueue::encode_(const Operation& operation)
+{
+    std::string body;
+    write_field<uint8_t>(body, static_cast<uint8_t>(operation.type));
+    write_field<int64_t>(body, operation.time);
+    write_string(body, operation.path);
+    write_string(body, operation.old_path);
+
+    std::string frame;
+    frame.reserve(RECORD_FRAME_SIZE + body.size());
+    write_field<uint32_t>(frame, static_cast<uint32_t>(body.size()));
+    write_field<uint32_t>(frame, calculate_crc32(body.data(), body.size()));
+    frame += body;
+    return frame;
+}
+
+bool OfflineQueue::decode_(const char* data, std::size_t size, Operation& operation)
+{
+    const char* cursor = data;
+    const char* end = data + size;
+
+    uint8_t type;
+    if(!read_field(cursor, end, type)
+        || !read_field(cursor, end, operation.time)
+        || !read_string(cursor, end, operation.path)
+        || !read_string(cursor, end, operation.old_path))
+    {
+        return false;
+    }
+
+    if(type < static_cast<uint8_t>(OperationType::UPLOAD)
+        || type > static_cast<uint8_t>(OperationType::RENAME))
+    {
+        return false;
+    }
+    operation.type = static_cast<OperationType>(type);
+    return cursor == end;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// synchronization
+#include <mutex>
+
+namespace offline_queue
+{
+    const char* const QUEUE_SUFFIX = ".swizqueue";
+    const char* const REWRITE_SUFFIX = ".swizrewrite";  // next to the queue while it is rewritten
+    const std::size_t COMPACT_THRESHOLD = 4096;  // records on disk before the file is rewritten compacted
+
+    enum class OperationType : uint8_t
+    {
+        UPLOAD = 1,
+        DELETE = 2,
+        RENAME = 3   // old_path was moved to path
+    };
+
+    struct Operation
+    {
+        OperationType type = OperationType::UPLOAD;
+        std::string path;      // relative to the sync dir, with leading slash
+        std::string old_path;  // only set on renames
+        int64_t time = 0;      // assigned on append
+    };
+
+    struct QueueStats
+    {
+        uint64_t recorded = 0;
+        uint64_t recovered = 0;  // left behind by a previous run
+        uint64_t compacted = 0;  // superseded by a later operation on the same path
+        uint64_t replayed = 0;
+        uint64_t acknowledged = 0;
+        std::size_t pending = 0;
+        std::size_t unacknowledged = 0;  // replayed, kept on disk until the server answers
+        uint64_t file_size = 0;
+    };
+
+    // the file kept next to the sync dir, outside of it
+    std::string queue_path(const std::string& sync_dir);
+
+    // keeps the latest operation of each path, in the order those happened
+    // the server has no rename, so one is folded into a delete of the old
+    // path and an upload of the new one
+    std::vector<Operation> compact(const std::vector<Operation>& operations);
+
+    class OfflineQueue
+    {
+        // append only log of the local changes made while the server could not
+        // be reached, so they survive both the outage and a restart
+        // records are framed with their length and a crc, a write torn by a
+        // crash is cut off on the next open
+        // before open() operations are only kept in memory
+        public:
+            OfflineQueue();
+            ~OfflineQueue();
+
+            // loads what a previous run left behind, returns how many operations
+            std::size_t open(const std::string& sync_dir);
+            void close();
+
+            // durable once it returns
+            void append(Operation operation);
+
+            // hands over the compacted operations, along with those handed over
+            // before and never acknowledged - all of them stay on disk until
+            // acknowledge(), so a crash meanwhile replays them again
+            // operations that fail again have to be appended again
+            std::vector<Operation> take();
+
+            // the server answered the replayed operation of path, the file is
+            // emptied once nothing is left to replay or acknowledge
+            void acknowledge(const std::string& path);
+
+            // pending and unacknowledged operations
+            std::size_t size();
+            bool empty();
+
+            QueueStats get_stats();
+            std::string format_stats();
+
+        private:
+            std::string path_;
+            int fd_;
+            std::vector<Operation> operations_;
+            std::vector<Operation> unacknowledged_;
+            QueueStats stats_;
+            std::mutex queue_mtx_;
+
+            // NOTE: caller must hold queue_mtx_
+            void load_();
+            void rewrite_();
+            void truncate_();
+
+            static std::string encode_(const Operation& operation);
+            static bool decode_(const char* data, std::size_t size, Operation& operation);
+    };
+}
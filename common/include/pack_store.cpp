@@ -0,0 +1,513 @@
+// c++
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "pack_store.hpp"
+#include "utils.hpp"
+
+using namespace pack_store;
+namespace fs = std::filesystem;
+
+const uint32_t RECORD_MAGIC = 0x4B505753;  // "SWPK"
+const uint8_t RECORD_FILE = 1;
+const uint8_t RECORD_TOMBSTONE = 2;
+
+// magic, data crc, type, checksum length, path length, modification time, data size, header crc
+// the header crc covers every field before it plus the path and checksum
+const std::size_t RECORD_HEADER_SIZE = 4 + 4 + 1 + 1 + 2 + 8 + 4 + 4;
+const std::size_t HEADER_CRC_OFFSET = 24;
+
+static void pwrite_all(int fd, const std::string& data, uint64_t offset)
+{
+    std::size_t written = 0;
+    while(written < data.size())
+    {
+        ssize_t result = pwrite(fd, data.data() + written, data.size() - written, offset + written);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error("[PACK STORE] Could not write segment: " + std::string(std::strerror(errno)));
+        }
+        written += result;
+    }
+}
+
+static bool pread_all(int fd, char* data, std::size_t size, uint64_t offset)
+{
+    std::size_t total = 0;
+    while(total < size)
+    {
+        ssize_t result = pread(fd, data + total, size - total, offset + total);
+        if(result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(result <= 0)
+        {
+            return false;
+        }
+        total += result;
+    }
+    return true;
+}
+
+PackStore::PackStore(const std::string& directory, path_table::PathTable* paths, uint64_t segment_size)
+    :   directory_(directory),
+        paths_(paths),
+        segment_size_(segment_size),
+        active_segment_(0),
+        compacted_segments_(0),
+        reclaimed_bytes_(0)
+{
+    fs::create_directories(directory_);
+    open_segments_();
+}
+
+PackStore::~PackStore()
+{
+    for(auto& [id, segment] : segments_)
+    {
+        if(segment.fd >= 0)
+        {
+            close(segment.fd);
+        }
+    }
+}
+
+std::string PackStore::put(
+    const std::string& path, 
+    const std::string& contents, 
+    int64_t modification_time, 
+    const std::string& checksum)
+{
+    if(!fits_record(path, checksum, contents.size()))
+    {
+        throw std::runtime_error("[PACK STORE] Path, checksum or contents too long for a pack record!");
+    }
+
+    std::unique_lock<std::shared_mutex> lock(store_mtx_);
+
+    path_table::path_id id = paths_->intern(path);
+    PackedFile file = append_(path, contents.data(), contents.size(), modification_time, checksum, false);
+
+    forget_(id);
+    segments_[file.segment].live_bytes += file.size;
+    index_[id] = file;
+    return segment_path_(file.segment);
+}
+
+bool PackStore::get(const std::string& path, std::string& contents)
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+
+    auto it = index_.find(paths_->find(path));
+    if(it == index_.end())
+    {
+        return false;
+    }
+    return read_(it->second, contents);
+}
+
+bool PackStore::find(const std::string& path, PackedFile& file)
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+
+    auto it = index_.find(paths_->find(path));
+    if(it == index_.end())
+    {
+        return false;
+    }
+    file = it->second;
+    return true;
+}
+
+bool PackStore::remove(const std::string& path)
+{
+    if(!fits_record(path, "", 0))
+    {
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(store_mtx_);
+
+    path_table::path_id id = paths_->find(path);
+    if(index_.count(id) == 0)
+    {
+        return false;
+    }
+
+    append_(path, nullptr, 0, 0, "", true);
+    forget_(id);
+    return true;
+}
+
+void PackStore::list(std::function<void(const std::string& path, const PackedFile& file)> on_file)
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+    for(const auto& [id, file] : index_)
+    {
+        on_file(paths_->resolve(id), file);
+    }
+}
+
+void PackStore::sync()
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+    fdatasync(segments_[active_segment_].fd);
+}
+
+bool PackStore::fits_record(const std::string& path, const std::string& checksum, uint64_t size)
+{
+    return path.size() <= UINT16_MAX && checksum.size() <= UINT8_MAX && size <= UINT32_MAX;
+}
+
+int PackStore::compact(double max_live_ratio)
+{
+    std::unique_lock<std::shared_mutex> lock(store_mtx_);
+
+    // candidates are picked up front, the active segment is never compacted
+    std::vector<uint32_t> candidates;
+    for(const auto& [id, segment] : segments_)
+    {
+        if(id != active_segment_ && segment.live_bytes < segment.size * max_live_ratio)
+        {
+            candidates.push_back(id);
+        }
+    }
+
+    int compacted = 0;
+    for(uint32_t id : candidates)
+    {
+        bool is_oldest = (segments_.begin()->first == id);
+
+        // live files are copied to the active segment - a tombstone is carried
+        // along while an older segment may still hold the record it deletes
+        std::vector<RecordView> records;
+        scan_segment_(id, [&records](const RecordView& record) { records.push_back(record); });
+
+        for(const RecordView& record : records)
+        {
+            path_table::path_id path_id = paths_->find(record.path);
+            auto it = index_.find(path_id);
+
+            if(record.tombstone)
+            {
+                if(!is_oldest && it == index_.end())
+                {
+                    append_(record.path, nullptr, 0, 0, "", true);
+                }
+                continue;
+            }
+
+            if(it == index_.end() || it->second.segment != id || it->second.offset != record.data_offset)
+            {
+                // overwritten or deleted since
+                continue;
+            }
+
+            std::string contents;
+            if(!read_(it->second, contents))
+            {
+                continue;
+            }
+
+            PackedFile moved = append_(record.path, contents.data(), contents.size(), 
+                record.modification_time, record.checksum, false);
+            segments_[moved.segment].live_bytes += moved.size;
+            it->second = moved;
+        }
+
+        // rewritten records must be durable before the old copies are gone
+        fdatasync(segments_[active_segment_].fd);
+
+        Segment& segment = segments_[id];
+        reclaimed_bytes_ += segment.size;
+        close(segment.fd);
+        unlink(segment_path_(id).c_str());
+        segments_.erase(id);
+
+        compacted_segments_++;
+        compacted++;
+    }
+    return compacted;
+}
+
+PackStats PackStore::get_stats()
+{
+    std::shared_lock<std::shared_mutex> lock(store_mtx_);
+
+    PackStats stats;
+    stats.files = index_.size();
+    stats.segments = segments_.size();
+    for(const auto& [id, segment] : segments_)
+    {
+        stats.live_bytes += segment.live_bytes;
+        stats.total_bytes += segment.size;
+    }
+    stats.compacted_segments = compacted_segments_;
+    stats.reclaimed_bytes = reclaimed_bytes_;
+    return stats;
+}
+
+std::string PackStore::format_stats()
+{
+    PackStats stats = get_stats();
+    std::string output = "packs: " + std::to_string(stats.files) + " files in ";
+    output += std::to_string(stats.segments) + " segments, ";
+    output += std::to_string(stats.live_bytes) + "/" + std::to_string(stats.total_bytes) + " bytes live, ";
+    output += std::to_string(stats.compacted_segments) + " compacted (";
+    output += std::to_string(stats.reclaimed_bytes) + " bytes reclaimed)";
+    return output;
+}
+
+std::string PackStore::segment_path_(uint32_t segment)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%08u.pack", segment);
+    return directory_ + "/" + name;
+}
+
+void PackStore::open_segments_()
+{
+    for(const fs::directory_entry& entry : fs::directory_iterator(directory_))
+    {
+        unsigned int id;
+        if(std::sscanf(entry.path().filename().c_str(), "segment-%08u.pack", &id) != 1)
+        {
+            continue;
+        }
+
+        int fd = open(entry.path().c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0)
+        {
+            throw std::runtime_error("[PACK STORE] Could not open segment \"" + entry.path().string() + "\"!");
+        }
+        segments_[id].fd = fd;
+    }
+
+    // segments are replayed oldest first, so later records win
+    for(auto& [id, segment] : segments_)
+    {
+        uint32_t segment_id = id;
+        uint64_t valid_end = scan_segment_(
+            segment_id,
+            [this, segment_id](const RecordView& record)
+            {
+                path_table::path_id path_id = paths_->intern(record.path);
+                forget_(path_id);
+                if(record.tombstone)
+                {
+                    return;
+                }
+
+                PackedFile file;
+                file.segment = segment_id;
+                file.offset = record.data_offset;
+                file.size = record.data_size;
+                file.crc = record.crc;
+                file.modification_time = record.modification_time;
+                file.checksum = record.checksum;
+                segments_[segment_id].live_bytes += file.size;
+                index_[path_id] = file;
+            });
+
+        // a crash may leave half a record at the end, it is cut off
+        struct stat segment_info;
+        fstat(segment.fd, &segment_info);
+        if(static_cast<uint64_t>(segment_info.st_size) > valid_end)
+        {
+            if(ftruncate(segment.fd, valid_end) != 0)
+            {
+                throw std::runtime_error("[PACK STORE] Could not cut torn tail of segment " + std::to_string(id) + "!");
+            }
+        }
+        segment.size = valid_end;
+    }
+
+    if(segments_.empty())
+    {
+        roll_segment_();
+    }
+    else
+    {
+        active_segment_ = segments_.rbegin()->first;
+    }
+}
+
+void PackStore::roll_segment_()
+{
+    // NOTE: caller must hold store_mtx_ exclusively, or be the constructor
+    uint32_t id = segments_.empty() ? 1 : segments_.rbegin()->first + 1;
+    int fd = open(segment_path_(id).c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        throw std::runtime_error("[PACK STORE] Could not create segment " + std::to_string(id) + ": " + std::strerror(errno));
+    }
+
+    segments_[id].fd = fd;
+    active_segment_ = id;
+}
+
+uint64_t PackStore::scan_segment_(uint32_t segment, std::function<void(const RecordView& record)> on_record)
+{
+    // only headers are read, file contents are skipped over
+    int fd = segments_[segment].fd;
+    struct stat segment_info;
+    fstat(fd, &segment_info);
+    uint64_t file_size = segment_info.st_size;
+
+    uint64_t offset = 0;
+    char header[RECORD_HEADER_SIZE];
+    while(offset + RECORD_HEADER_SIZE <= file_size)
+    {
+        if(!pread_all(fd, header, RECORD_HEADER_SIZE, offset))
+        {
+            break;
+        }
+
+        uint32_t magic;
+        RecordView record;
+        uint8_t type;
+        uint8_t checksum_length;
+        uint16_t path_length;
+        uint32_t header_crc;
+        std::memcpy(&magic, header, 4);
+        std::memcpy(&record.crc, header + 4, 4);
+        std::memcpy(&type, header + 8, 1);
+        std::memcpy(&checksum_length, header + 9, 1);
+        std::memcpy(&path_length, header + 10, 2);
+        std::memcpy(&record.modification_time, header + 12, 8);
+        std::memcpy(&record.data_size, header + 20, 4);
+        std::memcpy(&header_crc, header + HEADER_CRC_OFFSET, 4);
+
+        uint64_t record_size = RECORD_HEADER_SIZE + path_length + checksum_length + record.data_size;
+        if(magic != RECORD_MAGIC 
+            || (type != RECORD_FILE && type != RECORD_TOMBSTONE) 
+            || offset + record_size > file_size)
+        {
+            break;
+        }
+
+        // a damaged header would misplace every record after it
+        std::string names(path_length + checksum_length, '\0');
+        if(!pread_all(fd, names.data(), names.size(), offset + RECORD_HEADER_SIZE))
+        {
+            break;
+        }
+        std::string covered(header, HEADER_CRC_OFFSET);
+        covered += names;
+        if(calculate_crc32(covered.data(), covered.size()) != header_crc)
+        {
+            break;
+        }
+
+        record.tombstone = (type == RECORD_TOMBSTONE);
+        record.path = names.substr(0, path_length);
+        record.checksum = names.substr(path_length);
+        record.record_offset = offset;
+        record.data_offset = offset + RECORD_HEADER_SIZE + names.size();
+        on_record(record);
+
+        offset += record_size;
+    }
+    return offset;
+}
+
+PackedFile PackStore::append_(
+    const std::string& path, 
+    const char* data, 
+    uint32_t size, 
+    int64_t modification_time, 
+    const std::string& checksum, 
+    bool tombstone)
+{
+    // NOTE: caller must hold store_mtx_ exclusively
+    if(segments_[active_segment_].size >= segment_size_)
+    {
+        roll_segment_();
+    }
+
+    // NOTE: callers check the field widths with fits_record
+    uint8_t type = tombstone ? RECORD_TOMBSTONE : RECORD_FILE;
+    uint8_t checksum_length = checksum.size();
+    uint16_t path_length = path.size();
+    uint32_t crc = calculate_crc32(data, size);
+
+    // the whole record goes out in a single write
+    std::string record(RECORD_HEADER_SIZE, '\0');
+    std::memcpy(&record[0], &RECORD_MAGIC, 4);
+    std::memcpy(&record[4], &crc, 4);
+    std::memcpy(&record[8], &type, 1);
+    std::memcpy(&record[9], &checksum_length, 1);
+    std::memcpy(&record[10], &path_length, 2);
+    std::memcpy(&record[12], &modification_time, 8);
+    std::memcpy(&record[20], &size, 4);
+    record += path;
+    record += checksum;
+
+    std::string covered = record.substr(0, HEADER_CRC_OFFSET) + path + checksum;
+    uint32_t header_crc = calculate_crc32(covered.data(), covered.size());
+    std::memcpy(&record[HEADER_CRC_OFFSET], &header_crc, 4);
+    if(size > 0)
+    {
+        record.append(data, size);
+    }
+
+    Segment& segment = segments_[active_segment_];
+    pwrite_all(segment.fd, record, segment.size);
+
+    PackedFile file;
+    file.segment = active_segment_;
+    file.offset = segment.size + RECORD_HEADER_SIZE + path.size() + checksum.size();
+    file.size = size;
+    file.crc = crc;
+    file.modification_time = modification_time;
+    file.checksum = checksum;
+
+    segment.size += record.size();
+    return file;
+}
+
+void PackStore::forget_(path_table::path_id id)
+{
+    // NOTE: caller must hold store_mtx_ exclusively
+    auto it = index_.find(id);
+    if(it != index_.end())
+    {
+        segments_[it->second.segment].live_bytes -= it->second.size;
+        index_.erase(it);
+    }
+}
+
+bool PackStore::read_(const PackedFile& file, std::string& contents)
+{
+    // NOTE: caller must hold store_mtx_
+    auto it = segments_.find(file.segment);
+    if(it == segments_.end())
+    {
+        return false;
+    }
+
+    contents.resize(file.size);
+    if(!pread_all(it->second.fd, contents.data(), file.size, file.offset))
+    {
+        return false;
+    }
+
+    // a record torn by a crash is never handed out
+    return calculate_crc32(contents.data(), contents.size()) == file.crc;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+// c++
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+// synchronization
+#include <shared_mutex>
+
+// locals
+#include "path_table.hpp"
+
+namespace pack_store
+{
+    const uint64_t DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;  // segments are rolled over past this
+    const double DEFAULT_COMPACTION_RATIO = 0.5;              // segments with less live data are rewritten
+    const uint64_t MAX_PACKED_FILE_SIZE = 16 * 1024 * 1024;   // packed files are read and written whole in memory
+
+    struct PackedFile
+    {
+        uint32_t segment = 0;
+        uint64_t offset = 0;  // of the file contents inside the segment
+        uint32_t size = 0;
+        uint32_t crc = 0;
+        int64_t modification_time = 0;
+        std::string checksum;
+    };
+
+    struct PackStats
+    {
+        uint64_t files = 0;
+        uint64_t segments = 0;
+        uint64_t live_bytes = 0;
+        uint64_t total_bytes = 0;
+        uint64_t compacted_segments = 0;
+        uint64_t reclaimed_bytes = 0;
+    };
+
+    class PackStore
+    {
+        // small files of a user packed into append only segment files
+        // every put, overwrite or delete is a record appended to the newest
+        // segment, the in memory offset index points at the live records and
+        // is rebuilt from the record headers when the store is opened
+        // segments left mostly dead are compacted by rewriting what is still live
+        public:
+            PackStore(
+                const std::string& directory, 
+                path_table::PathTable* paths, 
+                uint64_t segment_size = DEFAULT_SEGMENT_SIZE);
+            ~PackStore();
+
+            // returns the path of the segment the record went to, for callers
+            // batching their own syncs - throws if a field does not fit a record
+            std::string put(const std::string& path, const std::string& contents, int64_t modification_time, const std::string& checksum);
+            bool get(const std::string& path, std::string& contents);
+            bool find(const std::string& path, PackedFile& file);
+            bool remove(const std::string& path);
+            void list(std::function<void(const std::string& path, const PackedFile& file)> on_file);
+
+            // makes every record appended so far durable
+            void sync();
+
+            // record fields have fixed widths, longer values are never packed
+            static bool fits_record(const std::string& path, const std::string& checksum, uint64_t size);
+
+            // rewrites segments whose live ratio dropped under the given one
+            // returns how many segments were compacted
+            int compact(double max_live_ratio = DEFAULT_COMPACTION_RATIO);
+
+            PackStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct Segment
+            {
+                int fd = -1;
+                uint64_t size = 0;
+                uint64_t live_bytes = 0;
+            };
+
+            struct RecordView
+            {
+                bool tombstone = false;
+                std::string path;
+                std::string checksum;
+                int64_t modification_time = 0;
+                uint64_t record_offset = 0;
+                uint64_t data_offset = 0;
+                uint32_t data_size = 0;
+                uint32_t crc = 0;
+            };
+
+            std::string directory_;
+            path_table::PathTable* paths_;
+            uint64_t segment_size_;
+
+            std::map<uint32_t, Segment> segments_;
+            uint32_t active_segment_;
+            std::unordered_map<path_table::path_id, PackedFile> index_;
+
+            uint64_t compacted_segments_;
+            uint64_t reclaimed_bytes_;
+
+            std::shared_mutex store_mtx_;
+
+            std::string segment_path_(uint32_t segment);
+            void open_segments_();
+            void roll_segment_();
+            uint64_t scan_segment_(uint32_t segment, std::function<void(const RecordView& record)> on_record);
+            PackedFile append_(const std::string& path, const char* data, uint32_t size, int64_t modification_time, const std::string& checksum, bool tombstone);
+            void forget_(path_table::path_id id);
+            bool read_(const PackedFile& file, std::string& contents);
+    };
+}
@@ -0,0 +1,280 @@
+// c++
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+
+// local
+#include "path_table.hpp"
+
+using namespace path_table;
+
+const std::size_t INITIAL_INDEX_SLOTS = 1024;  // must be a power of two
+
+PathTable::PathTable(std::size_t max_paths)
+    :   max_paths_(std::min<std::size_t>(max_paths, INVALID_PATH_ID - 1)),
+        slots_(INITIAL_INDEX_SLOTS, INVALID_PATH_ID)
+{
+    // root node has no name and is its own parent
+    nodes_.push_back({ROOT_PATH_ID, 0, 0});
+}
+
+path_id PathTable::intern(const std::string& path)
+{
+    // fast path - most lookups are for paths that already exist
+    path_id existing = find(path);
+    if(existing != INVALID_PATH_ID)
+    {
+        return existing;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(table_mtx_);
+
+    path_id current = ROOT_PATH_ID;
+    std::size_t start = 0;
+    while(start < path.size())
+    {
+        std::size_t end = path.find('/', start);
+        if(end == std::string::npos)
+        {
+            end = path.size();
+        }
+
+        std::size_t length = end - start;
+        const char* name = path.data() + start;
+        start = end + 1;
+
+        // skips empty and current directory components
+        if(length == 0 || (length == 1 && name[0] == '.'))
+        {
+            continue;
+        }
+
+        path_id child = find_child_(current, name, length);
+        if(child == INVALID_PATH_ID)
+        {
+            child = insert_child_(current, name, length);
+        }
+        current = child;
+    }
+    return current;
+}
+
+path_id PathTable::find(const std::string& path)
+{
+    std::shared_lock<std::shared_mutex> lock(table_mtx_);
+
+    path_id current = ROOT_PATH_ID;
+    std::size_t start = 0;
+    while(start < path.size())
+    {
+        std::size_t end = path.find('/', start);
+        if(end == std::string::npos)
+        {
+            end = path.size();
+        }
+
+        std::size_t length = end - start;
+        const char* name = path.data() + start;
+        start = end + 1;
+
+        if(length == 0 || (length == 1 && name[0] == '.'))
+        {
+            continue;
+        }
+
+        current = find_child_(current, name, length);
+        if(current == INVALID_PATH_ID)
+        {
+            return INVALID_PATH_ID;
+        }
+    }
+    return current;
+}
+
+std::string PathTable::resolve(path_id id)
+{
+    std::shared_lock<std::shared_mutex> lock(table_mtx_);
+
+    if(id >= nodes_.size())
+    {
+        throw std::runtime_error("[PATH TABLE] Invalid path id " + std::to_string(id) + "!");
+    }
+
+    // walks up to the root, then joins the components in reverse
+    std::vector<path_id> components;
+    std::size_t total_length = 0;
+    while(id != ROOT_PATH_ID)
+    {
+        components.push_back(id);
+        total_length += nodes_[id].name_length + 1;
+        id = nodes_[id].parent;
+    }
+
+    std::string path;
+    path.reserve(total_length);
+    for(auto it = components.rbegin(); it != components.rend(); ++it)
+    {
+        const Node& node = nodes_[*it];
+        if(!path.empty())
+        {
+            path += '/';
+        }
+        path.append(arena_.data() + node.name_offset, node.name_length);
+    }
+    return path;
+}
+
+std::string PathTable::get_name(path_id id)
+{
+    std::shared_lock<std::shared_mutex> lock(table_mtx_);
+
+    if(id >= nodes_.size())
+    {
+        throw std::runtime_error("[PATH TABLE] Invalid path id " + std::to_string(id) + "!");
+    }
+    return std::string(arena_.data() + nodes_[id].name_offset, nodes_[id].name_length);
+}
+
+path_id PathTable::get_parent(path_id id)
+{
+    std::shared_lock<std::shared_mutex> lock(table_mtx_);
+
+    if(id >= nodes_.size())
+    {
+        throw std::runtime_error("[PATH TABLE] Invalid path id " + std::to_string(id) + "!");
+    }
+    return nodes_[id].parent;
+}
+
+std::size_t PathTable::size()
+{
+    std::shared_lock<std::shared_mutex> lock(table_mtx_);
+    return nodes_.size();
+}
+
+std::size_t PathTable::memory_usage()
+{
+    // bytes reserved by the table itself, excluding the object header
+    std::shared_lock<std::shared_mutex> lock(table_mtx_);
+    return nodes_.capacity() * sizeof(Node)
+        + arena_.capacity()
+        + slots_.capacity() * sizeof(path_id);
+}
+
+uint64_t PathTable::hash_(path_id parent, const char* name, std::size_t length)
+{
+    // fnv-1a over the parent id and the name bytes
+    uint64_t hash = 14695981039346656037ULL;
+    for(int i = 0; i < 4; i++)
+    {
+        hash ^= (parent >> (i * 8)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    for(std::size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+path_id PathTable::find_child_(path_id parent, const char* name, std::size_t length)
+{
+    // NOTE: caller must hold table_mtx_
+    std::size_t mask = slots_.size() - 1;
+    std::size_t slot = hash_(parent, name, length) & mask;
+
+    while(slots_[slot] != INVALID_PATH_ID)
+    {
+        const Node& node = nodes_[slots_[slot]];
+        if(node.parent == parent
+            && node.name_length == length
+            && std::memcmp(arena_.data() + node.name_offset, name, length) == 0)
+        {
+            return slots_[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return INVALID_PATH_ID;
+}
+
+path_id PathTable::insert_child_(path_id parent, const char* name, std::size_t length)
+{
+    // NOTE: caller must hold table_mtx_ exclusively
+    if(nodes_.size() >= max_paths_)
+    {
+        throw std::runtime_error("[PATH TABLE] Path table is full (" + std::to_string(max_paths_) + " paths)!");
+    }
+
+    // keeps the index load factor under 0.7
+    if((nodes_.size() + 1) * 10 > slots_.size() * 7)
+    {
+        grow_index_();
+    }
+
+    path_id id = nodes_.size();
+    nodes_.push_back({parent, static_cast<uint32_t>(arena_.size()), static_cast<uint32_t>(length)});
+    arena_.insert(arena_.end(), name, name + length);
+
+    std::size_t mask = slots_.size() - 1;
+    std::size_t slot = hash_(parent, name, length) & mask;
+    while(slots_[slot] != INVALID_PATH_ID)
+    {
+        slot = (slot + 1) & mask;
+    }
+    slots_[slot] = id;
+    return id;
+}
+
+void PathTable::grow_index_()
+{
+    std::vector<path_id> new_slots(slots_.size() * 2, INVALID_PATH_ID);
+    std::size_t mask = new_slots.size() - 1;
+
+    // root is never indexed, it is not anyone's child
+    for(path_id id = 1; id < nodes_.size(); id++)
+    {
+        const Node& node = nodes_[id];
+        std::size_t slot = hash_(node.parent, arena_.data() + node.name_offset, node.name_length) & mask;
+        while(new_slots[slot] != INVALID_PATH_ID)
+        {
+            slot = (slot + 1) & mask;
+        }
+        new_slots[slot] = id;
+    }
+    slots_.swap(new_slots);
+}
+
+bool path_table::normalize_path(const std::string& path, std::string& normalized)
+{
+    std::string result;
+    std::size_t start = 0;
+    while(start <= path.size())
+    {
+        std::size_t end = path.find('/', start);
+        if(end == std::string::npos)
+        {
+            end = path.size();
+        }
+
+        std::size_t length = end - start;
+        if(length > 0)
+        {
+            if(path.compare(start, length, ".") == 0 || path.compare(start, length, "..") == 0)
+            {
+                return false;
+            }
+            result += "/";
+            result.append(path, start, length);
+        }
+        start = end + 1;
+    }
+
+    if(result.empty())
+    {
+        return false;
+    }
+    normalized.swap(result);
+    return true;
+}
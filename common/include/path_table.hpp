@@ -0,0 +1,73 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// synchronization
+#include <shared_mutex>
+
+namespace path_table
+{
+    typedef uint32_t path_id;
+
+    const path_id ROOT_PATH_ID = 0;
+    const path_id INVALID_PATH_ID = UINT32_MAX;
+    const std::size_t DEFAULT_MAX_PATHS = 1 << 22;  // ~240MB of nodes, names and index at 57B per path
+
+    // rewrites a path sent by a user as "/a/b", dropping repeated and trailing slashes
+    // returns false for paths naming no file or stepping out of the user folder:
+    // empty, "/" or holding a "." or ".." component
+    bool normalize_path(const std::string& path, std::string& normalized);
+
+    class PathTable
+    {
+        // interned path namespace, one per user
+        // every path is stored once as (parent id, name) with the name
+        // bytes kept in a shared arena, so directory prefixes are never
+        // duplicated and paths can be passed around as 32 bit ids
+        // ids stay valid for the life of the table, so nodes are never
+        // removed - the table is bounded instead, and interning past
+        // max_paths throws
+        public:
+            PathTable(std::size_t max_paths = DEFAULT_MAX_PATHS);
+
+            // returns the id for the given path, creating every missing component
+            // both "/a/b" and "a/b" map to the same id
+            path_id intern(const std::string& path);
+
+            // same as intern, but never inserts - returns INVALID_PATH_ID instead
+            path_id find(const std::string& path);
+
+            // rebuilds the full path for an id, without leading slash
+            std::string resolve(path_id id);
+            std::string get_name(path_id id);
+            path_id get_parent(path_id id);
+
+            std::size_t size();
+            std::size_t memory_usage();
+
+        private:
+            struct Node
+            {
+                path_id parent;
+                uint32_t name_offset;
+                uint32_t name_length;
+            };
+
+            std::size_t max_paths_;
+            std::vector<Node> nodes_;
+            std::vector<char> arena_;
+
+            // open addressing index over nodes_, keyed by (parent, name)
+            std::vector<path_id> slots_;
+
+            std::shared_mutex table_mtx_;
+
+            static uint64_t hash_(path_id parent, const char* name, std::size_t length);
+            path_id find_child_(path_id parent, const char* name, std::size_t length);
+            path_id insert_child_(path_id parent, const char* name, std::size_t length);
+            void grow_index_();
+    };
+}
@@ -0,0 +1,441 @@
+// c++
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <unordered_set>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "state_store.hpp"
+#include "directory_scanner.hpp"
+#include "utils.hpp"
+
+using namespace state_store;
+
+const char STATE_MAGIC[8] = {'S', 'W', 'I', 'Z', 'C', 'S', 'T', '1'};
+
+template <typename T>
+static void write_field(std::string& buffer, T value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void write_string(std::string& buffer, const std::string& value)
+{
+    write_field<uint16_t>(buffer, static_cast<uint16_t>(value.size()));
+    buffer.append(value);
+}
+
+template <typename T>
+static bool read_field(const char*& cursor, const char* end, T& value)
+{
+    if(static_cast<std::size_t>(end - cursor) < sizeof(T))
+    {
+        return false;
+    }
+    std::memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+static bool read_string(const char*& cursor, const char* end, std::string& value)
+{
+    uint16_t length;
+    if(!read_field(cursor, end, length) || static_cast<std::size_t>(end - cursor) < length)
+    {
+        return false;
+    }
+    value.assign(cursor, length);
+    cursor += length;
+    return true;
+}
+
+static std::string read_file(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return "";
+    }
+
+    std::string contents;
+    char buffer[64 * 1024];
+    ssize_t result;
+    while((result = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            close(fd);
+            throw std::runtime_error("[STATE STORE] Could not read \"" + path + "\": " + std::strerror(errno));
+        }
+        contents.append(buffer, result);
+    }
+    close(fd);
+    return contents;
+}
+
+static void replace_file(const std::string& path, const std::string& contents)
+{
+    std::string temp_path = path + ".swizdownload";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        throw std::runtime_error("[STATE STORE] Could not create \"" + temp_path + "\": " + std::strerror(errno));
+    }
+
+    std::size_t written = 0;
+    while(written < contents.size())
+    {
+        ssize_t result = write(fd, contents.data() + written, contents.size() - written);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            std::string error = std::strerror(errno);
+            close(fd);
+            throw std::runtime_error("[STATE STORE] Could not write \"" + temp_path + "\": " + error);
+        }
+        written += result;
+    }
+    fdatasync(fd);
+    close(fd);
+
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("[STATE STORE] Could not replace \"" + path + "\": " + std::strerror(errno));
+    }
+}
+
+static std::string normalize_path(const std::string& path)
+{
+    std::size_t start = path.find_first_not_of('/');
+    return start == std::string::npos ? "" : path.substr(start);
+}
+
+std::string state_store::state_path(const std::string& sync_dir)
+{
+    std::size_t end = sync_dir.find_last_not_of('/');
+    return (end == std::string::npos ? sync_dir : sync_dir.substr(0, end + 1)) + STATE_SUFFIX;
+}
+
+StateStore::StateStore()
+    :   loaded_(false),
+        dirty_(false),
+        last_save_(std::chrono::steady_clock::now())
+{
+    //
+}
+
+bool StateStore::open(const std::string& sync_dir)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    sync_dir_ = sync_dir;
+    path_ = state_path(sync_dir);
+    files_.clear();
+    dirty_ = false;
+    last_save_ = std::chrono::steady_clock::now();
+
+    // a damaged state is dropped, the next walk becomes the baseline again
+    loaded_ = load_();
+    if(!loaded_)
+    {
+        files_.clear();
+    }
+    return loaded_;
+}
+
+void StateStore::save()
+{
+    std::lock_guard<std::mutex> save_lock(save_mtx_);
+
+    std::string contents(STATE_MAGIC, sizeof(STATE_MAGIC));
+    {
+        std::lock_guard<std::mutex> lock(store_mtx_);
+        if(path_.empty())
+        {
+            return;
+        }
+
+        // files changed from here on are newer than the saved time
+        write_field<int64_t>(contents, std::time(nullptr));
+        write_field<uint64_t>(contents, files_.size());
+        for(const auto& [path, file] : files_)
+        {
+            write_string(contents, path);
+            write_field<uint64_t>(contents, file.size);
+            write_field<int64_t>(contents, file.modification_time);
+            write_field<uint64_t>(contents, file.inode);
+            write_string(contents, file.checksum);
+            write_string(contents, file.server_checksum);
+        }
+        write_field<uint32_t>(contents, calculate_crc32(contents.data(), contents.size()));
+        dirty_ = false;
+        last_save_ = std::chrono::steady_clock::now();
+    }
+
+    replace_file(path_, contents);
+}
+
+bool StateStore::save_if_dirty(int interval_seconds)
+{
+    {
+        std::lock_guard<std::mutex> lock(store_mtx_);
+        if(!dirty_ || std::chrono::steady_clock::now() - last_save_ < std::chrono::seconds(interval_seconds))
+        {
+            return false;
+        }
+    }
+    save();
+    return true;
+}
+
+Reconciliation StateStore::reconcile()
+{
+    Reconciliation result;
+    auto start = std::chrono::steady_clock::now();
+
+    std::string root;
+    {
+        std::lock_guard<std::mutex> lock(store_mtx_);
+        root = sync_dir_;
+    }
+
+    std::vector<directory_scanner::ScanEntry> entries;
+    std::mutex entries_mtx;
+    directory_scanner::default_scanner().scan(
+        root,
+        [&](const directory_scanner::ScanEntry& entry)
+        {
+            std::lock_guard<std::mutex> lock(entries_mtx);
+            entries.push_back(entry);
+        });
+    result.scanned_files = entries.size();
+
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    if(!loaded_)
+    {
+        // nothing to compare with, hashes are filled in as files are sent
+        std::time_t now = std::time(nullptr);
+        for(const directory_scanner::ScanEntry& entry : entries)
+        {
+            FileState& state = files_[entry.path];
+            state.size = entry.size;
+            state.modification_time = entry.modification_time;
+            state.inode = entry.inode;
+            state.racy = entry.modification_time >= now;
+        }
+        loaded_ = true;
+        dirty_ = true;
+        result.baseline = true;
+        result.elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    std::unordered_set<std::string> found;
+    found.reserve(entries.size());
+    for(const directory_scanner::ScanEntry& entry : entries)
+    {
+        found.insert(entry.path);
+
+        auto known = files_.find(entry.path);
+        if(known == files_.end())
+        {
+            result.created.push_back(entry.path);
+            continue;
+        }
+
+        FileState& state = known->second;
+        if(!state.racy
+            && state.size == entry.size
+            && state.modification_time == entry.modification_time
+            && state.inode == entry.inode)
+        {
+            continue;
+        }
+
+        // touched, copied over or replaced - only a different content counts
+        if(state.size == entry.size && !state.checksum.empty())
+        {
+            result.hashed_files++;
+            if(calculate_md5_checksum(root + "/" + entry.path) == state.checksum)
+            {
+                state.modification_time = entry.modification_time;
+                state.inode = entry.inode;
+                state.racy = entry.modification_time >= std::time(nullptr);
+                dirty_ = true;
+                continue;
+            }
+        }
+        result.modified.push_back(entry.path);
+    }
+
+    for(auto it = files_.begin(); it != files_.end();)
+    {
+        if(found.count(it->first) == 0)
+        {
+            result.deleted.push_back(it->first);
+            it = files_.erase(it);
+            dirty_ = true;
+            continue;
+        }
+        it++;
+    }
+
+    result.elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void StateStore::record(const std::string& path, const std::string& checksum)
+{
+    std::string relative_path = normalize_path(path);
+
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    struct stat file_info;
+    std::string full_path = sync_dir_ + "/" + relative_path;
+    if(lstat(full_path.c_str(), &file_info) != 0 || !S_ISREG(file_info.st_mode))
+    {
+        return;
+    }
+
+    FileState& state = files_[relative_path];
+    state.size = file_info.st_size;
+    state.modification_time = file_info.st_mtime;
+    state.inode = file_info.st_ino;
+    state.checksum = checksum;
+    state.racy = file_info.st_mtime >= std::time(nullptr);
+    dirty_ = true;
+}
+
+void StateStore::record(const std::string& path, const FileState& state)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    FileState& known = files_[normalize_path(path)];
+    known.size = state.size;
+    known.modification_time = state.modification_time;
+    known.inode = state.inode;
+    known.checksum = state.checksum;
+    known.racy = state.modification_time >= std::time(nullptr);
+    dirty_ = true;
+}
+
+void StateStore::set_server_checksum(const std::string& path, const std::string& checksum)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    auto state = files_.find(normalize_path(path));
+    if(state != files_.end())
+    {
+        state->second.server_checksum = checksum;
+        dirty_ = true;
+    }
+}
+
+void StateStore::remove(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    if(files_.erase(normalize_path(path)) != 0)
+    {
+        dirty_ = true;
+    }
+}
+
+bool StateStore::get(const std::string& path, FileState& state)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    auto known = files_.find(normalize_path(path));
+    if(known == files_.end())
+    {
+        return false;
+    }
+    state = known->second;
+    return true;
+}
+
+bool StateStore::lookup_checksum(
+    const std::string& path,
+    uint64_t size,
+    std::time_t modification_time,
+    uint64_t inode,
+    std::string& checksum)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    auto known = files_.find(normalize_path(path));
+    if(known == files_.end()
+        || known->second.racy
+        || known->second.checksum.empty()
+        || known->second.size != size
+        || known->second.modification_time != modification_time
+        || known->second.inode != inode)
+    {
+        return false;
+    }
+    checksum = known->second.checksum;
+    return true;
+}
+
+std::size_t StateStore::get_file_count()
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    return files_.size();
+}
+
+bool StateStore::load_()
+{
+    std::string contents = read_file(path_);
+
+    const std::size_t minimum_size = sizeof(STATE_MAGIC) + sizeof(int64_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    if(contents.size() < minimum_size
+        || std::memcmp(contents.data(), STATE_MAGIC, sizeof(STATE_MAGIC)) != 0)
+    {
+        return false;
+    }
+
+    uint32_t checksum;
+    std::size_t body_size = contents.size() - sizeof(checksum);
+    std::memcpy(&checksum, contents.data() + body_size, sizeof(checksum));
+    if(calculate_crc32(contents.data(), body_size) != checksum)
+    {
+        return false;
+    }
+
+    const char* cursor = contents.data() + sizeof(STATE_MAGIC);
+    const char* end = contents.data() + body_size;
+
+    int64_t saved_time;
+    uint64_t count;
+    read_field(cursor, end, saved_time);
+    read_field(cursor, end, count);
+
+    files_.reserve(count);
+    for(uint64_t i = 0; i < count; i++)
+    {
+        std::string path;
+        FileState state;
+        int64_t modification_time;
+        if(!read_string(cursor, end, path)
+            || !read_field(cursor, end, state.size)
+            || !read_field(cursor, end, modification_time)
+            || !read_field(cursor, end, state.inode)
+            || !read_string(cursor, end, state.checksum)
+            || !read_string(cursor, end, state.server_checksum))
+        {
+            return false;
+        }
+        state.modification_time = modification_time;
+        state.racy = modification_time >= saved_time;
+        files_.emplace(std::move(path), std::move(state));
+    }
+    return true;
+}
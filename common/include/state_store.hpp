@@ -0,0 +1,108 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+
+// synchronization
+#include <mutex>
+
+namespace state_store
+{
+    const char* const STATE_SUFFIX = ".swizstate";
+    const int DEFAULT_SAVE_INTERVAL_SECONDS = 30;
+
+    struct FileState
+    {
+        uint64_t size = 0;
+        std::time_t modification_time = 0;
+        uint64_t inode = 0;
+        std::string checksum;         // md5 of the content, empty until it was hashed
+        std::string server_checksum;  // last version the server acknowledged
+        bool racy = false;            // recorded within the second it was modified, not saved
+    };
+
+    // paths relative to the sync dir, without leading slash
+    struct Reconciliation
+    {
+        std::vector<std::string> created;
+        std::vector<std::string> modified;
+        std::vector<std::string> deleted;
+        uint64_t scanned_files = 0;
+        uint64_t hashed_files = 0;  // metadata moved but the content may not have
+        uint64_t elapsed_us = 0;
+        bool baseline = false;      // no previous state, nothing was compared
+    };
+
+    // where the state of a sync dir is kept, next to it and outside the
+    // watched tree
+    std::string state_path(const std::string& sync_dir);
+
+    class StateStore
+    {
+        // what the client knew of every file in the sync dir when it last ran:
+        // size, modification time, inode, content hash and the version the
+        // server holds, saved to a single file next to the sync dir
+        // on restart a single stat pass is compared against it, files whose
+        // metadata did not move are never opened, and the ones that did are
+        // hashed before being taken for changed
+        // modification times have second resolution, a file recorded within the
+        // second the state was saved in is always hashed again
+        public:
+            StateStore();
+
+            // loads the state kept for sync_dir, starting empty when there is none
+            // returns true when a previous state was found
+            bool open(const std::string& sync_dir);
+
+            // written aside and renamed over the previous state
+            void save();
+
+            // saves when something changed and the interval since the last save passed
+            bool save_if_dirty(int interval_seconds = DEFAULT_SAVE_INTERVAL_SECONDS);
+
+            // walks the sync dir once, returning what changed since the state was
+            // saved - deleted files are forgotten, created and modified ones are
+            // left for record() once they were sent
+            // without a previous state the walk is taken as the baseline
+            Reconciliation reconcile();
+
+            // stats a file of the sync dir and records it with its content hash
+            void record(const std::string& path, const std::string& checksum);
+
+            // records metadata taken before the file was hashed, a stat done
+            // afterwards could pair the hash with a newer content
+            void record(const std::string& path, const FileState& state);
+            void set_server_checksum(const std::string& path, const std::string& checksum);
+            void remove(const std::string& path);
+
+            bool get(const std::string& path, FileState& state);
+
+            // the recorded hash, as long as the file was not modified since
+            bool lookup_checksum(
+                const std::string& path,
+                uint64_t size,
+                std::time_t modification_time,
+                uint64_t inode,
+                std::string& checksum);
+            std::size_t get_file_count();
+
+        private:
+            std::string sync_dir_;
+            std::string path_;
+
+            std::unordered_map<std::string, FileState> files_;
+            bool loaded_;
+            bool dirty_;
+            std::chrono::steady_clock::time_point last_save_;
+            std::mutex store_mtx_;
+            std::mutex save_mtx_;  // held across the write, saves never interleave
+
+            // NOTE: caller must hold store_mtx_
+            bool load_();
+    };
+}
@@ -0,0 +1,659 @@
+// c++
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+
+// c
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "upload_pipeline.hpp"
+#include "utils.hpp"
+
+using namespace upload_pipeline;
+namespace fs = std::filesystem;
+
+std::string upload_pipeline::stage_name(Stage stage)
+{
+    switch(stage)
+    {
+        case Stage::SCAN:
+            return "scan";
+        case Stage::STAT:
+            return "stat";
+        case Stage::HASH:
+            return "hash";
+        case Stage::READ:
+            return "read";
+        case Stage::COMPRESS:
+            return "compress";
+        case Stage::SEND:
+            return "send";
+    }
+    return "unknown";
+}
+
+UploadPipeline::UploadPipeline(PipelineConfig config)
+    :   config_(config),
+        accepting_(false),
+        stat_queue_(config.queue_capacity),
+        hash_queue_(config.queue_capacity),
+        read_queue_(config.queue_capacity),
+        compress_queue_(config.queue_capacity),
+        send_queue_(config.queue_capacity),
+        running_(false),
+        in_flight_(0),
+        sent_files_(0),
+        cached_checksums_(0),
+        changed_files_(0),
+        superseded_files_(0),
+        failed_files_(0),
+        started_(std::chrono::steady_clock::now())
+{
+    if(config_.queue_capacity == 0 || config_.chunk_size == 0)
+    {
+        throw std::runtime_error("[UPLOAD PIPELINE] Queue capacity and chunk size must be positive!");
+    }
+    if(config_.workers[static_cast<int>(Stage::SCAN)] != 1)
+    {
+        throw std::runtime_error("[UPLOAD PIPELINE] Stage \"scan\" keeps submissions in order, it needs a single worker!");
+    }
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        if(config_.workers[i] < 1)
+        {
+            throw std::runtime_error("[UPLOAD PIPELINE] Stage \"" + stage_name(static_cast<Stage>(i)) + "\" needs a worker!");
+        }
+        stage_items_[i].store(0);
+        stage_bytes_[i].store(0);
+        stage_busy_us_[i].store(0);
+    }
+}
+
+UploadPipeline::~UploadPipeline()
+{
+    stop();
+}
+
+void UploadPipeline::start(UploadCallbacks callbacks)
+{
+    if(running_.exchange(true))
+    {
+        return;
+    }
+    if(!callbacks.send)
+    {
+        running_.store(false);
+        throw std::runtime_error("[UPLOAD PIPELINE] Chunks have nowhere to be sent!");
+    }
+
+    callbacks_ = callbacks;
+    started_ = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(submitted_mtx_);
+        accepting_ = true;
+    }
+
+    void (UploadPipeline::*loops[STAGE_COUNT])() = {
+        &UploadPipeline::scan_loop_,
+        &UploadPipeline::stat_loop_,
+        &UploadPipeline::hash_loop_,
+        &UploadPipeline::read_loop_,
+        &UploadPipeline::compress_loop_,
+        &UploadPipeline::send_loop_};
+    for(int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        for(int i = 0; i < config_.workers[stage]; i++)
+        {
+            workers_[stage].emplace_back(loops[stage], this);
+        }
+    }
+}
+
+void UploadPipeline::stop()
+{
+    if(!running_.exchange(false))
+    {
+        return;
+    }
+
+    // whatever is still queued is dropped, the state store sees it again
+    // as changed on the next start
+    {
+        std::lock_guard<std::mutex> lock(submitted_mtx_);
+        accepting_ = false;
+        submitted_.clear();
+    }
+    submitted_cv_.notify_all();
+    paths_cv_.notify_all();
+    stat_queue_.close();
+    hash_queue_.close();
+    read_queue_.close();
+    compress_queue_.close();
+    send_queue_.close();
+
+    for(int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        for(std::thread& worker : workers_[stage])
+        {
+            if(worker.joinable())
+            {
+                worker.join();
+            }
+        }
+        workers_[stage].clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(paths_mtx_);
+        paths_.clear();
+    }
+    idle_cv_.notify_all();
+}
+
+void UploadPipeline::submit(const std::string& root, const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(submitted_mtx_);
+        if(!accepting_)
+        {
+            return;
+        }
+        submitted_.push_back({root, path.empty() || path[0] != '/' ? "/" + path : path});
+    }
+    add_files_(1);
+    submitted_cv_.notify_one();
+}
+
+void UploadPipeline::remove(const std::string& root, const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(submitted_mtx_);
+        if(!accepting_)
+        {
+            return;
+        }
+        submitted_.push_back({root, path.empty() || path[0] != '/' ? "/" + path : path, true});
+    }
+    add_files_(1);
+    submitted_cv_.notify_one();
+}
+
+void UploadPipeline::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(idle_mtx_);
+    idle_cv_.wait(lock, [this]() { return in_flight_ == 0 || !running_.load(); });
+}
+
+bool UploadPipeline::is_idle()
+{
+    std::lock_guard<std::mutex> lock(idle_mtx_);
+    return in_flight_ == 0;
+}
+
+PipelineStats UploadPipeline::get_stats()
+{
+    PipelineStats stats;
+    std::size_t depths[STAGE_COUNT] = {
+        0,
+        stat_queue_.size(),
+        hash_queue_.size(),
+        read_queue_.size(),
+        compress_queue_.size(),
+        send_queue_.size()};
+    {
+        std::lock_guard<std::mutex> lock(submitted_mtx_);
+        depths[0] = submitted_.size();
+    }
+
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        stats.stages[i].workers = config_.workers[i];
+        stats.stages[i].items = stage_items_[i].load();
+        stats.stages[i].bytes = stage_bytes_[i].load();
+        stats.stages[i].busy_us = stage_busy_us_[i].load();
+        stats.stages[i].queue_depth = depths[i];
+        stats.stages[i].queue_capacity = i == 0 ? 0 : config_.queue_capacity;
+    }
+    stats.sent_files = sent_files_.load();
+    stats.cached_checksums = cached_checksums_.load();
+    stats.changed_files = changed_files_.load();
+    stats.superseded_files = superseded_files_.load();
+    stats.failed_files = failed_files_.load();
+    stats.uptime_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started_).count();
+    return stats;
+}
+
+std::string UploadPipeline::format_stats()
+{
+    // a stage whose workers are busy most of the time is the bottleneck,
+    // the queues in front of it are the ones found full
+    PipelineStats stats = get_stats();
+    std::string output = "uploads: " + std::to_string(stats.sent_files) + " sent, ";
+    output += std::to_string(stats.cached_checksums) + " cached hashes, ";
+    output += std::to_string(stats.changed_files) + " changed meanwhile, ";
+    output += std::to_string(stats.superseded_files) + " superseded, ";
+    output += std::to_string(stats.failed_files) + " failed";
+
+    double uptime_seconds = stats.uptime_us / 1e6;
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        const StageStats& stage = stats.stages[i];
+        uint64_t busy_percent = 0;
+        if(stats.uptime_us > 0)
+        {
+            busy_percent = 100 * stage.busy_us / (stats.uptime_us * stage.workers);
+        }
+        uint64_t kilobytes_per_second = uptime_seconds > 0 ? stage.bytes / 1024 / uptime_seconds : 0;
+
+        output += "\n\t" + stage_name(static_cast<Stage>(i)) + " (" + std::to_string(stage.workers) + " workers): ";
+        output += std::to_string(stage.items) + " items, ";
+        output += std::to_string(kilobytes_per_second) + " KB/s, ";
+        output += std::to_string(busy_percent) + "% busy, queue ";
+        output += std::to_string(stage.queue_depth);
+        output += stage.queue_capacity > 0 ? "/" + std::to_string(stage.queue_capacity) : "";
+    }
+    return output;
+}
+
+void UploadPipeline::scan_loop_()
+{
+    while(true)
+    {
+        ScanItem item;
+        {
+            std::unique_lock<std::mutex> lock(submitted_mtx_);
+            submitted_cv_.wait(lock, [this]() { return !submitted_.empty() || !accepting_; });
+            if(!accepting_)
+            {
+                return;
+            }
+            item = std::move(submitted_.front());
+            submitted_.pop_front();
+        }
+
+        auto work_start = std::chrono::steady_clock::now();
+        std::string full_path = item.root + item.path;
+        std::error_code error;
+        if(item.deleted || !fs::is_directory(fs::symlink_status(full_path, error)))
+        {
+            std::shared_ptr<UploadFile> file = make_file_(item.root, item.path, item.deleted);
+            record_(Stage::SCAN, 0, work_start);
+            if(!stat_queue_.push(file))
+            {
+                return;
+            }
+            continue;
+        }
+
+        // every file under a directory is its own upload
+        std::vector<std::string> found;
+        fs::recursive_directory_iterator it(full_path, error);
+        for(; !error && it != fs::recursive_directory_iterator(); it.increment(error))
+        {
+            if(it->is_regular_file(error))
+            {
+                found.push_back(item.path + "/" + fs::relative(it->path(), full_path, error).string());
+            }
+        }
+        add_files_(found.size());
+        release_();
+
+        record_(Stage::SCAN, 0, work_start);
+        for(const std::string& path : found)
+        {
+            std::shared_ptr<UploadFile> file = make_file_(item.root, path, false);
+            if(!stat_queue_.push(file))
+            {
+                return;
+            }
+        }
+    }
+}
+
+void UploadPipeline::stat_loop_()
+{
+    std::shared_ptr<UploadFile> file;
+    while(stat_queue_.pop(file))
+    {
+        // deletes only need their turn on the path
+        if(file->deleted)
+        {
+            if(!hash_queue_.push(file))
+            {
+                return;
+            }
+            continue;
+        }
+        if(!is_current_(*file))
+        {
+            superseded_files_.fetch_add(1, std::memory_order_relaxed);
+            finish_file_(*file, "");
+            continue;
+        }
+
+        auto work_start = std::chrono::steady_clock::now();
+        struct stat file_info;
+        std::string full_path = file->root + file->path;
+        if(lstat(full_path.c_str(), &file_info) != 0 || !S_ISREG(file_info.st_mode))
+        {
+            record_(Stage::STAT, 0, work_start);
+            finish_file_(*file, "Could not access \"" + full_path + "\"!");
+            continue;
+        }
+
+        file->size = file_info.st_size;
+        file->modification_time = file_info.st_mtime;
+        file->inode = file_info.st_ino;
+        file->chunk_count = std::max<std::size_t>(1, (file->size + config_.chunk_size - 1) / config_.chunk_size);
+        record_(Stage::STAT, 0, work_start);
+
+        if(!hash_queue_.push(file))
+        {
+            return;
+        }
+    }
+}
+
+void UploadPipeline::hash_loop_()
+{
+    std::shared_ptr<UploadFile> file;
+    while(hash_queue_.pop(file))
+    {
+        auto work_start = std::chrono::steady_clock::now();
+        uint64_t hashed_bytes = 0;
+        if(file->deleted)
+        {
+            // nothing to hash
+        }
+        else if(callbacks_.lookup_checksum && callbacks_.lookup_checksum(*file, file->checksum))
+        {
+            cached_checksums_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            file->checksum = calculate_md5_checksum(file->root + file->path);
+            hashed_bytes = file->size;
+        }
+        record_(Stage::HASH, hashed_bytes, work_start);
+
+        if(!read_queue_.push(file))
+        {
+            return;
+        }
+    }
+}
+
+void UploadPipeline::read_loop_()
+{
+    std::shared_ptr<UploadFile> file;
+    while(read_queue_.pop(file))
+    {
+        try
+        {
+            read_file_(file);
+        }
+        catch(const std::exception& e)
+        {
+            finish_file_(*file, e.what());
+        }
+    }
+}
+
+void UploadPipeline::read_file_(std::shared_ptr<UploadFile>& file)
+{
+    // waits for the file of the same path being sent, and gives way to a newer one
+    if(!acquire_path_(*file))
+    {
+        superseded_files_.fetch_add(1, std::memory_order_relaxed);
+        finish_file_(*file, "");
+        return;
+    }
+    if(file->deleted)
+    {
+        UploadChunk chunk;
+        chunk.file = file;
+        file->chunk_count = 1;
+        if(!compress_queue_.push(std::move(chunk)))
+        {
+            finish_file_(*file, "");
+        }
+        return;
+    }
+
+    // held for the whole read, a download can not replace the file midway
+    file_lock_manager::SharedLock file_lock;
+    if(callbacks_.lock_file)
+    {
+        file_lock = callbacks_.lock_file(file->path);
+    }
+
+    std::string full_path = file->root + file->path;
+    int fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        throw std::runtime_error("[UPLOAD PIPELINE] Could not open \"" + full_path + "\": " + std::strerror(errno));
+    }
+
+    // a file written since it was hashed is sent once its writer is done,
+    // when the watcher reports it again
+    struct stat file_info;
+    if(fstat(fd, &file_info) != 0
+        || static_cast<uint64_t>(file_info.st_size) != file->size
+        || file_info.st_mtime != file->modification_time
+        || file_info.st_ino != file->inode)
+    {
+        close(fd);
+        changed_files_.fetch_add(1, std::memory_order_relaxed);
+        finish_file_(*file, "");
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for(std::size_t index = 0; index < file->chunk_count; index++)
+    {
+        auto work_start = std::chrono::steady_clock::now();
+        UploadChunk chunk;
+        chunk.file = file;
+        chunk.index = index;
+        chunk.data.resize(std::min<uint64_t>(config_.chunk_size, file->size - index * config_.chunk_size));
+
+        std::size_t offset = 0;
+        while(offset < chunk.data.size())
+        {
+            ssize_t result = pread(
+                fd,
+                &chunk.data[offset],
+                chunk.data.size() - offset,
+                index * config_.chunk_size + offset);
+            if(result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if(result <= 0)
+            {
+                std::string error = result < 0 ? std::strerror(errno) : "file was truncated";
+                close(fd);
+                throw std::runtime_error("[UPLOAD PIPELINE] Could not read \"" + full_path + "\": " + error);
+            }
+            offset += result;
+        }
+        record_(Stage::READ, chunk.data.size(), work_start);
+
+        if(!compress_queue_.push(std::move(chunk)))
+        {
+            break;
+        }
+    }
+    close(fd);
+}
+
+void UploadPipeline::compress_loop_()
+{
+    UploadChunk chunk;
+    while(compress_queue_.pop(chunk))
+    {
+        auto work_start = std::chrono::steady_clock::now();
+        uint64_t input_bytes = chunk.data.size();
+        if(callbacks_.compress && !chunk.file->deleted)
+        {
+            callbacks_.compress(chunk.data);
+        }
+        record_(Stage::COMPRESS, input_bytes, work_start);
+
+        if(!send_queue_.push(std::move(chunk)))
+        {
+            return;
+        }
+    }
+}
+
+void UploadPipeline::send_loop_()
+{
+    UploadChunk chunk;
+    while(send_queue_.pop(chunk))
+    {
+        auto work_start = std::chrono::steady_clock::now();
+        try
+        {
+            if(!chunk.file->deleted)
+            {
+                callbacks_.send(chunk);
+            }
+            else if(callbacks_.send_delete)
+            {
+                callbacks_.send_delete(chunk.file->path);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            record_(Stage::SEND, 0, work_start);
+            if(chunk.file->sent_chunks.fetch_add(1) + 1 == chunk.file->chunk_count)
+            {
+                finish_file_(*chunk.file, e.what());
+            }
+            continue;
+        }
+        record_(Stage::SEND, chunk.data.size(), work_start);
+
+        // the last chunk out completes the file, whichever worker sent it
+        if(chunk.file->sent_chunks.fetch_add(1) + 1 == chunk.file->chunk_count)
+        {
+            if(chunk.file->deleted)
+            {
+                finish_file_(*chunk.file, "");
+                continue;
+            }
+            sent_files_.fetch_add(1, std::memory_order_relaxed);
+            if(callbacks_.on_sent)
+            {
+                callbacks_.on_sent(*chunk.file);
+            }
+            finish_file_(*chunk.file, "");
+        }
+    }
+}
+
+void UploadPipeline::add_files_(std::size_t count)
+{
+    std::lock_guard<std::mutex> lock(idle_mtx_);
+    in_flight_ += count;
+}
+
+void UploadPipeline::release_()
+{
+    std::lock_guard<std::mutex> lock(idle_mtx_);
+    in_flight_--;
+    if(in_flight_ == 0)
+    {
+        idle_cv_.notify_all();
+    }
+}
+
+std::shared_ptr<UploadFile> UploadPipeline::make_file_(const std::string& root, const std::string& path, bool deleted)
+{
+    // newer than anything queued for the path before it
+    std::shared_ptr<UploadFile> file = std::make_shared<UploadFile>();
+    file->root = root;
+    file->path = path;
+    file->deleted = deleted;
+
+    std::lock_guard<std::mutex> lock(paths_mtx_);
+    PathState& state = paths_[path];
+    file->generation = ++state.latest;
+    state.pending++;
+    return file;
+}
+
+bool UploadPipeline::is_current_(const UploadFile& file)
+{
+    std::lock_guard<std::mutex> lock(paths_mtx_);
+    auto state = paths_.find(file.path);
+    return state != paths_.end() && state->second.latest == file.generation;
+}
+
+bool UploadPipeline::acquire_path_(UploadFile& file)
+{
+    // a delete is never superseded by an upload submitted after it, it
+    // still has to go first
+    std::unique_lock<std::mutex> lock(paths_mtx_);
+    paths_cv_.wait(
+        lock, 
+        [this, &file]() 
+        { 
+            auto state = paths_.find(file.path);
+            return state == paths_.end() || !state->second.busy || !running_.load(); 
+        });
+
+    auto state = paths_.find(file.path);
+    if(!running_.load() || state == paths_.end() || (!file.deleted && state->second.latest != file.generation))
+    {
+        return false;
+    }
+    state->second.busy = true;
+    file.holds_path = true;
+    return true;
+}
+
+void UploadPipeline::finish_file_(UploadFile& file, const std::string& error)
+{
+    {
+        std::lock_guard<std::mutex> lock(paths_mtx_);
+        auto state = paths_.find(file.path);
+        if(state != paths_.end())
+        {
+            state->second.busy = state->second.busy && !file.holds_path;
+            if(--state->second.pending == 0)
+            {
+                paths_.erase(state);
+            }
+        }
+        file.holds_path = false;
+    }
+    paths_cv_.notify_all();
+
+    if(!error.empty())
+    {
+        failed_files_.fetch_add(1, std::memory_order_relaxed);
+        if(callbacks_.on_failed && !file.deleted)
+        {
+            callbacks_.on_failed(file.path, error);
+        }
+    }
+    release_();
+}
+
+void UploadPipeline::record_(Stage stage, uint64_t bytes, std::chrono::steady_clock::time_point work_start)
+{
+    int index = static_cast<int>(stage);
+    uint64_t busy_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - work_start).count();
+    stage_items_[index].fetch_add(1, std::memory_order_relaxed);
+    stage_bytes_[index].fetch_add(bytes, std::memory_order_relaxed);
+    stage_busy_us_[index].fetch_add(busy_us, std::memory_order_relaxed);
+}
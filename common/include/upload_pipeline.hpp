@@ -0,0 +1,289 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+
+// local
+#include "file_lock_manager.hpp"
+
+namespace upload_pipeline
+{
+    const std::size_t DEFAULT_QUEUE_CAPACITY = 256;
+
+    enum class Stage
+    {
+        SCAN,      // submitted paths, directories expanded into their files
+        STAT,
+        HASH,      // skipped when the cache still knows the content
+        READ,      // split into chunks under a shared file lock
+        COMPRESS,
+        SEND
+    };
+
+    const int STAGE_COUNT = 6;
+
+    std::string stage_name(Stage stage);
+
+    struct PipelineConfig
+    {
+        int workers[STAGE_COUNT] = {1, 2, 2, 2, 1, 1};
+        std::size_t queue_capacity = DEFAULT_QUEUE_CAPACITY;  // items waiting in front of each stage
+        std::size_t chunk_size = 8192;
+    };
+
+    struct UploadFile
+    {
+        std::string root;
+        std::string path;  // relative to root, with leading slash
+        uint64_t size = 0;
+        std::time_t modification_time = 0;
+        uint64_t inode = 0;
+        std::string checksum;
+        std::size_t chunk_count = 0;
+        std::atomic<std::size_t> sent_chunks{0};
+        uint64_t generation = 0;  // of the path, a newer submission drops this one
+        bool deleted = false;     // a delete of the path, sent as a single empty chunk
+        bool holds_path = false;  // between read and send, see UploadPipeline
+    };
+
+    struct UploadChunk
+    {
+        std::shared_ptr<UploadFile> file;
+        std::size_t index = 0;
+        std::string data;
+    };
+
+    // returns the hash kept for the file while its metadata still matches
+    typedef std::function<bool(const UploadFile& file, std::string& checksum)> ChecksumLookup;
+
+    // transforms a chunk in place, returning false to send it as read
+    typedef std::function<bool(std::string& data)> Compressor;
+
+    // hands a chunk to the connection, blocking here is what bounds the pipeline
+    typedef std::function<void(const UploadChunk& chunk)> ChunkSender;
+
+    // hands a delete to the connection, in order with the chunks of the path,
+    // keeping it for later itself when there is no connection
+    typedef std::function<void(const std::string& path)> DeleteSender;
+
+    typedef std::function<file_lock_manager::SharedLock(const std::string& path)> LockCallback;
+    typedef std::function<void(const UploadFile& file)> SentCallback;
+    typedef std::function<void(const std::string& path, const std::string& error)> FailureCallback;
+
+    struct UploadCallbacks
+    {
+        ChecksumLookup lookup_checksum;  // may be empty, every file is hashed then
+        Compressor compress;             // may be empty, chunks are sent as read
+        ChunkSender send;
+        DeleteSender send_delete;        // may be empty, deletes are dropped then
+        LockCallback lock_file;          // may be empty when files need no locking
+        SentCallback on_sent;
+        FailureCallback on_failed;
+    };
+
+    struct StageStats
+    {
+        int workers = 0;
+        uint64_t items = 0;      // files, chunks past the read stage
+        uint64_t bytes = 0;
+        uint64_t busy_us = 0;    // summed over the stage workers
+        std::size_t queue_depth = 0;
+        std::size_t queue_capacity = 0;
+    };
+
+    struct PipelineStats
+    {
+        StageStats stages[STAGE_COUNT];
+        uint64_t sent_files = 0;
+        uint64_t cached_checksums = 0;
+        uint64_t changed_files = 0;  // changed between stat and read, left for the watcher
+        uint64_t superseded_files = 0;  // dropped for a newer upload or a delete of the path
+        uint64_t failed_files = 0;
+        uint64_t uptime_us = 0;
+    };
+
+    template <typename T>
+    class BoundedQueue
+    {
+        // blocking fifo between two stages, push waits while it is full
+        public:
+            BoundedQueue(std::size_t capacity) : capacity_(capacity), closed_(false)
+            {
+                //
+            }
+
+            // false once the queue was closed
+            bool push(T item)
+            {
+                std::unique_lock<std::mutex> lock(queue_mtx_);
+                not_full_cv_.wait(lock, [this]() { return items_.size() < capacity_ || closed_; });
+                if(closed_)
+                {
+                    return false;
+                }
+                items_.push_back(std::move(item));
+                not_empty_cv_.notify_one();
+                return true;
+            }
+
+            // false once the queue was closed and drained
+            bool pop(T& item)
+            {
+                std::unique_lock<std::mutex> lock(queue_mtx_);
+                not_empty_cv_.wait(lock, [this]() { return !items_.empty() || closed_; });
+                if(items_.empty())
+                {
+                    return false;
+                }
+                item = std::move(items_.front());
+                items_.pop_front();
+                not_full_cv_.notify_one();
+                return true;
+            }
+
+            void close()
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx_);
+                closed_ = true;
+                not_full_cv_.notify_all();
+                not_empty_cv_.notify_all();
+            }
+
+            std::size_t size()
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx_);
+                return items_.size();
+            }
+
+            std::size_t capacity()
+            {
+                return capacity_;
+            }
+
+        private:
+            std::size_t capacity_;
+            bool closed_;
+            std::deque<T> items_;
+            std::mutex queue_mtx_;
+            std::condition_variable not_full_cv_;
+            std::condition_variable not_empty_cv_;
+    };
+
+    class UploadPipeline
+    {
+        // sends local files through a chain of stages, each with its own
+        // workers and a bounded queue in front of it, so hashing and reading
+        // the next files overlaps with sending the current ones
+        // a full queue stalls the stage feeding it, the send callback blocking
+        // on the connection is what eventually holds back the disk
+        // a path is read and sent by one file at a time, in submission order -
+        // a newer upload or a delete drops older uploads of the path not read
+        // yet, and waits for the one being sent to be handed over whole
+        // only submit() and remove() never block, they are called from the sender thread
+        public:
+            UploadPipeline(PipelineConfig config = PipelineConfig());
+            ~UploadPipeline();
+
+            void start(UploadCallbacks callbacks);
+            void stop();
+
+            // queues a file, or every file under a directory, for upload
+            void submit(const std::string& root, const std::string& path);
+
+            // queues a delete of path, sent after the upload of it already being sent
+            void remove(const std::string& root, const std::string& path);
+
+            // blocks until every submitted file was sent or dropped
+            void wait_idle();
+            bool is_idle();
+
+            PipelineStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct ScanItem
+            {
+                std::string root;
+                std::string path;
+                bool deleted = false;
+            };
+
+            struct PathState
+            {
+                uint64_t latest = 0;      // generation of the newest submission
+                bool busy = false;        // a file of the path is between read and send
+                std::size_t pending = 0;  // submissions not finished, dropped with the last
+            };
+
+            PipelineConfig config_;
+            UploadCallbacks callbacks_;
+
+            // the scan queue is unbounded, every other one is bounded
+            std::deque<ScanItem> submitted_;
+            bool accepting_;
+            std::mutex submitted_mtx_;
+            std::condition_variable submitted_cv_;
+
+            BoundedQueue<std::shared_ptr<UploadFile>> stat_queue_;
+            BoundedQueue<std::shared_ptr<UploadFile>> hash_queue_;
+            BoundedQueue<std::shared_ptr<UploadFile>> read_queue_;
+            BoundedQueue<UploadChunk> compress_queue_;
+            BoundedQueue<UploadChunk> send_queue_;
+
+            std::vector<std::thread> workers_[STAGE_COUNT];
+            std::atomic<bool> running_;
+
+            // generations are handed out by the single scan worker, in
+            // submission order
+            std::unordered_map<std::string, PathState> paths_;
+            std::mutex paths_mtx_;
+            std::condition_variable paths_cv_;
+
+            // files submitted but neither sent nor dropped yet
+            uint64_t in_flight_;
+            std::mutex idle_mtx_;
+            std::condition_variable idle_cv_;
+
+            // statistics
+            std::atomic<uint64_t> stage_items_[STAGE_COUNT];
+            std::atomic<uint64_t> stage_bytes_[STAGE_COUNT];
+            std::atomic<uint64_t> stage_busy_us_[STAGE_COUNT];
+            std::atomic<uint64_t> sent_files_;
+            std::atomic<uint64_t> cached_checksums_;
+            std::atomic<uint64_t> changed_files_;
+            std::atomic<uint64_t> superseded_files_;
+            std::atomic<uint64_t> failed_files_;
+            std::chrono::steady_clock::time_point started_;
+
+            void scan_loop_();
+            void stat_loop_();
+            void hash_loop_();
+            void read_loop_();
+            void compress_loop_();
+            void send_loop_();
+
+            void read_file_(std::shared_ptr<UploadFile>& file);
+            std::shared_ptr<UploadFile> make_file_(const std::string& root, const std::string& path, bool deleted);
+            bool is_current_(const UploadFile& file);
+            bool acquire_path_(UploadFile& file);
+            void add_files_(std::size_t count);
+            void release_();
+            void finish_file_(UploadFile& file, const std::string& error = "");
+            void record_(Stage stage, uint64_t bytes, std::chrono::steady_clock::time_point work_start);
+    };
+}
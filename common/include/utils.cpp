@@ -19,6 +19,7 @@
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/md5.h>
+#include <cryptopp/sha.h>
 #include <cryptopp/hex.h>
 #include <cryptopp/files.h>
 
@@ -32,6 +33,12 @@ namespace fs = std::filesystem;
 bool is_valid_username(const std::string& username) 
 {
     // checks if the username is alphanumeric and does not have any symbols (including spaces)
+    // an empty one would be served the whole server folder
+    if(username.empty())
+    {
+        return false;
+    }
+
     for(char c : username) 
     {
         if (!std::isalnum(c)) 
@@ -188,6 +195,59 @@ std::string calculate_md5_checksum(const std::string& filepath)
     return digest;
 }
 
+std::string calculate_md5_checksum(const char* data, std::size_t size)
+{
+    // same digest as the file version, for contents already in memory
+    CryptoPP::Weak1::MD5 md5;
+    std::string digest;
+
+    CryptoPP::StringSource source(std::string(data, size), true,
+        new CryptoPP::HashFilter(md5, new CryptoPP::HexEncoder(new CryptoPP::StringSink(digest))));
+
+    return digest;
+}
+
+std::string calculate_sha256_checksum(const std::string& filepath)
+{
+    // md5 is fine to spot transfer errors, but content shared between
+    // users is keyed by this one, so collisions must be out of reach
+    CryptoPP::SHA256 sha256;
+    std::string digest;
+
+    CryptoPP::FileSource file(filepath.c_str(), true,
+        new CryptoPP::HashFilter(sha256, new CryptoPP::HexEncoder(new CryptoPP::StringSink(digest), false)));
+
+    return digest;
+}
+
+uint32_t calculate_crc32(const char* data, std::size_t size)
+{
+    // reflected crc-32, table built on first use
+    static uint32_t table[256] = {0};
+    static std::once_flag table_flag;
+    std::call_once(
+        table_flag,
+        []()
+        {
+            for(uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t value = i;
+                for(int bit = 0; bit < 8; bit++)
+                {
+                    value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+                }
+                table[i] = value;
+            }
+        });
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for(std::size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
 std::vector<std::vector<char>> bufferize_file(std::string file_path, std::size_t buffer_size)
 {
     std::ifstream file(file_path, std::ios::binary);
@@ -219,7 +279,7 @@ std::vector<std::vector<char>> bufferize_file(std::string file_path, std::size_t
 
 void rename_replacing(std::string& old_path, std::string& new_path)
 {
-    if(!std::rename(old_path.c_str(), new_path.c_str()))
+    if(std::rename(old_path.c_str(), new_path.c_str()) != 0)
     {
         throw std::runtime_error("[UTILS] Could nome rename file " + old_path);
     }
@@ -235,7 +295,7 @@ std::string file_without_extension(std::string file_name)
     return file_name;
 }
 
-int get_folder_space(std::string folder_path, std::string param = "")
+uint64_t get_folder_space(std::string folder_path, std::string param = "")
 {
     if (fs::exists(folder_path)) 
     {
@@ -244,16 +304,16 @@ int get_folder_space(std::string folder_path, std::string param = "")
             fs::space_info space = fs::space(folder_path);
             if(param == "free")
             {
-                return static_cast<int>(space.free);
+                return static_cast<uint64_t>(space.free);
             }
             else if(param == "used")
             {
-                return static_cast<int>(space.capacity - space.free);
+                return static_cast<uint64_t>(space.capacity - space.free);
 
             }
             else if(param == "total")
             {
-                return static_cast<int>(space.capacity);
+                return static_cast<uint64_t>(space.capacity);
             }
             else
             {
@@ -3,6 +3,7 @@
 // c++
 #include <iostream>
 #include <ctime>
+#include <cstdint>
 #include <mutex>
 #include <list>
 #include <condition_variable>
@@ -33,9 +34,12 @@ json get_json_contents(const std::string& path);
 void save_json_to_file(json data, const std::string& filename);
 void rename_replacing(std::string& old_path, std::string& new_path);
 std::string file_without_extension(std::string file_name); 
-int get_folder_space(std::string folder_path, std::string param);
+uint64_t get_folder_space(std::string folder_path, std::string param);  // filesystem wide
 std::string get_file_name(std::string& path);
 std::string calculate_md5_checksum(const std::string& file_path);
+std::string calculate_md5_checksum(const char* data, std::size_t size);
+std::string calculate_sha256_checksum(const std::string& file_path);
+uint32_t calculate_crc32(const char* data, std::size_t size);
 std::vector<std::vector<char>> bufferize_file(std::string file_path, std::size_t buffer_size);
 
 // other utilities
@@ -0,0 +1,557 @@
+// c++
+#include <stdexcept>
+#include <filesystem>
+#include <fstream>
+#include <ctime>
+#include <cstdio>
+
+// c
+#include <unistd.h>
+#include <sys/stat.h>
+
+// local
+#include "version_store.hpp"
+#include "binary_delta.hpp"
+#include "utils.hpp"
+
+using namespace version_store;
+namespace fs = std::filesystem;
+
+const std::string HISTORY_FILE_NAME = "history.json";
+const std::string STAGED_SUFFIX = ".swizstaged";
+
+static uint64_t hash_path(const std::string& path)
+{
+    // fnv-1a, collisions are told apart by the path kept in each history
+    uint64_t hash = 14695981039346656037ULL;
+    for(char c : path)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool read_file(const std::string& path, std::string& contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open())
+    {
+        return false;
+    }
+    contents.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+static int64_t modification_ns(const struct stat& info)
+{
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+VersionStore::VersionStore(
+    const std::string& directory,
+    int max_versions,
+    int max_age_days,
+    uint64_t max_delta_size)
+    :   directory_(directory),
+        max_versions_(max_versions),
+        max_age_days_(max_age_days),
+        max_delta_size_(max_delta_size),
+        next_staged_(0)
+{
+    fs::create_directories(directory_);
+    load_stats_();
+}
+
+std::shared_ptr<PendingVersion> VersionStore::prepare(
+    const std::string& path,
+    const std::string& current_path,
+    const std::string& next_path)
+{
+    std::shared_ptr<PendingVersion> pending = std::make_shared<PendingVersion>();
+    pending->path = path;
+    pending->current_path = current_path;
+    pending->next_path = next_path;
+
+    // nothing is replaced when the file is new
+    struct stat current_info;
+    if(stat(current_path.c_str(), &current_info) != 0 || !S_ISREG(current_info.st_mode))
+    {
+        return pending;
+    }
+
+    pending->inode = current_info.st_ino;
+    pending->size = current_info.st_size;
+    pending->modification_ns = modification_ns(current_info);
+    pending->info.size = current_info.st_size;
+    pending->info.checksum = calculate_md5_checksum(current_path);
+    pending->valid = true;
+
+    // too big to diff in memory, the replaced file is linked whole instead
+    struct stat next_info;
+    if(static_cast<uint64_t>(current_info.st_size) > max_delta_size_
+        || stat(next_path.c_str(), &next_info) != 0
+        || static_cast<uint64_t>(next_info.st_size) > max_delta_size_)
+    {
+        pending->info.full = true;
+        return pending;
+    }
+
+    std::string current;
+    std::string next;
+    if(!read_file(current_path, current) || !read_file(next_path, next))
+    {
+        pending->info.full = true;
+        return pending;
+    }
+
+    // unrelated contents make deltas bigger than the file itself
+    pending->blob = binary_delta::encode(next, current);
+    if(pending->blob.size() >= current.size())
+    {
+        pending->blob.clear();
+        pending->info.full = true;
+    }
+    return pending;
+}
+
+StagedVersion VersionStore::stage(PendingVersion& pending)
+{
+    // NOTE: caller must hold the file lock exclusively
+    struct stat current_info;
+    if(stat(pending.current_path.c_str(), &current_info) != 0 || !S_ISREG(current_info.st_mode))
+    {
+        return StagedVersion();
+    }
+
+    // another commit got in between, its file is the one being replaced now
+    bool changed = !pending.valid
+        || current_info.st_ino != pending.inode
+        || current_info.st_size != pending.size
+        || modification_ns(current_info) != pending.modification_ns;
+    if(changed)
+    {
+        pending = *prepare(pending.path, pending.current_path, pending.next_path);
+        if(!pending.valid)
+        {
+            return StagedVersion();
+        }
+    }
+
+    if(pending.info.full)
+    {
+        return stage_blob_(pending.path, pending.info, nullptr, pending.current_path);
+    }
+    return stage_blob_(pending.path, pending.info, &pending.blob, "");
+}
+
+StagedVersion VersionStore::stage_whole(const std::string& path, const std::string& current_path, const std::string& checksum)
+{
+    // NOTE: caller must hold the file lock exclusively
+    struct stat current_info;
+    if(stat(current_path.c_str(), &current_info) != 0 || !S_ISREG(current_info.st_mode))
+    {
+        return StagedVersion();
+    }
+
+    VersionInfo info;
+    info.size = current_info.st_size;
+    info.full = true;
+    info.checksum = checksum.empty() ? calculate_md5_checksum(current_path) : checksum;
+    return stage_blob_(path, info, nullptr, current_path);
+}
+
+StagedVersion VersionStore::stage(
+    const std::string& path, 
+    const std::string& current, 
+    const std::string* next, 
+    const std::string& checksum)
+{
+    // NOTE: caller must hold the file lock exclusively
+    VersionInfo info;
+    info.size = current.size();
+    info.checksum = checksum;
+
+    std::string blob;
+    if(next != nullptr && current.size() <= max_delta_size_ && next->size() <= max_delta_size_)
+    {
+        blob = binary_delta::encode(*next, current);
+    }
+
+    if(blob.empty() || blob.size() >= current.size())
+    {
+        info.full = true;
+        return stage_blob_(path, info, &current, "");
+    }
+    return stage_blob_(path, info, &blob, "");
+}
+
+void VersionStore::finish(const StagedVersion& staged, bool replaced)
+{
+    // NOTE: caller must hold the file lock exclusively
+    if(staged.staged_path.empty())
+    {
+        return;
+    }
+
+    // a delta of contents that never went live could not be applied, and
+    // would break every older version along with it
+    if(!replaced)
+    {
+        std::error_code error;
+        fs::remove(staged.staged_path, error);
+        return;
+    }
+    push_version_(staged);
+}
+
+std::vector<VersionInfo> VersionStore::list(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+
+    History history;
+    if(!load_history_(path, history, false))
+    {
+        return {};
+    }
+    return history.versions;
+}
+
+bool VersionStore::restore(
+    const std::string& path,
+    uint32_t id,
+    std::function<bool(std::string& contents)> read_latest,
+    std::string& contents)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+
+    History history;
+    if(!load_history_(path, history, false))
+    {
+        return false;
+    }
+
+    int target = -1;
+    for(std::size_t i = 0; i < history.versions.size(); i++)
+    {
+        if(history.versions[i].id == id)
+        {
+            target = i;
+            break;
+        }
+    }
+    if(target < 0)
+    {
+        return false;
+    }
+
+    // walks down from the closest full copy above the target, or from the
+    // live file when every newer version is a delta
+    int start = history.versions.size();
+    for(std::size_t i = target; i < history.versions.size(); i++)
+    {
+        if(history.versions[i].full)
+        {
+            start = i;
+            break;
+        }
+    }
+
+    std::string data;
+    if(start == static_cast<int>(history.versions.size()))
+    {
+        if(!read_latest(data))
+        {
+            return false;
+        }
+    }
+    else if(!read_file(blob_path_(history, history.versions[start]), data))
+    {
+        return false;
+    }
+
+    for(int i = start - 1; i >= target; i--)
+    {
+        std::string delta;
+        if(!read_file(blob_path_(history, history.versions[i]), delta))
+        {
+            return false;
+        }
+        data = binary_delta::apply(data, delta);
+    }
+
+    contents.swap(data);
+    return true;
+}
+
+uint64_t VersionStore::prune_expired()
+{
+    if(max_age_days_ <= 0)
+    {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    uint64_t pruned_before = stats_.pruned_versions;
+
+    std::error_code error;
+    for(const fs::directory_entry& entry : fs::directory_iterator(directory_, error))
+    {
+        std::string history_path = entry.path().string() + "/" + HISTORY_FILE_NAME;
+        try
+        {
+            json data = get_json_contents(history_path);
+            std::string path = data["path"];
+
+            History history;
+            if(!load_history_(path, history, false))
+            {
+                continue;
+            }
+
+            std::size_t kept = history.versions.size();
+            apply_retention_(history);
+            if(history.versions.size() != kept)
+            {
+                save_history_(path, history);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            // unreadable histories are left for inspection
+            continue;
+        }
+    }
+    return stats_.pruned_versions - pruned_before;
+}
+
+std::string VersionStore::get_directory()
+{
+    return directory_;
+}
+
+VersionStats VersionStore::get_stats()
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+    return stats_;
+}
+
+std::string VersionStore::format_stats()
+{
+    VersionStats stats = get_stats();
+    std::string output = "versions: " + std::to_string(stats.versions) + " kept for ";
+    output += std::to_string(stats.files) + " files, ";
+    output += std::to_string(stats.stored_bytes) + " bytes stored for ";
+    output += std::to_string(stats.logical_bytes) + " bytes of old contents, ";
+    output += std::to_string(stats.pruned_versions) + " pruned";
+    return output;
+}
+
+std::string VersionStore::history_directory_(const std::string& path, bool create)
+{
+    // NOTE: caller must hold store_mtx_
+    char name[24];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash_path(path)));
+
+    for(int suffix = 0; ; suffix++)
+    {
+        std::string directory = directory_ + "/" + name;
+        if(suffix > 0)
+        {
+            directory += "-" + std::to_string(suffix);
+        }
+
+        if(!fs::exists(directory + "/" + HISTORY_FILE_NAME))
+        {
+            return create ? directory : "";
+        }
+
+        // another path with the same hash moves on to the next suffix
+        json data = get_json_contents(directory + "/" + HISTORY_FILE_NAME);
+        if(data["path"] == path)
+        {
+            return directory;
+        }
+    }
+}
+
+bool VersionStore::load_history_(const std::string& path, History& history, bool create)
+{
+    // NOTE: caller must hold store_mtx_
+    history.directory = history_directory_(path, create);
+    if(history.directory.empty())
+    {
+        return false;
+    }
+
+    std::string history_path = history.directory + "/" + HISTORY_FILE_NAME;
+    if(!fs::exists(history_path))
+    {
+        return true;
+    }
+
+    json data = get_json_contents(history_path);
+    history.next_id = data["next_id"];
+    for(const json& entry : data["versions"])
+    {
+        VersionInfo version;
+        version.id = entry["id"];
+        version.superseded_time = entry["time"];
+        version.size = entry["size"];
+        version.stored_bytes = entry["stored"];
+        version.full = entry["full"];
+        version.checksum = entry["checksum"];
+        history.versions.push_back(version);
+    }
+    return true;
+}
+
+void VersionStore::save_history_(const std::string& path, const History& history)
+{
+    // NOTE: caller must hold store_mtx_
+    if(history.versions.empty())
+    {
+        fs::remove_all(history.directory);
+        stats_.files--;
+        return;
+    }
+
+    json data;
+    data["path"] = path;
+    data["next_id"] = history.next_id;
+    data["versions"] = json::array();
+    for(const VersionInfo& version : history.versions)
+    {
+        data["versions"].push_back({
+            {"id", version.id},
+            {"time", version.superseded_time},
+            {"size", version.size},
+            {"stored", version.stored_bytes},
+            {"full", version.full},
+            {"checksum", version.checksum}});
+    }
+
+    // replaced at once, a crash keeps either the old or the new history
+    std::string history_path = history.directory + "/" + HISTORY_FILE_NAME;
+    std::string temp_path = history_path + ".swizdownload";
+    save_json_to_file(data, temp_path);
+    rename_replacing(temp_path, history_path);
+}
+
+std::string VersionStore::blob_path_(const History& history, const VersionInfo& version)
+{
+    return history.directory + "/" + std::to_string(version.id) + (version.full ? ".full" : ".delta");
+}
+
+StagedVersion VersionStore::stage_blob_(
+    const std::string& path, 
+    VersionInfo info, 
+    const std::string* blob, 
+    const std::string& link_from)
+{
+    // staged next to the histories, blobs then only need a rename into place
+    StagedVersion staged;
+    staged.path = path;
+    staged.staged_path = directory_ + "/" + std::to_string(getpid()) + "-";
+    staged.staged_path += std::to_string(next_staged_.fetch_add(1)) + STAGED_SUFFIX;
+
+    if(!link_from.empty())
+    {
+        // the replaced file is never written again, so sharing its inode is
+        // as good as a copy - filesystems without hard links get a real one
+        if(link(link_from.c_str(), staged.staged_path.c_str()) != 0)
+        {
+            fs::copy_file(link_from, staged.staged_path, fs::copy_options::overwrite_existing);
+        }
+        info.stored_bytes = info.size;
+    }
+    else
+    {
+        std::ofstream file(staged.staged_path, std::ios::binary | std::ios::trunc);
+        file.write(blob->data(), blob->size());
+        if(!file.good())
+        {
+            file.close();
+            std::error_code error;
+            fs::remove(staged.staged_path, error);
+            throw std::runtime_error("[VERSION STORE] Could not write version of \"" + path + "\"!");
+        }
+        info.stored_bytes = blob->size();
+    }
+
+    staged.info = info;
+    return staged;
+}
+
+void VersionStore::push_version_(const StagedVersion& staged)
+{
+    std::lock_guard<std::mutex> lock(store_mtx_);
+
+    History history;
+    load_history_(staged.path, history, true);
+    bool new_history = history.versions.empty();
+    fs::create_directories(history.directory);
+
+    VersionInfo info = staged.info;
+    info.id = history.next_id++;
+    info.superseded_time = std::time(nullptr);
+    fs::rename(staged.staged_path, blob_path_(history, info));
+
+    history.versions.push_back(info);
+    stats_.files += new_history ? 1 : 0;
+    stats_.versions++;
+    stats_.logical_bytes += info.size;
+    stats_.stored_bytes += info.stored_bytes;
+
+    apply_retention_(history);
+    save_history_(staged.path, history);
+}
+
+void VersionStore::apply_retention_(History& history)
+{
+    // NOTE: caller must hold store_mtx_
+    // nothing depends on the oldest version, so it always goes first
+    int64_t oldest_kept = std::time(nullptr) - static_cast<int64_t>(max_age_days_) * 24 * 60 * 60;
+    while(!history.versions.empty())
+    {
+        const VersionInfo& oldest = history.versions.front();
+        bool over_count = max_versions_ > 0 && history.versions.size() > static_cast<std::size_t>(max_versions_);
+        bool over_age = max_age_days_ > 0 && oldest.superseded_time < oldest_kept;
+        if(!over_count && !over_age)
+        {
+            break;
+        }
+
+        std::error_code error;
+        fs::remove(blob_path_(history, oldest), error);
+
+        stats_.versions--;
+        stats_.logical_bytes -= oldest.size;
+        stats_.stored_bytes -= oldest.stored_bytes;
+        stats_.pruned_versions++;
+        history.versions.erase(history.versions.begin());
+    }
+}
+
+void VersionStore::load_stats_()
+{
+    std::error_code error;
+    for(const fs::directory_entry& entry : fs::directory_iterator(directory_, error))
+    {
+        try
+        {
+            json data = get_json_contents(entry.path().string() + "/" + HISTORY_FILE_NAME);
+            stats_.files++;
+            for(const json& version : data["versions"])
+            {
+                stats_.versions++;
+                stats_.logical_bytes += version["size"].get<uint64_t>();
+                stats_.stored_bytes += version["stored"].get<uint64_t>();
+            }
+        }
+        catch(const std::exception& e)
+        {
+            continue;
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+// c++
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+// synchronization
+#include <atomic>
+#include <mutex>
+
+// c
+#include <sys/types.h>
+
+namespace version_store
+{
+    const uint64_t DEFAULT_MAX_DELTA_SIZE = 64 * 1024 * 1024;  // bigger files keep linked full copies
+
+    struct VersionInfo
+    {
+        uint32_t id = 0;
+        int64_t superseded_time = 0;  // when these contents were replaced or deleted
+        uint64_t size = 0;
+        uint64_t stored_bytes = 0;
+        bool full = false;            // kept whole instead of as a delta
+        std::string checksum;
+    };
+
+    struct VersionStats
+    {
+        uint64_t files = 0;
+        uint64_t versions = 0;
+        uint64_t logical_bytes = 0;
+        uint64_t stored_bytes = 0;
+        uint64_t pruned_versions = 0;
+    };
+
+    struct PendingVersion
+    {
+        // old contents of a file, encoded before its replacement is published
+        std::string path;
+        std::string current_path;
+        std::string next_path;
+        bool valid = false;
+
+        std::string blob;
+        VersionInfo info;
+
+        // identity of the replaced file when prepared
+        ino_t inode = 0;
+        int64_t size = 0;
+        int64_t modification_ns = 0;
+    };
+
+    struct StagedVersion
+    {
+        // a version written aside, only entered into the history once the
+        // replacement it was encoded against went live
+        std::string path;
+        std::string staged_path;  // empty when nothing was staged
+        VersionInfo info;
+    };
+
+    class VersionStore
+    {
+        // old versions of the files of a user, kept as reverse deltas
+        // the newest version of a path is always the live file, every kept
+        // version is a delta that rebuilds it from the next newer one, so
+        // the oldest versions can be dropped without touching the others
+        // deleted files and files too big to diff are kept whole
+        // every path owns <directory>/<path hash>/ with its history.json
+        // and one blob per version
+        public:
+            VersionStore(
+                const std::string& directory,
+                int max_versions,
+                int max_age_days,
+                uint64_t max_delta_size = DEFAULT_MAX_DELTA_SIZE);
+
+            // encodes the current file against the one about to replace it
+            // meant to run outside of any lock, as diffing is the slow part
+            std::shared_ptr<PendingVersion> prepare(
+                const std::string& path,
+                const std::string& current_path,
+                const std::string& next_path);
+
+            // writes a prepared version aside right before the replacement happens
+            // a current file changed since prepare is encoded again
+            // NOTE: caller must hold the file lock exclusively until finish
+            StagedVersion stage(PendingVersion& pending);
+
+            // keeps a whole file about to be deleted or replaced, linked instead
+            // of copied - checksum is computed when empty
+            // NOTE: caller must hold the file lock exclusively until finish
+            StagedVersion stage_whole(const std::string& path, const std::string& current_path, const std::string& checksum = "");
+
+            // in memory variant for files that are not regular files
+            // next is nullptr when the path goes away, the current contents
+            // are then kept whole
+            // NOTE: caller must hold the file lock exclusively until finish
+            StagedVersion stage(
+                const std::string& path, 
+                const std::string& current, 
+                const std::string* next, 
+                const std::string& checksum);
+
+            // enters a staged version into the history once the replacement or
+            // delete it was staged for went through, or drops it when it failed
+            // NOTE: caller must still hold the file lock taken for staging
+            void finish(const StagedVersion& staged, bool replaced);
+
+            // versions of a path, oldest first
+            std::vector<VersionInfo> list(const std::string& path);
+
+            // rebuilds the contents of an old version
+            // read_latest gives the contents the path holds now, it is only
+            // called when the newest kept version is a delta
+            bool restore(
+                const std::string& path,
+                uint32_t id,
+                std::function<bool(std::string& contents)> read_latest,
+                std::string& contents);
+
+            // drops versions past the age limit from every history, for paths
+            // that were not written again since - returns how many were dropped
+            uint64_t prune_expired();
+
+            // on the same filesystem as the user files, for restores to rename from
+            std::string get_directory();
+
+            VersionStats get_stats();
+            std::string format_stats();
+
+        private:
+            struct History
+            {
+                std::string directory;
+                uint32_t next_id = 1;
+                std::vector<VersionInfo> versions;
+            };
+
+            std::string directory_;
+            int max_versions_;
+            int max_age_days_;
+            uint64_t max_delta_size_;
+
+            VersionStats stats_;
+            std::atomic<uint64_t> next_staged_;
+            std::mutex store_mtx_;
+
+            std::string history_directory_(const std::string& path, bool create);
+            bool load_history_(const std::string& path, History& history, bool create);
+            void save_history_(const std::string& path, const History& history);
+            std::string blob_path_(const History& history, const VersionInfo& version);
+            StagedVersion stage_blob_(const std::string& path, VersionInfo info, const std::string* blob, const std::string& link_from);
+            void push_version_(const StagedVersion& staged);
+            void apply_retention_(History& history);
+            void load_stats_();
+    };
+}
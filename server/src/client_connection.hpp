@@ -6,6 +6,11 @@
 #include <thread>
 #include <functional>
 #include <list>
+#include <deque>
+#include <set>
+#include <memory>
+#include <ctime>
+#include <unordered_map>
 
 // synchronization
 #include <atomic>
@@ -15,6 +20,17 @@
 
 // locals
 #include "../include/common/utils_packet.hpp"
+#include "../include/common/path_table.hpp"
+#include "../include/common/file_lock_manager.hpp"
+#include "../include/common/chunk_writer.hpp"
+#include "../include/common/commit_pipeline.hpp"
+#include "../include/common/metadata_journal.hpp"
+#include "../include/common/pack_store.hpp"
+#include "../include/common/dedup_store.hpp"
+#include "../include/common/version_store.hpp"
+#include "../include/common/cold_store.hpp"
+#include "../include/common/garbage_collector.hpp"
+#include "server_config.hpp"
 
 using namespace utils_packet;
 
@@ -24,7 +40,83 @@ namespace client_connection
     void aprint(std::string content, int scope = 0, bool endl = true);
     void raise(std::string content, int scope = 0);
 
-    class ClientSession
+    // how long a session receiver waits on an idle socket before checking if it should stop
+    const int SESSION_POLL_MS = 1000;
+    const int RESUME_TOKEN_BYTES = 16;
+    const std::size_t MAX_PARKED_PACKETS = 4096;  // queued for a parked session before it stops being resumable
+    const std::size_t MAX_UNACKNOWLEDGED_PACKETS = 4096;  // sent but not acknowledged, kept for a resumption
+
+    // random hex string a device presents to take its session back
+    std::string generate_resume_token();
+
+    struct UserNamespace
+    {
+        // state shared by every session of the same user
+        UserNamespace() : index(&paths) {}
+
+        std::string username;
+        std::string directory;
+        path_table::PathTable paths;
+        file_lock_manager::FileLockManager locks;
+        chunk_writer::ChunkWriterTable writers;
+        metadata_journal::FileIndex index;
+
+        // small file storage, only set when packing is enabled
+        std::shared_ptr<pack_store::PackStore> packs;
+        uint64_t pack_threshold = 0;
+
+        // old versions of replaced and deleted files, only set when enabled
+        std::shared_ptr<version_store::VersionStore> versions;
+
+        // compressed files nobody touched for a while, only set when enabled
+        std::shared_ptr<cold_store::ColdStore> cold;
+
+        // shared by every user
+        std::shared_ptr<commit_pipeline::CommitPipeline> commits;
+        std::shared_ptr<metadata_journal::MetadataJournal> journal;
+
+        // content shared across users, only set when deduplication is enabled
+        std::shared_ptr<dedup_store::DedupStore> dedup;
+        uint64_t dedup_min_bytes = 0;
+
+        // journals a file operation and applies it to the index, never throws
+        // size and modification time of committed files are read from disk
+        void log_operation(metadata_journal::JournalOperation operation, const std::string& path, const std::string& checksum = "");
+
+        // stages what a path holds before it is replaced or deleted, never throws
+        // pending is set when a regular file replaces it, next_contents when
+        // a packed file does, neither when the path is being deleted
+        // NOTE: caller must hold the file lock exclusively until finish_version
+        version_store::StagedVersion preserve_version(
+            const std::string& path, 
+            const std::string& local_path,
+            version_store::PendingVersion* pending = nullptr, 
+            const std::string* next_contents = nullptr);
+
+        // keeps a staged version once its replacement or delete went through,
+        // drops it otherwise - never throws
+        // NOTE: caller must still hold the file lock taken for preserve_version
+        void finish_version(const version_store::StagedVersion& staged, bool replaced);
+
+        // compresses regular files not read nor written for cold_after_seconds
+        // stops once byte_budget bytes were read or pace returns false, pace
+        // is told how many bytes are about to be read
+        // returns how many bytes compression saved
+        uint64_t compress_cold_files(
+            int cold_after_seconds, 
+            uint64_t byte_budget, 
+            std::function<bool(uint64_t bytes)> pace = nullptr);
+
+        // drops compressed copies of files that were written again since
+        // returns how many bytes were reclaimed
+        uint64_t remove_superseded_cold_files(std::function<bool()> pace = nullptr);
+
+        // decompresses a cold file back into the user folder before it is served
+        // a cold copy left behind by a newer write is dropped instead
+        void rehydrate_cold_file(const std::string& path, const std::string& local_path);
+    };
+
+    class ClientSession : public std::enable_shared_from_this<ClientSession>
     {
         // client connection instance to server
         public:
@@ -33,9 +125,11 @@ namespace client_connection
                 std::string username, 
                 std::string machine_name,
                 std::string directory_path,
+                std::shared_ptr<UserNamespace> user_namespace,
                 std::function<void(const packet& p, int sockfd, int timeout)> send_callback_,
                 std::function<void(packet* p, int sockfd, int timeout)> receive_callback_,
-                std::function<void(int caller_sockfd, packet& p)> broadcast_user_callback);
+                std::function<void(int caller_sockfd, packet& p)> broadcast_user_callback,
+                std::string resume_token = "");
             
             ~ClientSession();
 
@@ -46,6 +140,29 @@ namespace client_connection
             std::string get_machine_name();
             std::string get_identifier();
             std::chrono::high_resolution_clock::time_point get_last_ping();
+            bool is_alive();
+
+            // resumption - a session whose connection dropped is parked, its
+            // loops stop but everything queued for it is kept, and broadcasts
+            // keep being queued, until its device comes back with the token
+            // sent packets are kept until the device acknowledges them, and
+            // it tells at login how many it got, so the ones lost along with
+            // the connection are sent again
+            std::string get_resume_token();
+            bool is_parked();
+            bool is_resumable(int grace_seconds);
+            std::time_t get_parked_time();
+
+            // reserves a parked session for a single resumption
+            bool claim(const std::string& resume_token, int grace_seconds);
+            void release_claim();
+
+            // whether every packet after received_packets was kept
+            bool can_replay(uint64_t received_packets);
+
+            // restarts the loops of a claimed session on the new socket,
+            // sending again whatever came after received_packets
+            void resume(int sock_fd, uint64_t received_packets);
 
             // network
             void send_ping();
@@ -69,16 +186,18 @@ namespace client_connection
 
         private:
             // identifiers
-            int socket_fd_;  // connection identifier
+            std::atomic<int> socket_fd_;  // connection identifier, replaced on resumption
             std::string username_;
             std::string address_;
             std::string machine_;
             std::string directory_path_;
+            std::shared_ptr<UserNamespace> user_namespace_;
 
             // internal buffers
             std::vector<packet> sender_buffer_;
             std::vector<packet> receiver_buffer_;
-            std::unordered_map<std::string, std::shared_ptr<std::shared_mutex>> file_mtx_;
+            std::deque<packet> sent_buffer_;  // sent, not yet acknowledged by the device
+            uint64_t sent_packets_;           // sent on this session so far, acknowledged or not
 
             // runtime control
             std::atomic<bool> initializing_;
@@ -86,6 +205,13 @@ namespace client_connection
             std::atomic<bool> running_receiver_;
             std::atomic<bool> running_sync_;
 
+            // resumption
+            std::string resume_token_;
+            std::atomic<bool> parked_;
+            std::atomic<bool> resuming_;
+            std::atomic<bool> ended_;  // logged out or kicked, never parked
+            std::atomic<std::time_t> parked_time_;
+
             // mutexes
             std::mutex send_mtx_;
             std::mutex recieve_mtx_;
@@ -112,20 +238,41 @@ namespace client_connection
             void client_requested_logout_();
             void client_requested_ping_();
             void client_responded_ping_();
+            void client_acknowledged_packets_(std::string args);
             void client_requested_delete_(std::string args, packet buffer, std::string arg2 = "");
+            void delete_stored_file_(const std::string& file_name);
+            int list_stored_files_(const std::string& directory_name, std::vector<std::string>& file_names, std::vector<std::string>& directories);
             void client_requested_slist_();
             void client_requested_flist_();
             void client_requested_adownload_(std::string args);
             void client_sent_clist_(packet buffer, std::string args = "");
             void client_sent_sdownload_(std::string args, packet buffer, std::string arg2 = "");
             void client_sent_supload_(std::string args, std::string arg2);
+            void client_requested_versions_(std::string args);
+            void client_requested_restore_(std::string args, std::string version);
+            void commit_received_file_(const std::string& file_name, const std::string& temp_file_path, const std::string& current_checksum);
+            void send_reply_(const std::string& command, const std::string& contents);
+            bool normalize_path_(std::string& file_name);
+            void acknowledge_commit_(std::string file_name, std::string checksum, std::string error);
+            bool is_packed_(const std::string& file_name);
+            bool is_cold_(const std::string& file_name);
+            int send_packed_file_(const std::string& command_name, const std::string& file_name);
+            bool pack_received_file_(const std::string& file_name, const std::string& temp_file_path, const std::string& checksum);
+            bool pack_received_packet_(const std::string& file_name, const packet& buffer);
+            void pack_contents_(const std::string& file_name, const std::string& contents, const std::string& checksum);
             std::string slist_();
 
             // main communication methods
             void receive_packet_(packet* p, int sockfd = -1, int timeout = -1);
             void send_packet_(const packet& p, int sockfd = -1, int timeout = -1);
+            void park_(std::string reason);
     };
     
+    // sessions of a user indexed by socket descriptor
+    // published as immutable snapshots: readers atomically load the current
+    // table and writers copy, modify and swap it, so reads never block
+    typedef std::unordered_map<int, std::shared_ptr<ClientSession>> SessionTable;
+
     class User
     {
         private:
@@ -135,29 +282,64 @@ namespace client_connection
             // other attributes
             std::string home_dir_path_;
             std::string user_dir_path_;
+            std::string files_dir_path_;  // where sessions read and write, see isolate_users
+            std::string metadata_path_;
+            std::string index_path_;
+            std::shared_ptr<UserNamespace> user_namespace_;
+
+            // idle tracking - see UserGroup eviction
+            std::atomic<std::time_t> last_activity_;
+            std::atomic<int> pending_logins_;
+            bool warm_loaded_;
+            int total_sessions_;
 
             // threads
             std::thread overseer_th_;
 
             std::atomic<bool> overseer_running_;
+            std::mutex overseer_mtx_;
+            std::condition_variable overseer_cv_;
             std::mutex broadcast_mtx_;
 
             // user attributes
             int max_sessions_;  // maximum number of connections allowed for this user
             const int max_sessions_default_ = 2;
+            int session_grace_seconds_;  // parked sessions are dropped after this
 
-            // main user manager vector
-            std::vector<ClientSession*> sessions_;
+            // main user session table - see SessionTable
+            std::shared_ptr<const SessionTable> sessions_;
+            std::mutex sessions_write_mtx_;
+
+            std::shared_ptr<const SessionTable> get_sessions_snapshot_();
+            void seed_index_();
         public:
-            User(std::string username, std::string home_dir);
+            User(
+                std::string username, 
+                std::string home_dir, 
+                const server_config::ServerConfig& config,
+                std::shared_ptr<commit_pipeline::CommitPipeline> commits,
+                std::shared_ptr<metadata_journal::MetadataJournal> journal,
+                std::shared_ptr<dedup_store::DedupStore> dedup);
+            ~User();
             
             // identification
             std::string get_username();
 
             // session control
-            void add_session(ClientSession* new_session);
+            void add_session(std::shared_ptr<ClientSession> new_session);
             void remove_session(int sock_fd, std::string reason = "");
-            ClientSession* get_session(int sock_fd);
+            std::shared_ptr<ClientSession> get_session(int sock_fd);
+
+            // parked session holding the token, reserved for the caller
+            std::shared_ptr<ClientSession> claim_parked_session(const std::string& resume_token, uint64_t received_packets);
+            void resume_session(std::shared_ptr<ClientSession> session, int sock_fd, uint64_t received_packets);
+
+            // a device logging in again gave up on resuming, returns how many were dropped
+            int drop_parked_sessions(const std::string& machine_name);
+
+            // parked sessions of other devices give their slot up to a new login
+            // once the user is at its session limit, oldest first
+            int evict_parked_sessions();
             void nuke();  // disconnect all sessions
             void broadcast_other_sessions(int caller_sockfd, packet& p);
             void broadcast(packet& p);
@@ -166,6 +348,19 @@ namespace client_connection
             bool has_current_files();
             int get_active_session_count();
             std::string get_home_directory();
+            std::string get_user_directory();
+            std::string get_files_directory();
+            std::shared_ptr<UserNamespace> get_namespace();
+
+            // persistent metadata and idle tracking
+            bool load_metadata();
+            void save_metadata();
+            void checkpoint_index(uint64_t lsn);
+            bool was_warm_loaded();
+            void begin_login();
+            void end_login();
+            bool is_idle_for(int seconds);
+            int prune_sessions();
             
             // overseer control
             void start_overseer();
@@ -175,28 +370,84 @@ namespace client_connection
 
     class UserGroup
     {
+        // loaded users, sharded by username hash
+        // lookups only take the shared lock of a single shard, and users are
+        // handed out as shared pointers - an unloaded user is only destroyed
+        // after the last thread still using it lets go
+        // users without sessions are evicted after the configured idle time
+        // and lazily loaded back from their metadata on the next login
         public:
             UserGroup(
+                server_config::ServerConfig config,
                 std::function<void(const packet& p, int sockfd, int timeout)> send_callback,
                 std::function<void(packet* p, int sockfd, int timeout)> receive_callback);
+            ~UserGroup();
 
             // group control
             std::list<std::string> list_users();
-            User* get_user(std::string username);
-            void load_user(std::string username);
+            std::shared_ptr<User> get_user(std::string username);
+            std::shared_ptr<User> load_user(std::string username);
+            std::shared_ptr<User> checkout_user(std::string username);
             void unload_user(std::string username);
             void global_broadcast(packet& p);
 
             int get_active_users_count();
+            std::list<std::string> get_stats_report();
 
         private:
-            std::thread director_th_;
+            static const int user_shard_count_ = 64;
+
+            struct UserShard
+            {
+                std::shared_mutex shard_mtx;
+                std::unordered_map<std::string, std::shared_ptr<User>> users;
+            };
+
+            server_config::ServerConfig config_;
+            std::shared_ptr<commit_pipeline::CommitPipeline> commits_;
+            std::shared_ptr<metadata_journal::MetadataJournal> journal_;
+            std::shared_ptr<dedup_store::DedupStore> dedup_;
+            std::shared_ptr<garbage_collector::GarbageCollector> collector_;
+            std::time_t last_checkpoint_;
             std::string sync_dir_ = "./sync_dir_server";
+            std::string metadata_dir_ = server_config::metadata_directory(sync_dir_);
+
+            // director evicts idle users in the background
+            std::thread director_th_;
+            std::atomic<bool> director_running_;
+            std::mutex director_mtx_;
+            std::condition_variable director_cv_;
 
             // callbacks
             std::function<void(const packet& p, int sockfd, int timeout)> send_callback_;
             std::function<void(packet* p, int sockfd, int timeout)> receive_callback_;
             
-            std::vector<User*> users_;
+            UserShard user_shards_[user_shard_count_];
+            std::atomic<int> loaded_users_;
+
+            // load and eviction statistics
+            std::atomic<uint64_t> cold_loads_;
+            std::atomic<uint64_t> warm_loads_;
+            std::atomic<uint64_t> warm_load_total_us_;
+            std::atomic<uint64_t> warm_load_max_us_;
+            std::atomic<uint64_t> warm_load_files_;
+            std::atomic<uint64_t> evicted_users_;
+
+            // startup recovery statistics
+            uint64_t recovered_records_;
+            uint64_t recovered_debris_;
+            uint64_t recovery_us_;
+
+            UserShard& get_shard_(const std::string& username);
+            std::shared_ptr<User> load_user_locked_(UserShard& shard, const std::string& username);
+            void director_loop_();
+            int evict_idle_users_();
+            void start_collector_();
+            void abort_swept_transfer_(const std::string& temp_path);
+            void open_layout_();
+            void recover_();
+            void checkpoint_users_();
+            void compact_journal_(uint64_t lsn, const std::set<std::string>& checkpointed_users);
+            std::vector<std::shared_ptr<User>> get_users_snapshot_();
     };
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 // locals
 #include "server.hpp"
+#include "server_config.hpp"
 #include "../include/common/cxxopts.hpp"
 #include "../include/common/utils.hpp"
 #include "../include/common/async_cout.hpp"
@@ -27,7 +28,7 @@ void cleanup(int signal)
 	std::exit(signal);
 }
 
-int main()
+int main(int argc, char* argv[])
 {	
 	// saves current terminal mode
 	std::cout << "[MAIN] Saving terminal current mode..." << std::endl;
@@ -41,9 +42,154 @@ int main()
 	// starts async cout
 	start_capture();
 
+	// server tunables
+	server_config::ServerConfig config;
+	std::string durability = commit_pipeline::policy_name(config.durability_policy);
+	std::string layout = directory_layout::layout_name(config.layout);
+	bool show_help = false;
+
+	const std::string SERVER_PROGRAM_NAME = "SyncWizard Server";
+	const std::string SERVER_PROGRAM_DESCRIPTION = "SyncWizard server keeps the synchronized \
+	files of every user. All arguments are optional:";
+	const std::string ISOLATE_USERS_DESCRIPTION = "Serves every user from their own folder instead \
+	of the shared server folder. Required by packing, cold files, quotas and the hashed layout. \
+	Paths holding \".\" or \"..\" are refused either way, so a user never reaches past their folder.";
+	const std::string IDLE_EVICTION_DESCRIPTION = "Seconds a user without connected sessions \
+	is kept in memory before being unloaded. Use 0 to never unload users.";
+	const std::string SESSION_GRACE_DESCRIPTION = "Seconds a session whose connection dropped is \
+	kept for its device to resume it, along with the changes queued for it. Use 0 to disable.";
+	const std::string DURABILITY_DESCRIPTION = "When received files are flushed to disk and \
+	acknowledged: \"none\", \"batched\" (grouped every few milliseconds) or \"strict\" \
+	(every file is flushed on its own).";
+	const std::string DURABILITY_BATCH_DESCRIPTION = "Milliseconds a batched flush waits for \
+	other files to join it.";
+	const std::string CHECKPOINT_DESCRIPTION = "Seconds between checkpoints of the file indexes, \
+	after which the metadata journal is compacted. Use 0 to only checkpoint on journal size.";
+	const std::string PACK_THRESHOLD_DESCRIPTION = "Files up to this many bytes are packed into \
+	per user segment files instead of being stored one by one. Use 0 to disable packing.";
+	const std::string DEDUP_DESCRIPTION = "Received files of at least this many bytes are \
+	stored once and shared by every user holding the same contents. Use 0 to disable deduplication.";
+	const std::string VERSION_COUNT_DESCRIPTION = "How many old versions of every file are kept \
+	when it is replaced or deleted. Use 0 for no limit.";
+	const std::string VERSION_DAYS_DESCRIPTION = "Days old versions of a file are kept for. \
+	Use 0 for no limit. With both version limits at 0 no history is kept.";
+	const std::string COLD_AFTER_DESCRIPTION = "Seconds a file must go unread and unchanged \
+	before it is compressed on disk. It is decompressed again when next requested. Use 0 to disable.";
+	const std::string QUOTA_BYTES_DESCRIPTION = "Bytes every user may store. Uploads that would \
+	go past it are rejected. Use 0 for no limit.";
+	const std::string QUOTA_FILES_DESCRIPTION = "Files every user may store. Use 0 for no limit.";
+	const std::string GC_INTERVAL_DESCRIPTION = "Seconds between garbage collection passes, which \
+	remove abandoned temporary files and unreferenced data at idle priority. Use 0 to disable.";
+	const std::string GC_STALE_DESCRIPTION = "Seconds a temporary file must go unmodified before \
+	the garbage collector removes it.";
+	const std::string LAYOUT_DESCRIPTION = "Where user folders are kept: \"flat\" (directly \
+	under the server folder) or \"hashed\" (spread over two levels of hash named folders).";
+	const std::string MIGRATE_LAYOUT_DESCRIPTION = "Moves user folders written with another \
+	layout to the configured one before serving. Safe to run again if interrupted.";
+	const std::string HELP_DESCRIPTION = "This option displays the description of the available \
+	program arguments.";
+	const std::string ERROR_PARSING_CRITICAL = "Critical error parsing command-line options:";
+
+	cxxopts::Options options(SERVER_PROGRAM_NAME, SERVER_PROGRAM_DESCRIPTION);
+	options.add_options()
+		("u,isolate_users", ISOLATE_USERS_DESCRIPTION, cxxopts::value<bool>(config.isolate_users))
+		("i,idle_eviction", IDLE_EVICTION_DESCRIPTION, cxxopts::value<int>(config.idle_eviction_seconds))
+		("r,session_grace", SESSION_GRACE_DESCRIPTION, cxxopts::value<int>(config.session_grace_seconds))
+		("d,durability", DURABILITY_DESCRIPTION, cxxopts::value<std::string>(durability))
+		("b,durability_batch_ms", DURABILITY_BATCH_DESCRIPTION, cxxopts::value<int>(config.durability_batch_ms))
+		("c,checkpoint_interval", CHECKPOINT_DESCRIPTION, cxxopts::value<int>(config.checkpoint_interval_seconds))
+		("k,pack_threshold", PACK_THRESHOLD_DESCRIPTION, cxxopts::value<uint64_t>(config.pack_threshold_bytes))
+		("e,dedup_min_bytes", DEDUP_DESCRIPTION, cxxopts::value<uint64_t>(config.dedup_min_bytes))
+		("v,version_count", VERSION_COUNT_DESCRIPTION, cxxopts::value<int>(config.version_count))
+		("t,version_days", VERSION_DAYS_DESCRIPTION, cxxopts::value<int>(config.version_days))
+		("o,cold_after", COLD_AFTER_DESCRIPTION, cxxopts::value<int>(config.cold_after_seconds))
+		("q,quota_bytes", QUOTA_BYTES_DESCRIPTION, cxxopts::value<uint64_t>(config.quota_bytes))
+		("n,quota_files", QUOTA_FILES_DESCRIPTION, cxxopts::value<uint64_t>(config.quota_files))
+		("g,gc_interval", GC_INTERVAL_DESCRIPTION, cxxopts::value<int>(config.gc_interval_seconds))
+		("s,gc_stale_after", GC_STALE_DESCRIPTION, cxxopts::value<int>(config.gc_stale_seconds))
+		("l,layout", LAYOUT_DESCRIPTION, cxxopts::value<std::string>(layout))
+		("m,migrate_layout", MIGRATE_LAYOUT_DESCRIPTION, cxxopts::value<bool>(config.migrate_layout))
+		("h,help", HELP_DESCRIPTION, cxxopts::value<bool>(show_help));
+
+	try
+	{
+		options.parse(argc, argv);
+
+		if(show_help)
+		{
+			std::cout << "\t[MAIN] " << options.help() << std::endl;
+			cleanup(0);
+			return 0;
+		}
+
+		if(config.idle_eviction_seconds < 0)
+		{
+			throw std::runtime_error("idle eviction time must not be negative");
+		}
+
+		if(config.session_grace_seconds < 0)
+		{
+			throw std::runtime_error("session grace period must not be negative");
+		}
+
+		if(config.checkpoint_interval_seconds < 0)
+		{
+			throw std::runtime_error("checkpoint interval must not be negative");
+		}
+
+		if(config.version_count < 0 || config.version_days < 0)
+		{
+			throw std::runtime_error("version limits must not be negative");
+		}
+
+		if(config.cold_after_seconds < 0)
+		{
+			throw std::runtime_error("cold file age must not be negative");
+		}
+
+		if(config.gc_interval_seconds < 0 || config.gc_stale_seconds < 0)
+		{
+			throw std::runtime_error("garbage collection times must not be negative");
+		}
+
+		if(config.cold_after_seconds > 0 && config.gc_interval_seconds == 0)
+		{
+			throw std::runtime_error("cold files are compressed by the garbage collector, which is disabled");
+		}
+
+		config.durability_policy = commit_pipeline::parse_policy(durability);
+		config.layout = directory_layout::parse_layout(layout);
+
+		// these keep files apart per user, which a shared folder cannot
+		bool per_user_storage = config.pack_threshold_bytes > 0
+			|| config.cold_after_seconds > 0
+			|| config.quota_bytes > 0
+			|| config.quota_files > 0
+			|| config.layout != directory_layout::Layout::FLAT
+			|| config.migrate_layout;
+		if(per_user_storage && !config.isolate_users)
+		{
+			throw std::runtime_error("packing, cold files, quotas and layouts require --isolate_users");
+		}
+		if(config.pack_threshold_bytes > pack_store::MAX_PACKED_FILE_SIZE)
+		{
+			throw std::runtime_error("pack threshold must not exceed " + std::to_string(pack_store::MAX_PACKED_FILE_SIZE) + " bytes");
+		}
+		if(config.durability_batch_ms < 0)
+		{
+			throw std::runtime_error("durability batch interval must not be negative");
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "\t[MAIN] " + ERROR_PARSING_CRITICAL << e.what() << std::endl;
+		cleanup(0);
+		return -1;
+	}
+
 	try
 	{
-		Server server;
+		Server server(config);
 		server.start();
 	}
 	catch(const std::exception& e)
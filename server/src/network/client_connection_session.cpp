@@ -13,6 +13,8 @@
 #include <sys/stat.h>
 #include <fstream>
 #include <dirent.h>
+#include <random>
+#include <sys/socket.h>
 
 // multithread & synchronization
 #include <thread>
@@ -33,19 +35,28 @@ ClientSession::ClientSession(
     std::string username,
     std::string machine_name,
     std::string directory_path,
+    std::shared_ptr<UserNamespace> user_namespace,
     std::function<void(const packet& p, int sockfd, int timeout)> send_callback,
     std::function<void(packet* p, int sockfd, int timeout)> receive_callback,
-    std::function<void(int caller_sockfd, packet& p)> broadcast_user_callback)
+    std::function<void(int caller_sockfd, packet& p)> broadcast_user_callback,
+    std::string resume_token)
     :   socket_fd_(sock_fd),
         username_(username),
         machine_(machine_name),
         directory_path_(directory_path),
+        user_namespace_(user_namespace),
         send_callback_(send_callback),
         receive_callback_(receive_callback),
         broadcast_user_callback_(broadcast_user_callback),
+        sent_packets_(0),
         running_receiver_(false),
         running_sender_(false),
-        initializing_(true)
+        initializing_(true),
+        resume_token_(resume_token),
+        parked_(false),
+        resuming_(false),
+        ended_(false),
+        parked_time_(0)
 {
     aprint("Starting up new session for user " 
         + username_ 
@@ -58,8 +69,30 @@ ClientSession::ClientSession(
 
 ClientSession::~ClientSession()
 {
+    send_cv_.notify_all();
     stop_receiver();
     stop_sender();
+
+    // a parked session kept its socket, so no other session reuses its descriptor
+    if(parked_.load())
+    {
+        close(socket_fd_.load());
+    }
+}
+
+std::string client_connection::generate_resume_token()
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    std::random_device random;
+    std::string token;
+    token.reserve(RESUME_TOKEN_BYTES * 2);
+    for(int i = 0; i < RESUME_TOKEN_BYTES; i++)
+    {
+        unsigned int byte = random() & 0xff;
+        token += hex_digits[byte >> 4];
+        token += hex_digits[byte & 0xf];
+    }
+    return token;
 }
 
 int ClientSession::get_socket_fd()
@@ -90,4 +123,113 @@ std::string ClientSession::get_identifier()
 std::chrono::high_resolution_clock::time_point ClientSession::get_last_ping()
 {
     return last_ping_;
+}
+
+bool ClientSession::is_alive()
+{
+    // session is considered gone once both of its loops were stopped
+    return running_receiver_.load() || running_sender_.load();
+}
+
+std::string ClientSession::get_resume_token()
+{
+    return resume_token_;
+}
+
+bool ClientSession::is_parked()
+{
+    return parked_.load();
+}
+
+std::time_t ClientSession::get_parked_time()
+{
+    return parked_time_.load();
+}
+
+bool ClientSession::is_resumable(int grace_seconds)
+{
+    // a claimed session is kept until its resumption either ends or fails
+    if(resuming_.load())
+    {
+        return true;
+    }
+    return parked_.load() && get_time() - parked_time_.load() < grace_seconds;
+}
+
+bool ClientSession::claim(const std::string& resume_token, int grace_seconds)
+{
+    if(resume_token_.empty() || resume_token != resume_token_ || !is_resumable(grace_seconds))
+    {
+        return false;
+    }
+    return resuming_.exchange(true) == false;
+}
+
+void ClientSession::release_claim()
+{
+    resuming_.store(false);
+}
+
+bool ClientSession::can_replay(uint64_t received_packets)
+{
+    std::lock_guard<std::mutex> lock(send_mtx_);
+    return received_packets <= sent_packets_ && sent_packets_ - received_packets <= sent_buffer_.size();
+}
+
+void ClientSession::resume(int sock_fd, uint64_t received_packets)
+{
+    // the loops left on their own when the connection was lost
+    send_cv_.notify_all();
+    stop_receiver();
+    stop_sender();
+
+    int old_socket_fd = socket_fd_.exchange(sock_fd);
+    close(old_socket_fd);
+
+    // whatever the device did not get went down with the connection, it
+    // goes out again ahead of what was queued since
+    std::size_t resent_packets;
+    std::size_t queued_packets;
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        while(!sent_buffer_.empty() && sent_packets_ - sent_buffer_.size() < received_packets)
+        {
+            sent_buffer_.pop_front();
+        }
+        resent_packets = sent_buffer_.size();
+        sender_buffer_.insert(sender_buffer_.begin(), sent_buffer_.begin(), sent_buffer_.end());
+        sent_packets_ -= resent_packets;
+        sent_buffer_.clear();
+        queued_packets = sender_buffer_.size();
+    }
+    std::string output = get_identifier() + " Resumed after ";
+    output += std::to_string(get_time() - parked_time_.load()) + "s, sending ";
+    output += std::to_string(queued_packets) + " queued packets (";
+    output += std::to_string(resent_packets) + " lost with the connection).";
+    aprint(output, 1);
+
+    parked_.store(false);
+    resuming_.store(false);
+    start_sender();
+    start_receiver();
+}
+
+void ClientSession::park_(std::string reason)
+{
+    // keeps the session, and what is still queued for it, for the device to resume
+    if(ended_.load() || parked_.exchange(true))
+    {
+        return;
+    }
+    parked_time_.store(get_time());
+
+    running_receiver_.store(false);
+    running_sender_.store(false);
+    send_cv_.notify_all();
+
+    // wakes up whichever loop did not notice yet
+    shutdown(socket_fd_.load(), SHUT_RDWR);
+
+    std::string output = get_identifier() + " Connection lost, keeping session for resumption: " + reason;
+    aprint(output, 1);
 }
\ No newline at end of file
@@ -5,6 +5,11 @@
 #include <mutex>
 #include <shared_mutex>
 #include <fstream>
+#include <sstream>
+#include <unordered_set>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
 
 // c
 #include <unistd.h>
@@ -16,6 +21,8 @@
 #include "../include/common/utils.hpp"
 #include "../include/common/async_cout.hpp"
 #include "../include/common/utils_packet.hpp"
+#include "../include/common/directory_scanner.hpp"
+#include "../include/common/path_table.hpp"
 
 using namespace async_cout;
 using namespace client_connection;
@@ -41,6 +48,7 @@ void ClientSession::client_requested_logout_()
     std::string output = get_identifier() + " Requested logoff.";
     aprint(output, 2);
 
+    ended_.store(true);
     running_receiver_.store(false);
     running_sender_.store(false);
 }
@@ -74,80 +82,225 @@ void ClientSession::client_responded_ping_()
     aprint(output, 2);
 }
 
+void ClientSession::client_acknowledged_packets_(std::string args)
+{
+    // user got every packet sent on this session up to the given count,
+    // those no longer have to be kept for a resumption
+    uint64_t received_packets;
+    try
+    {
+        received_packets = std::stoull(args);
+    }
+    catch(const std::exception& e)
+    {
+        malformed_command_("ack");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(send_mtx_);
+    while(!sent_buffer_.empty() && sent_packets_ - sent_buffer_.size() < received_packets)
+    {
+        sent_buffer_.pop_front();
+    }
+}
+
 void ClientSession::client_requested_delete_(std::string args, packet buffer, std::string arg2)
 {
     // client requested to delete certain file
     // propagates to other sessions
-    std::string local_file_path = directory_path_ + args;
     std::string file_name = args;
+    if(!normalize_path_(file_name))
+    {
+        send_reply_("delete|" + args + "|fail", "Invalid file path!");
+        return;
+    }
+    std::string local_file_path = directory_path_ + file_name;
+
+    // a directory goes along with everything stored under it, one file at a time,
+    // as packed and cold files are not on disk where a plain remove would see them
+    std::vector<std::string> file_names;
+    std::vector<std::string> directories;
+    int failed_directories = 0;
+    bool directory = fs::is_directory(local_file_path);
+    if(directory)
+    {
+        failed_directories = list_stored_files_(file_name, file_names, directories);
+        std::sort(file_names.begin(), file_names.end());
+        file_names.erase(std::unique(file_names.begin(), file_names.end()), file_names.end());
+    }
+    else if(is_valid_path(local_file_path) || is_packed_(file_name) || is_cold_(file_name))
+    {
+        file_names.push_back(file_name);
+    }
 
-    if(!is_valid_path(local_file_path))
+    if(!directory && file_names.empty())
     {
         std::string output = get_identifier() + " Delete command for file \"" + file_name;
         output += "\" failed! Could not acess given path!";
         aprint(output, 2);
 
-        // mounts fail packet
-        packet fail_packet;
-        std::string command_string = "delete|" + file_name + "|fail";
-        strcharray(command_string, fail_packet.command, sizeof(fail_packet.command));
-        std::string reason = "Could not find or acess given file path!";
-        strcharray(reason, fail_packet.payload, reason.size());
-        fail_packet.payload_size = reason.size();
-        
-        // requests send mutex
+        send_reply_("delete|" + args + "|fail", "Could not find or acess given file path!");
+        return;
+    }
+
+    // every file is tried, one that fails does not keep the rest
+    std::vector<std::string> deleted_files;
+    std::vector<std::string> failed_files;
+    for(const std::string& stored_file_name : file_names)
+    {
+        try
         {
-            std::unique_lock<std::mutex> lock(send_mtx_);
-            sender_buffer_.push_back(fail_packet);
+            delete_stored_file_(stored_file_name);
+            deleted_files.push_back(stored_file_name);
+        }
+        catch(const std::exception& e)
+        {
+            std::string output = get_identifier() + " Exception raised while deleting file \"";
+            output += stored_file_name + "\": " + std::string(e.what());
+            aprint(output, 2);
+            failed_files.push_back(stored_file_name);
         }
-        send_cv_.notify_one();
-        return;
     }
-    else
+
+    // deepest first, a directory still holding an upload in progress stays
+    for(auto it = directories.rbegin(); it != directories.rend(); ++it)
     {
-        // valid path, propagates, then deletes file
+        std::error_code error;
+        fs::remove(*it, error);
+    }
 
-        // propagates user delete command
+    // other devices only drop what is gone here, and the user keeps a
+    // delete made offline queued until either answer arrives
+    // files under a directory that could not be read are left behind too
+    if(failed_files.empty() && failed_directories == 0)
+    {
         broadcast_user_callback_(socket_fd_, buffer);
+        send_reply_("delete|" + args + "|ok", "");
+        return;
+    }
 
-        try
+    for(const std::string& deleted_file : deleted_files)
+    {
+        packet delete_packet;
+        strcharray("delete|" + deleted_file, delete_packet.command, sizeof(delete_packet.command));
+        broadcast_user_callback_(socket_fd_, delete_packet);
+    }
+
+    std::string reason = "Could not delete " + std::to_string(failed_files.size()) + " of ";
+    reason += std::to_string(file_names.size()) + " files";
+    reason += failed_files.empty() ? "" : ", first was \"" + failed_files.front() + "\"";
+    reason += failed_directories == 0 ? "." : ", and could not read " + std::to_string(failed_directories) + " directories.";
+    send_reply_("delete|" + args + "|fail", reason);
+}
+
+void ClientSession::delete_stored_file_(const std::string& file_name)
+{
+    // deletes a single file wherever it is stored, keeping its last version
+    std::string checked_file_name = file_name;
+    if(!normalize_path_(checked_file_name) || checked_file_name != file_name)
+    {
+        raise(get_identifier() + " Refused to delete \"" + file_name + "\"!", 2);
+    }
+    std::string local_file_path = directory_path_ + file_name;
+    bool packed = !is_valid_path(local_file_path) && is_packed_(file_name);
+    bool cold = !is_valid_path(local_file_path) && is_cold_(file_name);
+
+    // requests file lock shared by every session of this user
+    path_table::path_id file_id = user_namespace_->paths.intern(file_name);
+    file_lock_manager::ExclusiveLock file_lock = user_namespace_->locks.lock_exclusive(file_id);
+    version_store::StagedVersion staged_version = user_namespace_->preserve_version(file_name, local_file_path);
+        
+    // deletes file
+    try
+    {
+        if(packed)
         {
-            // requests file mutex to delete entry
-            if(file_mtx_.find(file_name) == file_mtx_.end())
+            user_namespace_->packs->remove(file_name);
+        }
+        else if(cold)
+        {
+            // holds no shared contents, they were released once compressed
+            user_namespace_->cold->remove(file_name);
+        }
+        else
+        {
+            // the shared contents are only let go once the copy is gone
+            dedup_store::Reference reference;
+            if(user_namespace_->dedup != nullptr)
             {
-                std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[file_name]);
-                
-                // deletes file
-                delete_file(local_file_path);
+                reference = user_namespace_->dedup->hold(local_file_path);
             }
-            else
+            delete_file(local_file_path);
+            if(user_namespace_->dedup != nullptr)
             {
-                std::string output = get_identifier() + " Could not find a file mutex for \"";
-                output += file_name + "\"!";
-                raise(output, 2);
+                user_namespace_->dedup->release(reference);
             }
+        }
+    }
+    catch(const std::exception& e)
+    {
+        user_namespace_->finish_version(staged_version, false);
+        throw;
+    }
+    user_namespace_->finish_version(staged_version, true);
+    user_namespace_->log_operation(metadata_journal::JournalOperation::DELETE_FILE, file_name);
+}
 
-            // after deleting - removes file mutex from internal list
-            auto it = file_mtx_.find(file_name);
-            if(it != file_mtx_.end())
-            {
-                file_mtx_.erase(it);
-                return;
-            }
-            else
-            {
-                std::string output = get_identifier() + " Could not find a file mutex for \"";
-                output += file_name + "\"!";
-                raise(output, 2);
-            }
+int ClientSession::list_stored_files_(
+    const std::string& directory_name, 
+    std::vector<std::string>& file_names, 
+    std::vector<std::string>& directories)
+{
+    // files under a directory of the user, wherever they are stored, and
+    // the directories on disk below it, parents first
+    // returns how many directories could not be read
+    std::string checked_directory_name = directory_name;
+    if(!normalize_path_(checked_directory_name) || checked_directory_name != directory_name)
+    {
+        raise(get_identifier() + " Refused to list \"" + directory_name + "\"!", 2);
+    }
+    std::string local_directory_path = directory_path_ + directory_name;
+    directories.push_back(local_directory_path);
+    int failed_directories = 0;
+    for(const directory_scanner::ScanEntry& entry : directory_scanner::default_scanner().scan_to_vector(local_directory_path, true, &failed_directories))
+    {
+        if(entry.is_directory)
+        {
+            directories.push_back(local_directory_path + "/" + entry.path);
         }
-        catch(const std::exception& e)
+        else if(fs::path(entry.name).extension().string().rfind(".swiz", 0) != 0)
         {
-            std::string output = get_identifier() + + " Exception raised while deleting file \"";
-            output += file_name + "\": " + std::string(e.what());
-            raise(output, 2);
+            // transfers in progress are not files of the user yet
+            file_names.push_back(directory_name + "/" + entry.path);
         }
     }
+
+    // stores key their files relative to the user folder, without a leading slash
+    std::string prefix = directory_name.substr(directory_name.find_first_not_of('/')) + "/";
+    auto add_under_prefix = [&file_names, &prefix](const std::string& path)
+    {
+        if(path.compare(0, prefix.size(), prefix) == 0)
+        {
+            file_names.push_back("/" + path);
+        }
+    };
+    if(user_namespace_->packs != nullptr)
+    {
+        user_namespace_->packs->list(
+            [&add_under_prefix](const std::string& path, const pack_store::PackedFile& file)
+            {
+                add_under_prefix(path);
+            });
+    }
+    if(user_namespace_->cold != nullptr)
+    {
+        user_namespace_->cold->list(
+            [&add_under_prefix](const std::string& path, const cold_store::ColdFile& file)
+            {
+                add_under_prefix(path);
+            });
+    }
+    return failed_directories;
 }
 
 void ClientSession::client_requested_slist_()
@@ -176,66 +329,80 @@ void ClientSession::client_requested_slist_()
 void ClientSession::client_requested_flist_()
 {
     // client requested formatted list of every file
-    DIR* dir = opendir(directory_path_.c_str());
-    if(dir == nullptr) 
+    std::vector<directory_scanner::ScanEntry> entries;
+    int failed_directories = 0;
+    try
+    {
+        entries = directory_scanner::default_scanner().scan_to_vector(directory_path_, false, &failed_directories);
+    }
+    catch(const std::exception& e)
     {
         std::string output = get_identifier() + " Could not acess user folder!";
         raise(output, 2);
     }
 
+    // files under them are missing from the list
+    if(failed_directories > 0)
+    {
+        std::string output = get_identifier() + " Could not read " + std::to_string(failed_directories);
+        output += " directories of the user folder, file list is partial!";
+        aprint(output, 2);
+    }
+
     // main output string
     std::string output = "";
-    std::function<void(const std::string&)> list_files_recursively = [&](const std::string& current_path) 
+    for(const directory_scanner::ScanEntry& entry : entries)
     {
+        char modification_time_buffer[100];
+        char access_time_buffer[100];
+        char change_creation_time_buffer[100];
 
-        DIR* dir = opendir(current_path.c_str());
-        if(dir == nullptr) 
-        {
-            std::string output = get_identifier() + " Could not acess \"";
-            output += current_path + "\" user folder!";
-            raise(output, 2);
-        }
+        output += "\n\t\t\tFile name: " + entry.name;
+        output += "\n\t\t\tFile path: " + directory_path_ + "/" + entry.path;
 
-        dirent* entry;
-        while((entry = readdir(dir)) != nullptr) 
-        {
-            if(entry->d_type == DT_REG) 
-            { 
-                std::string file_path = current_path + "/" + entry->d_name;
-                file_path += "/";
-                file_path += entry->d_name;
+        std::strftime(modification_time_buffer, sizeof(modification_time_buffer), "%c", std::localtime(&entry.modification_time));
+        output += "\n\t\t\tModification time: " + std::string(modification_time_buffer);
 
-                struct stat file_info;
-                if(lstat(file_path.c_str(), &file_info) == 0) 
-                {
-                    char modification_time_buffer[100];
-                    char access_time_buffer[100];
-                    char change_creation_time_buffer[100];
+        std::strftime(access_time_buffer, sizeof(access_time_buffer), "%c", std::localtime(&entry.access_time));
+        output += "\n\t\t\tAccess time: " + std::string(access_time_buffer);
 
-                    output += "\n\t\t\tFile name: " + std::string(entry->d_name);
-                    output += "\n\t\t\tFile path: " + file_path;
+        std::strftime(change_creation_time_buffer, sizeof(change_creation_time_buffer), "%c", std::localtime(&entry.change_time));
+        output += "\n\t\t\tChange/creation time: " + std::string(change_creation_time_buffer);
+    }
 
-                    std::strftime(modification_time_buffer, sizeof(modification_time_buffer), "%c", std::localtime(&file_info.st_mtime));
-                    output += "\n\t\t\tModification time: " + std::string(modification_time_buffer);
+    // packed files only keep their modification time
+    if(user_namespace_->packs != nullptr)
+    {
+        user_namespace_->packs->list(
+            [this, &output](const std::string& path, const pack_store::PackedFile& file)
+            {
+                char modification_time_buffer[100];
+                std::time_t modification_time = file.modification_time;
 
-                    std::strftime(access_time_buffer, sizeof(access_time_buffer), "%c", std::localtime(&file_info.st_atime));
-                    output += "\n\t\t\tAccess time: " + std::string(access_time_buffer);
+                output += "\n\t\t\tFile name: " + path.substr(path.find_last_of('/') + 1);
+                output += "\n\t\t\tFile path: " + directory_path_ + "/" + path + " (packed)";
 
-                    std::strftime(change_creation_time_buffer, sizeof(change_creation_time_buffer), "%c", std::localtime(&file_info.st_ctime));
-                    output += "\n\t\t\tChange/creation time: " + std::string(change_creation_time_buffer);
+                std::strftime(modification_time_buffer, sizeof(modification_time_buffer), "%c", std::localtime(&modification_time));
+                output += "\n\t\t\tModification time: " + std::string(modification_time_buffer);
+            });
+    }
 
-                }
-                else if(entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) 
-                {
-                    list_files_recursively(current_path + "/" + entry->d_name);
-                }
-            }
-        }
-        closedir(dir);
-    };
+    // so are compressed ones
+    if(user_namespace_->cold != nullptr)
+    {
+        user_namespace_->cold->list(
+            [this, &output](const std::string& path, const cold_store::ColdFile& file)
+            {
+                char modification_time_buffer[100];
+                std::time_t modification_time = file.modification_time;
+
+                output += "\n\t\t\tFile name: " + path.substr(path.find_last_of('/') + 1);
+                output += "\n\t\t\tFile path: " + directory_path_ + "/" + path + " (compressed)";
 
-    // gathers formatted file list
-    list_files_recursively(directory_path_);
+                std::strftime(modification_time_buffer, sizeof(modification_time_buffer), "%c", std::localtime(&modification_time));
+                output += "\n\t\t\tModification time: " + std::string(modification_time_buffer);
+            });
+    }
 
     // mounts packet to send
     packet flist_packet;
@@ -260,8 +427,26 @@ void ClientSession::client_requested_adownload_(std::string args)
     // user is requesting a file download to
     // keep in a non synchronized folder
     // send as "aupload"
+    std::string requested_path = args;
+    if(!normalize_path_(args))
+    {
+        send_reply_("aupload|" + requested_path + "|fail", "Invalid file path!");
+        return;
+    }
     std::string local_file_path = directory_path_ + args;
 
+    // cold files are decompressed back first, they are served as any other
+    if(is_valid_path(local_file_path) == false)
+    {
+        user_namespace_->rehydrate_cold_file(args, local_file_path);
+    }
+
+    // small files may live in the user packs instead
+    if(is_valid_path(local_file_path) == false && send_packed_file_("aupload", args) > 0)
+    {
+        return;
+    }
+
     if(is_valid_path(local_file_path) == false)
     {
         // invalid path, sends fail packet
@@ -282,12 +467,13 @@ void ClientSession::client_requested_adownload_(std::string args)
         std::string output = get_identifier() + " Async download failed! Could not acess given file: ";
         output += "\"" + args + "\"!";
         aprint(output, 2);
+        return;
     }
 
-    // requests file lock
-    if(file_mtx_.find(args) != file_mtx_.end())
+    // requests file lock - only reading, other sessions may read it too
     {
-        std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[args]);
+        path_table::path_id file_id = user_namespace_->paths.intern(args);
+        file_lock_manager::SharedLock file_lock = user_namespace_->locks.lock_shared(file_id);
         
         std::string checksum = calculate_md5_checksum(local_file_path);
         std::ifstream sfile(local_file_path, std::ios::binary);
@@ -367,13 +553,6 @@ void ClientSession::client_requested_adownload_(std::string args)
             sfile.close();
         }
     }
-    else
-    {
-        // if there is no mutex for this file, an error has occured!
-        std::string output = get_identifier() + " No file mutex was found for file \"" + args + "\"!";
-        aprint(output, 2);
-        return;
-    }
 }
 
 void ClientSession::client_sent_clist_(packet buffer, std::string args)
@@ -390,95 +569,87 @@ void ClientSession::client_sent_clist_(packet buffer, std::string args)
         aprint(output, 2);
     }
 
-    // session files
-    std::vector<std::string> session_files = split_buffer(buffer.payload);
-
-    // current server files
-    std::string current_server_files_string = slist_();
-    std::istringstream iss(current_server_files_string);
-    std::string token;
-    std::vector<std::string> current_server_files;
-    while(std::getline(iss, token, '|')) 
+    // files are compared as interned path ids, which makes each membership
+    // check O(1) instead of a linear search - the ids come from a table of
+    // this call only, a client supplied list never grows the user namespace
+    path_table::PathTable paths;
+    const std::string temporary_suffix = ".swizdownload";
+
+    // every path listed by one of the sides, along with
+    // the ones that have a download in progress on that side
+    std::unordered_set<path_table::path_id> session_files;
+    std::unordered_set<path_table::path_id> session_temporary_files;
+    std::unordered_set<path_table::path_id> server_files;
+    std::unordered_set<path_table::path_id> server_temporary_files;
+    std::vector<path_table::path_id> server_files_ordered;
+
+    auto index_file = [&](
+        const std::string& file, 
+        std::unordered_set<path_table::path_id>& files, 
+        std::unordered_set<path_table::path_id>& temporary_files) -> bool
     {
-        current_server_files.push_back(token);
-    }
+        if(file.size() == 0)
+        {
+            return false;
+        }
 
-    // file difference between session and server
-    std::vector<std::string> files_not_in_session;
-    std::vector<std::string> files_not_in_current_server;
-    std::vector<std::string> server_temporary_files;
-    std::vector<std::string> session_temporary_files;
+        // temporary files are indexed by the path of the file being downloaded
+        if(file.size() > temporary_suffix.size() 
+            && file.compare(file.size() - temporary_suffix.size(), temporary_suffix.size(), temporary_suffix) == 0)
+        {
+            temporary_files.insert(paths.intern(file.substr(0, file.size() - temporary_suffix.size())));
+            return false;
+        }
+
+        return files.insert(paths.intern(file)).second;
+    };
 
-    // moves temporary download files from current files buffer to the propper one
-    for(auto it = current_server_files.begin(); it != current_server_files.end();) 
+    // session files
+    if(buffer.payload != nullptr && buffer.payload_size > 0)
     {
-        if((*it).find(".swizdownload") != std::string::npos)
-        {
-            server_temporary_files.push_back((*it));
-            it = current_server_files.erase(it);
-        } 
-        else 
+        std::istringstream session_stream(charraystr(buffer.payload, buffer.payload_size));
+        std::string token;
+        while(std::getline(session_stream, token, '|')) 
         {
-            ++it;
+            // a listed path out of the user folder is never asked for
+            std::string file;
+            if(path_table::normalize_path(token, file))
+            {
+                index_file(file, session_files, session_temporary_files);
+            }
         }
     }
 
-    // does the same thing for session files
-    for(auto it = session_files.begin(); it != session_files.end();) 
+    // current server files
+    std::istringstream server_stream(slist_());
+    std::string token;
+    while(std::getline(server_stream, token, '|')) 
     {
-        if((*it).find(".swizdownload") != std::string::npos)
-        {
-            session_temporary_files.push_back((*it));
-            it = session_files.erase(it);
-        } 
-        else 
+        if(index_file(token, server_files, server_temporary_files))
         {
-            ++it;
+            server_files_ordered.push_back(paths.intern(token));
         }
     }
 
-    // checks for unsynchronized session files
-    for(const std::string& file : current_server_files) 
+    // file difference between session and server
+    std::vector<path_table::path_id> files_not_in_session;
+    std::vector<path_table::path_id> files_not_in_current_server;
+
+    // checks for unsynchronized session files, skipping the ones being downloaded
+    for(path_table::path_id file_id : server_files_ordered) 
     {
-        if(std::find(
-            session_files.begin(), 
-            session_files.end(), 
-            file) == session_files.end()) 
+        if(session_files.count(file_id) == 0 && session_temporary_files.count(file_id) == 0)
         {
-            // session does not have current file
-            std::string temporary_file_name = file_without_extension(file) + ".swizdownload";
-
-            // checks for temporary files
-            if(std::find(
-                session_temporary_files.begin(), 
-                session_temporary_files.end(), 
-                temporary_file_name) == session_temporary_files.end())
-            {
-                // session does not have current file at all
-                files_not_in_session.push_back(file);
-            }
+            files_not_in_session.push_back(file_id);
         }
     }
 
     // checks for unsynchronized server files
-    for(const std::string& file : session_files) 
+    for(path_table::path_id file_id : session_files) 
     {
-        if(std::find(
-            current_server_files.begin(), 
-            current_server_files.end(), 
-            file) == current_server_files.end()) 
+        if(server_files.count(file_id) == 0 && server_temporary_files.count(file_id) == 0)
         {
-            // server does not have current file
-            std::string temporary_file_name = file_without_extension(file) + ".swizdownload";
-
-            //checks for temporary files
-            if(std::find(
-                server_temporary_files.begin(), 
-                server_temporary_files.end(), 
-                temporary_file_name) == server_temporary_files.end())
-            {
-                files_not_in_current_server.push_back(file);
-            }
+            files_not_in_current_server.push_back(file_id);
         }
     }
 
@@ -490,14 +661,30 @@ void ClientSession::client_sent_clist_(packet buffer, std::string args)
 
     int delta_packets = 0;
     // updates session with missing files
-    for(const std::string& file : files_not_in_session) 
+    for(path_table::path_id file_id : files_not_in_session) 
     {
+        std::string file = "/" + paths.resolve(file_id);
         std::string local_file_path = directory_path_ + file;
 
+        if(!is_valid_path(local_file_path))
+        {
+            user_namespace_->rehydrate_cold_file(file, local_file_path);
+        }
+
+        if(!is_valid_path(local_file_path))
+        {
+            int packed_packets = send_packed_file_("sdownload", file);
+            if(packed_packets > 0)
+            {
+                delta_packets += packed_packets;
+                continue;
+            }
+        }
+
         // requests file lock
-        if(file_mtx_.find(file) != file_mtx_.end())
         {
-            std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[file]);
+            file_lock_manager::SharedLock file_lock = user_namespace_->locks.lock_shared(
+                user_namespace_->paths.intern(file));
             
             std::string checksum = calculate_md5_checksum(local_file_path);
             std::ifstream sfile(local_file_path, std::ios::binary);
@@ -564,20 +751,12 @@ void ClientSession::client_sent_clist_(packet buffer, std::string args)
                 sfile.close();
             }
         }
-        else
-        {
-            // if there is no mutex for this file, an error has occured!
-            std::string output = get_identifier() + " No file mutex was found for file \"" + file + "\"!";
-            aprint(output, 2);
-            
-            // goes to the next file...
-            continue;
-        }
     }
 
     // requests server missing files from session
-    for (const std::string& file : files_not_in_current_server) 
+    for(path_table::path_id file_id : files_not_in_current_server) 
     {
+        std::string file = "/" + paths.resolve(file_id);
         // mounts request packet and adds to buffer
         packet request_packet;
         std::string command = "sdownload|" + file;
@@ -612,6 +791,16 @@ void ClientSession::client_sent_sdownload_(std::string args, packet buffer, std:
     {
         // user is sending some file
         // server is sending some file
+        if(!normalize_path_(file_name))
+        {
+            // answered once, the rest of the transfer is dropped
+            if(buffer.sequence_number == 0)
+            {
+                acknowledge_commit_(args, "", "Invalid file path!");
+            }
+            return;
+        }
+        args = file_name;
         std::string local_file_path = directory_path_ + args;
         std::string temp_file_path = local_file_path + ".swizdownload";
         
@@ -622,61 +811,571 @@ void ClientSession::client_sent_sdownload_(std::string args, packet buffer, std:
             return;
         }
 
+        // uploads are admitted against the user quota on their first chunk, each
+        // one on its own even when another is still sending the same path
+        // the rest of a rejected one is dropped without being written
+        metadata_journal::FileIndex& index = user_namespace_->index;
+        if(index.has_quota())
+        {
+            std::string reason;
+            uint64_t incoming_bytes = static_cast<uint64_t>(buffer.expected_packets) * chunk_writer::DEFAULT_CHUNK_SIZE;
+            if(buffer.sequence_number != 0)
+            {
+                if(!index.renew(file_name))
+                {
+                    return;
+                }
+            }
+            else if(!index.reserve(file_name, incoming_bytes, reason))
+            {
+                acknowledge_commit_(file_name, "", "Rejected upload: " + reason);
+                return;
+            }
+        }
+
+        if(pack_received_packet_(file_name, buffer))
+        {
+            return;
+        }
+
         // tries to write on temporary file
-        std::ofstream temp_file(temp_file_path, std::ios::app | std::ios::binary);
-        if(!temp_file) 
+        std::shared_ptr<chunk_writer::ChunkWriter> writer;
+        try
         {
-            // given file does not exist locally - informs server
-            packet fail_packet;
-            std::string command_response = "sdownload|" + args + "|fail";
-            strcharray(command_response, fail_packet.command, sizeof(fail_packet.command));
-            std::string args_response = "Given file could not be created or accessed";
-            args_response += "on user server folder.";
-            strcharray(args_response, fail_packet.payload, args_response.size());
-            fail_packet.payload_size = args_response.size();
-
-            // adds to sender buffer
+            writer = user_namespace_->writers.acquire(
+                temp_file_path, 
+                buffer.expected_packets, 
+                buffer.sequence_number);
+            writer->write_chunk(buffer.sequence_number, buffer.payload, buffer.payload_size);
+
+            // journaled once, so a crash mid transfer leaves no debris behind
+            if(writer->get_received_chunks() == 1)
             {
-                std::unique_lock<std::mutex> lock(send_mtx_);
-                sender_buffer_.push_back(fail_packet);
+                user_namespace_->log_operation(metadata_journal::JournalOperation::BEGIN_TRANSFER, file_name);
             }
-            send_cv_.notify_one();
+        }
+        catch(const std::exception& e)
+        {
+            // given file does not exist locally - informs server
+            user_namespace_->writers.release(temp_file_path, writer);
+            user_namespace_->log_operation(metadata_journal::JournalOperation::ABORT_TRANSFER, file_name);
 
-            std::string output = get_identifier() + " Could not write on file \"";
-            output += file_name + "\" sent by user!";
-            aprint(output, 2);
+            acknowledge_commit_(file_name, "", "Could not write on file sent by user: " + std::string(e.what()));
+            return;
+        }
+
+        // file is replaced once every chunk arrived, in whatever order
+        // only the session that claims the complete transfer commits it
+        bool completed = false;
+        std::string finished_file_path;
+        try
+        {
+            completed = user_namespace_->writers.complete(temp_file_path, writer, finished_file_path);
+        }
+        catch(const std::exception& e)
+        {
+            user_namespace_->log_operation(metadata_journal::JournalOperation::ABORT_TRANSFER, file_name);
+            acknowledge_commit_(file_name, "", e.what());
             return;
         }
-        else 
+
+        if(completed)
         {
-            // updates temporary file with payload
-            temp_file.write(buffer.payload, buffer.payload_size);
-            temp_file.close();
+            std::string current_checksum = calculate_md5_checksum(finished_file_path);
+            commit_received_file_(file_name, finished_file_path, current_checksum);
+        }
+    }
+}
+
+void ClientSession::commit_received_file_(
+    const std::string& file_name, 
+    const std::string& temp_file_path, 
+    const std::string& current_checksum)
+{
+    // stores a complete temporary file as the new contents of a user file
+    std::string local_file_path = directory_path_ + file_name;
+
+    // small files go to the user packs when packing is enabled
+    if(pack_received_file_(file_name, temp_file_path, current_checksum))
+    {
+        return;
+    }
 
-            // checks if the packet is last to overwrite original file
-            if(buffer.sequence_number == buffer.expected_packets - 1)
+    // big files are swapped for a clone of the same contents stored by
+    // anyone before, the user folder still holds a regular file
+    std::shared_ptr<dedup_store::Reference> new_reference = std::make_shared<dedup_store::Reference>();
+    if(user_namespace_->dedup != nullptr 
+        && fs::file_size(temp_file_path) >= user_namespace_->dedup_min_bytes)
+    {
+        try
+        {
+            *new_reference = user_namespace_->dedup->deduplicate(temp_file_path, local_file_path);
+        }
+        catch(const std::exception& e)
+        {
+            std::string output = get_identifier() + " Could not deduplicate file \"";
+            output += file_name + "\", storing it on its own: " + std::string(e.what());
+            aprint(output, 2);
+        }
+    }
+
+    // the replaced contents are diffed here, only storing the delta waits
+    // for the file lock
+    std::shared_ptr<version_store::PendingVersion> pending_version;
+    if(user_namespace_->versions != nullptr)
+    {
+        try
+        {
+            pending_version = user_namespace_->versions->prepare(file_name, local_file_path, temp_file_path);
+        }
+        catch(const std::exception& e)
+        {
+            std::string output = get_identifier() + " Could not diff previous version of \"";
+            output += file_name + "\": " + std::string(e.what());
+            aprint(output, 2);
+        }
+    }
+
+    // replaces the original file under its lock, the user is only told
+    // the upload is done once it reached the configured durability point
+    path_table::path_id file_id = user_namespace_->paths.intern(file_name);
+    std::shared_ptr<UserNamespace> user_namespace = user_namespace_;
+    std::weak_ptr<ClientSession> weak_session = weak_from_this();
+    std::shared_ptr<dedup_store::Reference> replaced_reference = std::make_shared<dedup_store::Reference>();
+    std::shared_ptr<version_store::StagedVersion> staged_version = std::make_shared<version_store::StagedVersion>();
+    user_namespace_->commits->commit(
+        temp_file_path, 
+        local_file_path,
+        [user_namespace, file_id, file_name, local_file_path, pending_version, replaced_reference, staged_version]()
+        {
+            // the version is only staged here, it joins the history once the
+            // rename went through, still under the same lock
+            file_lock_manager::ExclusiveLock file_lock = user_namespace->locks.lock_exclusive(file_id);
+            *staged_version = user_namespace->preserve_version(file_name, local_file_path, pending_version.get());
+
+            // the copy about to be replaced stops referencing shared contents,
+            // but only once the rename went through
+            if(user_namespace->dedup != nullptr)
             {
-                if(file_mtx_.find(file_name) != file_mtx_.end())
-                {
-                    // requests file mutex to change original file
-                    std::unique_lock<std::shared_mutex> file_lock(*file_mtx_[file_name]);
-                        
-                    std::string current_checksum = calculate_md5_checksum(temp_file_path);
+                *replaced_reference = user_namespace->dedup->hold(local_file_path);
+            }
+            return file_lock;
+        },
+        [user_namespace, file_name, current_checksum, replaced_reference, new_reference](const std::string& error)
+        {
+            // a failed commit leaves the old copy in place, and the new one
+            // never shows up
+            if(user_namespace->dedup != nullptr)
+            {
+                user_namespace->dedup->release(error.empty() ? *replaced_reference : *new_reference);
+            }
 
-                    // deletes temporaty file replacing the original file
-                    rename_replacing(temp_file_path, local_file_path);
-                    return;
+            // a packed copy from when the file was still small is stale now
+            if(error.empty() && user_namespace->packs != nullptr)
+            {
+                user_namespace->packs->remove(file_name);
+            }
+
+            // and so is a compressed one
+            if(error.empty() && user_namespace->cold != nullptr)
+            {
+                user_namespace->cold->remove(file_name);
+            }
+
+            user_namespace->log_operation(
+                error.empty() 
+                    ? metadata_journal::JournalOperation::COMMIT_TRANSFER 
+                    : metadata_journal::JournalOperation::ABORT_TRANSFER,
+                file_name,
+                current_checksum);
+        },
+        [weak_session, file_name, current_checksum](const std::string& error)
+        {
+            // the journal record is durable by now too
+            std::shared_ptr<ClientSession> session = weak_session.lock();
+            if(session == nullptr)
+            {
+                return;
+            }
+            session->acknowledge_commit_(file_name, current_checksum, error);
+        },
+        [user_namespace, staged_version](bool renamed)
+        {
+            user_namespace->finish_version(*staged_version, renamed);
+        });
+}
+
+void ClientSession::client_requested_versions_(std::string args)
+{
+    // user requested the kept versions of a file, newest first
+    std::string file_name = args;
+    std::string output;
+    if(!normalize_path_(file_name))
+    {
+        output = "Invalid file path!";
+    }
+    else if(user_namespace_->versions == nullptr)
+    {
+        output = "File history is disabled on this server.";
+    }
+    else
+    {
+        std::vector<version_store::VersionInfo> versions = user_namespace_->versions->list(file_name);
+        if(versions.empty())
+        {
+            output = "No previous versions of \"" + file_name + "\" were kept.";
+        }
+
+        for(auto it = versions.rbegin(); it != versions.rend(); ++it)
+        {
+            char superseded_time_buffer[100];
+            std::time_t superseded_time = it->superseded_time;
+            std::strftime(superseded_time_buffer, sizeof(superseded_time_buffer), "%c", std::localtime(&superseded_time));
+
+            output += "\n\t\t\tVersion " + std::to_string(it->id) + ": " + std::to_string(it->size) + " bytes";
+            output += ", replaced on " + std::string(superseded_time_buffer);
+            output += it->checksum.empty() ? "" : " (" + it->checksum + ")";
+        }
+    }
+
+    send_reply_("versions|" + args, output);
+
+    output = get_identifier() + " Sent versions of \"" + file_name + "\" to session.";
+    aprint(output, 2);
+}
+
+void ClientSession::client_requested_restore_(std::string args, std::string version)
+{
+    // user requested an old version of a file back, it is committed as the
+    // newest version, so the contents it replaces are kept in turn
+    std::string file_name = args;
+    if(!normalize_path_(file_name))
+    {
+        send_reply_("restore|" + args + "|fail", "Invalid file path!");
+        return;
+    }
+    std::string local_file_path = directory_path_ + file_name;
+    std::string temp_file_path;
+
+    std::string contents;
+    bool restored = false;
+    try
+    {
+        uint32_t version_id = std::stoul(version);
+
+        path_table::path_id file_id = user_namespace_->paths.intern(file_name);
+        file_lock_manager::SharedLock file_lock = user_namespace_->locks.lock_shared(file_id);
+
+        // kept out of the user folder, where clist would take it for a user file
+        if(user_namespace_->versions != nullptr)
+        {
+            // and unique to this restore, concurrent ones of the same file may be writing theirs
+            temp_file_path = chunk_writer::completed_path(
+                user_namespace_->versions->get_directory() + "/restore-" + std::to_string(file_id) + ".swizrestore");
+        }
+
+        std::shared_ptr<UserNamespace> user_namespace = user_namespace_;
+        restored = user_namespace_->versions != nullptr && user_namespace_->versions->restore(
+            file_name,
+            version_id,
+            [user_namespace, file_name, local_file_path](std::string& latest)
+            {
+                if(user_namespace->packs != nullptr && user_namespace->packs->get(file_name, latest))
+                {
+                    return true;
                 }
-                else
+
+                if(!fs::exists(local_file_path) && user_namespace->cold != nullptr && user_namespace->cold->read(file_name, latest))
                 {
-                    std::string output = get_identifier() + " No file mutex was found for \"";
-                    output += file_name + "\"!";
-                    raise(output, 2);
+                    return true;
                 }
-            }
-            return;
+
+                std::ifstream file(local_file_path, std::ios::binary);
+                latest.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                return file.is_open() && !file.bad();
+            },
+            contents);
+    }
+    catch(const std::exception& e)
+    {
+        std::string output = get_identifier() + " Could not rebuild version " + version + " of \"";
+        output += file_name + "\": " + std::string(e.what());
+        aprint(output, 2);
+    }
+
+    if(!restored)
+    {
+        send_reply_("restore|" + file_name + "|fail", "Version " + version + " of this file is not available.");
+        return;
+    }
+
+    std::ofstream temp_file(temp_file_path, std::ios::binary | std::ios::trunc);
+    temp_file.write(contents.data(), contents.size());
+    temp_file.close();
+    if(!temp_file.good())
+    {
+        std::error_code error;
+        fs::remove(temp_file_path, error);
+        send_reply_("restore|" + file_name + "|fail", "Restored contents could not be written on the server.");
+        return;
+    }
+
+    // a restore stores a file as any upload does, and counts against the quota the same way
+    std::string reason;
+    if(user_namespace_->index.has_quota() && !user_namespace_->index.reserve(file_name, contents.size(), reason))
+    {
+        std::error_code error;
+        fs::remove(temp_file_path, error);
+        send_reply_("restore|" + file_name + "|fail", reason);
+        return;
+    }
+
+    std::string output = get_identifier() + " Restoring version " + version + " of \"" + file_name + "\"...";
+    aprint(output, 2);
+
+    // acknowledged as any other upload, other devices pick it up on their next sync
+    commit_received_file_(file_name, temp_file_path, calculate_md5_checksum(temp_file_path));
+}
+
+void ClientSession::send_reply_(const std::string& command, const std::string& contents)
+{
+    // queues a reply carrying text for the user
+    packet reply_packet;
+    strcharray(command, reply_packet.command, sizeof(reply_packet.command));
+    reply_packet.payload = new char[contents.size() + 1];
+    strcharray(contents, reply_packet.payload, contents.size() + 1);
+    reply_packet.payload_size = contents.size();
+
+    {
+        std::unique_lock<std::mutex> lock(send_mtx_);
+        sender_buffer_.push_back(reply_packet);
+    }
+    send_cv_.notify_one();
+}
+
+bool ClientSession::normalize_path_(std::string& file_name)
+{
+    // paths sent by the user are resolved under the folder this session
+    // serves, one that could step out of it is refused
+    std::string normalized;
+    if(!path_table::normalize_path(file_name, normalized))
+    {
+        std::string output = get_identifier() + " Refused path \"" + file_name + "\" sent by user!";
+        aprint(output, 2);
+        return false;
+    }
+
+    file_name = normalized;
+    return true;
+}
+
+void ClientSession::acknowledge_commit_(std::string file_name, std::string checksum, std::string error)
+{
+    // tells the user a file it sent is stored, or why it is not
+    packet ack_packet;
+    std::string command = "commit|" + file_name + "|" + (error.empty() ? checksum : "fail");
+    strcharray(command, ack_packet.command, sizeof(ack_packet.command));
+
+    // failures carry their reason
+    if(!error.empty())
+    {
+        ack_packet.payload = new char[error.size() + 1];
+        strcharray(error, ack_packet.payload, error.size() + 1);
+        ack_packet.payload_size = error.size();
+
+        std::string output = get_identifier() + " Could not commit file \"" + file_name + "\": " + error;
+        aprint(output, 2);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(send_mtx_);
+        sender_buffer_.push_back(ack_packet);
+    }
+    send_cv_.notify_one();
+}
+
+bool ClientSession::is_packed_(const std::string& file_name)
+{
+    pack_store::PackedFile file;
+    return user_namespace_->packs != nullptr && user_namespace_->packs->find(file_name, file);
+}
+
+bool ClientSession::is_cold_(const std::string& file_name)
+{
+    cold_store::ColdFile file;
+    return user_namespace_->cold != nullptr && user_namespace_->cold->find(file_name, file);
+}
+
+int ClientSession::send_packed_file_(const std::string& command_name, const std::string& file_name)
+{
+    // queues a packed file the same way regular files are sent
+    // returns how many packets were queued, 0 if the file is not packed
+    if(user_namespace_->packs == nullptr)
+    {
+        return 0;
+    }
+
+    std::string contents;
+    pack_store::PackedFile file;
+    {
+        // packed files were interned when stored, an unknown path is not one
+        path_table::path_id file_id = user_namespace_->paths.find(file_name);
+        if(file_id == path_table::INVALID_PATH_ID)
+        {
+            return 0;
+        }
+
+        file_lock_manager::SharedLock file_lock = user_namespace_->locks.lock_shared(file_id);
+        if(!user_namespace_->packs->find(file_name, file) || !user_namespace_->packs->get(file_name, contents))
+        {
+            return 0;
+        }
+    }
+
+    std::size_t default_payload = chunk_writer::DEFAULT_CHUNK_SIZE;
+    std::size_t expected_packets = std::max<std::size_t>(1, (contents.size() + default_payload - 1) / default_payload);
+    std::string command = command_name + "|" + file_name + "|" + file.checksum;
+
+    for(std::size_t packet_index = 0; packet_index < expected_packets; packet_index++)
+    {
+        std::size_t offset = packet_index * default_payload;
+        std::size_t payload_size = std::min(default_payload, contents.size() - offset);
+
+        packet file_packet;
+        file_packet.sequence_number = packet_index;
+        file_packet.expected_packets = expected_packets;
+        file_packet.payload_size = payload_size;
+        file_packet.payload = new char[std::max<std::size_t>(payload_size, 1)];
+        std::memcpy(file_packet.payload, contents.data() + offset, payload_size);
+        strcharray(command, file_packet.command, sizeof(file_packet.command));
+
+        {
+            std::unique_lock<std::mutex> lock(send_mtx_);
+            sender_buffer_.push_back(file_packet);
+        }
+        send_cv_.notify_one();
+    }
+    return expected_packets;
+}
+
+bool ClientSession::pack_received_file_(
+    const std::string& file_name, 
+    const std::string& temp_file_path, 
+    const std::string& checksum)
+{
+    // moves a completely received file into the user packs if it is small enough
+    std::shared_ptr<pack_store::PackStore> packs = user_namespace_->packs;
+    std::error_code error;
+    uint64_t file_size = fs::file_size(temp_file_path, error);
+    if(packs == nullptr || error || file_size > user_namespace_->pack_threshold 
+        || !pack_store::PackStore::fits_record(file_name, checksum, file_size))
+    {
+        return false;
+    }
+
+    std::ifstream temp_file(temp_file_path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(temp_file)), std::istreambuf_iterator<char>());
+    temp_file.close();
+
+    pack_contents_(file_name, contents, checksum);
+    fs::remove(temp_file_path, error);
+    return true;
+}
+
+bool ClientSession::pack_received_packet_(const std::string& file_name, const packet& buffer)
+{
+    // a small file sent in a single chunk is packed straight from the packet,
+    // it never goes through a temporary file
+    std::shared_ptr<pack_store::PackStore> packs = user_namespace_->packs;
+    if(packs == nullptr || buffer.expected_packets != 1 || buffer.sequence_number != 0 
+        || buffer.payload_size > user_namespace_->pack_threshold)
+    {
+        return false;
+    }
+
+    std::string contents(buffer.payload, buffer.payload_size);
+    std::string checksum = calculate_md5_checksum(contents.data(), contents.size());
+    if(!pack_store::PackStore::fits_record(file_name, checksum, contents.size()))
+    {
+        return false;
+    }
+
+    // an older transfer of the same file must not finish over this one
+    user_namespace_->writers.cancel(directory_path_ + file_name + ".swizdownload");
+    try
+    {
+        pack_contents_(file_name, contents, checksum);
+    }
+    catch(const std::exception& e)
+    {
+        user_namespace_->log_operation(metadata_journal::JournalOperation::ABORT_TRANSFER, file_name);
+        acknowledge_commit_(file_name, "", e.what());
+    }
+    return true;
+}
+
+void ClientSession::pack_contents_(
+    const std::string& file_name, 
+    const std::string& contents, 
+    const std::string& checksum)
+{
+    std::shared_ptr<pack_store::PackStore> packs = user_namespace_->packs;
+    std::string segment_path;
+    {
+        path_table::path_id file_id = user_namespace_->paths.intern(file_name);
+        file_lock_manager::ExclusiveLock file_lock = user_namespace_->locks.lock_exclusive(file_id);
+        version_store::StagedVersion staged_version = 
+            user_namespace_->preserve_version(file_name, directory_path_ + file_name, nullptr, &contents);
+        try
+        {
+            segment_path = packs->put(file_name, contents, get_time(), checksum);
+        }
+        catch(const std::exception& e)
+        {
+            user_namespace_->finish_version(staged_version, false);
+            throw;
+        }
+        user_namespace_->finish_version(staged_version, true);
+        if(user_namespace_->cold != nullptr)
+        {
+            user_namespace_->cold->remove(file_name);
+        }
+
+        // a regular copy from when the file was still big is stale now
+        std::error_code error;
+        dedup_store::Reference reference;
+        if(user_namespace_->dedup != nullptr)
+        {
+            reference = user_namespace_->dedup->hold(directory_path_ + file_name);
+        }
+        if(fs::remove(directory_path_ + file_name, error) && user_namespace_->dedup != nullptr)
+        {
+            user_namespace_->dedup->release(reference);
         }
     }
+
+    // packed files are acknowledged once their segment is durable
+    std::shared_ptr<UserNamespace> user_namespace = user_namespace_;
+    std::weak_ptr<ClientSession> weak_session = weak_from_this();
+    user_namespace_->commits->sync_point(
+        segment_path,
+        [user_namespace, file_name, checksum](const std::string& error)
+        {
+            user_namespace->log_operation(
+                error.empty() 
+                    ? metadata_journal::JournalOperation::COMMIT_TRANSFER 
+                    : metadata_journal::JournalOperation::ABORT_TRANSFER,
+                file_name,
+                checksum);
+        },
+        [weak_session, file_name, checksum](const std::string& error)
+        {
+            std::shared_ptr<ClientSession> session = weak_session.lock();
+            if(session != nullptr)
+            {
+                session->acknowledge_commit_(file_name, checksum, error);
+            }
+        });
 }
 
 void ClientSession::client_sent_supload_(std::string args, std::string arg2)
@@ -701,71 +1400,77 @@ void ClientSession::client_sent_supload_(std::string args, std::string arg2)
 std::string ClientSession::slist_()
 {
     // returns a string list of every file hosted for this session
-    DIR* dir = opendir(directory_path_.c_str());
-    if(dir == nullptr) 
+    std::vector<directory_scanner::ScanEntry> entries;
+    int failed_directories = 0;
+    try
+    {
+        entries = directory_scanner::default_scanner().scan_to_vector(directory_path_, false, &failed_directories);
+    }
+    catch(const std::exception& e)
     {
         std::string output = get_identifier() + " Could not acess user folder!";
         raise(output, 2);
     }
 
-    // main output string
+    // files under them are missing from the list
+    if(failed_directories > 0)
+    {
+        std::string output = get_identifier() + " Could not read " + std::to_string(failed_directories);
+        output += " directories of the user folder, file list is partial!";
+        aprint(output, 2);
+    }
+
+    // main output string - paths are relative to the user folder
     std::string output = "";
-    std::function<void(const std::string&)> list_files_recursively = [&](const std::string& current_path) 
+    for(const directory_scanner::ScanEntry& entry : entries)
     {
+        if(output.size() > 0)
+        {
+            // theres a few files already
+            output += "|/" + entry.path;
+        }
+        else
+        {
+            output += "/" + entry.path;
+        }
+    }
 
-        DIR* dir = opendir(current_path.c_str());
-        if(dir == nullptr) 
+    // packed and compressed files are listed as if they were regular ones
+    if(user_namespace_->packs != nullptr || user_namespace_->cold != nullptr)
+    {
+        std::unordered_set<std::string> listed;
+        for(const directory_scanner::ScanEntry& entry : entries)
         {
-            std::string output = get_identifier() + " Could not acess \"";
-            output += current_path + "\" user folder!";
-            raise(output, 2);
+            listed.insert(entry.path);
         }
 
-        dirent* entry;
-        while((entry = readdir(dir)) != nullptr) 
+        auto list_file = [&output, &listed](const std::string& path)
         {
-            if(entry->d_type == DT_REG) 
-            { 
-                std::string file_path = current_path + "/" + entry->d_name;
-                file_path += "/";
-                file_path += entry->d_name;
+            if(!listed.insert(path).second)
+            {
+                return;
+            }
+            output += (output.size() > 0 ? "|/" : "/") + path;
+        };
 
-                struct stat file_info;
-                if(lstat(file_path.c_str(), &file_info) == 0) 
+        if(user_namespace_->packs != nullptr)
+        {
+            user_namespace_->packs->list(
+                [&list_file](const std::string& path, const pack_store::PackedFile& file)
                 {
-                    // removes server filesystem prefix from file path
-                    std::string current_file_string = file_path;
-                    size_t pos = current_file_string.find(directory_path_);
-                    if(pos != std::string::npos) 
-                    {
-                        current_file_string.erase(pos, directory_path_.length());
-                    }
-
-                    if(output.size() > 0)
-                    {
-                        // theres a few files already
-                        output += "|" + current_file_string;
-                    }
-                    else
-                    {
-                        output += current_file_string;
-                    }
-
-                    //output += "\n\t\t\tFile name: " + std::string(entry->d_name);
-                    //output += "\n\t\t\tFile path: " + file_path;
+                    list_file(path);
+                });
+        }
 
-                }
-                else if(entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) 
+        if(user_namespace_->cold != nullptr)
+        {
+            user_namespace_->cold->list(
+                [&list_file](const std::string& path, const cold_store::ColdFile& file)
                 {
-                    list_files_recursively(current_path + "/" + entry->d_name);
-                }
-            }
+                    list_file(path);
+                });
         }
-        closedir(dir);
-    };
-
-    // gathers formatted file list
-    list_files_recursively(directory_path_);
+    }
 
     return output;
-}
+}
\ No newline at end of file
@@ -6,6 +6,8 @@
 
 // c
 #include <unistd.h>
+#include <poll.h>
+#include <cerrno>
 
 // locals
 #include "client_connection.hpp"
@@ -48,12 +50,28 @@ void ClientSession::session_receiver_loop()
             return;
         }
 
+        packet buffer;
         try
         {
+            // an idle connection is not an error, only a packet cut short is
+            pollfd socket_poll = {socket_fd_.load(), POLLIN, 0};
+            int ready = poll(&socket_poll, 1, SESSION_POLL_MS);
+            if(ready == 0 || (ready < 0 && errno == EINTR))
+            {
+                continue;
+            }
+
             // receives a new packet
-            packet buffer;
             receive_packet_(&buffer);
+        }
+        catch(const std::exception& e)
+        {
+            park_(std::string(e.what()));
+            return;
+        }
 
+        try
+        {
             // sanitizes packet command argument
             std::vector<std::string> received_buffer = split_buffer(buffer.command);
             int nargs = received_buffer.size();
@@ -119,8 +137,6 @@ void ClientSession::session_receiver_loop()
                     std::string command_name = received_buffer[0];
                     std::string args = received_buffer[1];
 
-                    std::string local_file_path = directory_path_ + args;
-
                     if(command_name == "delete")
                     {
                         // user requested server to delete file
@@ -128,6 +144,12 @@ void ClientSession::session_receiver_loop()
                         this->client_requested_delete_(args, buffer);
                         break;
                     }
+                    else if(command_name == "ack")
+                    {
+                        // user got every packet up to the given count
+                        this->client_acknowledged_packets_(args);
+                        break;
+                    }
                     else if(command_name == "clist")
                     {
                         // client listing command probably failed
@@ -150,6 +172,12 @@ void ClientSession::session_receiver_loop()
                         // whenever checked
                         break;
                     }
+                    else if(command_name == "versions")
+                    {
+                        // user requested the kept versions of a file
+                        this->client_requested_versions_(args);
+                        break;
+                    }
                     else
                     {
                         // client sent malformed command
@@ -163,8 +191,6 @@ void ClientSession::session_receiver_loop()
                     std::string args = received_buffer[1];
                     std::string checksum = received_buffer[2];
                     
-                    std::string local_file_path = directory_path_ + args;
-
                     if(command_name == "sdownload")
                     {
                         // user is sending some file
@@ -177,6 +203,13 @@ void ClientSession::session_receiver_loop()
                         this->client_sent_supload_(args, checksum);
                         break;
                     }
+                    else if(command_name == "restore")
+                    {
+                        // user requested an old version of a file back
+                        // the third argument is the version id
+                        this->client_requested_restore_(args, checksum);
+                        break;
+                    }
                     else
                     {
                         // malformed command
@@ -204,9 +237,20 @@ void ClientSession::session_receiver_loop()
 
 void ClientSession::add_packet_from_broadcast(packet& p)
 {
-    // receives a new packet
+    // a device away for long on a busy account resyncs instead, its
+    // session would otherwise hold every broadcast file in memory
+    if(parked_.load())
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        if(sender_buffer_.size() >= MAX_PARKED_PACKETS)
+        {
+            parked_time_.store(0);
+            return;
+        }
+    }
+
+    // handled as if this session had sent it, the packet is already here
     packet buffer = p;
-    receive_packet_(&buffer);
 
     // sanitizes packet command argument
     std::vector<std::string> received_buffer = split_buffer(buffer.command);
@@ -273,13 +317,17 @@ void ClientSession::add_packet_from_broadcast(packet& p)
             std::string command_name = received_buffer[0];
             std::string args = received_buffer[1];
 
-            std::string local_file_path = directory_path_ + args;
-
             if(command_name == "delete")
             {
-                // user requested server to delete file
-                // propagates to other sessions
-                this->client_requested_delete_(args, buffer);
+                // another device deleted it and the server already dropped
+                // it, this device only has to remove its own copy
+                packet delete_packet;
+                strcharray(std::string(buffer.command), delete_packet.command, sizeof(delete_packet.command));
+                {
+                    std::unique_lock<std::mutex> lock(send_mtx_);
+                    sender_buffer_.push_back(delete_packet);
+                }
+                send_cv_.notify_one();
                 break;
             }
             else if(command_name == "clist")
@@ -317,8 +365,6 @@ void ClientSession::add_packet_from_broadcast(packet& p)
             std::string args = received_buffer[1];
             std::string checksum = received_buffer[2];
             
-            std::string local_file_path = directory_path_ + args;
-
             if(command_name == "sdownload")
             {
                 // user is sending some file
@@ -418,16 +464,25 @@ void ClientSession::session_sender_loop()
             if(!sender_buffer_.empty())
             {
                 // sends using previoulsy set callback method
+                // a packet that fails is kept at the front for a resumption
                 this->send_packet_(sender_buffer_.front());
 
+                // a sent packet may still be lost with the connection, it
+                // is kept until the device acknowledges it
+                sent_buffer_.push_back(sender_buffer_.front());
+                sent_packets_++;
+                if(sent_buffer_.size() > MAX_UNACKNOWLEDGED_PACKETS)
+                {
+                    sent_buffer_.pop_front();
+                }
                 sender_buffer_.erase(sender_buffer_.begin());
             }
 
         }
         catch(const std::exception& e)
         {
-            std::string output = "Exception occured while running send: " + std::string(e.what());
-            raise(output, 2);
+            park_(std::string(e.what()));
+            return;
         }
 
         send_cv_.notify_one();
@@ -466,6 +521,7 @@ void ClientSession::disconnect(std::string reason)
     }
     send_cv_.notify_one();
 
+    ended_.store(true);
     running_receiver_.store(false);
     running_sender_.store(false);
     send_cv_.notify_one();
@@ -475,7 +531,8 @@ void ClientSession::disconnect(std::string reason)
 
 void ClientSession::send_packet_(const packet& p, int sockfd, int timeout)
 {
-    send_callback_(p, sockfd, timeout);
+    // the socket is looked up on every send, it changes when the session is resumed
+    send_callback_(p, sockfd == -1 ? socket_fd_.load() : sockfd, timeout);
 }
 
 void ClientSession::receive_packet_(packet* p, int sockfd, int timeout)
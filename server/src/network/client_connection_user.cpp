@@ -6,7 +6,10 @@
 #include <exception>
 #include <stdexcept>
 #include <filesystem>
+#include <vector>
+#include <algorithm>
 #include <unistd.h>
+#include <sys/stat.h>
 
 // multithreading & synchronization
 #include <thread>
@@ -17,19 +20,303 @@
 #include "client_connection.hpp"
 #include "../include/common/utils.hpp"
 #include "../include/common/async_cout.hpp"
+#include "../include/common/directory_scanner.hpp"
 
 using namespace async_cout;
 using namespace client_connection;
 namespace fs = std::filesystem;
 
+void UserNamespace::log_operation(
+    metadata_journal::JournalOperation operation, 
+    const std::string& path, 
+    const std::string& checksum)
+{
+    metadata_journal::JournalRecord record;
+    record.operation = operation;
+    record.username = username;
+    record.path = path;
+    record.checksum = checksum;
+
+    if(operation == metadata_journal::JournalOperation::COMMIT_TRANSFER)
+    {
+        struct stat file_info;
+        pack_store::PackedFile packed_file;
+        cold_store::ColdFile cold_file;
+        if(stat((directory + path).c_str(), &file_info) == 0)
+        {
+            record.size = file_info.st_size;
+            record.modification_time = file_info.st_mtime;
+        }
+        else if(packs != nullptr && packs->find(path, packed_file))
+        {
+            record.size = packed_file.size;
+            record.modification_time = packed_file.modification_time;
+        }
+        else if(cold != nullptr && cold->find(path, cold_file))
+        {
+            record.size = cold_file.size;
+            record.modification_time = cold_file.modification_time;
+        }
+    }
+
+    try
+    {
+        index.log(*journal, record);
+    }
+    catch(const std::exception& e)
+    {
+        // losing a record only costs a reconciliation with the clients
+        aprint("Could not journal operation on \"" + path + "\": " + std::string(e.what()), 4);
+    }
+}
+
+version_store::StagedVersion UserNamespace::preserve_version(
+    const std::string& path, 
+    const std::string& local_path,
+    version_store::PendingVersion* pending, 
+    const std::string* next_contents)
+{
+    // NOTE: caller must hold the file lock exclusively
+    if(versions == nullptr)
+    {
+        return version_store::StagedVersion();
+    }
+
+    try
+    {
+        pack_store::PackedFile packed_file;
+        cold_store::ColdFile cold_file;
+        std::string current;
+        if(packs != nullptr && packs->find(path, packed_file) && packs->get(path, current))
+        {
+            // a regular file taking over a packed one has nothing to diff against
+            // packed files are small enough to be held in memory
+            return versions->stage(path, current, next_contents, packed_file.checksum);
+        }
+        else if(cold != nullptr && !fs::exists(local_path) && cold->find(path, cold_file))
+        {
+            // a compressed file is kept whole, it was not worth diffing when cold
+            // and it is decompressed to disk, it may be of any size
+            std::string extracted_path = chunk_writer::completed_path(
+                versions->get_directory() + "/cold.swizstaged");
+            if(!cold->extract(path, extracted_path))
+            {
+                return version_store::StagedVersion();
+            }
+
+            version_store::StagedVersion staged = versions->stage_whole(path, extracted_path);
+            std::error_code error;
+            fs::remove(extracted_path, error);
+            return staged;
+        }
+        else if(pending != nullptr)
+        {
+            return versions->stage(*pending);
+        }
+        return versions->stage_whole(path, local_path);
+    }
+    catch(const std::exception& e)
+    {
+        // the write goes on, only its undo is lost
+        aprint("Could not keep previous version of \"" + path + "\": " + std::string(e.what()), 4);
+    }
+    return version_store::StagedVersion();
+}
+
+void UserNamespace::finish_version(const version_store::StagedVersion& staged, bool replaced)
+{
+    // NOTE: caller must hold the file lock exclusively
+    if(versions == nullptr)
+    {
+        return;
+    }
+
+    try
+    {
+        versions->finish(staged, replaced);
+    }
+    catch(const std::exception& e)
+    {
+        aprint("Could not keep previous version of \"" + staged.path + "\": " + std::string(e.what()), 4);
+    }
+}
+
+uint64_t UserNamespace::compress_cold_files(
+    int cold_after_seconds, 
+    uint64_t byte_budget, 
+    std::function<bool(uint64_t bytes)> pace)
+{
+    if(cold == nullptr)
+    {
+        return 0;
+    }
+
+    std::vector<directory_scanner::ScanEntry> entries;
+    try
+    {
+        entries = directory_scanner::default_scanner().scan_to_vector(directory);
+    }
+    catch(const std::exception& e)
+    {
+        aprint("Could not scan folder of user \"" + username + "\" for cold files: " + std::string(e.what()), 4);
+        return 0;
+    }
+
+    std::time_t cold_before = get_time() - cold_after_seconds;
+    uint64_t read_bytes = 0;
+    uint64_t saved_bytes = 0;
+    for(const directory_scanner::ScanEntry& entry : entries)
+    {
+        if(read_bytes >= byte_budget || (pace != nullptr && !pace(0)))
+        {
+            break;
+        }
+
+        // transfers in progress and recently used files stay as they are
+        bool temporary = fs::path(entry.name).extension().string().rfind(".swiz", 0) == 0;
+        if(temporary
+            || entry.size < cold_store::MIN_COLD_FILE_SIZE
+            || std::max(entry.modification_time, entry.access_time) > cold_before)
+        {
+            continue;
+        }
+        read_bytes += entry.size;
+        if(pace != nullptr && !pace(entry.size))
+        {
+            break;
+        }
+
+        try
+        {
+            // compressing takes long, only putting the copy in place is locked
+            std::string local_path = directory + "/" + entry.path;
+            cold_store::PendingCold pending;
+            if(!cold->prepare(entry.path, local_path, pending))
+            {
+                continue;
+            }
+
+            path_table::path_id file_id = paths.intern(entry.path);
+            file_lock_manager::ExclusiveLock file_lock = locks.lock_exclusive(file_id);
+            if(!cold->publish(pending, local_path))
+            {
+                continue;
+            }
+
+            // the original only goes away once the compressed copy is durable,
+            // and takes its shared contents along
+            dedup_store::Reference reference;
+            if(dedup != nullptr)
+            {
+                reference = dedup->hold(local_path);
+            }
+            cold_store::ColdFile file;
+            if(unlink(local_path.c_str()) != 0 || !cold->find(entry.path, file))
+            {
+                cold->remove(entry.path);
+                continue;
+            }
+            if(dedup != nullptr)
+            {
+                dedup->release(reference);
+            }
+            saved_bytes += file.size - file.stored_size;
+        }
+        catch(const std::exception& e)
+        {
+            aprint("Could not compress cold file \"" + entry.path + "\": " + std::string(e.what()), 4);
+        }
+    }
+    return saved_bytes;
+}
+
+uint64_t UserNamespace::remove_superseded_cold_files(std::function<bool()> pace)
+{
+    if(cold == nullptr)
+    {
+        return 0;
+    }
+
+    std::vector<std::string> cold_paths;
+    cold->list(
+        [&cold_paths](const std::string& path, const cold_store::ColdFile& file)
+        {
+            cold_paths.push_back(path);
+        });
+
+    uint64_t reclaimed_bytes = 0;
+    for(const std::string& path : cold_paths)
+    {
+        if(pace != nullptr && !pace())
+        {
+            break;
+        }
+
+        // a regular file next to a compressed copy was committed over it
+        std::string local_path = directory + "/" + path;
+        if(!fs::exists(local_path))
+        {
+            continue;
+        }
+
+        path_table::path_id file_id = paths.intern(path);
+        file_lock_manager::ExclusiveLock file_lock = locks.lock_exclusive(file_id);
+        cold_store::ColdFile file;
+        if(fs::exists(local_path) && cold->find(path, file) && cold->remove(path))
+        {
+            reclaimed_bytes += file.stored_size;
+        }
+    }
+    return reclaimed_bytes;
+}
+
+void UserNamespace::rehydrate_cold_file(const std::string& path, const std::string& local_path)
+{
+    cold_store::ColdFile file;
+    if(cold == nullptr || !cold->find(path, file))
+    {
+        return;
+    }
+
+    path_table::path_id file_id = paths.intern(path);
+    file_lock_manager::ExclusiveLock file_lock = locks.lock_exclusive(file_id);
+
+    // a file committed over the cold one is newer, the cold copy is only
+    // removed by the commit after it already landed
+    if(fs::exists(local_path))
+    {
+        cold->remove(path);
+        return;
+    }
+
+    if(!cold->rehydrate(path, local_path))
+    {
+        aprint("Could not decompress cold file \"" + path + "\" of user \"" + username + "\"!", 4);
+    }
+}
+
 User::User(
     std::string username, 
-    std::string home_dir)
+    std::string home_dir,
+    const server_config::ServerConfig& config,
+    std::shared_ptr<commit_pipeline::CommitPipeline> commits,
+    std::shared_ptr<metadata_journal::MetadataJournal> journal,
+    std::shared_ptr<dedup_store::DedupStore> dedup)
     :   home_dir_path_(home_dir),
-        user_dir_path_(home_dir + "/" + username),
+        user_dir_path_(directory_layout::user_directory(home_dir, username, config.layout)),
+        files_dir_path_(config.isolate_users ? user_dir_path_ : home_dir),
+        metadata_path_(server_config::metadata_directory(home_dir) + "/" + username + ".json"),
+        index_path_(server_config::metadata_directory(home_dir) + "/" + username + ".index"),
+        user_namespace_(std::make_shared<UserNamespace>()),
         username_(username),
+        last_activity_(get_time()),
+        pending_logins_(0),
+        warm_loaded_(false),
+        total_sessions_(0),
         overseer_running_(false),
-        max_sessions_(max_sessions_default_)
+        max_sessions_(max_sessions_default_),
+        session_grace_seconds_(config.session_grace_seconds),
+        sessions_(std::make_shared<const SessionTable>())
 {
     // checks if user had a folder on the server
     if(!fs::exists(user_dir_path_))
@@ -41,79 +328,240 @@ User::User(
         }
     }
 
+    user_namespace_->username = username_;
+    user_namespace_->directory = files_dir_path_;
+    user_namespace_->commits = commits;
+    user_namespace_->journal = journal;
+    user_namespace_->dedup = dedup;
+    user_namespace_->dedup_min_bytes = config.dedup_min_bytes;
+
+    std::string metadata_dir = server_config::metadata_directory(home_dir);
+
+    if(config.pack_threshold_bytes > 0)
+    {
+        user_namespace_->pack_threshold = config.pack_threshold_bytes;
+        user_namespace_->packs = std::make_shared<pack_store::PackStore>(
+            metadata_dir + "/packs/" + username_, 
+            &user_namespace_->paths);
+    }
+
+    if(config.version_count > 0 || config.version_days > 0)
+    {
+        user_namespace_->versions = std::make_shared<version_store::VersionStore>(
+            metadata_dir + "/versions/" + username_,
+            config.version_count,
+            config.version_days);
+    }
+
+    if(config.cold_after_seconds > 0)
+    {
+        user_namespace_->cold = std::make_shared<cold_store::ColdStore>(metadata_dir + "/cold/" + username_);
+    }
+
+    // restores what was persisted when the user was last evicted
+    // the journal tail was folded into the checkpoint on startup, only
+    // records logged after the eviction are still left to apply
+    load_metadata();
+    bool index_loaded = false;
+    try
+    {
+        index_loaded = user_namespace_->index.load_checkpoint(index_path_);
+        if(index_loaded)
+        {
+            // only the records of this user are read, whatever the journal holds
+            user_namespace_->journal->scan_user(
+                username_,
+                user_namespace_->index.get_applied_lsn(),
+                [this](const metadata_journal::JournalRecord& record)
+                {
+                    user_namespace_->index.apply(record);
+                });
+        }
+    }
+    catch(const std::exception& e)
+    {
+        // index is only a cache of the user folder, clients fill it back
+        aprint("Discarding file index of user \"" + username_ + "\": " + std::string(e.what()), 4);
+    }
+
+    // usage is kept by the index, files it never saw must count against the quota too
+    if(!index_loaded)
+    {
+        seed_index_();
+    }
+
+    // only the file index makes a load warm, the metadata file alone is a few counters
+    warm_loaded_ = index_loaded;
+    user_namespace_->index.set_quota(config.quota_bytes, config.quota_files);
+
     // after loading user, starts up overseer thread to process user events
     start_overseer();
     aprint("Overseer initialized for user \"" + username_ + "\"...", 4);
 }
 
+User::~User()
+{
+    stop_overseer();
+}
+
 std::string User::get_username()
 {
     return username_;
 }
 
-void User::add_session(client_connection::ClientSession* new_session)
+void User::add_session(std::shared_ptr<client_connection::ClientSession> new_session)
 {
+    std::lock_guard<std::mutex> lock(sessions_write_mtx_);
+    std::shared_ptr<const SessionTable> current = get_sessions_snapshot_();
+
     // checks the maximum connection number
-    if(sessions_.size() <= max_sessions_)
-    {
-        sessions_.push_back(new_session);
-    }
-    else
+    if(current->size() >= max_sessions_)
     {
         raise("Session limit reached for this user!", 4);
     }
 
+    // publishes a new table including the given session
+    std::shared_ptr<SessionTable> updated = std::make_shared<SessionTable>(*current);
+    updated->emplace(new_session->get_socket_fd(), new_session);
+    std::atomic_store(&sessions_, std::shared_ptr<const SessionTable>(updated));
+
+    total_sessions_++;
+    last_activity_.store(get_time());
 }
 
 void User::remove_session(int sock_fd, std::string reason)
 {
-    // checks if machine is already connected,
-    // if it is under the maximum connection number
-    if(get_session(sock_fd) != nullptr)
+    std::shared_ptr<client_connection::ClientSession> removed_session;
+    {
+        std::lock_guard<std::mutex> lock(sessions_write_mtx_);
+        std::shared_ptr<const SessionTable> current = get_sessions_snapshot_();
+
+        auto it = current->find(sock_fd);
+        if(it == current->end())
+        {
+            raise("No session exists under given socket descriptor!", 4);
+        }
+        removed_session = it->second;
+
+        std::shared_ptr<SessionTable> updated = std::make_shared<SessionTable>(*current);
+        updated->erase(sock_fd);
+        std::atomic_store(&sessions_, std::shared_ptr<const SessionTable>(updated));
+        last_activity_.store(get_time());
+    }
+
+    // ends session properly - readers holding an older table may still
+    // reference it, it is only destroyed after they are done
+    removed_session->disconnect(reason);
+}
+
+std::shared_ptr<client_connection::ClientSession> User::get_session(int sock_fd)
+{
+    std::shared_ptr<const SessionTable> current = get_sessions_snapshot_();
+    auto it = current->find(sock_fd);
+    if(it != current->end())
     {
-        raise("No session exists under given socket descriptor!", 4);
+        return it->second;
     }
-    else
+    return nullptr;
+}
+
+std::shared_ptr<client_connection::ClientSession> User::claim_parked_session(const std::string& resume_token, uint64_t received_packets)
+{
+    for(const auto& [sock_fd, session] : *get_sessions_snapshot_())
     {
-        // iterates through sessions
-        auto it = sessions_.begin();
-        while(it != sessions_.end()) 
+        // the device has to start over if it missed packets no longer kept
+        if(session->can_replay(received_packets) && session->claim(resume_token, session_grace_seconds_))
         {
-            if ((*it)->get_socket_fd() == sock_fd) 
-            {   
-                // ends session properly previous to deleting it
-                (*it)->disconnect(reason);
+            return session;
+        }
+    }
+    return nullptr;
+}
 
-                // after disconnecting, removes it from the list
-                it = sessions_.erase(it);
-                return;
-            }
-            else
-            {
-                ++it;
-            }
+void User::resume_session(std::shared_ptr<client_connection::ClientSession> session, int sock_fd, uint64_t received_packets)
+{
+    // the session is keyed again by its new socket
+    std::lock_guard<std::mutex> lock(sessions_write_mtx_);
+    std::shared_ptr<SessionTable> updated = std::make_shared<SessionTable>(*get_sessions_snapshot_());
+    updated->erase(session->get_socket_fd());
+    session->resume(sock_fd, received_packets);
+    updated->emplace(sock_fd, session);
+    std::atomic_store(&sessions_, std::shared_ptr<const SessionTable>(updated));
+    last_activity_.store(get_time());
+}
+
+int User::drop_parked_sessions(const std::string& machine_name)
+{
+    std::lock_guard<std::mutex> lock(sessions_write_mtx_);
+    std::shared_ptr<const SessionTable> current = get_sessions_snapshot_();
+
+    std::shared_ptr<SessionTable> updated = std::make_shared<SessionTable>();
+    for(const auto& [sock_fd, session] : *current)
+    {
+        // a claimed session is being resumed by someone else right now
+        if(session->is_parked() && session->get_machine_name() == machine_name && session->claim(session->get_resume_token(), session_grace_seconds_))
+        {
+            continue;
         }
+        updated->emplace(sock_fd, session);
     }
-    raise("Could not find given session to remove!", 4);
+
+    int dropped = current->size() - updated->size();
+    if(dropped > 0)
+    {
+        std::atomic_store(&sessions_, std::shared_ptr<const SessionTable>(updated));
+        last_activity_.store(get_time());
+    }
+    return dropped;
 }
 
-client_connection::ClientSession* User::get_session(int sock_fd)
+int User::evict_parked_sessions()
 {
-    // iterates though client list
-    for(client_connection::ClientSession* session : sessions_)
+    std::lock_guard<std::mutex> lock(sessions_write_mtx_);
+    std::shared_ptr<const SessionTable> current = get_sessions_snapshot_();
+
+    std::vector<std::shared_ptr<ClientSession>> parked_sessions;
+    for(const auto& [sock_fd, session] : *current)
     {
-        if(session->get_socket_fd() == sock_fd)
+        if(session->is_parked())
         {
-            return session;
+            parked_sessions.push_back(session);
         }
     }
-    return nullptr;
+    std::sort(parked_sessions.begin(), parked_sessions.end(),
+        [](const std::shared_ptr<ClientSession>& a, const std::shared_ptr<ClientSession>& b)
+        {
+            return a->get_parked_time() < b->get_parked_time();
+        });
+
+    std::shared_ptr<SessionTable> updated = std::make_shared<SessionTable>(*current);
+    for(const std::shared_ptr<ClientSession>& session : parked_sessions)
+    {
+        if(updated->size() < max_sessions_)
+        {
+            break;
+        }
+
+        // a claimed session is being resumed by someone else right now
+        if(session->claim(session->get_resume_token(), session_grace_seconds_))
+        {
+            updated->erase(session->get_socket_fd());
+        }
+    }
+
+    int evicted = current->size() - updated->size();
+    if(evicted > 0)
+    {
+        std::atomic_store(&sessions_, std::shared_ptr<const SessionTable>(updated));
+        last_activity_.store(get_time());
+    }
+    return evicted;
 }
 
 void User::nuke()
 {
     // disconnects all active sessions
-    for(client_connection::ClientSession* session : sessions_)
+    for(const auto& [sock_fd, session] : *get_sessions_snapshot_())
     {
         session->disconnect("Nuked!");
     }
@@ -129,12 +577,12 @@ void User::broadcast_other_sessions(int caller_sockfd, packet& p)
     output += " from session " + std::to_string(caller_sockfd) + ".";
     aprint(output, 4);
 
-    for(client_connection::ClientSession* session : sessions_)
+    for(const auto& [sock_fd, session] : *get_sessions_snapshot_())
     {
         try
         {
             // does not send back to the sender
-            if(session->get_socket_fd() != caller_sockfd)
+            if(sock_fd != caller_sockfd)
             {
                 session->add_packet_from_broadcast(p);
             }
@@ -142,7 +590,7 @@ void User::broadcast_other_sessions(int caller_sockfd, packet& p)
         catch(const std::exception& e)
         {
             std::string output = "An exception happened ";
-            output += "while sending buffer to session " + session->get_socket_fd();
+            output += "while sending buffer to session " + std::to_string(sock_fd);
             output += "! Errors caught: " + std::string(e.what());
             aprint(output, 4);
         }     
@@ -152,7 +600,7 @@ void User::broadcast_other_sessions(int caller_sockfd, packet& p)
 void User::broadcast(packet& p)
 {
     // sends a packet to all sessions
-    for(client_connection::ClientSession* session : sessions_)
+    for(const auto& [sock_fd, session] : *get_sessions_snapshot_())
     {
         try
         {
@@ -161,7 +609,7 @@ void User::broadcast(packet& p)
         catch(const std::exception& e)
         {
             std::string output = "An exception happened ";
-            output += "while sending buffer to session " + session->get_socket_fd();
+            output += "while sending buffer to session " + std::to_string(sock_fd);
             output += "! Errors caught: " + std::string(e.what());
             aprint(output, 4);
         }     
@@ -170,7 +618,64 @@ void User::broadcast(packet& p)
 
 int User::get_active_session_count()
 {
-    return sessions_.size();
+    return get_sessions_snapshot_()->size();
+}
+
+void User::seed_index_()
+{
+    // counts every stored file once, without journaling, the next
+    // checkpoint persists them
+    std::shared_ptr<UserNamespace> user_namespace = user_namespace_;
+    auto seed_file = [user_namespace](const std::string& path, uint64_t size, int64_t modification_time)
+    {
+        metadata_journal::JournalRecord record;
+        record.operation = metadata_journal::JournalOperation::COMMIT_TRANSFER;
+        record.username = user_namespace->username;
+        record.path = "/" + path;
+        record.size = size;
+        record.modification_time = modification_time;
+        user_namespace->index.apply(record);
+    };
+
+    try
+    {
+        int failed_directories = 0;
+        for(const directory_scanner::ScanEntry& entry : directory_scanner::default_scanner().scan_to_vector(files_dir_path_, false, &failed_directories))
+        {
+            if(fs::path(entry.name).extension().string().rfind(".swiz", 0) != 0)
+            {
+                seed_file(entry.path, entry.size, entry.modification_time);
+            }
+        }
+
+        // files under them do not count against the quota until they are sent again
+        if(failed_directories > 0)
+        {
+            aprint("Could not read " + std::to_string(failed_directories) + " directories of user \"" + username_ + "\", usage is undercounted!", 4);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        aprint("Could not count files of user \"" + username_ + "\": " + std::string(e.what()), 4);
+    }
+
+    if(user_namespace_->packs != nullptr)
+    {
+        user_namespace_->packs->list(
+            [&seed_file](const std::string& path, const pack_store::PackedFile& file)
+            {
+                seed_file(path, file.size, file.modification_time);
+            });
+    }
+
+    if(user_namespace_->cold != nullptr)
+    {
+        user_namespace_->cold->list(
+            [&seed_file](const std::string& path, const cold_store::ColdFile& file)
+            {
+                seed_file(path, file.size, file.modification_time);
+            });
+    }
 }
 
 bool User::has_current_files()
@@ -184,6 +689,117 @@ std::string User::get_home_directory()
     return home_dir_path_;
 }
 
+std::string User::get_user_directory()
+{
+    return user_dir_path_;
+}
+
+std::string User::get_files_directory()
+{
+    return files_dir_path_;
+}
+
+std::shared_ptr<UserNamespace> User::get_namespace()
+{
+    return user_namespace_;
+}
+
+bool User::load_metadata()
+{
+    // returns false when the user was never persisted (first login)
+    if(!fs::exists(metadata_path_))
+    {
+        return false;
+    }
+
+    try
+    {
+        json metadata = get_json_contents(metadata_path_);
+        total_sessions_ = metadata.value("total_sessions", 0);
+        return true;
+    }
+    catch(const std::exception& e)
+    {
+        aprint("Could not read metadata for user \"" + username_ + "\": " + std::string(e.what()), 4);
+        return false;
+    }
+}
+
+void User::save_metadata()
+{
+    json metadata;
+    metadata["username"] = username_;
+    metadata["last_activity"] = last_activity_.load();
+    metadata["total_sessions"] = total_sessions_;
+
+    // written aside and renamed, a crash never leaves a truncated file behind
+    std::string temp_path = metadata_path_ + ".swizdownload";
+    save_json_to_file(metadata, temp_path);
+    fs::rename(temp_path, metadata_path_);
+
+    checkpoint_index(user_namespace_->journal->get_last_lsn());
+}
+
+void User::checkpoint_index(uint64_t lsn)
+{
+    // untouched indexes are already on disk as they are
+    if(user_namespace_->index.is_dirty() || !fs::exists(index_path_))
+    {
+        user_namespace_->index.save_checkpoint(index_path_, lsn);
+    }
+}
+
+bool User::was_warm_loaded()
+{
+    return warm_loaded_;
+}
+
+void User::begin_login()
+{
+    // pins the user in memory while a session is being created for it
+    pending_logins_.fetch_add(1);
+    last_activity_.store(get_time());
+}
+
+void User::end_login()
+{
+    pending_logins_.fetch_sub(1);
+    last_activity_.store(get_time());
+}
+
+bool User::is_idle_for(int seconds)
+{
+    if(pending_logins_.load() > 0 || get_active_session_count() > 0)
+    {
+        return false;
+    }
+    return get_time() - last_activity_.load() >= seconds;
+}
+
+int User::prune_sessions()
+{
+    // drops sessions that already disconnected, returns how many were dropped
+    std::lock_guard<std::mutex> lock(sessions_write_mtx_);
+    std::shared_ptr<const SessionTable> current = get_sessions_snapshot_();
+
+    std::shared_ptr<SessionTable> updated = std::make_shared<SessionTable>();
+    for(const auto& [sock_fd, session] : *current)
+    {
+        if(session->is_alive() || session->is_resumable(session_grace_seconds_))
+        {
+            updated->emplace(sock_fd, session);
+        }
+    }
+
+    int pruned = current->size() - updated->size();
+    if(pruned > 0)
+    {
+        std::atomic_store(&sessions_, std::shared_ptr<const SessionTable>(updated));
+        last_activity_.store(get_time());
+    }
+    return pruned;
+}
+
 void User::start_overseer()
 {
     aprint("Initializing overseer for user \"" + username_ + "\"...", 4);
@@ -197,7 +813,12 @@ void User::start_overseer()
 
 void User::stop_overseer()
 {
-    overseer_running_.store(false);
+    {
+        std::lock_guard<std::mutex> lock(overseer_mtx_);
+        overseer_running_.store(false);
+    }
+    overseer_cv_.notify_all();
+
     if(overseer_th_.joinable())
     {
         overseer_th_.join();
@@ -209,11 +830,32 @@ void User::overseer_loop()
     while(overseer_running_.load() == true)
     {
         // every minute, checks if sessions are alive
-        std::this_thread::sleep_for(std::chrono::seconds(60));
+        {
+            std::unique_lock<std::mutex> lock(overseer_mtx_);
+            overseer_cv_.wait_for(
+                lock, 
+                std::chrono::seconds(60), 
+                [this]() 
+                { 
+                    return overseer_running_.load() == false; 
+                });
+        }
 
-        for(client_connection::ClientSession* session : sessions_)
+        if(overseer_running_.load() == false)
         {
-      
+            return;
+        }
+
+        // parked sessions past their grace period let go of their socket
+        prune_sessions();
+
+        for(const auto& [sock_fd, session] : *get_sessions_snapshot_())
+        {
+            if(session->is_parked())
+            {
+                continue;
+            }
+
             std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
             std::chrono::minutes minutes_passed = std::chrono::duration_cast<std::chrono::minutes>(now - session->get_last_ping());
 
@@ -229,4 +871,9 @@ void User::overseer_loop()
             }
         }
     }
+}
+
+std::shared_ptr<const SessionTable> User::get_sessions_snapshot_()
+{
+    return std::atomic_load(&sessions_);
 }
\ No newline at end of file
@@ -1,32 +1,146 @@
 // c++
 #include <string>
 #include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <set>
+#include <unordered_map>
+#include <vector>
 #include <exception>
 #include <stdexcept>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 // locals
 #include "client_connection.hpp"
 #include "../include/common/json.hpp"
 #include "../include/common/utils.hpp"
 #include "../include/common/async_cout.hpp"
+#include "../include/common/chunk_writer.hpp"
 
 using namespace client_connection;
 using namespace async_cout;
 
 UserGroup::UserGroup(
+    server_config::ServerConfig config,
     std::function<void(const packet& p, int sockfd, int timeout)> send_callback,
     std::function<void(packet* p, int sockfd, int timeout)> receive_callback)
-    :   send_callback_(send_callback),
-        receive_callback_(receive_callback)
+    :   config_(config),
+        commits_(std::make_shared<commit_pipeline::CommitPipeline>(
+            config.durability_policy, 
+            config.durability_batch_ms)),
+        last_checkpoint_(std::time(nullptr)),
+        director_running_(false),
+        send_callback_(send_callback),
+        receive_callback_(receive_callback),
+        loaded_users_(0),
+        cold_loads_(0),
+        warm_loads_(0),
+        warm_load_total_us_(0),
+        warm_load_max_us_(0),
+        warm_load_files_(0),
+        evicted_users_(0),
+        recovered_records_(0),
+        recovered_debris_(0),
+        recovery_us_(0)
 {
-    //
+    // evicted users leave their metadata behind in here
+    // older servers kept it inside the server folder, where clients could list it
+    std::string legacy_metadata_dir = sync_dir_ + "/" + server_config::METADATA_SUFFIX;
+    if(std::filesystem::exists(legacy_metadata_dir) && !std::filesystem::exists(metadata_dir_))
+    {
+        std::filesystem::rename(legacy_metadata_dir, metadata_dir_);
+        aprint("Moved server metadata out of the server folder to \"" + metadata_dir_ + "\".", 5);
+    }
+    std::filesystem::create_directories(metadata_dir_);
+    open_layout_();
+
+    // strict deployments sync every record, batched ones sync the records of
+    // a whole flush before any of its commits is acknowledged
+    journal_ = std::make_shared<metadata_journal::MetadataJournal>(
+        metadata_dir_ + "/journal",
+        config_.durability_policy == commit_pipeline::DurabilityPolicy::STRICT);
+    if(config_.durability_policy == commit_pipeline::DurabilityPolicy::BATCHED)
+    {
+        std::shared_ptr<metadata_journal::MetadataJournal> journal = journal_;
+        commits_->set_record_sync([journal]() { journal->sync(); });
+    }
+    recover_();
+
+    // objects live next to the user folders, so linking never crosses filesystems
+    if(config_.dedup_min_bytes > 0)
+    {
+        try
+        {
+            dedup_ = std::make_shared<dedup_store::DedupStore>(metadata_dir_ + "/cas");
+        }
+        catch(const std::exception& e)
+        {
+            aprint("Deduplication disabled, it needs a filesystem with reflinks: " + std::string(e.what()), 5);
+        }
+    }
+
+    if(config_.gc_interval_seconds > 0)
+    {
+        start_collector_();
+    }
+
+    director_running_.store(true);
+    director_th_ = std::thread(&UserGroup::director_loop_, this);
+}
+
+UserGroup::~UserGroup()
+{
+    // sweepers reach into the users, the collector goes first
+    collector_.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(director_mtx_);
+        director_running_.store(false);
+    }
+    director_cv_.notify_all();
+
+    if(director_th_.joinable())
+    {
+        director_th_.join();
+    }
+
+    // acknowledges whatever is still waiting on the disk
+    commits_->flush();
+
+    // persists whoever is still loaded, next startup loads them warm
+    uint64_t lsn = journal_->get_last_lsn();
+    std::set<std::string> checkpointed_users;
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
+    {
+        try
+        {
+            user->save_metadata();
+            checkpointed_users.insert(user->get_username());
+        }
+        catch(const std::exception& e)
+        {
+            aprint("Could not save metadata for user \"" + user->get_username() + "\": " + std::string(e.what()), 5);
+        }
+    }
+
+    // every index is checkpointed, a clean shutdown leaves no tail to replay
+    try
+    {
+        compact_journal_(lsn, checkpointed_users);
+    }
+    catch(const std::exception& e)
+    {
+        aprint("Could not compact journal: " + std::string(e.what()), 5);
+    }
 }
 
 std::list<std::string> UserGroup::list_users()
 {
     std::list<std::string> client_list;
-    for(client_connection::User* user : users_)
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
     {
         std::string output = user->get_username();
         int session_number = user->get_active_session_count();
@@ -36,53 +150,65 @@ std::list<std::string> UserGroup::list_users()
     return client_list;
 }
 
-client_connection::User* UserGroup::get_user(std::string username)
+std::shared_ptr<client_connection::User> UserGroup::get_user(std::string username)
 {   
-    // checks if user is logged in
-    for(client_connection::User* user : users_)
+    // checks if user is loaded
+    UserShard& shard = get_shard_(username);
+    std::shared_lock<std::shared_mutex> lock(shard.shard_mtx);
+
+    auto it = shard.users.find(username);
+    if(it != shard.users.end())
     {
-        if(user->get_username() == username)
-        {
-            return user;
-        }
+        return it->second;
     }
     return nullptr;
 }
 
-void UserGroup::load_user(std::string username)
+std::shared_ptr<client_connection::User> UserGroup::load_user(std::string username)
 {  
-    std::unique_ptr<client_connection::User> new_user = 
-        std::make_unique<client_connection::User>(username, sync_dir_);
+    UserShard& shard = get_shard_(username);
+    std::unique_lock<std::shared_mutex> lock(shard.shard_mtx);
+    return load_user_locked_(shard, username);
+}
 
-    //client_connection::User new_user(username, sync_dir_);
-    //users_.push_back(&new_user);
-    users_.push_back(new_user.release());
-    aprint("User \"" + username + "\" loaded to vector.", 5);
+std::shared_ptr<client_connection::User> UserGroup::checkout_user(std::string username)
+{
+    // gets or loads the user and pins it for a login in the same critical
+    // section, so the director can never evict it halfway through
+    // NOTE: every checkout must be paired with User::end_login
+    UserShard& shard = get_shard_(username);
+    std::unique_lock<std::shared_mutex> lock(shard.shard_mtx);
+
+    std::shared_ptr<client_connection::User> user = load_user_locked_(shard, username);
+    user->begin_login();
+    return user;
 }
 
 void UserGroup::unload_user(std::string username)
 {
-    // removes user from users manager vector
-    auto it = users_.begin();
-    while(it != users_.end()) 
+    // removes user from its shard - the instance itself lives on
+    // until every thread holding a reference to it is done
+    std::shared_ptr<client_connection::User> removed_user;
     {
-        if ((*it)->get_username() == username) 
-        {   
-            // after disconnecting, removes it from the list
-            it = users_.erase(it);
-            aprint("User " + username + " removed.", 5);
-            return;
-        }
-        else
+        UserShard& shard = get_shard_(username);
+        std::unique_lock<std::shared_mutex> lock(shard.shard_mtx);
+
+        auto it = shard.users.find(username);
+        if(it == shard.users.end())
         {
-            ++it;
+            return;
         }
+        removed_user = it->second;
+        shard.users.erase(it);
+        loaded_users_.fetch_sub(1);
     }
+
+    aprint("User " + username + " removed.", 5);
 }
 
 void UserGroup::global_broadcast(packet& p)
 {
-    for(client_connection::User* user : users_)
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
     {
         user->broadcast(p);
     }
@@ -90,5 +216,496 @@ void UserGroup::global_broadcast(packet& p)
 
 int UserGroup::get_active_users_count()
 {
-    return users_.size();
+    return loaded_users_.load();
+}
+
+std::list<std::string> UserGroup::get_stats_report()
+{
+    // per user runtime statistics, shown by the "stats" console command
+    std::list<std::string> report;
+
+    uint64_t warm_loads = warm_loads_.load();
+    uint64_t warm_load_avg_us = (warm_loads > 0) ? warm_load_total_us_.load() / warm_loads : 0;
+    std::string summary = "users: " + std::to_string(loaded_users_.load()) + " loaded, ";
+    summary += std::to_string(cold_loads_.load()) + " cold loads, ";
+    summary += std::to_string(warm_loads) + " warm loads (avg " + std::to_string(warm_load_avg_us);
+    summary += "us, max " + std::to_string(warm_load_max_us_.load()) + "us, ";
+    summary += std::to_string(warm_load_files_.load()) + " indexed files), ";
+    summary += std::to_string(evicted_users_.load()) + " evicted";
+    report.push_back(summary);
+    report.push_back(commits_->format_stats());
+
+    std::string journal_summary = "journal: " + std::to_string(journal_->get_size()) + " bytes, lsn ";
+    journal_summary += std::to_string(journal_->get_last_lsn()) + ", recovered ";
+    journal_summary += std::to_string(recovered_records_) + " records and removed ";
+    journal_summary += std::to_string(recovered_debris_) + " temporary files in " + std::to_string(recovery_us_) + "us";
+    report.push_back(journal_summary);
+
+    if(dedup_ != nullptr)
+    {
+        report.push_back(dedup_->format_stats());
+    }
+
+    if(collector_ != nullptr)
+    {
+        report.push_back(collector_->format_stats());
+    }
+
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
+    {
+        std::string output = user->get_username() + " - ";
+        output += user->get_namespace()->locks.format_stats();
+        output += " | " + user->get_namespace()->index.format_quota_stats();
+        if(user->get_namespace()->packs != nullptr)
+        {
+            output += " | " + user->get_namespace()->packs->format_stats();
+        }
+        if(user->get_namespace()->versions != nullptr)
+        {
+            // overhead is relative to what the user currently stores
+            version_store::VersionStats versions = user->get_namespace()->versions->get_stats();
+            uint64_t live_bytes = user->get_namespace()->index.get_total_bytes();
+            uint64_t overhead = (live_bytes > 0) ? versions.stored_bytes * 100 / live_bytes : 0;
+            output += " | " + user->get_namespace()->versions->format_stats();
+            output += " (" + std::to_string(overhead) + "% overhead)";
+        }
+        if(user->get_namespace()->cold != nullptr)
+        {
+            output += " | " + user->get_namespace()->cold->format_stats();
+        }
+        report.push_back(output);
+    }
+    return report;
+}
+
+UserGroup::UserShard& UserGroup::get_shard_(const std::string& username)
+{
+    return user_shards_[std::hash<std::string>{}(username) % user_shard_count_];
+}
+
+std::shared_ptr<client_connection::User> UserGroup::load_user_locked_(
+    UserShard& shard, 
+    const std::string& username)
+{
+    // NOTE: caller must hold the shard lock exclusively
+    // another thread may have loaded it in the meantime
+    auto it = shard.users.find(username);
+    if(it != shard.users.end())
+    {
+        return it->second;
+    }
+
+    auto load_start = std::chrono::steady_clock::now();
+    std::shared_ptr<client_connection::User> new_user = 
+        std::make_shared<client_connection::User>(username, sync_dir_, config_, commits_, journal_, dedup_);
+    uint64_t load_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - load_start).count();
+
+    shard.users.emplace(username, new_user);
+    loaded_users_.fetch_add(1);
+
+    // warm loads come back from the file index left by a previous eviction
+    if(new_user->was_warm_loaded())
+    {
+        std::size_t indexed_files = new_user->get_namespace()->index.size();
+        warm_loads_.fetch_add(1);
+        warm_load_total_us_.fetch_add(load_us);
+        warm_load_files_.fetch_add(indexed_files);
+
+        uint64_t previous_max = warm_load_max_us_.load();
+        while(load_us > previous_max && !warm_load_max_us_.compare_exchange_weak(previous_max, load_us))
+        {
+            // retries until the max is updated or surpassed by another thread
+        }
+        std::string output = "User \"" + username + "\" loaded with " + std::to_string(indexed_files);
+        output += " indexed files in " + std::to_string(load_us) + "us.";
+        aprint(output, 5);
+    }
+    else
+    {
+        cold_loads_.fetch_add(1);
+        aprint("User \"" + username + "\" loaded.", 5);
+    }
+    return new_user;
+}
+
+void UserGroup::director_loop_()
+{
+    // wakes up a few times per period, so users are evicted and indexes
+    // checkpointed at most a quarter of the configured time late
+    int interval = 30;
+    if(config_.idle_eviction_seconds > 0)
+    {
+        interval = std::min(interval, config_.idle_eviction_seconds / 4);
+    }
+    if(config_.checkpoint_interval_seconds > 0)
+    {
+        interval = std::min(interval, config_.checkpoint_interval_seconds / 4);
+    }
+    interval = std::max(interval, 1);
+
+    std::unique_lock<std::mutex> lock(director_mtx_);
+    while(director_running_.load())
+    {
+        director_cv_.wait_for(
+            lock, 
+            std::chrono::seconds(interval), 
+            [this]() { return !director_running_.load(); });
+
+        if(!director_running_.load())
+        {
+            break;
+        }
+
+        lock.unlock();
+        try
+        {
+            if(config_.idle_eviction_seconds > 0)
+            {
+                evict_idle_users_();
+            }
+
+            bool checkpoint_due = config_.checkpoint_interval_seconds > 0
+                && std::time(nullptr) - last_checkpoint_ >= config_.checkpoint_interval_seconds;
+            if(checkpoint_due || journal_->get_size() >= config_.journal_compact_bytes)
+            {
+                checkpoint_users_();
+            }
+        }
+        catch(const std::exception& e)
+        {
+            aprint("Exception while running director: " + std::string(e.what()), 5);
+        }
+        lock.lock();
+    }
+}
+
+void UserGroup::open_layout_()
+{
+    // user folders are looked up where the configured layout puts them,
+    // serving a tree written with another one would lose every user
+    std::string marker_path = metadata_dir_ + "/layout";
+    directory_layout::Layout current = directory_layout::read_layout(marker_path);
+    if(config_.migrate_layout)
+    {
+        directory_layout::MigrationStats stats = directory_layout::migrate(
+            sync_dir_, 
+            marker_path, 
+            metadata_dir_ + "/migrating", 
+            config_.layout);
+
+        std::string output = "Migrated " + std::to_string(stats.moved_users) + " user folders from the ";
+        output += directory_layout::layout_name(stats.previous_layout) + " to the ";
+        output += directory_layout::layout_name(config_.layout) + " layout in " + std::to_string(stats.elapsed_us) + "us.";
+        aprint(output, 5);
+        return;
+    }
+
+    if(current != config_.layout)
+    {
+        std::string output = "[USER GROUP] Server folder uses the " + directory_layout::layout_name(current);
+        output += " layout, start with --migrate_layout to move it to the " + directory_layout::layout_name(config_.layout) + " one!";
+        throw std::runtime_error(output);
+    }
+
+    // recorded once, so a later change of layout is noticed
+    if(!std::filesystem::exists(marker_path))
+    {
+        directory_layout::write_layout(marker_path, current);
+    }
+}
+
+void UserGroup::start_collector_()
+{
+    // uploads abandoned mid transfer keep their writer open for a while,
+    // their temporary file is never taken from under it
+    int stale_seconds = std::max(config_.gc_stale_seconds, chunk_writer::STALE_WRITER_SECONDS);
+    collector_ = std::make_shared<garbage_collector::GarbageCollector>(
+        config_.gc_interval_seconds,
+        stale_seconds,
+        config_.gc_operations_per_second,
+        config_.gc_bytes_per_second);
+
+    // leftovers of transfers, restores, compressions and stores cut short
+    // the ones of metadata writes live next to the server folder
+    std::string sync_dir = sync_dir_;
+    std::string metadata_dir = metadata_dir_;
+    collector_->add_sweeper(
+        "temp",
+        [this, sync_dir, metadata_dir](garbage_collector::Sweep& sweep)
+        {
+            sweep.remove_stale_files(
+                sync_dir, 
+                {".swizdownload", ".swizrestore", ".swizcold", ".swizwarm", ".swizdedup", ".swizstaged"},
+                [this](const std::string& path) { abort_swept_transfer_(path); });
+            sweep.remove_stale_files(metadata_dir, {".swizdownload", ".swizrestore", ".swizcold", ".swizwarm", ".swizdedup", ".swizstaged"});
+        });
+
+    // stored contents no user file links to anymore
+    if(dedup_ != nullptr)
+    {
+        std::shared_ptr<dedup_store::DedupStore> dedup = dedup_;
+        collector_->add_sweeper(
+            "cas",
+            [dedup](garbage_collector::Sweep& sweep)
+            {
+                sweep.reclaimed(dedup->sweep([&sweep]() { return sweep.pace(); }), 0);
+            });
+    }
+
+    // cold files are compressed at idle priority too, and compressed copies
+    // a commit replaced without removing them (crash in between) dropped
+    if(config_.cold_after_seconds > 0)
+    {
+        collector_->add_sweeper(
+            "cold",
+            [this](garbage_collector::Sweep& sweep)
+            {
+                for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
+                {
+                    std::shared_ptr<client_connection::UserNamespace> user_namespace = user->get_namespace();
+                    sweep.reclaimed(user_namespace->remove_superseded_cold_files([&sweep]() { return sweep.pace(); }), 0);
+                    sweep.reclaimed(
+                        user_namespace->compress_cold_files(
+                            config_.cold_after_seconds, 
+                            config_.cold_pass_bytes, 
+                            [&sweep](uint64_t bytes) { return sweep.pace(bytes); }),
+                        0);
+                }
+            });
+    }
+}
+
+void UserGroup::abort_swept_transfer_(const std::string& temp_path)
+{
+    // an abandoned upload still holds room against the quota and is open in
+    // the journal, it is closed as a failed one - users not loaded have
+    // theirs aborted when loaded, their reservations were never kept
+    const std::string suffix = ".swizdownload";
+    if(temp_path.size() <= suffix.size() 
+        || temp_path.compare(temp_path.size() - suffix.size(), suffix.size(), suffix) != 0)
+    {
+        return;
+    }
+    std::string file_path = temp_path.substr(0, temp_path.size() - suffix.size());
+
+    // complete ones waiting for their commit carry an id, see chunk_writer::completed_path
+    std::size_t id_start = file_path.find_last_of('.');
+    if(id_start != std::string::npos && id_start > file_path.find_last_of('/'))
+    {
+        std::string id = file_path.substr(id_start + 1);
+        if(id.find('-') != std::string::npos && id.find_first_not_of("0123456789-") == std::string::npos)
+        {
+            file_path.erase(id_start);
+        }
+    }
+
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
+    {
+        std::string directory = user->get_files_directory();
+        if(file_path.compare(0, directory.size() + 1, directory + "/") == 0)
+        {
+            user->get_namespace()->log_operation(
+                metadata_journal::JournalOperation::ABORT_TRANSFER, 
+                file_path.substr(directory.size()));
+        }
+    }
+}
+
+int UserGroup::evict_idle_users_()
+{
+    // commits still in flight must reach the index before it is checkpointed
+    commits_->flush();
+
+    int evicted = 0;
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
+    {
+        // cheap check without the shard lock first
+        user->prune_sessions();
+        if(!user->is_idle_for(config_.idle_eviction_seconds))
+        {
+            continue;
+        }
+
+        std::string username = user->get_username();
+        UserShard& shard = get_shard_(username);
+        {
+            // checks again while holding the lock, as a login could
+            // have checked the user out in the meantime
+            std::unique_lock<std::shared_mutex> lock(shard.shard_mtx);
+            auto it = shard.users.find(username);
+            if(it == shard.users.end() || it->second != user)
+            {
+                continue;
+            }
+            if(!user->is_idle_for(config_.idle_eviction_seconds))
+            {
+                continue;
+            }
+
+            // saved before unlocking, so a login racing the eviction
+            // always loads the freshest metadata back
+            user->save_metadata();
+            shard.users.erase(it);
+            loaded_users_.fetch_sub(1);
+        }
+
+        evicted_users_.fetch_add(1);
+        evicted++;
+        aprint("User \"" + username + "\" evicted after being idle.", 5);
+    }
+    return evicted;
+}
+
+std::vector<std::shared_ptr<client_connection::User>> UserGroup::get_users_snapshot_()
+{
+    // copies every loaded user, one shard lock at a time, so slow
+    // operations on the result never block logins
+    std::vector<std::shared_ptr<client_connection::User>> snapshot;
+    for(int i = 0; i < user_shard_count_; i++)
+    {
+        std::shared_lock<std::shared_mutex> lock(user_shards_[i].shard_mtx);
+        for(auto& [username, user] : user_shards_[i].users)
+        {
+            snapshot.push_back(user);
+        }
+    }
+    return snapshot;
+}
+
+void UserGroup::recover_()
+{
+    // replays the journal tail into the index checkpoints of the users it
+    // touches, and removes temporary files of transfers that never finished
+    // NOTE: runs before any user is loaded
+    auto recovery_start = std::chrono::steady_clock::now();
+
+    std::unordered_map<std::string, std::vector<metadata_journal::JournalRecord>> user_tails;
+    std::set<std::pair<std::string, std::string>> open_transfers;
+    recovered_records_ = journal_->replay(
+        [&user_tails, &open_transfers](const metadata_journal::JournalRecord& record)
+        {
+            std::pair<std::string, std::string> transfer(record.username, record.path);
+            if(record.operation == metadata_journal::JournalOperation::BEGIN_TRANSFER)
+            {
+                open_transfers.insert(transfer);
+            }
+            else
+            {
+                open_transfers.erase(transfer);
+            }
+            user_tails[record.username].push_back(record);
+        });
+
+    uint64_t last_lsn = journal_->get_last_lsn();
+    for(auto& [username, records] : user_tails)
+    {
+        path_table::PathTable paths;
+        metadata_journal::FileIndex index(&paths);
+        std::string checkpoint_path = metadata_dir_ + "/" + username + ".index";
+
+        try
+        {
+            index.load_checkpoint(checkpoint_path);
+        }
+        catch(const std::exception& e)
+        {
+            aprint("Rebuilding file index of user \"" + username + "\": " + std::string(e.what()), 5);
+        }
+
+        for(const metadata_journal::JournalRecord& record : records)
+        {
+            index.apply(record);
+        }
+        index.save_checkpoint(checkpoint_path, last_lsn);
+    }
+
+    for(const auto& [username, path] : open_transfers)
+    {
+        std::string files_dir = config_.isolate_users
+            ? directory_layout::user_directory(sync_dir_, username, config_.layout)
+            : sync_dir_;
+        std::string temp_path = files_dir + path + ".swizdownload";
+        std::error_code error;
+        if(std::filesystem::remove(temp_path, error))
+        {
+            recovered_debris_++;
+        }
+
+        // closes the transfer, so compaction stops carrying it over
+        metadata_journal::JournalRecord abort_record;
+        abort_record.operation = metadata_journal::JournalOperation::ABORT_TRANSFER;
+        abort_record.username = username;
+        abort_record.path = path;
+        journal_->append(abort_record);
+    }
+
+    // everything replayed now lives in the checkpoints, and aborts never
+    // change an index
+    journal_->compact(journal_->get_last_lsn());
+
+    recovery_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - recovery_start).count();
+
+    std::string output = "Recovered " + std::to_string(recovered_records_) + " journal records of ";
+    output += std::to_string(user_tails.size()) + " users and removed " + std::to_string(recovered_debris_);
+    output += " unfinished transfers in " + std::to_string(recovery_us_) + "us.";
+    aprint(output, 5);
+}
+
+void UserGroup::checkpoint_users_()
+{
+    // records up to lsn of every user saved here are no longer needed, the
+    // ones of users evicted in the meantime are kept unless their own
+    // checkpoint covers them
+    uint64_t lsn = journal_->get_last_lsn();
+    std::set<std::string> checkpointed_users;
+    for(std::shared_ptr<client_connection::User>& user : get_users_snapshot_())
+    {
+        user->checkpoint_index(lsn);
+        checkpointed_users.insert(user->get_username());
+
+        // pack segments left mostly dead are rewritten on the same schedule
+        std::shared_ptr<pack_store::PackStore> packs = user->get_namespace()->packs;
+        if(packs != nullptr)
+        {
+            packs->compact();
+        }
+
+        // versions past the age limit are dropped even if the file never changes again
+        std::shared_ptr<version_store::VersionStore> versions = user->get_namespace()->versions;
+        if(versions != nullptr)
+        {
+            versions->prune_expired();
+        }
+    }
+    compact_journal_(lsn, checkpointed_users);
+    last_checkpoint_ = std::time(nullptr);
+}
+
+void UserGroup::compact_journal_(uint64_t lsn, const std::set<std::string>& checkpointed_users)
+{
+    // records of anyone else, such as those a late commit callback logged
+    // after its user was evicted, survive until a checkpoint of theirs
+    // covers them - the user folds them back in on its next load
+    std::unordered_map<std::string, uint64_t> checkpoint_lsns;
+    journal_->compact(
+        lsn,
+        [this, &checkpointed_users, &checkpoint_lsns](const metadata_journal::JournalRecord& record)
+        {
+            if(checkpointed_users.count(record.username) > 0)
+            {
+                return false;
+            }
+
+            auto it = checkpoint_lsns.find(record.username);
+            if(it == checkpoint_lsns.end())
+            {
+                std::string checkpoint_path = metadata_dir_ + "/" + record.username + ".index";
+                it = checkpoint_lsns.emplace(
+                    record.username, 
+                    metadata_journal::FileIndex::read_checkpoint_lsn(checkpoint_path)).first;
+            }
+            return record.lsn > it->second;
+        });
 }
\ No newline at end of file
@@ -23,7 +23,7 @@
 using namespace server;
 using namespace async_cout;
 
-Server::Server()
+Server::Server(server_config::ServerConfig config)
 	:	S_UI_(
 			&ui_mutex, 
 			&ui_cv, 
@@ -32,6 +32,7 @@ Server::Server()
 		internet_manager(),
 		stop_requested_(false),
 		client_manager_(
+			config,
 			std::bind(&connection::ServerConnectionManager::send_packet, &internet_manager, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), 
 			std::bind(&connection::ServerConnectionManager::receive_packet, &internet_manager, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3))
 {
@@ -96,9 +97,9 @@ void Server::start()
 		[this]() 
 		{
         	internet_manager.server_accept_loop(
-				[this](int new_socket, std::string username, std::string machine)
+				[this](int new_socket, std::string username, std::string machine, std::string resume_token)
 				{
-					handle_new_session(new_socket, username, machine);
+					handle_new_session(new_socket, username, machine, resume_token);
 				});
     	});
 
@@ -16,6 +16,7 @@
 
 // locals
 #include "client_connection.hpp"
+#include "server_config.hpp"
 #include "../include/common/connection_manager.hpp"
 #include "../include/common/user_interface.hpp"
 #include "../include/common/utils.hpp"
@@ -37,14 +38,14 @@ namespace server
             std::vector<std::string> ui_sanitized_buffer;
 
             // init & destroy
-            Server();
+            Server(server_config::ServerConfig config = server_config::ServerConfig());
             ~Server();
 
             // methods
             void start();
             void stop();
             void close();
-            void handle_new_session(int new_socket, std::string username, std::string machine);
+            void handle_new_session(int new_socket, std::string username, std::string machine, std::string resume_token = "");
             void process_input();
             void main_loop();
  
@@ -0,0 +1,85 @@
+#pragma once
+
+// c++
+#include <string>
+
+// locals
+#include "../include/common/commit_pipeline.hpp"
+#include "../include/common/garbage_collector.hpp"
+#include "../include/common/directory_layout.hpp"
+#include "../include/common/pack_store.hpp"
+
+namespace server_config
+{
+    // server metadata lives next to the server folder, never inside of it,
+    // so no user folder or listing can ever reach it
+    const char* const METADATA_SUFFIX = ".swizmeta";
+
+    inline std::string metadata_directory(const std::string& sync_dir)
+    {
+        std::size_t end = sync_dir.find_last_not_of('/');
+        return (end == std::string::npos ? sync_dir : sync_dir.substr(0, end + 1)) + METADATA_SUFFIX;
+    }
+
+    struct ServerConfig
+    {
+        // server side tunables, parsed from the command line on startup
+
+        // every user is served from their own folder instead of the shared
+        // server folder - the per user storage options below depend on it
+        bool isolate_users = false;
+
+        // users without active sessions are unloaded after this many seconds
+        // 0 keeps every loaded user in memory
+        int idle_eviction_seconds = 600;
+
+        // a session whose connection dropped is kept this long, with whatever
+        // was queued for it, for its device to resume - 0 disables resumption
+        int session_grace_seconds = 120;
+
+        // when received files are made durable and acknowledged to clients
+        commit_pipeline::DurabilityPolicy durability_policy = commit_pipeline::DurabilityPolicy::BATCHED;
+        int durability_batch_ms = commit_pipeline::DEFAULT_BATCH_INTERVAL_MS;
+
+        // loaded user indexes are checkpointed and the journal compacted this
+        // often, or sooner once the journal grows past the size limit
+        int checkpoint_interval_seconds = 300;
+        uint64_t journal_compact_bytes = 64 * 1024 * 1024;
+
+        // files up to this size are stored in per user pack segments instead
+        // of one regular file each, 0 keeps every file as a regular file
+        uint64_t pack_threshold_bytes = 0;
+
+        // received files of at least this size are deduplicated by content
+        // across every user, 0 stores every file on its own
+        uint64_t dedup_min_bytes = 0;
+
+        // replaced and deleted files are kept as old versions, up to this many
+        // per file and for this many days, 0 lifts a limit - both 0 keep none
+        int version_count = 0;
+        int version_days = 0;
+
+        // files neither read nor written for this many seconds are compressed
+        // at rest by the garbage collector, reading up to the byte budget of
+        // every user on each pass - 0 disables it
+        int cold_after_seconds = 0;
+        uint64_t cold_pass_bytes = 256 * 1024 * 1024;
+
+        // bytes and files every user may store, uploads past them are rejected
+        // before their first chunk is written - 0 lifts a limit
+        uint64_t quota_bytes = 0;
+        uint64_t quota_files = 0;
+
+        // the garbage collector runs this often at idle priority, removing
+        // temporary files left untouched for the stale time - 0 disables it
+        int gc_interval_seconds = garbage_collector::DEFAULT_INTERVAL_SECONDS;
+        int gc_stale_seconds = garbage_collector::DEFAULT_STALE_SECONDS;
+        int gc_operations_per_second = garbage_collector::DEFAULT_OPERATIONS_PER_SECOND;
+        uint64_t gc_bytes_per_second = garbage_collector::DEFAULT_BYTES_PER_SECOND;
+
+        // where user folders live under the server root, a tree written with
+        // another layout is only served after being migrated on startup
+        directory_layout::Layout layout = directory_layout::Layout::FLAT;
+        bool migrate_layout = false;
+    };
+}
@@ -2,28 +2,85 @@
 
 using namespace server;
 
-void Server::handle_new_session(int new_socket, std::string username, std::string machine)
+void Server::handle_new_session(int new_socket, std::string username, std::string machine, std::string resume_token)
 {
 	// processes new connection requests
+	// the user is pinned in memory until the login is over, so an idle
+	// eviction can never unload it while its first session is created
+	std::shared_ptr<client_connection::User> new_user;
     try
     {
-		client_connection::User* new_user = client_manager_.get_user(username);
+		aprint("Loading session's user...");
+		new_user = client_manager_.checkout_user(username);
 		if(new_user == nullptr)
 		{
-			// session is from a new user, add to the list
-			aprint("Loading new session's user files...");
-			client_manager_.load_user(username);
+			raise("User was wrongly or not added to the user manager!");
+		}
+		
+		// a device back within the grace period takes its parked session over,
+		// along with what was queued for it while it was away - it sends
+		// "<token>|<packets received>", older clients just the token
+		std::shared_ptr<client_connection::ClientSession> parked_session = nullptr;
+		uint64_t received_packets = 0;
+		std::size_t separator = resume_token.find('|');
+		if(separator != std::string::npos)
+		{
+			try
+			{
+				received_packets = std::stoull(resume_token.substr(separator + 1));
+				resume_token.erase(separator);
+			}
+			catch(const std::exception& e)
+			{
+				resume_token.clear();
+			}
+		}
+		else
+		{
+			// without a count there is no telling what was lost
+			resume_token.clear();
+		}
+		if(!resume_token.empty())
+		{
+			parked_session = new_user->claim_parked_session(resume_token, received_packets);
+			if(parked_session == nullptr)
+			{
+				aprint("Resumption token is unknown or expired, logging in again...");
+			}
+		}
 
-			// tries to retrieve newly added user
-			aprint("Verifying loaded user user...");
-			new_user = client_manager_.get_user(username);
+		if(parked_session != nullptr)
+		{
+			try
+			{
+				// confirmed before the session starts sending on the new socket
+				std::string login_confirmation_command = "login|ok|" + std::to_string(new_user->get_active_session_count());
+				login_confirmation_command += "|" + resume_token + "|resumed";
+				packet login_confirmation_packet;
+				strcharray(
+					login_confirmation_command, 
+					login_confirmation_packet.command, 
+					sizeof(login_confirmation_packet.command));
+				internet_manager.send_packet(login_confirmation_packet, new_socket);
 
-			if(new_user == nullptr)
+				new_user->resume_session(parked_session, new_socket, received_packets);
+			}
+			catch(const std::exception& e)
 			{
-				raise("User was wrongly or not added to the user manager!");
+				// still parked, the device may try again
+				parked_session->release_claim();
+				throw;
 			}
+			new_user->end_login();
+			return;
 		}
-		
+
+		// parked sessions past their grace period, or of this same device,
+		// no longer hold a slot, and the rest give theirs up to a new login
+		new_user->prune_sessions();
+		new_user->drop_parked_sessions(machine);
+		new_user->evict_parked_sessions();
+
 		aprint("Checking for existing sessions...");
 		int active_sessions = new_user->get_active_session_count();
 		int session_limit = 2;
@@ -32,14 +89,17 @@ void Server::handle_new_session(int new_socket, std::string username, std::strin
 		{
 			// checks if there is already a session on the given socket
 			aprint("Checking for duplicate sessions...");
-			client_connection::ClientSession* new_session = new_user->get_session(new_socket);
+			std::shared_ptr<client_connection::ClientSession> new_session = new_user->get_session(new_socket);
 
 			if(new_session == nullptr)
 			{	
 				aprint("Creating a new session...");
 				
 				// before creating a new session, sends login confirmation to client
+				// along with the token its device presents to resume it
+				std::string new_resume_token = client_connection::generate_resume_token();
 				std::string login_confirmation_command = "login|ok|" + std::to_string(active_sessions + 1);
+				login_confirmation_command += "|" + new_resume_token;
 				packet login_confirmation_packet;
 				strcharray(
 					login_confirmation_command, 
@@ -51,12 +111,16 @@ void Server::handle_new_session(int new_socket, std::string username, std::strin
 				
 				// creates new session instance
 				// sends references to the general send/receive methods by reference
-				std::unique_ptr<client_connection::ClientSession> created_session = 
-					std::make_unique<client_connection::ClientSession>(
+				// the broadcast callback only holds a weak reference, as the
+				// user owns its sessions and an unloaded user must be freed
+				std::weak_ptr<client_connection::User> weak_user = new_user;
+				std::shared_ptr<client_connection::ClientSession> created_session = 
+					std::make_shared<client_connection::ClientSession>(
 						new_socket,
 						username,
 						machine,
-						sync_dir_,
+						new_user->get_files_directory(),
+						new_user->get_namespace(),
 						[this](const packet& p, int sockfd = -1, int timeout = -1) 
 						{
 							internet_manager.send_packet(p, sockfd, timeout);
@@ -65,10 +129,15 @@ void Server::handle_new_session(int new_socket, std::string username, std::strin
 						{
 							internet_manager.receive_packet(p, sockfd, timeout);
 						},
-						[new_user](int caller_sockfd, packet& p) 
+						[weak_user](int caller_sockfd, packet& p) 
 						{
-							new_user->broadcast_other_sessions(caller_sockfd, p);
-						});
+							std::shared_ptr<client_connection::User> user = weak_user.lock();
+							if(user != nullptr)
+							{
+								user->broadcast_other_sessions(caller_sockfd, p);
+							}
+						},
+						new_resume_token);
 
 				std::string output = created_session->get_identifier();
 				output += " logged in!";
@@ -80,7 +149,7 @@ void Server::handle_new_session(int new_socket, std::string username, std::strin
 				created_session->add_packet_from_broadcast(sync_packet);*/
 				
 				// adds new session to the user manager
-				new_user->add_session(created_session.release());
+				new_user->add_session(created_session);
 			}
 			else
 			{
@@ -95,10 +164,19 @@ void Server::handle_new_session(int new_socket, std::string username, std::strin
     }
     catch(const std::exception& e)
     {
+		if(new_user != nullptr)
+		{
+			new_user->end_login();
+		}
 		raise("Exception occurred while processing new session: \n\t\t" + std::string(e.what()));
     }
     catch(...)
     {
+		if(new_user != nullptr)
+		{
+			new_user->end_login();
+		}
 		raise("Unknown exception occurred while processing new session!");
     }
+	new_user->end_login();
 }
\ No newline at end of file
@@ -17,6 +17,16 @@ void Server::process_input()
 				stop();
 				break;
 			}
+			else if(ui_sanitized_buffer.front() == "stats")
+			{
+				std::list<std::string> report = client_manager_.get_stats_report();
+				std::string output = "Runtime statistics for loaded users:";
+				for(std::string s : report)
+				{
+					output += "\n\t\t-> " + s;
+				}
+				aprint(output);
+			}
 			else
 			{
 				aprint("Could not find a command by \"" + ui_buffer + "\"!");